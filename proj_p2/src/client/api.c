@@ -3,6 +3,7 @@
 #include "src/common/io.h"
 #include "src/common/constants.h"
 #include "src/common/protocol.h"
+#include "src/common/varint.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,7 +13,15 @@
 #include <pthread.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
+// Ends a pattern subscription, as PATTERN_WILDCARD of the server
+#define SUBSCRIPTION_WILDCARD '*'
+
+// Version the next connect asks for, and the one the server agreed to
+static int requestedProtocol = PROTOCOL_TRUNCATION_FLAGS;
+static int sessionProtocol = PROTOCOL_FIXED;
 
 /// @brief Writes a given message to a file descriptor, 
 ///        filling the rest of the buffer with nulls.
@@ -37,6 +46,23 @@ int write_connect_message(int fdServerPipe,
 						 const char *resp_pipe_path,
 						 const char *notif_pipe_path) {
 
+	if (requestedProtocol != PROTOCOL_FIXED) {
+		// Paths take their length plus one byte, instead of MAX_PIPE_PATH_LENGTH
+		char message[2 + 3 * (VARINT_MAX_SIZE + MAX_PIPE_PATH_LENGTH)];
+		const char *paths[3] = {req_pipe_path, resp_pipe_path, notif_pipe_path};
+		size_t size = 0;
+		message[size++] = OP_CODE_CONNECT_COMPACT;
+		message[size++] = (char) requestedProtocol;
+		for (int i = 0; i < 3; i++) {
+			size_t length = strnlen(paths[i], MAX_PIPE_PATH_LENGTH);
+			size += varint_encode(length, message + size);
+			memcpy(message + size, paths[i], length);
+			size += length;
+		}
+		// Below PIPE_BUF, so it does not interleave with other clients
+		return write_all(fdServerPipe, message, size);
+	}
+
 	char connectMessage[1 + 3 * MAX_PIPE_PATH_LENGTH];
 	connectMessage[0] = OP_CODE_CONNECT;
 	fill_with_nulls(connectMessage + 1, req_pipe_path, MAX_PIPE_PATH_LENGTH);
@@ -50,8 +76,10 @@ int write_connect_message(int fdServerPipe,
 /// @param fdResponsePipe File descriptor of the response pipe.
 /// @param expected_OP_Code Expected OP Code.
 /// @param result Result of the operation.
+/// @param report Whether to print the result, off for the requests of the cache.
 /// @return 0 if the operation was successful, 1 otherwise.
-int read_server_response(int fdResponsePipe, const char expected_OP_Code, char *result) {
+static int read_response(int fdResponsePipe, const char expected_OP_Code, char *result,
+						 int report) {
 	char opcode;
 	int readingError = 0;
 
@@ -76,6 +104,7 @@ int read_server_response(int fdResponsePipe, const char expected_OP_Code, char *
 
 	switch (expected_OP_Code) {
 		case OP_CODE_CONNECT:
+		case OP_CODE_CONNECT_COMPACT:
 			opName = "connect";
 			break;
 		case OP_CODE_DISCONNECT:
@@ -87,11 +116,73 @@ int read_server_response(int fdResponsePipe, const char expected_OP_Code, char *
 		case OP_CODE_UNSUBSCRIBE:
 			opName = "unsubscribe";
 			break;
+		case OP_CODE_GET:
+			opName = "get";
+			break;
+		case OP_CODE_PUT:
+			opName = "put";
+			break;
+		case OP_CODE_DEL:
+			opName = "delete";
+			break;
+		case OP_CODE_ATTACH:
+			opName = "attach";
+			break;
+		case OP_CODE_SUBSCRIBE_BATCH:
+			opName = "subscribe";
+			break;
+		case OP_CODE_UNSUBSCRIBE_BATCH:
+			opName = "unsubscribe";
+			break;
+		case OP_CODE_RESUME:
+			opName = "resume";
+			break;
+		case OP_CODE_PUT_VALUE:
+			opName = "put";
+			break;
+		case OP_CODE_GET_VALUE:
+			opName = "get";
+			break;
+		case OP_CODE_PUT_TTL:
+			opName = "put";
+			break;
+		case OP_CODE_EXPIRE:
+			opName = "expire";
+			break;
 		default:
 			opName = "unknown";
 			break;
 	}
-	fprintf(stdout, "Server returned %c for operation: %s\n", *result, opName);
+	if (report) fprintf(stdout, "Server returned %c for operation: %s\n", *result, opName);
+	return 0;
+}
+
+int read_server_response(int fdResponsePipe, const char expected_OP_Code, char *result) {
+	return read_response(fdResponsePipe, expected_OP_Code, result, 1);
+}
+
+void kvs_request_protocol(int version) {
+	requestedProtocol = version;
+}
+
+int kvs_session_protocol(void) {
+	return sessionProtocol;
+}
+
+/// @brief Reads the answer to a CONNECT_COMPACT request and records the
+/// version the server agreed to.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param result Result of the connect.
+/// @param report Whether to print the result.
+/// @return 0 if the response was read, 1 otherwise.
+static int read_compact_connect(int fdResponsePipe, char *result, int report) {
+	char version;
+	int readingError = 0;
+	if (read_response(fdResponsePipe, OP_CODE_CONNECT_COMPACT, result, report) ||
+		read_all(fdResponsePipe, &version, 1, &readingError) <= 0) {
+		return 1;
+	}
+	if (*result == '0') sessionProtocol = version;
 	return 0;
 }
 
@@ -178,12 +269,141 @@ int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
 	
 
 	// read response from server
-	const char expected_OP_Code = OP_CODE_CONNECT;
+	sessionProtocol = PROTOCOL_FIXED;
+	char result;
+	int error = requestedProtocol == PROTOCOL_FIXED
+					? read_server_response(*fdResponsePipe, OP_CODE_CONNECT, &result)
+					: read_compact_connect(*fdResponsePipe, &result, 1);
+	if (error) {
+		fprintf(stderr, "Failed to read connect message from response pipe.\n");
+		result = '1';
+	}
+
+	// the server refused the session, e.g. because it is full
+	if (result != '0') {
+		terminate_pipes(*fdRequestPipe, req_pipe_path, *fdResponsePipe, resp_pipe_path,
+						*fdNotificationPipe, notif_pipe_path);
+		return 1;
+	}
+
+	return 0;
+}
+
+struct ReceiverArgs {
+	int fdSocket;
+	int fdResponses;     // write end of the responses pipe
+	int fdNotifications; // write end of the notifications pipe
+};
+
+/// @brief Delivers the packets of a session socket to the responses and
+/// notifications pipes, until the server closes the session.
+/// @param arg struct ReceiverArgs, freed by the thread.
+static void *receive_messages(void *arg) {
+	struct ReceiverArgs *args = (struct ReceiverArgs *) arg;
+	char packet[MAX_MESSAGE_SIZE];
+
+	while (1) {
+		ssize_t size = recv(args->fdSocket, packet, sizeof(packet), 0);
+		if (size < 0 && errno == EINTR) continue;
+		if (size <= 0) break;
+
+		int fd = packet[0] == MESSAGE_NOTIFICATION ? args->fdNotifications : args->fdResponses;
+		if (write_all(fd, packet + 1, (size_t) size - 1) == -1) {
+			fprintf(stderr, "Failed to deliver message from server.\n");
+			break;
+		}
+	}
+
+	// End of file on the pipes tells the client the session is over
+	close(args->fdResponses);
+	close(args->fdNotifications);
+	free(args);
+	return NULL;
+}
+
+int connect_server_socket(char const *server_socket_path) {
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(server_socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Server socket path is too long.\n");
+		return -1;
+	}
+	strcpy(address.sun_path, server_socket_path);
+
+	int fdSocket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fdSocket < 0 || connect(fdSocket, (struct sockaddr *) &address, sizeof(address))) {
+		fprintf(stderr, "Client could not connect to server socket.\n");
+		if (fdSocket >= 0) close(fdSocket);
+		return -1;
+	}
+	return fdSocket;
+}
+
+int send_protocol_request(int fdSocket) {
+	if (requestedProtocol == PROTOCOL_FIXED) return 0;
+	const char request[2] = {OP_CODE_CONNECT_COMPACT, (char) requestedProtocol};
+	if (write_all(fdSocket, request, sizeof(request)) == -1) return -1;
+	return 1;
+}
+
+int kvs_connect_socket(char const *server_socket_path, int *fdNotificationPipe,
+					   int *fdRequestPipe, int *fdResponsePipe) {
+	int fdSocket = connect_server_socket(server_socket_path);
+	if (fdSocket < 0) return 1;
+
+	int responses[2], notifications[2];
+	struct ReceiverArgs *args = malloc(sizeof(struct ReceiverArgs));
+	if (args == NULL || pipe(responses)) {
+		fprintf(stderr, "Client could not create response pipe.\n");
+		free(args);
+		close(fdSocket);
+		return 1;
+	}
+	if (pipe(notifications)) {
+		fprintf(stderr, "Client could not create notification pipe.\n");
+		free(args);
+		close(responses[0]);
+		close(responses[1]);
+		close(fdSocket);
+		return 1;
+	}
+
+	args->fdSocket = fdSocket;
+	args->fdResponses = responses[1];
+	args->fdNotifications = notifications[1];
+	pthread_t receiver;
+	if (pthread_create(&receiver, NULL, receive_messages, args) || pthread_detach(receiver)) {
+		fprintf(stderr, "Client could not create receiver thread.\n");
+		free(args);
+		close(responses[0]);
+		close(responses[1]);
+		close(notifications[0]);
+		close(notifications[1]);
+		close(fdSocket);
+		return 1;
+	}
+
+	*fdRequestPipe = fdSocket;
+	*fdResponsePipe = responses[0];
+	*fdNotificationPipe = notifications[0];
+
+	sessionProtocol = PROTOCOL_FIXED;
 	char result;
-	if (read_server_response(*fdResponsePipe, expected_OP_Code, &result) == 1) {
+	if (read_server_response(*fdResponsePipe, OP_CODE_CONNECT, &result) == 1) {
 		fprintf(stderr, "Failed to read connect message from response pipe.\n");
+		result = '1';
 	}
 
+	// Sockets are answered on accept, the version is asked for afterwards
+	int sent = result == '0' ? send_protocol_request(fdSocket) : 0;
+	if (sent < 0 || (sent > 0 && read_compact_connect(*fdResponsePipe, &result, 0))) {
+		fprintf(stderr, "Failed to negotiate the protocol version.\n");
+		result = '1';
+	}
+	if (result != '0') {
+		// The receiver stops once the server closes the socket
+		terminate_pipes(*fdRequestPipe, "", *fdResponsePipe, "", *fdNotificationPipe, "");
+		return 1;
+	}
 	return 0;
 }
 
@@ -201,7 +421,7 @@ void terminate_pipes(int fdRequestPipe, const char *req_pipe_path,
 		fprintf(stderr, "Client failed to close requests pipe.\n");
 	}
 
-	if (unlink(req_pipe_path)) {
+	if (req_pipe_path[0] != '\0' && unlink(req_pipe_path)) {
 		fprintf(stderr, "Client failed to unlink requests pipe.\n");
 	}
 
@@ -209,7 +429,7 @@ void terminate_pipes(int fdRequestPipe, const char *req_pipe_path,
 		fprintf(stderr, "Client failed to close notifications pipe.\n");
 	}
 
-	if (unlink(notif_pipe_path)) {
+	if (notif_pipe_path[0] != '\0' && unlink(notif_pipe_path)) {
 		fprintf(stderr, "Client failed to unlink notifications pipe.\n");
 	}
 
@@ -217,11 +437,261 @@ void terminate_pipes(int fdRequestPipe, const char *req_pipe_path,
 		fprintf(stderr, "Client failed to close responses pipe.\n");
 	}
 
-	if (unlink(resp_pipe_path)) {
+	if (resp_pipe_path[0] != '\0' && unlink(resp_pipe_path)) {
 		fprintf(stderr, "Client failed to unlink responses pipe.\n");
 	}
 }
 
+/// A key kept by the near cache. Its subscription keeps it up to date.
+typedef struct CacheEntry {
+	char key[MAX_STRING_SIZE];
+	char value[MAX_STRING_SIZE];
+	int found;    // 0 while the key does not exist
+	int filling;  // its GET is in flight
+	int notified; // a notification arrived while filling, it is newer than the GET
+	int stale;    // notifications may have been lost, it is read again
+	uint64_t seq; // last change applied
+	struct CacheEntry *hashNext; // also links the free entries
+	struct CacheEntry *lruPrev;
+	struct CacheEntry *lruNext;
+} CacheEntry;
+
+// Near cache of kvs_get, off while capacity is 0. The notifications thread
+// updates it, so every field is guarded by lock.
+static struct {
+	pthread_mutex_t lock;
+	size_t capacity;
+	size_t numBuckets; // power of two
+	CacheEntry **buckets;
+	CacheEntry *entries;
+	CacheEntry *freeEntries;
+	CacheEntry lru; // most recently used at lru.lruNext
+	// Keys and patterns the user subscribed, whose notifications are printed
+	char (*watched)[MAX_STRING_SIZE];
+	size_t numWatched;
+	size_t watchedCapacity;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/// @brief Tells whether a key is a pattern, which the server reads as every
+/// key with its prefix.
+static int is_pattern_key(const char *key) {
+	size_t length = strlen(key);
+	return length > 0 && key[length - 1] == SUBSCRIPTION_WILDCARD;
+}
+
+/// @brief Gets the bucket of a key in the cache, by its FNV-1a hash.
+static CacheEntry **cache_bucket(const char *key) {
+	uint64_t h = 14695981039346656037ULL;
+	for (const unsigned char *c = (const unsigned char *) key; *c != '\0'; c++) {
+		h ^= *c;
+		h *= 1099511628211ULL;
+	}
+	return &cache.buckets[h & (cache.numBuckets - 1)];
+}
+
+/// @brief Finds a key in the cache. The lock must be held.
+/// @return the entry, NULL if the key is not cached
+static CacheEntry *cache_find(const char *key) {
+	for (CacheEntry *entry = *cache_bucket(key); entry != NULL; entry = entry->hashNext) {
+		if (strcmp(entry->key, key) == 0) return entry;
+	}
+	return NULL;
+}
+
+static void lru_unlink(CacheEntry *entry) {
+	entry->lruPrev->lruNext = entry->lruNext;
+	entry->lruNext->lruPrev = entry->lruPrev;
+}
+
+static void lru_push_front(CacheEntry *entry) {
+	entry->lruPrev = &cache.lru;
+	entry->lruNext = cache.lru.lruNext;
+	cache.lru.lruNext->lruPrev = entry;
+	cache.lru.lruNext = entry;
+}
+
+/// @brief Removes an entry from the cache. The lock must be held.
+static void cache_remove(CacheEntry *entry) {
+	CacheEntry **link = cache_bucket(entry->key);
+	while (*link != entry) link = &(*link)->hashNext;
+	*link = entry->hashNext;
+	lru_unlink(entry);
+	entry->hashNext = cache.freeEntries;
+	cache.freeEntries = entry;
+}
+
+/// @brief Adds a key being filled, evicting the least recently used key
+/// that is not being filled when the cache is full. The lock must be held.
+/// @param key
+/// @param evicted Set to the evicted key, "" if none.
+/// @return the entry, NULL if every entry is being filled
+static CacheEntry *cache_insert(const char *key, char evicted[MAX_STRING_SIZE]) {
+	evicted[0] = '\0';
+	if (cache.freeEntries == NULL) {
+		CacheEntry *victim = cache.lru.lruPrev;
+		while (victim != &cache.lru && victim->filling) victim = victim->lruPrev;
+		if (victim == &cache.lru) return NULL;
+		strcpy(evicted, victim->key);
+		cache_remove(victim);
+	}
+
+	CacheEntry *entry = cache.freeEntries;
+	cache.freeEntries = entry->hashNext;
+	strcpy(entry->key, key);
+	entry->found = 0;
+	entry->filling = 1;
+	entry->notified = 0;
+	entry->stale = 0;
+	entry->seq = 0;
+	CacheEntry **bucket = cache_bucket(key);
+	entry->hashNext = *bucket;
+	*bucket = entry;
+	lru_push_front(entry);
+	return entry;
+}
+
+/// @brief Finds a key or pattern the user subscribed. The lock must be held.
+/// @return its position, numWatched if not found
+static size_t watched_position(const char *key) {
+	size_t i = 0;
+	while (i < cache.numWatched && strcmp(cache.watched[i], key) != 0) i++;
+	return i;
+}
+
+/// @brief Records a subscription of the user, whose notifications are then
+/// printed even for a key the cache subscribed first.
+static void watch(const char *key) {
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity == 0 || watched_position(key) < cache.numWatched) {
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+	if (cache.numWatched == cache.watchedCapacity) {
+		size_t capacity = cache.watchedCapacity ? 2 * cache.watchedCapacity : 16;
+		char (*watched)[MAX_STRING_SIZE] = realloc(cache.watched, capacity * MAX_STRING_SIZE);
+		if (watched == NULL) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			pthread_mutex_unlock(&cache.lock);
+			return;
+		}
+		cache.watched = watched;
+		cache.watchedCapacity = capacity;
+	}
+	snprintf(cache.watched[cache.numWatched++], MAX_STRING_SIZE, "%s", key);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/// @brief Forgets a subscription the user removed. The server keeps one
+/// subscription per key, so a cached key loses its updates and is dropped.
+static void unwatch(const char *key) {
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity == 0) {
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+	size_t i = watched_position(key);
+	if (i < cache.numWatched) {
+		memcpy(cache.watched[i], cache.watched[--cache.numWatched], MAX_STRING_SIZE);
+	}
+	CacheEntry *entry = cache_find(key);
+	if (entry != NULL && !entry->filling) cache_remove(entry);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/// @brief Tells whether the user subscribed a key, by itself or through a
+/// pattern. The lock must be held.
+static int user_watches(const char *key) {
+	for (size_t i = 0; i < cache.numWatched; i++) {
+		const char *watched = cache.watched[i];
+		if (strcmp(watched, key) == 0) return 1;
+		size_t prefix = strlen(watched) - 1;
+		if (is_pattern_key(watched) && strncmp(watched, key, prefix) == 0) return 1;
+	}
+	return 0;
+}
+
+/// @brief Empties the cache once the notifications thread is gone.
+static void cache_reset(void) {
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity > 0) {
+		memset(cache.buckets, 0, cache.numBuckets * sizeof(CacheEntry *));
+		cache.lru.lruNext = cache.lru.lruPrev = &cache.lru;
+		cache.freeEntries = NULL;
+		for (size_t i = cache.capacity; i > 0; i--) {
+			cache.entries[i - 1].hashNext = cache.freeEntries;
+			cache.freeEntries = &cache.entries[i - 1];
+		}
+		cache.numWatched = 0;
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+int kvs_cache_init(size_t max_entries) {
+	if (max_entries == 0) return 0;
+	size_t numBuckets = 1;
+	while (numBuckets < max_entries) numBuckets <<= 1;
+
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity > 0) {
+		pthread_mutex_unlock(&cache.lock);
+		fprintf(stderr, "The cache is already enabled\n");
+		return 1;
+	}
+	cache.entries = calloc(max_entries, sizeof(CacheEntry));
+	cache.buckets = calloc(numBuckets, sizeof(CacheEntry *));
+	if (cache.entries == NULL || cache.buckets == NULL) {
+		free(cache.entries);
+		free(cache.buckets);
+		pthread_mutex_unlock(&cache.lock);
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	cache.capacity = max_entries;
+	cache.numBuckets = numBuckets;
+	pthread_mutex_unlock(&cache.lock);
+	cache_reset();
+	return 0;
+}
+
+int kvs_cache_apply(const char *key, const char *value, size_t length, uint64_t seq) {
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity == 0) {
+		pthread_mutex_unlock(&cache.lock);
+		return 1;
+	}
+
+	if (key[0] == '\0') {
+		// Any key may have missed its change, so each is read again
+		for (CacheEntry *entry = cache.lru.lruNext; entry != &cache.lru; entry = entry->lruNext) {
+			entry->stale = 1;
+		}
+		pthread_mutex_unlock(&cache.lock);
+		return 0;
+	}
+
+	int print = user_watches(key);
+	CacheEntry *entry = cache_find(key);
+	if (entry != NULL) {
+		// A user pattern and the key of the cache may both notify a change
+		if (seq != 0 && seq <= entry->seq) print = 0;
+		else {
+			entry->found = strcmp(value, "DELETE") != 0;
+			// Served as a GET answers, cut with the flag that says so
+			if (entry->found && length > BATCH_MAX_STRING_LENGTH &&
+				sessionProtocol >= PROTOCOL_TRUNCATION_FLAGS) {
+				entry->found = BATCH_VALUE_TRUNCATED;
+			}
+			snprintf(entry->value, MAX_STRING_SIZE, "%s", entry->found ? value : "");
+			entry->seq = seq;
+			entry->notified = entry->filling;
+			// Later than any change lost before it
+			entry->stale = 0;
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return print;
+}
+
 int kvs_disconnect(int fdRequestPipe, int fdResponsePipe, 
 				   pthread_t notificationsThread) {
 	int error = 0;
@@ -244,22 +714,47 @@ int kvs_disconnect(int fdRequestPipe, int fdResponsePipe,
 		error = 1;
 	}
 
+	cache_reset();
 	return error;
 }
 
 
 
-int kvs_subscribe(int fdRequestPipe, int fdResponsePipe, const char *key) {
-
-	// write subscription message on requests pipe
-	const char opcode = OP_CODE_SUBSCRIBE;
-	if (write_all(fdRequestPipe, &opcode, 1) == -1) {
-		fprintf(stderr, "Error writing subscribe OP Code on requests pipe\n");
+/// @brief Writes a SUBSCRIBE or UNSUBSCRIBE request in the layout of the
+/// session's protocol.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param opcode
+/// @param key
+/// @return 0 on success, 1 on error
+static int write_key_request(int fdRequestPipe, char opcode, const char *key) {
+	if (sessionProtocol >= PROTOCOL_COMPACT) {
+		char request[1 + VARINT_MAX_SIZE + BATCH_MAX_STRING_LENGTH];
+		size_t length = strnlen(key, BATCH_MAX_STRING_LENGTH);
+		request[0] = opcode;
+		size_t size = 1 + varint_encode(length, request + 1);
+		memcpy(request + size, key, length);
+		if (write_all(fdRequestPipe, request, size + length) == -1) {
+			fprintf(stderr, "Error writing key on requests pipe\n");
+			return 1;
+		}
 		return 0;
 	}
 
+	if (write_all(fdRequestPipe, &opcode, 1) == -1) {
+		fprintf(stderr, "Error writing OP Code on requests pipe\n");
+		return 1;
+	}
 	if (write_correct_size(fdRequestPipe, key, KEY_MESSAGE_SIZE) == -1) {
 		fprintf(stderr, "Error writing key on requests pipe\n");
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_subscribe(int fdRequestPipe, int fdResponsePipe, const char *key) {
+
+	// write subscription message on requests pipe
+	if (write_key_request(fdRequestPipe, OP_CODE_SUBSCRIBE, key)) {
 		return 0;
 	}
 
@@ -267,19 +762,17 @@ int kvs_subscribe(int fdRequestPipe, int fdResponsePipe, const char *key) {
 
 	if (read_server_response(fdResponsePipe, OP_CODE_SUBSCRIBE, &result) == 1) {
 		fprintf(stderr, "Failed to read subscribe response from server.\n");
+		return 0;
 	}
+	// The cache trusts only the subscriptions the server confirmed
+	if (result != RESULT_KEY_EXISTS && result != RESULT_KEY_PARKED) return 0;
+	watch(key);
 	return 1;
 }
 
 int kvs_unsubscribe(int fdResquestPipe, int fdResponsePipe, const char *key) {
 	// send unsubscribe message to request pipe 
-	const char opcode = OP_CODE_UNSUBSCRIBE;
-	if (write_all(fdResquestPipe, &opcode, 1) == -1) {
-		fprintf(stderr, "Error writing unsubscribe OP Code on requests pipe\n");
-		return 1;
-	}
-	if (write_correct_size(fdResquestPipe, key, KEY_MESSAGE_SIZE) == -1) {
-		fprintf(stderr, "Error writing key on requests pipe\n");
+	if (write_key_request(fdResquestPipe, OP_CODE_UNSUBSCRIBE, key)) {
 		return 1;
 	}
 
@@ -289,7 +782,719 @@ int kvs_unsubscribe(int fdResquestPipe, int fdResponsePipe, const char *key) {
 	if (read_server_response(fdResponsePipe, OP_CODE_UNSUBSCRIBE, &result) == 1) {
 		fprintf(stderr, "Failed to read unsubscribe response from server.\n");
 	}
+	unwatch(key);
+	return 0;
+}
+
+
+
+/// @brief Appends a length-prefixed string to a batch frame.
+/// @param frame Frame being built.
+/// @param str String to append, truncated to BATCH_MAX_STRING_LENGTH.
+/// @return number of bytes appended
+static size_t append_batch_string(char *frame, const char *str) {
+	size_t length = strnlen(str, BATCH_MAX_STRING_LENGTH);
+	frame[0] = (char) length;
+	memcpy(frame + 1, str, length);
+	return 1 + length;
+}
+
+size_t encode_batch_request(char *frame, char opcode, size_t num_keys,
+							char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]) {
+	size_t offset = 0;
+	frame[offset++] = opcode;
+	uint32_t count = (uint32_t) num_keys;
+	memcpy(frame + offset, &count, sizeof(count));
+	offset += sizeof(count);
+
+	for (size_t i = 0; i < num_keys; i++) {
+		offset += append_batch_string(frame + offset, keys[i]);
+		if (values != NULL) {
+			offset += append_batch_string(frame + offset, values[i]);
+		}
+	}
+	return offset;
+}
+
+/// @brief Writes a GET, PUT or DEL request on the requests pipe.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param opcode OP Code of the request.
+/// @param num_keys Number of keys.
+/// @param keys Keys of the request.
+/// @param values Values of a PUT request, NULL otherwise.
+/// @return on success, returns 1, on error, returns -1
+static int write_batch_request(int fdRequestPipe, char opcode, size_t num_keys,
+							   char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]) {
+	char frame[BATCH_REQUEST_MAX_SIZE(num_keys)];
+	size_t length = encode_batch_request(frame, opcode, num_keys, keys, values);
+	return write_all(fdRequestPipe, frame, length);
+}
+
+/// @brief Reads the count that follows the result of a batch response.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param expected Number of keys in the request.
+/// @return 0 if the count matches, 1 otherwise.
+static int read_batch_count(int fdResponsePipe, size_t expected) {
+	uint32_t count;
+	int readingError = 0;
+	if (read_all(fdResponsePipe, &count, sizeof(count), &readingError) <= 0) {
+		fprintf(stderr, "Failed to read count from responses pipe.\n");
+		return 1;
+	}
+	return count != expected;
+}
+
+/// @brief Reads the values of several keys from the server.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys.
+/// @param keys Keys to read.
+/// @param values Where to store the value of each key.
+/// @param found Set to 1 for each key that exists, 0 otherwise.
+/// @return 0 if the values were read, 1 otherwise.
+static int request_values(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+						  char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+						  int found[]) {
+	if (write_batch_request(fdRequestPipe, OP_CODE_GET, num_keys, keys, NULL) == -1) {
+		fprintf(stderr, "Error writing get request on requests pipe\n");
+		return 1;
+	}
+
+	char result;
+	if (read_server_response(fdResponsePipe, OP_CODE_GET, &result) == 1) {
+		fprintf(stderr, "Failed to read get response from server.\n");
+		return 1;
+	}
+	// on error the server answers with no entries
+	if (result != '0') {
+		read_batch_count(fdResponsePipe, 0);
+		return 1;
+	}
+	if (read_batch_count(fdResponsePipe, num_keys)) return 1;
+
+	int readingError = 0;
+	for (size_t i = 0; i < num_keys; i++) {
+		unsigned char header[2]; // found, valueLength
+		if (read_all(fdResponsePipe, header, sizeof(header), &readingError) <= 0 ||
+			header[1] > BATCH_MAX_STRING_LENGTH ||
+			read_all(fdResponsePipe, values[i], header[1], &readingError) < 0) {
+			fprintf(stderr, "Failed to read value from responses pipe.\n");
+			return 1;
+		}
+		values[i][header[1]] = '\0';
+		found[i] = header[0];
+	}
+	return 0;
+}
+
+int kvs_put(int fdRequestPipe, int fdResponsePipe, size_t num_pairs,
+			char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]) {
+	if (num_pairs == 0 || num_pairs > MAX_BATCH_KEYS) return 1;
+
+	if (write_batch_request(fdRequestPipe, OP_CODE_PUT, num_pairs, keys, values) == -1) {
+		fprintf(stderr, "Error writing put request on requests pipe\n");
+		return 1;
+	}
+
+	char result;
+	if (read_server_response(fdResponsePipe, OP_CODE_PUT, &result) == 1) {
+		fprintf(stderr, "Failed to read put response from server.\n");
+		return 1;
+	}
+	return result != '0';
+}
+
+/// @brief Writes a PUT_TTL or EXPIRE request on the requests pipe.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param opcode OP Code of the request.
+/// @param ttl_ms Milliseconds until the keys expire, 0 for never.
+/// @param num_keys Number of keys.
+/// @param keys Keys of the request.
+/// @param values Values of a PUT_TTL request, NULL otherwise.
+/// @return on success, returns 1, on error, returns -1
+static int write_ttl_request(int fdRequestPipe, char opcode, uint32_t ttl_ms, size_t num_keys,
+							 char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]) {
+	char frame[TTL_SIZE + BATCH_REQUEST_MAX_SIZE(num_keys)];
+	// The batch goes after the ttl, then the opcode is moved in front of it
+	size_t length = encode_batch_request(frame + TTL_SIZE, opcode, num_keys, keys, values);
+	frame[0] = opcode;
+	memcpy(frame + 1, &ttl_ms, TTL_SIZE);
+	return write_all(fdRequestPipe, frame, TTL_SIZE + length);
+}
+
+/// @brief Reads a DEL or EXPIRE response, with one flag per key.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param opcode OP Code of the request.
+/// @param num_keys Number of keys in the request.
+/// @param flags Set to the flag of each key.
+/// @return 0 if the request was served, 1 otherwise.
+static int read_flags_response(int fdResponsePipe, char opcode, size_t num_keys, int flags[]) {
+	char result;
+	if (read_server_response(fdResponsePipe, opcode, &result) == 1) {
+		fprintf(stderr, "Failed to read response from server.\n");
+		return 1;
+	}
+	if (result != '0') {
+		read_batch_count(fdResponsePipe, 0);
+		return 1;
+	}
+	if (read_batch_count(fdResponsePipe, num_keys)) return 1;
+
+	unsigned char bytes[num_keys];
+	int readingError = 0;
+	if (read_all(fdResponsePipe, bytes, num_keys, &readingError) <= 0) {
+		fprintf(stderr, "Failed to read results from responses pipe.\n");
+		return 1;
+	}
+	for (size_t i = 0; i < num_keys; i++) {
+		flags[i] = bytes[i];
+	}
+	return 0;
+}
+
+int kvs_delete(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+			   char keys[][MAX_STRING_SIZE], int deleted[]) {
+	if (num_keys == 0 || num_keys > MAX_BATCH_KEYS) return 1;
+
+	if (write_batch_request(fdRequestPipe, OP_CODE_DEL, num_keys, keys, NULL) == -1) {
+		fprintf(stderr, "Error writing delete request on requests pipe\n");
+		return 1;
+	}
+	return read_flags_response(fdResponsePipe, OP_CODE_DEL, num_keys, deleted);
+}
+
+int kvs_put_ttl(int fdRequestPipe, int fdResponsePipe, size_t num_pairs,
+				char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], unsigned int ttl_ms) {
+	if (num_pairs == 0 || num_pairs > MAX_BATCH_KEYS) return 1;
+	if (sessionProtocol < PROTOCOL_EXPIRY) {
+		fprintf(stderr, "The session does not support expiry.\n");
+		return 1;
+	}
+
+	if (write_ttl_request(fdRequestPipe, OP_CODE_PUT_TTL, ttl_ms, num_pairs, keys, values) == -1) {
+		fprintf(stderr, "Error writing put request on requests pipe\n");
+		return 1;
+	}
+
+	char result;
+	if (read_server_response(fdResponsePipe, OP_CODE_PUT_TTL, &result) == 1) {
+		fprintf(stderr, "Failed to read put response from server.\n");
+		return 1;
+	}
+	return result != '0';
+}
+
+int kvs_expire(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+			   char keys[][MAX_STRING_SIZE], unsigned int ttl_ms, int found[]) {
+	if (num_keys == 0 || num_keys > MAX_BATCH_KEYS) return 1;
+	if (sessionProtocol < PROTOCOL_EXPIRY) {
+		fprintf(stderr, "The session does not support expiry.\n");
+		return 1;
+	}
+
+	if (write_ttl_request(fdRequestPipe, OP_CODE_EXPIRE, ttl_ms, num_keys, keys, NULL) == -1) {
+		fprintf(stderr, "Error writing expire request on requests pipe\n");
+		return 1;
+	}
+	return read_flags_response(fdResponsePipe, OP_CODE_EXPIRE, num_keys, found);
+}
+
+/// @brief Sends a SUBSCRIBE_BATCH or UNSUBSCRIBE_BATCH request and reads
+/// the bitmap of its response.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param opcode OP Code of the request.
+/// @param num_keys Number of keys.
+/// @param keys Keys of the request.
+/// @param succeeded Set to the bit of each key.
+/// @param report Whether to print the result, off for the requests of the cache.
+/// @return 0 if the request was served, 1 otherwise.
+static int subscription_batch(int fdRequestPipe, int fdResponsePipe, char opcode,
+							  size_t num_keys, char keys[][MAX_STRING_SIZE], int succeeded[],
+							  int report) {
+	if (num_keys == 0 || num_keys > MAX_BATCH_KEYS) return 1;
+
+	if (write_batch_request(fdRequestPipe, opcode, num_keys, keys, NULL) == -1) {
+		fprintf(stderr, "Error writing subscriptions request on requests pipe\n");
+		return 1;
+	}
+
+	char result;
+	if (read_response(fdResponsePipe, opcode, &result, report) == 1) {
+		fprintf(stderr, "Failed to read subscriptions response from server.\n");
+		return 1;
+	}
+	if (result != '0') {
+		read_batch_count(fdResponsePipe, 0);
+		return 1;
+	}
+	if (read_batch_count(fdResponsePipe, num_keys)) return 1;
+
+	unsigned char bitmap[BATCH_BITMAP_SIZE(num_keys)];
+	int readingError = 0;
+	if (read_all(fdResponsePipe, bitmap, sizeof(bitmap), &readingError) <= 0) {
+		fprintf(stderr, "Failed to read subscriptions results from responses pipe.\n");
+		return 1;
+	}
+	for (size_t i = 0; i < num_keys; i++) {
+		succeeded[i] = (bitmap[i / 8] >> (i % 8)) & 1;
+	}
 	return 0;
 }
 
+int kvs_subscribe_batch(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+						char keys[][MAX_STRING_SIZE], int subscribed[]) {
+	if (subscription_batch(fdRequestPipe, fdResponsePipe, OP_CODE_SUBSCRIBE_BATCH, num_keys,
+						   keys, subscribed, 1)) {
+		return 1;
+	}
+	for (size_t i = 0; i < num_keys; i++) {
+		if (subscribed[i]) watch(keys[i]);
+	}
+	return 0;
+}
 
+int kvs_unsubscribe_batch(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+						  char keys[][MAX_STRING_SIZE], int removed[]) {
+	if (subscription_batch(fdRequestPipe, fdResponsePipe, OP_CODE_UNSUBSCRIBE_BATCH, num_keys,
+						   keys, removed, 1)) {
+		return 1;
+	}
+	for (size_t i = 0; i < num_keys; i++) {
+		unwatch(keys[i]);
+	}
+	return 0;
+}
+
+/// @brief Drops the keys of a failed fill, and their subscriptions unless
+/// the user holds them.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys.
+/// @param keys Keys to drop or evicted from the cache.
+/// @param drop Whether the keys are still cached and must be removed.
+static void release_keys(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+						 char keys[][MAX_STRING_SIZE], int drop) {
+	char released[num_keys][MAX_STRING_SIZE];
+	size_t numReleased = 0;
+	pthread_mutex_lock(&cache.lock);
+	for (size_t i = 0; i < num_keys; i++) {
+		CacheEntry *entry = cache_find(keys[i]);
+		if (drop && entry != NULL) {
+			cache_remove(entry);
+			entry = NULL;
+		}
+		// A key cached again since it was evicted keeps its subscription
+		if (entry == NULL && watched_position(keys[i]) == cache.numWatched) {
+			memcpy(released[numReleased++], keys[i], MAX_STRING_SIZE);
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	int removed[MAX_BATCH_KEYS];
+	if (numReleased > 0 && subscription_batch(fdRequestPipe, fdResponsePipe,
+											  OP_CODE_UNSUBSCRIBE_BATCH, numReleased, released,
+											  removed, 0)) {
+		fprintf(stderr, "Failed to release cached keys\n");
+	}
+}
+
+/// @brief Serves a GET from the cache, asking the server only for the keys
+/// it misses. A missed key is subscribed before it is read, so no change
+/// after the read is lost, and a notification that arrives during the read
+/// wins over it. A missing key is cached too: its subscription waits for
+/// the key to be written. A key whose subscription failed is read but not
+/// kept. A stale key is read again, and one a marker reaches during its read
+/// stays stale.
+/// @return 0 if the values were read, 1 otherwise.
+static int cached_get(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+					  char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], int found[]) {
+	CacheEntry *entries[num_keys];
+	char missed[num_keys][MAX_STRING_SIZE];
+	char evicted[num_keys][MAX_STRING_SIZE];
+	size_t numMissed = 0;
+	size_t numEvicted = 0;
+
+	pthread_mutex_lock(&cache.lock);
+	for (size_t i = 0; i < num_keys; i++) {
+		CacheEntry *entry = cache_find(keys[i]);
+		if (entry != NULL && entry->stale && !entry->filling) {
+			// Read like a miss, subscribing it again changes nothing
+			entry->stale = 0;
+			entry->filling = 1;
+			entry->notified = 0;
+			memcpy(missed[numMissed++], keys[i], MAX_STRING_SIZE);
+		} else if (entry == NULL) {
+			// Only the keys of this call are filling, and they fit in the cache
+			entry = cache_insert(keys[i], evicted[numEvicted]);
+			if (evicted[numEvicted][0] != '\0') numEvicted++;
+			memcpy(missed[numMissed++], keys[i], MAX_STRING_SIZE);
+		} else if (!entry->filling) {
+			lru_unlink(entry);
+			lru_push_front(entry);
+		}
+		entries[i] = entry;
+		if (!entry->filling) {
+			memcpy(values[i], entry->value, MAX_STRING_SIZE);
+			found[i] = entry->found;
+		}
+	}
+	pthread_mutex_unlock(&cache.lock);
+	if (numMissed == 0) return 0;
+
+	int error = 0;
+	int subscribed[MAX_BATCH_KEYS];
+	char missedValues[num_keys][MAX_STRING_SIZE];
+	int missedFound[num_keys];
+	if (subscription_batch(fdRequestPipe, fdResponsePipe, OP_CODE_SUBSCRIBE_BATCH, numMissed,
+						   missed, subscribed, 0) ||
+		request_values(fdRequestPipe, fdResponsePipe, numMissed, missed, missedValues,
+					   missedFound)) {
+		error = 1;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	for (size_t i = 0; i < numMissed && !error; i++) {
+		CacheEntry *entry = cache_find(missed[i]);
+		if (!entry->notified) {
+			memcpy(entry->value, missedValues[i], MAX_STRING_SIZE);
+			entry->found = missedFound[i];
+		}
+		entry->filling = 0;
+		entry->notified = 0;
+	}
+	for (size_t i = 0; i < num_keys && !error; i++) {
+		memcpy(values[i], entries[i]->value, MAX_STRING_SIZE);
+		found[i] = entries[i]->found;
+	}
+	// No notification would ever invalidate a key its subscription failed for
+	for (size_t i = 0; i < numMissed && !error; i++) {
+		if (!subscribed[i]) cache_remove(cache_find(missed[i]));
+	}
+	pthread_mutex_unlock(&cache.lock);
+
+	if (error) release_keys(fdRequestPipe, fdResponsePipe, numMissed, missed, 1);
+	if (numEvicted > 0) release_keys(fdRequestPipe, fdResponsePipe, numEvicted, evicted, 0);
+	return error;
+}
+
+int kvs_get(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+			char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], int found[]) {
+	if (num_keys == 0 || num_keys > MAX_BATCH_KEYS) return 1;
+
+	pthread_mutex_lock(&cache.lock);
+	// Without gap markers a dropped notification would go unnoticed
+	int cached = cache.capacity >= num_keys && sessionProtocol >= PROTOCOL_GAP_MARKERS;
+	pthread_mutex_unlock(&cache.lock);
+	// Patterns are not keys, subscribing them would watch their prefix
+	for (size_t i = 0; i < num_keys && cached; i++) {
+		cached = !is_pattern_key(keys[i]);
+	}
+	if (cached) return cached_get(fdRequestPipe, fdResponsePipe, num_keys, keys, values, found);
+	return request_values(fdRequestPipe, fdResponsePipe, num_keys, keys, values, found);
+}
+
+/// @brief Writes a request, in packets a session socket takes whole.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param bytes
+/// @param size
+/// @return 0 on success, 1 on error
+static int write_request(int fdRequestPipe, const char *bytes, size_t size) {
+	while (size > 0) {
+		size_t chunk = size < MAX_MESSAGE_SIZE ? size : MAX_MESSAGE_SIZE;
+		if (write_all(fdRequestPipe, bytes, chunk) == -1) return 1;
+		bytes += chunk;
+		size -= chunk;
+	}
+	return 0;
+}
+
+/// @brief Starts a PUT_VALUE or GET_VALUE request with its key.
+/// @param request Where to store it, at least 1 + VARINT_MAX_SIZE +
+/// BATCH_MAX_STRING_LENGTH bytes.
+/// @param opcode
+/// @param key
+/// @return size of the request so far
+static size_t encode_value_request(char *request, char opcode, const char *key) {
+	size_t length = strnlen(key, BATCH_MAX_STRING_LENGTH);
+	request[0] = opcode;
+	size_t size = 1 + varint_encode(length, request + 1);
+	memcpy(request + size, key, length);
+	return size + length;
+}
+
+int kvs_put_value(int fdRequestPipe, int fdResponsePipe, const char *key, const void *value,
+				  size_t length) {
+	if (sessionProtocol < PROTOCOL_LARGE_VALUES || length > MAX_VALUE_SIZE) {
+		fprintf(stderr, "The session cannot carry this value.\n");
+		return 1;
+	}
+
+	char header[1 + 2 * VARINT_MAX_SIZE + BATCH_MAX_STRING_LENGTH];
+	size_t size = encode_value_request(header, OP_CODE_PUT_VALUE, key);
+	size += varint_encode(length, header + size);
+	if (write_request(fdRequestPipe, header, size) ||
+		write_request(fdRequestPipe, value, length)) {
+		fprintf(stderr, "Error writing put request on requests pipe\n");
+		return 1;
+	}
+
+	char result;
+	if (read_server_response(fdResponsePipe, OP_CODE_PUT_VALUE, &result) == 1) {
+		fprintf(stderr, "Failed to read put response from server.\n");
+		return 1;
+	}
+	return result != '0';
+}
+
+int kvs_get_value(int fdRequestPipe, int fdResponsePipe, const char *key, char **value,
+				  size_t *length, int *found) {
+	*value = NULL;
+	*length = 0;
+	*found = 0;
+	if (sessionProtocol < PROTOCOL_LARGE_VALUES) {
+		fprintf(stderr, "The session cannot carry whole values.\n");
+		return 1;
+	}
+
+	char request[1 + VARINT_MAX_SIZE + BATCH_MAX_STRING_LENGTH];
+	size_t size = encode_value_request(request, OP_CODE_GET_VALUE, key);
+	if (write_request(fdRequestPipe, request, size)) {
+		fprintf(stderr, "Error writing get request on requests pipe\n");
+		return 1;
+	}
+
+	char result;
+	unsigned char exists;
+	uint64_t valueLength;
+	int readingError = 0;
+	if (read_server_response(fdResponsePipe, OP_CODE_GET_VALUE, &result) == 1 ||
+		read_all(fdResponsePipe, &exists, 1, &readingError) <= 0 ||
+		varint_read(fdResponsePipe, &valueLength, &readingError) <= 0 ||
+		valueLength > MAX_VALUE_SIZE) {
+		fprintf(stderr, "Failed to read get response from server.\n");
+		return 1;
+	}
+	// On error the server answers that the key is missing
+	if (result != '0') return 1;
+	if (!exists) return 0;
+
+	*value = malloc(valueLength + 1);
+	if (*value == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	if (read_all(fdResponsePipe, *value, valueLength, &readingError) <= 0) {
+		fprintf(stderr, "Failed to read value from responses pipe.\n");
+		free(*value);
+		*value = NULL;
+		return 1;
+	}
+	(*value)[valueLength] = '\0';
+	*length = valueLength;
+	*found = 1;
+	return 0;
+}
+
+/// @brief Copies a string of a notification into a null terminated one.
+/// @param src Start of the string.
+/// @param length Its length, cut to MAX_STRING_SIZE - 1.
+/// @param dest Where to store the string.
+static void copy_notification_string(const char *src, size_t length, char dest[MAX_STRING_SIZE]) {
+	if (length >= MAX_STRING_SIZE) length = MAX_STRING_SIZE - 1;
+	memcpy(dest, src, length);
+	dest[length] = '\0';
+}
+
+/// @brief Gets the longest value a notification may carry.
+/// @param protocol Protocol version of the session.
+static uint64_t max_notification_value(int protocol) {
+	return protocol >= PROTOCOL_LARGE_VALUES ? MAX_VALUE_SIZE : MAX_STRING_SIZE - 1;
+}
+
+int decode_notification(const char *buffer, size_t length, int protocol, char key[MAX_STRING_SIZE],
+						char value[MAX_STRING_SIZE], const char **whole, size_t *wholeLength,
+						uint64_t *seq, size_t *size) {
+	if (protocol < PROTOCOL_COMPACT) {
+		if (length < NOTIFICATION_SIZE) return 1;
+		copy_notification_string(buffer, strnlen(buffer, MAX_STRING_SIZE - 1), key);
+		*whole = buffer + KEY_MESSAGE_SIZE;
+		*wholeLength = strnlen(*whole, MAX_STRING_SIZE - 1);
+		copy_notification_string(*whole, *wholeLength, value);
+		*seq = 0; // not sent to fixed sessions
+		*size = NOTIFICATION_SIZE;
+		return 0;
+	}
+
+	size_t offset = 0;
+	for (int i = 0; i < 2; i++) {
+		uint64_t stringLength;
+		size_t varintSize;
+		int status = varint_decode(buffer + offset, length - offset, &stringLength, &varintSize);
+		if (status) return status;
+		if (stringLength > (i == 0 ? MAX_STRING_SIZE - 1 : max_notification_value(protocol))) {
+			return -1;
+		}
+		offset += varintSize;
+		if (length - offset < stringLength) return 1;
+		copy_notification_string(buffer + offset, stringLength, i == 0 ? key : value);
+		if (i == 1) {
+			*whole = buffer + offset;
+			*wholeLength = stringLength;
+		}
+		offset += stringLength;
+	}
+	if (length - offset < sizeof(*seq)) return 1;
+	memcpy(seq, buffer + offset, sizeof(*seq));
+	*size = offset + sizeof(*seq);
+	return 0;
+}
+
+/// @brief Reads and drops bytes, the end of a value too long to keep.
+/// @return as read_all
+static int skip_bytes(int fd, uint64_t count, int *intr) {
+	char scratch[4096];
+	while (count > 0) {
+		size_t chunk = count < sizeof(scratch) ? (size_t) count : sizeof(scratch);
+		int status = read_all(fd, scratch, chunk, intr);
+		if (status != 1) return status;
+		count -= chunk;
+	}
+	return 1;
+}
+
+/// @brief Reads a notification laid out with length prefixes. Keys are
+/// below MAX_STRING_SIZE, so their length is one byte and the first byte of
+/// the value length comes with the key: a short value takes three reads, as
+/// in the fixed layout.
+/// @param fd
+/// @param key Where to store the key.
+/// @param value Where to store the value, cut to MAX_STRING_SIZE - 1 bytes.
+/// @param whole Set to a copy of the whole value, which the caller frees.
+/// NULL to drop what does not fit in value.
+/// @param wholeLength Set to the bytes in the whole value.
+/// @param seq Where to store the sequence number of the change.
+/// @param intr As in read_all.
+/// @return as kvs_read_notification
+static int read_compact_notification(int fd, char key[MAX_STRING_SIZE],
+									 char value[MAX_STRING_SIZE], char **whole,
+									 size_t *wholeLength, uint64_t *seq, int *intr) {
+	char buffer[2 + MAX_STRING_SIZE + sizeof(*seq)];
+	int status = read_all(fd, buffer, 1, intr);
+	size_t keyLength = (unsigned char) buffer[0];
+	if (status == 1 && keyLength >= MAX_STRING_SIZE) status = -1;
+	if (status == 1) status = read_all(fd, buffer + 1, keyLength + 1, intr);
+	if (status != 1) return status;
+	copy_notification_string(buffer + 1, keyLength, key);
+
+	unsigned char first = (unsigned char) buffer[1 + keyLength];
+	uint64_t valueLength = first & 0x7F;
+	if (first & 0x80) {
+		uint64_t rest;
+		status = varint_read(fd, &rest, intr);
+		if (status != 1) return status;
+		valueLength |= rest << 7;
+	}
+	if (valueLength > max_notification_value(sessionProtocol)) return -1;
+
+	char *dest = buffer;
+	size_t kept = valueLength < MAX_STRING_SIZE ? valueLength : MAX_STRING_SIZE - 1;
+	if (whole != NULL) {
+		// Room for the sequence number, read along with the value
+		dest = *whole = malloc(valueLength + sizeof(*seq));
+		if (dest == NULL) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			return -1;
+		}
+		kept = valueLength;
+	}
+	if (kept == valueLength) {
+		status = read_all(fd, dest, kept + sizeof(*seq), intr);
+	} else {
+		status = read_all(fd, dest, kept, intr);
+		if (status == 1) status = skip_bytes(fd, valueLength - kept, intr);
+		if (status == 1) status = read_all(fd, dest + kept, sizeof(*seq), intr);
+	}
+	if (status != 1) {
+		if (whole != NULL) free(*whole);
+		return status;
+	}
+
+	memcpy(seq, dest + kept, sizeof(*seq));
+	copy_notification_string(dest, kept, value);
+	if (whole != NULL) {
+		dest[valueLength] = '\0';
+		*wholeLength = valueLength;
+	}
+	return 1;
+}
+
+int kvs_read_notification(int fdNotificationPipe, char key[MAX_STRING_SIZE],
+						  char value[MAX_STRING_SIZE], uint64_t *seq, int *intr) {
+	if (sessionProtocol >= PROTOCOL_COMPACT) {
+		return read_compact_notification(fdNotificationPipe, key, value, NULL, NULL, seq, intr);
+	}
+
+	char buffer[NOTIFICATION_SIZE];
+	int status = read_all(fdNotificationPipe, buffer, NOTIFICATION_SIZE, intr);
+	if (status != 1) return status;
+
+	const char *whole;
+	size_t wholeLength, size;
+	return decode_notification(buffer, NOTIFICATION_SIZE, sessionProtocol, key, value, &whole,
+							   &wholeLength, seq, &size) ? -1 : 1;
+}
+
+int kvs_read_notification_value(int fdNotificationPipe, char key[MAX_STRING_SIZE], char **value,
+								size_t *length, uint64_t *seq, int *intr) {
+	char shortValue[MAX_STRING_SIZE];
+	if (sessionProtocol >= PROTOCOL_COMPACT) {
+		return read_compact_notification(fdNotificationPipe, key, shortValue, value, length, seq,
+										 intr);
+	}
+
+	int status = kvs_read_notification(fdNotificationPipe, key, shortValue, seq, intr);
+	if (status != 1) return status;
+	*length = strlen(shortValue);
+	*value = strdup(shortValue);
+	if (*value == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return -1;
+	}
+	return 1;
+}
+
+int kvs_resume(int fdRequestPipe, int fdResponsePipe, uint64_t after, ResumeRecord records[],
+			   size_t *count, uint64_t *last, char *result) {
+	char request[1 + sizeof(after)];
+	request[0] = OP_CODE_RESUME;
+	memcpy(request + 1, &after, sizeof(after));
+	if (write_all(fdRequestPipe, request, sizeof(request)) == -1) {
+		fprintf(stderr, "Error writing resume request on requests pipe\n");
+		return 1;
+	}
+
+	if (read_server_response(fdResponsePipe, OP_CODE_RESUME, result) == 1) {
+		fprintf(stderr, "Failed to read resume response from server.\n");
+		return 1;
+	}
+	uint32_t numRecords;
+	int readingError = 0;
+	if (read_all(fdResponsePipe, last, sizeof(*last), &readingError) <= 0 ||
+		read_all(fdResponsePipe, &numRecords, sizeof(numRecords), &readingError) <= 0 ||
+		numRecords > RESUME_MAX_RECORDS) {
+		fprintf(stderr, "Failed to read resume response from server.\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < numRecords; i++) {
+		// Resume records are laid out as notifications
+		if (kvs_read_notification(fdResponsePipe, records[i].key, records[i].value, &records[i].seq,
+							  &readingError) <= 0) {
+			fprintf(stderr, "Failed to read changes from responses pipe.\n");
+			return 1;
+		}
+	}
+	*count = numRecords;
+	return *result != RESUME_COMPLETE && *result != RESUME_PARTIAL && *result != RESUME_EVICTED;
+}
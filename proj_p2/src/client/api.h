@@ -2,12 +2,21 @@
 #define CLIENT_API_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <pthread.h>
 
 #include "src/common/constants.h"
+#include "src/common/protocol.h"
+
+/// Reads the response to a request that only returns a result.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param expected_OP_Code OP Code of the request.
+/// @param result Result of the operation.
+/// @return 0 if the response was read, 1 otherwise.
+int read_server_response(int fdResponsePipe, const char expected_OP_Code, char *result);
 
 /// Connects to a kvs server.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
@@ -23,6 +32,93 @@ int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
 				int *fdNotificationPipe, int *fdRequestPipe, int *fdResponsePipe,
 				int *fdServerPipe);
 
+/// Opens a session socket to a kvs server. The server answers the connection
+/// with a MESSAGE_RESPONSE packet carrying the CONNECT result.
+/// @param server_socket_path Path to the socket where the server is listening.
+/// @return the socket, -1 on error.
+int connect_server_socket(char const *server_socket_path);
+
+/// Chooses the protocol version the next connect asks for. Sessions ask for
+/// PROTOCOL_TRUNCATION_FLAGS unless an older version is chosen; servers that
+/// predate CONNECT_COMPACT need PROTOCOL_FIXED. A server that knows an older
+/// version only agrees to that one.
+/// @param version PROTOCOL_FIXED, PROTOCOL_COMPACT, PROTOCOL_LARGE_VALUES,
+/// PROTOCOL_EXPIRY, PROTOCOL_GAP_MARKERS or PROTOCOL_TRUNCATION_FLAGS.
+void kvs_request_protocol(int version);
+
+/// Gets the protocol version the server agreed to at the last connect.
+/// @return PROTOCOL_FIXED, PROTOCOL_COMPACT, PROTOCOL_LARGE_VALUES,
+/// PROTOCOL_EXPIRY, PROTOCOL_GAP_MARKERS or PROTOCOL_TRUNCATION_FLAGS
+int kvs_session_protocol(void);
+
+/// Decodes a notification, or a resume record, at the start of a buffer.
+/// @param buffer
+/// @param length Number of bytes in the buffer.
+/// @param protocol Protocol version of the session.
+/// @param key Where to store the key.
+/// @param value Where to store the value, "DELETE" for a delete, cut to
+/// MAX_STRING_SIZE - 1 bytes.
+/// @param whole Set to the whole value inside the buffer, not null terminated.
+/// @param wholeLength Set to the bytes in the whole value.
+/// @param seq Where to store the sequence number of the change, 0
+/// on a PROTOCOL_FIXED session.
+/// @param size Set to the number of bytes the notification takes.
+/// @return 0 on success, 1 if the buffer ends before the notification
+/// does, -1 if it is malformed
+int decode_notification(const char *buffer, size_t length, int protocol, char key[MAX_STRING_SIZE],
+						char value[MAX_STRING_SIZE], const char **whole, size_t *wholeLength,
+						uint64_t *seq, size_t *size);
+
+/// Reads the next notification from the notifications pipe, in the layout
+/// of the session's protocol.
+/// @param fdNotificationPipe File descriptor of the notifications pipe.
+/// @param key Where to store the key.
+/// @param value Where to store the new value, "DELETE" for a delete. Longer
+/// values are cut to MAX_STRING_SIZE - 1 bytes.
+/// @param seq Where to store the sequence number of the change, 0
+/// on a PROTOCOL_FIXED session.
+/// @param intr As in read_all.
+/// @return 1 if a notification was read, PIPES_CLOSED if the server closed
+/// the session, -1 on error
+int kvs_read_notification(int fdNotificationPipe, char key[MAX_STRING_SIZE],
+						  char value[MAX_STRING_SIZE], uint64_t *seq, int *intr);
+
+/// Reads the next notification with its whole value, as kvs_read_notification.
+/// Only PROTOCOL_LARGE_VALUES sessions are sent values of MAX_STRING_SIZE
+/// bytes or more.
+/// @param fdNotificationPipe File descriptor of the notifications pipe.
+/// @param key Where to store the key.
+/// @param value Set to a null terminated copy of the value, which the caller
+/// must free.
+/// @param length Set to the bytes in the value.
+/// @param seq Where to store the sequence number of the change.
+/// @param intr As in read_all.
+/// @return as kvs_read_notification
+int kvs_read_notification_value(int fdNotificationPipe, char key[MAX_STRING_SIZE], char **value,
+								size_t *length, uint64_t *seq, int *intr);
+
+/// Asks for the version chosen with kvs_request_protocol on a session
+/// socket that got its CONNECT response. The server answers with a
+/// CONNECT_COMPACT response.
+/// @param fdSocket
+/// @return 1 if the request was sent, 0 if the session keeps
+/// PROTOCOL_FIXED, -1 on error.
+int send_protocol_request(int fdSocket);
+
+/// Connects to a kvs server through its socket. Requests, responses and
+/// notifications share one socket; a thread started here delivers the
+/// responses and notifications to the returned fds, so the other functions
+/// work the same as with pipes.
+/// @param server_socket_path Path to the socket where the server is listening.
+/// @param fdNotificationPipe File descriptor for the notifications.
+/// @param fdRequestPipe File descriptor for the requests.
+/// @param fdResponsePipe File descriptor for the responses.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int kvs_connect_socket(char const *server_socket_path, int *fdNotificationPipe,
+					   int *fdRequestPipe, int *fdResponsePipe);
+
+/// Closes the client pipes and unlinks those with a path. Paths are empty
+/// for sessions over a socket.
 void terminate_pipes(int fdRequestPipe, const char *req_pipe_path,
 				   int fdResponsePipe, const char *resp_pipe_path,
 				   int fdNotification, const char *notif_pipe_path);
@@ -35,11 +131,13 @@ void terminate_pipes(int fdRequestPipe, const char *req_pipe_path,
 int kvs_disconnect(int fdRequestPipe, int fdResponsePipe, 
 				   pthread_t notificationsThread);
 
-/// Requests a subscription for a key
+/// Requests a subscription for a key. A key that does not exist yet is
+/// watched until it is written, and the server answers RESULT_KEY_PARKED.
 /// @param fdRequestPipe FFile descriptor of the requests pipe.
 /// @param fdResponsePipe File descriptor of the responses pipe.
 /// @param key Key to be subscribed
-/// @return 1 if the key was subscribed successfully (key existing), 0 otherwise.
+/// @return 1 if the key was subscribed, whether it exists or waits to be
+/// written, 0 otherwise.
 int kvs_subscribe(int fdRequestPipe, int fdResponsePipe, const char *key);
 
 /// Remove a subscription for a key
@@ -49,4 +147,169 @@ int kvs_subscribe(int fdRequestPipe, int fdResponsePipe, const char *key);
 /// @return 0 if the key was unsubscribed successfully  (subscription existed and was removed), 1 otherwise.
 int kvs_unsubscribe(int fdResquestPipe, int fdResponsePipe, const char *key);
 
+/// Enables the near cache of kvs_get, before connecting. Each key read is
+/// kept and subscribed, and the notifications keep it up to date, so reading
+/// it again needs no request. When the cache is full, the least recently
+/// read key is dropped and unsubscribed. Coherence relies on the session
+/// being told when changes are lost, so the cache is only used on
+/// PROTOCOL_GAP_MARKERS sessions.
+/// @param max_entries Most keys kept, 0 to leave the cache off.
+/// @return 0 if successful, 1 otherwise.
+int kvs_cache_init(size_t max_entries);
+
+/// Applies a notification to the near cache. Called by the notifications
+/// thread with each notification it reads. The marker of dropped
+/// notifications makes every cached key be read again.
+/// @param key
+/// @param value New value, "DELETE" for a delete.
+/// @param length Bytes in the value.
+/// @param seq Sequence number of the change.
+/// @return 1 if the user subscribed the key or a pattern matching it, or if
+/// the cache is off, 0 if only the cache watches it, the change was seen or
+/// it is the marker.
+int kvs_cache_apply(const char *key, const char *value, size_t length, uint64_t seq);
+
+/// Reads the values of several keys. With the near cache on, cached keys
+/// are served locally.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys to read.
+/// @param values Where to store the value of each key.
+/// @param found Set to 1 for each key that exists, 0 otherwise. On a
+/// PROTOCOL_TRUNCATION_FLAGS session, BATCH_VALUE_TRUNCATED for a key whose
+/// value is longer than MAX_STRING_SIZE - 1 bytes, read whole with
+/// kvs_get_value.
+/// @return 0 if the values were read, 1 otherwise.
+int kvs_get(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+			char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], int found[]);
+
+/// Writes several key value pairs. Existing keys are updated and lose any
+/// TTL they had.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_pairs Number of pairs, at most MAX_BATCH_KEYS.
+/// @param keys Keys to write.
+/// @param values Values to write.
+/// @return 0 if the pairs were written, 1 otherwise.
+int kvs_put(int fdRequestPipe, int fdResponsePipe, size_t num_pairs,
+			char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]);
+
+/// Writes one value of up to MAX_VALUE_SIZE bytes, which may hold any byte.
+/// Needs a PROTOCOL_LARGE_VALUES session. The value streams to the server
+/// in packets, without a copy.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param key Key to write.
+/// @param value
+/// @param length Bytes in the value.
+/// @return 0 if the pair was written, 1 otherwise.
+int kvs_put_value(int fdRequestPipe, int fdResponsePipe, const char *key, const void *value,
+				  size_t length);
+
+/// Reads the whole value of a key. Needs a PROTOCOL_LARGE_VALUES session.
+/// kvs_get reads the first MAX_STRING_SIZE - 1 bytes of longer values, and
+/// flags them as BATCH_VALUE_TRUNCATED on newer sessions.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param key Key to read.
+/// @param value Set to a null terminated copy of the value, which the caller
+/// must free, NULL if the key does not exist.
+/// @param length Set to the bytes in the value.
+/// @param found Set to 1 if the key exists, 0 otherwise.
+/// @return 0 if the value was read, 1 otherwise.
+int kvs_get_value(int fdRequestPipe, int fdResponsePipe, const char *key, char **value,
+				  size_t *length, int *found);
+
+/// Deletes several keys.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys to delete.
+/// @param deleted Set to 1 for each key that was deleted, 0 if it was missing.
+/// @return 0 if the request was served, 1 otherwise.
+int kvs_delete(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+			   char keys[][MAX_STRING_SIZE], int deleted[]);
+
+/// Writes several key value pairs that expire together after a TTL, as if
+/// they were deleted then. Needs a PROTOCOL_EXPIRY session.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_pairs Number of pairs, at most MAX_BATCH_KEYS.
+/// @param keys Keys to write.
+/// @param values Values to write.
+/// @param ttl_ms Milliseconds until the pairs expire, 0 for never.
+/// @return 0 if the pairs were written, 1 otherwise.
+int kvs_put_ttl(int fdRequestPipe, int fdResponsePipe, size_t num_pairs,
+				char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], unsigned int ttl_ms);
+
+/// Sets the TTL of several existing keys. Needs a PROTOCOL_EXPIRY session.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys to expire.
+/// @param ttl_ms Milliseconds until the keys expire, 0 to make them persistent.
+/// @param found Set to 1 for each key that exists, 0 if it was missing.
+/// @return 0 if the request was served, 1 otherwise.
+int kvs_expire(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+			   char keys[][MAX_STRING_SIZE], unsigned int ttl_ms, int found[]);
+
+/// Subscribes to several keys or patterns with one request.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys or patterns to subscribe.
+/// @param subscribed Set to 1 for each key or pattern subscribed, including
+/// keys that wait to be written, 0 if the subscription failed.
+/// @return 0 if the request was served, 1 otherwise.
+int kvs_subscribe_batch(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+						char keys[][MAX_STRING_SIZE], int subscribed[]);
+
+/// Removes several subscriptions with one request.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys or patterns to unsubscribe.
+/// @param removed Set to 1 for each subscription removed, 0 if it did not exist.
+/// @return 0 if the request was served, 1 otherwise.
+int kvs_unsubscribe_batch(int fdRequestPipe, int fdResponsePipe, size_t num_keys,
+						  char keys[][MAX_STRING_SIZE], int removed[]);
+
+/// A change returned by kvs_resume.
+typedef struct ResumeRecord {
+	uint64_t seq;
+	char key[MAX_STRING_SIZE];
+	char value[MAX_STRING_SIZE]; // "DELETE" for a delete, cut as in notifications
+} ResumeRecord;
+
+/// Asks for the changes missed after a sequence number, to the keys and
+/// patterns the session is subscribed to. Subscribe first, then call it
+/// again after *last while it answers RESUME_PARTIAL.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param after Sequence number of the last change seen.
+/// @param records Where to store the changes, at least RESUME_MAX_RECORDS.
+/// @param count Set to the number of changes stored.
+/// @param last Set to the last change the answer covers. On RESUME_EVICTED
+/// the changes were lost: read the keys again, then resume after *last.
+/// @param result Set to RESUME_COMPLETE, RESUME_PARTIAL or RESUME_EVICTED.
+/// @return 0 if the request was served, 1 otherwise.
+int kvs_resume(int fdRequestPipe, int fdResponsePipe, uint64_t after, ResumeRecord records[],
+			   size_t *count, uint64_t *last, char *result);
+
+/// Max size of a GET, PUT or DEL request frame with num_keys keys.
+#define BATCH_REQUEST_MAX_SIZE(num_keys) \
+	(BATCH_HEADER_SIZE + (num_keys) * 2 * (1 + BATCH_MAX_STRING_LENGTH))
+
+/// Encodes a GET, PUT or DEL request frame.
+/// @param frame Where to store the frame, at least
+/// BATCH_REQUEST_MAX_SIZE(num_keys) bytes.
+/// @param opcode OP Code of the request.
+/// @param num_keys Number of keys.
+/// @param keys Keys of the request.
+/// @param values Values of a PUT request, NULL otherwise.
+/// @return size of the frame
+size_t encode_batch_request(char *frame, char opcode, size_t num_keys,
+							char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]);
+
 #endif  // CLIENT_API_H
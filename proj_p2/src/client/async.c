@@ -0,0 +1,391 @@
+#include "async.h"
+#include "api.h"
+#include "src/common/io.h"
+#include "src/common/constants.h"
+#include "src/common/protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// Packets read from a socket per dispatch, so a flood of notifications
+// cannot hold back the completions
+#define ASYNC_MAX_PACKETS 64
+
+// What a ready fd of the epoll instance carries
+enum { SOURCE_SOCKET, SOURCE_RESPONSES, SOURCE_NOTIFICATIONS };
+
+/// @brief Adds an fd to the epoll instance of a session.
+/// @return 0 on success, 1 otherwise
+static int watch_fd(struct KvsAsync *async, int fd, uint32_t source) {
+	struct epoll_event event = {.events = EPOLLIN, .data.u32 = source};
+	if (epoll_ctl(async->fdEpoll, EPOLL_CTL_ADD, fd, &event)) {
+		perror("Failed to watch session");
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Closes the fds of a session and unlinks its pipes.
+static void close_session(struct KvsAsync *async) {
+	if (async->fdEpoll >= 0) close(async->fdEpoll);
+	async->fdEpoll = -1;
+	if (async->fdSocket >= 0) {
+		close(async->fdSocket);
+	} else {
+		terminate_pipes(async->fdRequest, async->reqPath, async->fdResponsePipe, async->respPath,
+						async->fdNotificationPipe, async->notifPath);
+	}
+	async->fdSocket = async->fdRequest = async->fdResponsePipe = async->fdNotificationPipe = -1;
+	free(async->notifBuffer);
+	async->notifBuffer = NULL;
+}
+
+/// @brief Prepares the pipeline and the epoll instance of a connected session.
+/// @return 0 on success, 1 otherwise
+static int init_session(struct KvsAsync *async, kvs_notification_callback notify, void *arg) {
+	kvs_pipeline_init(&async->pipeline, async->fdRequest, -1);
+	async->notify = notify;
+	async->notifyArg = arg;
+	async->notifLength = 0;
+	async->notifCapacity = ASYNC_NOTIFICATION_BUFFER_SIZE;
+	async->notifBuffer = malloc(async->notifCapacity);
+	if (async->notifBuffer == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+
+	async->fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+	if (async->fdEpoll < 0) {
+		perror("Failed to create epoll instance");
+		return 1;
+	}
+	if (async->fdSocket >= 0) return watch_fd(async, async->fdSocket, SOURCE_SOCKET);
+	return watch_fd(async, async->fdResponsePipe, SOURCE_RESPONSES) ||
+		   watch_fd(async, async->fdNotificationPipe, SOURCE_NOTIFICATIONS);
+}
+
+int kvs_async_connect(struct KvsAsync *async, const char *req_pipe_path,
+					  const char *resp_pipe_path, const char *server_pipe_path,
+					  const char *notif_pipe_path, kvs_notification_callback notify, void *arg) {
+	async->fdEpoll = -1;
+	async->fdSocket = -1;
+	async->notifBuffer = NULL;
+	if (strlen(req_pipe_path) > MAX_PIPE_PATH_LENGTH || strlen(resp_pipe_path) > MAX_PIPE_PATH_LENGTH ||
+		strlen(notif_pipe_path) > MAX_PIPE_PATH_LENGTH) {
+		fprintf(stderr, "Pipe path is too long.\n");
+		return 1;
+	}
+	strcpy(async->reqPath, req_pipe_path);
+	strcpy(async->respPath, resp_pipe_path);
+	strcpy(async->notifPath, notif_pipe_path);
+
+	int fdServerPipe;
+	if (kvs_connect(req_pipe_path, resp_pipe_path, server_pipe_path, notif_pipe_path,
+					&async->fdNotificationPipe, &async->fdRequest, &async->fdResponsePipe,
+					&fdServerPipe)) {
+		return 1;
+	}
+	async->protocol = kvs_session_protocol();
+	if (init_session(async, notify, arg)) {
+		close_session(async);
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Waits for a packet on a socket.
+/// @return size of the packet, -1 on error
+static ssize_t recv_packet(int fdSocket, char *packet, size_t size) {
+	ssize_t received;
+	do {
+		received = recv(fdSocket, packet, size, 0);
+	} while (received < 0 && errno == EINTR);
+	return received;
+}
+
+int kvs_async_connect_socket(struct KvsAsync *async, const char *server_socket_path,
+							 kvs_notification_callback notify, void *arg) {
+	async->fdEpoll = -1;
+	async->fdResponsePipe = async->fdNotificationPipe = -1;
+	async->notifBuffer = NULL;
+	async->reqPath[0] = async->respPath[0] = async->notifPath[0] = '\0';
+	async->fdSocket = connect_server_socket(server_socket_path);
+	if (async->fdSocket < 0) return 1;
+	async->fdRequest = async->fdSocket;
+
+	// Nothing else is sent before the server answers the connection, nor
+	// before it answers the protocol version
+	char packet[1 + CONNECT_COMPACT_RESPONSE_SIZE];
+	ssize_t size = recv_packet(async->fdSocket, packet, sizeof(packet));
+	if (size != 3 || packet[0] != MESSAGE_RESPONSE || packet[1] != OP_CODE_CONNECT ||
+		packet[2] != '0') {
+		fprintf(stderr, "Server refused the session.\n");
+		close_session(async);
+		return 1;
+	}
+
+	async->protocol = PROTOCOL_FIXED;
+	int sent = send_protocol_request(async->fdSocket);
+	if (sent > 0) {
+		size = recv_packet(async->fdSocket, packet, sizeof(packet));
+		if (size != sizeof(packet) || packet[0] != MESSAGE_RESPONSE ||
+			packet[1] != OP_CODE_CONNECT_COMPACT || packet[2] != '0') {
+			sent = -1;
+		} else {
+			async->protocol = packet[3];
+		}
+	}
+	if (sent < 0) {
+		fprintf(stderr, "Failed to negotiate the protocol version.\n");
+		close_session(async);
+		return 1;
+	}
+
+	if (init_session(async, notify, arg)) {
+		close_session(async);
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_async_fd(const struct KvsAsync *async) {
+	return async->fdEpoll;
+}
+
+int kvs_async_get(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+				  char values[][MAX_STRING_SIZE], int found[], kvs_completion_callback callback,
+				  void *arg, uint32_t *id) {
+	return kvs_pipeline_get(&async->pipeline, num_keys, keys, values, found, callback, arg, id);
+}
+
+int kvs_async_put(struct KvsAsync *async, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+				  char values[][MAX_STRING_SIZE], kvs_completion_callback callback, void *arg,
+				  uint32_t *id) {
+	return kvs_pipeline_put(&async->pipeline, num_pairs, keys, values, callback, arg, id);
+}
+
+int kvs_async_delete(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+					 int deleted[], kvs_completion_callback callback, void *arg, uint32_t *id) {
+	return kvs_pipeline_delete(&async->pipeline, num_keys, keys, deleted, callback, arg, id);
+}
+
+int kvs_async_subscribe(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+						int subscribed[], kvs_completion_callback callback, void *arg,
+						uint32_t *id) {
+	return kvs_pipeline_subscribe(&async->pipeline, num_keys, keys, subscribed, callback, arg, id);
+}
+
+int kvs_async_unsubscribe(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+						  int removed[], kvs_completion_callback callback, void *arg,
+						  uint32_t *id) {
+	return kvs_pipeline_unsubscribe(&async->pipeline, num_keys, keys, removed, callback, arg, id);
+}
+
+int kvs_async_flush(struct KvsAsync *async) {
+	return kvs_pipeline_flush(&async->pipeline);
+}
+
+/// @brief Hands the whole notifications read so far to the callback, in
+/// batches of at most ASYNC_MAX_NOTIFICATIONS, and keeps the partial one.
+/// @return 0 on success, -1 if a notification is malformed
+static int deliver_notifications(struct KvsAsync *async) {
+	size_t offset = 0, count = 0;
+	int status = 0;
+	while (status == 0) {
+		struct KvsNotification *entry = &async->batch[count];
+		size_t size;
+		status = decode_notification(async->notifBuffer + offset, async->notifLength - offset,
+									 async->protocol, entry->key, entry->value, &entry->wholeValue,
+									 &entry->valueLength, &entry->seq, &size);
+		if (status == 0) {
+			offset += size;
+			count++;
+		}
+		if (count > 0 && (status != 0 || count == ASYNC_MAX_NOTIFICATIONS)) {
+			if (async->notify != NULL) async->notify(async->batch, count, async->notifyArg);
+			count = 0;
+		}
+	}
+
+	memmove(async->notifBuffer, async->notifBuffer + offset, async->notifLength - offset);
+	async->notifLength -= offset;
+	if (status < 0) {
+		fprintf(stderr, "Malformed notification from server.\n");
+		return -1;
+	}
+
+	// Give back the room taken by a large value once it was handed over
+	if (async->notifCapacity > ASYNC_NOTIFICATION_BUFFER_SIZE &&
+		async->notifLength <= ASYNC_NOTIFICATION_BUFFER_SIZE) {
+		char *buffer = realloc(async->notifBuffer, ASYNC_NOTIFICATION_BUFFER_SIZE);
+		if (buffer != NULL) {
+			async->notifBuffer = buffer;
+			async->notifCapacity = ASYNC_NOTIFICATION_BUFFER_SIZE;
+		}
+	}
+	return 0;
+}
+
+/// @brief Makes room for more notification bytes, handing over the whole
+/// notifications, or growing the buffer when a single one fills it.
+/// @return 0 on success, -1 on error or if a notification is malformed
+static int make_notification_room(struct KvsAsync *async) {
+	if (async->notifLength < async->notifCapacity) return 0;
+	if (deliver_notifications(async)) return -1;
+	if (async->notifLength < async->notifCapacity) return 0;
+
+	char *buffer = realloc(async->notifBuffer, 2 * async->notifCapacity);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return -1;
+	}
+	async->notifBuffer = buffer;
+	async->notifCapacity *= 2;
+	return 0;
+}
+
+/// @brief Buffers notification bytes, handing them over whenever the
+/// buffer fills up.
+/// @return 0 on success, -1 on error or if a notification is malformed
+static int add_notification_bytes(struct KvsAsync *async, const char *bytes, size_t length) {
+	while (length > 0) {
+		if (make_notification_room(async)) return -1;
+		size_t chunk = async->notifCapacity - async->notifLength;
+		if (chunk > length) chunk = length;
+		memcpy(async->notifBuffer + async->notifLength, bytes, chunk);
+		async->notifLength += chunk;
+		bytes += chunk;
+		length -= chunk;
+	}
+	return 0;
+}
+
+/// @brief Reads the packets waiting on a session socket, without blocking.
+/// @param wait Whether to block for the first packet.
+/// @param response Where to copy the payload of the first response packet
+/// instead of delivering it to the pipeline, NULL to deliver every response.
+/// @return 1 if a response was copied, 0 otherwise, -1 on error or if the
+/// server closed the session
+static int receive_packets(struct KvsAsync *async, int wait, char response[2]) {
+	char packet[MAX_MESSAGE_SIZE];
+	for (int i = 0; i < ASYNC_MAX_PACKETS; i++) {
+		ssize_t size = recv(async->fdSocket, packet, sizeof(packet), wait ? 0 : MSG_DONTWAIT);
+		if (size < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			perror("Failed to read session socket");
+			return -1;
+		}
+		if (size == 0) {
+			fprintf(stderr, "Server closed the session.\n");
+			return -1;
+		}
+		wait = 0;
+
+		if (packet[0] == MESSAGE_NOTIFICATION) {
+			if (add_notification_bytes(async, packet + 1, (size_t) size - 1)) return -1;
+		} else if (response != NULL && size >= 3) {
+			memcpy(response, packet + 1, 2);
+			return 1;
+		} else if (kvs_pipeline_deliver(&async->pipeline, packet + 1, (size_t) size - 1)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/// @brief Reads what a ready pipe holds.
+/// @param fd
+/// @param buffer
+/// @param size Room in the buffer.
+/// @return number of bytes read, 0 if interrupted, -1 on error or if the
+/// server closed the session
+static ssize_t read_pipe(int fd, char *buffer, size_t size) {
+	ssize_t bytesRead = read(fd, buffer, size);
+	if (bytesRead < 0 && errno == EINTR) return 0;
+	if (bytesRead < 0) perror("Failed to read session pipe");
+	if (bytesRead == 0) {
+		fprintf(stderr, "Server closed the session.\n");
+		return -1;
+	}
+	return bytesRead;
+}
+
+/// @brief Handles a ready fd of the session.
+/// @return 0 on success, -1 on error or if the server closed the session
+static int handle_source(struct KvsAsync *async, uint32_t source) {
+	if (source == SOURCE_SOCKET) return receive_packets(async, 0, NULL) < 0 ? -1 : 0;
+
+	if (source == SOURCE_RESPONSES) {
+		// Responses never exceed those of the requests in flight
+		char bytes[PIPELINE_MAX_BYTES];
+		ssize_t bytesRead = read_pipe(async->fdResponsePipe, bytes,
+									  PIPELINE_MAX_BYTES - async->pipeline.inLength);
+		if (bytesRead < 0) return -1;
+		return kvs_pipeline_deliver(&async->pipeline, bytes, (size_t) bytesRead) ? -1 : 0;
+	}
+
+	if (make_notification_room(async)) return -1;
+	ssize_t bytesRead = read_pipe(async->fdNotificationPipe,
+								  async->notifBuffer + async->notifLength,
+								  async->notifCapacity - async->notifLength);
+	if (bytesRead < 0) return -1;
+	async->notifLength += (size_t) bytesRead;
+	return 0;
+}
+
+int kvs_async_dispatch(struct KvsAsync *async, int timeout_ms) {
+	if (kvs_pipeline_flush(&async->pipeline)) return -1;
+
+	struct epoll_event events[2];
+	int ready = epoll_wait(async->fdEpoll, events, 2, timeout_ms);
+	if (ready < 0) {
+		if (errno == EINTR) return 0;
+		perror("Failed to wait for the session");
+		return -1;
+	}
+
+	int error = 0;
+	for (int i = 0; i < ready && !error; i++) {
+		error = handle_source(async, events[i].data.u32);
+	}
+	if (deliver_notifications(async) || error) return -1;
+	return kvs_pipeline_complete(&async->pipeline, NULL, PIPELINE_MAX_DEPTH, 0);
+}
+
+int kvs_async_disconnect(struct KvsAsync *async) {
+	int error = 0;
+	// The callbacks of the requests in flight still run
+	while (async->pipeline.inFlight > 0 && !error) {
+		error = kvs_async_dispatch(async, -1) < 0;
+	}
+
+	const char opcode = OP_CODE_DISCONNECT;
+	if (!error && write_all(async->fdRequest, &opcode, 1) == -1) {
+		fprintf(stderr, "Error writing disconnect OP Code on the server pipe\n");
+		error = 1;
+	}
+
+	char response[2] = {0, '1'};
+	if (!error && async->fdSocket >= 0) {
+		// Notifications sent before the disconnect are still handed over
+		int status = 0;
+		while (status == 0) status = receive_packets(async, 1, response);
+		error = deliver_notifications(async) || status < 0;
+	} else if (!error) {
+		int readingError = 0;
+		error = read_all(async->fdResponsePipe, response, sizeof(response), &readingError) <= 0;
+	}
+	if (!error && (response[0] != OP_CODE_DISCONNECT || response[1] != '0')) {
+		fprintf(stderr, "Failed to read disconnect response from server.\n");
+		error = 1;
+	}
+
+	close_session(async);
+	return error;
+}
@@ -0,0 +1,128 @@
+#ifndef CLIENT_ASYNC_H
+#define CLIENT_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipeline.h"
+#include "src/common/constants.h"
+#include "src/common/protocol.h"
+
+#define ASYNC_MAX_NOTIFICATIONS 256 // max notifications per callback
+// Notification bytes buffered, grown while a large value does not fit
+#define ASYNC_NOTIFICATION_BUFFER_SIZE (ASYNC_MAX_NOTIFICATIONS * NOTIFICATION_SIZE)
+
+struct KvsNotification {
+	uint64_t seq;
+	char key[MAX_STRING_SIZE];
+	char value[MAX_STRING_SIZE]; // "DELETE" for a delete, cut to MAX_STRING_SIZE - 1 bytes
+	const char *wholeValue;      // not null terminated, valid during the callback
+	size_t valueLength;          // bytes in wholeValue
+};
+
+/// Called with the notifications read in one wakeup, oldest first. One with
+/// an empty key marks notifications the server dropped, see
+/// PROTOCOL_GAP_MARKERS.
+typedef void (*kvs_notification_callback)(const struct KvsNotification notifications[],
+										  size_t count, void *arg);
+
+/// A session driven by one event loop instead of a thread per connection.
+/// Requests are submitted without blocking and complete through their
+/// callbacks; notifications are handed over in batches. Every call must
+/// come from the thread running the loop. Shared rings are not supported.
+struct KvsAsync {
+	struct KvsPipeline pipeline; // reads no responses itself, they are delivered
+	int fdEpoll;
+	int fdRequest;
+	int fdSocket;             // session socket, -1 on pipes
+	int fdResponsePipe;       // -1 on a socket
+	int fdNotificationPipe;   // -1 on a socket
+	int protocol;             // version the server agreed to
+	char reqPath[MAX_PIPE_PATH_LENGTH + 1];
+	char respPath[MAX_PIPE_PATH_LENGTH + 1];
+	char notifPath[MAX_PIPE_PATH_LENGTH + 1];
+	kvs_notification_callback notify;
+	void *notifyArg;
+	size_t notifLength; // notification bytes read, the last one may be partial
+	size_t notifCapacity;
+	char *notifBuffer;
+	struct KvsNotification batch[ASYNC_MAX_NOTIFICATIONS];
+};
+
+/// Connects through named pipes, as kvs_connect does.
+/// @param async Session to initialize.
+/// @param req_pipe_path Path to the name pipe to be created for requests.
+/// @param resp_pipe_path Path to the name pipe to be created for responses.
+/// @param server_pipe_path Path to the name pipe where the server is listening.
+/// @param notif_pipe_path Path to the name pipe for notifications.
+/// @param notify Called with the notifications, may be NULL.
+/// @param arg Passed to notify.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int kvs_async_connect(struct KvsAsync *async, const char *req_pipe_path,
+					  const char *resp_pipe_path, const char *server_pipe_path,
+					  const char *notif_pipe_path, kvs_notification_callback notify, void *arg);
+
+/// Connects through the server socket. Unlike kvs_connect_socket, no thread
+/// is started: the event loop reads the socket itself. Both connects ask for
+/// the version chosen with kvs_request_protocol.
+/// @param async Session to initialize.
+/// @param server_socket_path Path to the socket where the server is listening.
+/// @param notify Called with the notifications, may be NULL.
+/// @param arg Passed to notify.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+int kvs_async_connect_socket(struct KvsAsync *async, const char *server_socket_path,
+							 kvs_notification_callback notify, void *arg);
+
+/// Gets the fd to wait on from another event loop. It is readable when
+/// kvs_async_dispatch has responses or notifications to handle.
+/// @param async
+/// @return the fd
+int kvs_async_fd(const struct KvsAsync *async);
+
+/// Submits a GET request, as kvs_pipeline_get.
+int kvs_async_get(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+				  char values[][MAX_STRING_SIZE], int found[], kvs_completion_callback callback,
+				  void *arg, uint32_t *id);
+
+/// Submits a PUT request, as kvs_pipeline_put.
+int kvs_async_put(struct KvsAsync *async, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+				  char values[][MAX_STRING_SIZE], kvs_completion_callback callback, void *arg,
+				  uint32_t *id);
+
+/// Submits a DEL request, as kvs_pipeline_delete.
+int kvs_async_delete(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+					 int deleted[], kvs_completion_callback callback, void *arg, uint32_t *id);
+
+/// Submits a SUBSCRIBE_BATCH request, as kvs_pipeline_subscribe.
+int kvs_async_subscribe(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+						int subscribed[], kvs_completion_callback callback, void *arg,
+						uint32_t *id);
+
+/// Submits an UNSUBSCRIBE_BATCH request, as kvs_pipeline_unsubscribe.
+int kvs_async_unsubscribe(struct KvsAsync *async, size_t num_keys, char keys[][MAX_STRING_SIZE],
+						  int removed[], kvs_completion_callback callback, void *arg,
+						  uint32_t *id);
+
+/// Writes the submitted requests to the server. Needed only when the loop
+/// waits on kvs_async_fd, kvs_async_dispatch flushes first.
+/// @param async
+/// @return 0 on success, 1 on error
+int kvs_async_flush(struct KvsAsync *async);
+
+/// Writes the submitted requests, waits for responses or notifications and
+/// handles all that arrived: completed requests get their callbacks, and
+/// notifications are handed to the notification callback in batches.
+/// @param async
+/// @param timeout_ms Longest wait, 0 to only handle what is ready, -1 for
+/// no limit.
+/// @return number of requests completed, -1 on error or if the server
+/// closed the session
+int kvs_async_dispatch(struct KvsAsync *async, int timeout_ms);
+
+/// Completes the requests in flight, then disconnects and releases the
+/// session.
+/// @param async
+/// @return 0 if successful, 1 otherwise
+int kvs_async_disconnect(struct KvsAsync *async);
+
+#endif  // CLIENT_ASYNC_H
@@ -6,6 +6,10 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 
 #include "parser.h"
@@ -14,6 +18,8 @@
 #include "src/common/io.h"
 
 int serverDisconnected = 0; // flag to indicate if the server disconnected
+volatile int disconnectRequested = 0; // flag to indicate if the client asked to disconnect
+atomic_uint_fast64_t lastSeq = 0; // last change seen, to resume from after reconnecting
 
 struct thread_args {
 	int fdNotificationPipe;
@@ -25,6 +31,13 @@ struct thread_args {
 };
 
 
+/// Remembers a change as seen, unless a later one was seen already.
+/// @param seq Sequence number of the change.
+static void seen_change(uint64_t seq) {
+	uint_fast64_t last = atomic_load(&lastSeq);
+	while (seq > last && !atomic_compare_exchange_weak(&lastSeq, &last, seq));
+}
+
 void *process_notif_thread(void *arg) {
 	struct thread_args *args = (struct thread_args *) arg;
 	int *fdNotificationPipe = &args->fdNotificationPipe;
@@ -37,11 +50,18 @@ void *process_notif_thread(void *arg) {
 	int readError = 0;
 	int status = 0;
 
-	char key[KEY_MESSAGE_SIZE];
-	char value[KEY_MESSAGE_SIZE];
+	char key[MAX_STRING_SIZE];
+	char *value;
+	size_t length;
+	uint64_t seq;
 	while (1) {
-		// read key from notifications pipe
-		status = read_all(*fdNotificationPipe, key, KEY_MESSAGE_SIZE, &readError);
+		// read the key, the whole value and the sequence number of the change
+		status = kvs_read_notification_value(*fdNotificationPipe, key, &value, &length, &seq,
+											 &readError);
+		if (status == PIPES_CLOSED && disconnectRequested) {
+			// the main thread is still reading the disconnect response
+			pthread_exit(NULL);
+		}
 		if (status == PIPES_CLOSED) {
 			serverDisconnected = 1;
 			terminate_pipes(*fdRequestPipe, req_pipe_path, *fdResponsePipe,
@@ -49,38 +69,118 @@ void *process_notif_thread(void *arg) {
 			pthread_exit(NULL);
 		}
 		if (status == -1 || readError == 1) {
-			fprintf(stderr, "Failed to read key from notifications pipe.\n");
+			if (status == 1) free(value);
+			fprintf(stderr, "Failed to read notification from notifications pipe.\n");
+			continue;
+		}
+		if (key[0] == '\0') {
+			// the server dropped notifications, the marker carries no change
+			kvs_cache_apply(key, value, length, seq);
+			fprintf(stdout, "Some notifications were lost, read the keys again\n");
+			free(value);
+			continue;
 		}
+		seen_change(seq);
 
-		// read value from notifications pipe
-		status = read_all(*fdNotificationPipe, value, KEY_MESSAGE_SIZE, &readError);
-		if (status == PIPES_CLOSED) {
-			serverDisconnected = 1;
-			terminate_pipes(*fdRequestPipe, req_pipe_path, *fdResponsePipe,
-							 resp_pipe_path, *fdNotificationPipe, notif_pipe_path);
-			pthread_exit(NULL);
+		// print key and value, unless only the cache subscribed the key
+		if (kvs_cache_apply(key, value, length, seq)) {
+			fprintf(stdout, "(%s,%.*s)\n", key, (int) length, value);
 		}
-		if (status == -1 || readError == 1) {
-			fprintf(stderr, "Failed to read key from notifications pipe.\n");
+		free(value);
+	}
+}
+
+/// Prints the changes missed after a sequence number, as notifications are
+/// printed, asking for one page after another.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param after Sequence number of the last change seen.
+/// @return 0 if the changes were printed, 1 otherwise.
+static int resume(int fdRequestPipe, int fdResponsePipe, uint64_t after) {
+	ResumeRecord records[RESUME_MAX_RECORDS];
+	size_t count;
+	char result = RESUME_PARTIAL;
+	while (result == RESUME_PARTIAL) {
+		if (kvs_resume(fdRequestPipe, fdResponsePipe, after, records, &count, &after, &result)) {
+			return 1;
 		}
+		for (size_t i = 0; i < count; i++) {
+			fprintf(stdout, "(%s,%s)\n", records[i].key, records[i].value);
+		}
+		seen_change(after);
+	}
+	if (result == RESUME_EVICTED) {
+		fprintf(stdout, "Missed changes are no longer kept, read the keys again\n");
+	}
+	return 0;
+}
 
-		// print key and value
-		fprintf(stdout, "(%s,%s)\n", key, value);
+/// Prints the keys a batch request failed for, as (key,KVSMISSING).
+/// @param num Number of keys.
+/// @param keys Keys of the request.
+/// @param results Result of each key, 0 if it failed.
+static void print_missing(size_t num, char keys[][MAX_STRING_SIZE], const int results[]) {
+	int missing = 0;
+	for (size_t i = 0; i < num; i++) {
+		if (results[i]) continue;
+		printf("%s(%s,KVSMISSING)", missing ? "" : "[", keys[i]);
+		missing = 1;
+	}
+	if (missing) printf("]\n");
+}
+
+/// Reads whole the values that GET cut.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+/// @param num Number of keys.
+/// @param keys Keys of the GET.
+/// @param found Found flags of the GET, set to 0 for keys deleted since.
+/// @param whole Set to each whole value, which the caller must free, NULL
+/// for the values GET did not cut or that could not be read.
+/// @param lengths Set to the bytes in each whole value.
+static void read_whole_values(int fdRequestPipe, int fdResponsePipe, size_t num,
+							  char keys[][MAX_STRING_SIZE], int found[], char *whole[],
+							  size_t lengths[]) {
+	for (size_t i = 0; i < num; i++) {
+		whole[i] = NULL;
+		if (found[i] != BATCH_VALUE_TRUNCATED) continue;
+		// The start GET answered is printed if the rest cannot be read
+		if (kvs_get_value(fdRequestPipe, fdResponsePipe, keys[i], &whole[i], &lengths[i],
+						  &found[i])) {
+			fprintf(stderr, "Failed to read the whole value of %s\n", keys[i]);
+			found[i] = 1;
+		}
 	}
 }
 
 int main(int argc, char *argv[]) {
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s <client_unique_id> <register_pipe_path>\n", argv[0]);
+	if (argc < 3 || argc > 4) {
+		fprintf(stderr, "Usage: %s <client_unique_id> <register_pipe_path | server_socket_path> "
+				"[cache_entries]\n", argv[0]);
 		return 1;
 	}
+	if (argc == 4) {
+		char *end;
+		errno = 0;
+		unsigned long cacheEntries = strtoul(argv[3], &end, 10);
+		if (errno || *end != '\0' || argv[3][0] == '-') {
+			fprintf(stderr, "Invalid cache size\n");
+			return 1;
+		}
+		if (kvs_cache_init(cacheEntries)) return 1;
+	}
 
 	char req_pipe_path[256] = "/tmp/req";
 	char resp_pipe_path[256] = "/tmp/resp";
 	char notif_pipe_path[256] = "/tmp/notif";
 
-	char keys[MAX_NUMBER_SUB][MAX_STRING_SIZE] = {0};
+	char batchKeys[MAX_BATCH_KEYS][MAX_STRING_SIZE] = {0};
+	char batchValues[MAX_BATCH_KEYS][MAX_STRING_SIZE] = {0};
+	int batchResults[MAX_BATCH_KEYS];
+	char *wholeValues[MAX_BATCH_KEYS];
+	size_t wholeLengths[MAX_BATCH_KEYS];
 	unsigned int delay_ms;
+	unsigned int ttl_ms;
 	size_t num;
 
     memcpy(req_pipe_path + strlen(req_pipe_path), argv[1], strlen(argv[1]));
@@ -98,12 +198,19 @@ int main(int argc, char *argv[]) {
 	int fdResponsePipe;
 	int fdServerPipe;
 
-	if (kvs_connect(req_pipe_path, resp_pipe_path, server_pipe_path, notif_pipe_path,
-					&fdNotificationPipe, &fdRequestPipe, &fdResponsePipe,
-					&fdServerPipe) != 0) {
-		if(close(fdServerPipe)){
-			fprintf(stderr, "Failed to close server pipe\n");
-		}
+	int connectError;
+	struct stat serverPath;
+	if (stat(server_pipe_path, &serverPath) == 0 && S_ISSOCK(serverPath.st_mode)) {
+		// A socket session has no pipes to unlink
+		req_pipe_path[0] = resp_pipe_path[0] = notif_pipe_path[0] = '\0';
+		connectError = kvs_connect_socket(server_pipe_path, &fdNotificationPipe,
+										  &fdRequestPipe, &fdResponsePipe);
+	} else {
+		connectError = kvs_connect(req_pipe_path, resp_pipe_path, server_pipe_path,
+								   notif_pipe_path, &fdNotificationPipe, &fdRequestPipe,
+								   &fdResponsePipe, &fdServerPipe);
+	}
+	if (connectError) {
 		fprintf(stderr, "Failed to connect to the server\n");
 		return 1;
 	}
@@ -120,35 +227,130 @@ int main(int argc, char *argv[]) {
 	while (!serverDisconnected) {
 		switch (get_next(STDIN_FILENO)) {
 			case CMD_DISCONNECT:
+				disconnectRequested = 1;
 				if (kvs_disconnect(fdRequestPipe, fdResponsePipe, notificationsThread)) {
 					fprintf(stderr, "Failed to disconnect to the server\n");
 					return 1;
 				}
+				terminate_pipes(fdRequestPipe, req_pipe_path, fdResponsePipe, resp_pipe_path,
+								fdNotificationPipe, notif_pipe_path);
 				return 0;
 
 			case CMD_SUBSCRIBE:
-				num = parse_list(STDIN_FILENO, keys, 1, MAX_STRING_SIZE);
+				num = parse_list(STDIN_FILENO, batchKeys, MAX_BATCH_KEYS, MAX_STRING_SIZE - 1);
 				if (num == 0) {
 					fprintf(stderr, "Invalid command. See HELP for usage\n");
 					continue;
 				}
 				
-				if (!kvs_subscribe(fdRequestPipe, fdResponsePipe, keys[0])) {
+				if (num == 1) {
+					if (!kvs_subscribe(fdRequestPipe, fdResponsePipe, batchKeys[0])) {
+						fprintf(stderr, "Command subscribe failed\n");
+					}
+					break;
+				}
+				// Several keys are subscribed with a single request
+				if (kvs_subscribe_batch(fdRequestPipe, fdResponsePipe, num, batchKeys,
+										batchResults)) {
 					fprintf(stderr, "Command subscribe failed\n");
+					break;
 				}
+				print_missing(num, batchKeys, batchResults);
 				break;
 
 			case CMD_UNSUBSCRIBE:
-				num = parse_list(STDIN_FILENO, keys, 1, MAX_STRING_SIZE);
+				num = parse_list(STDIN_FILENO, batchKeys, MAX_BATCH_KEYS, MAX_STRING_SIZE - 1);
 				if (num == 0) {
 					fprintf(stderr, "Invalid command. See HELP for usage\n");
 					continue;
 				}
 
-				if (kvs_unsubscribe(fdRequestPipe, fdResponsePipe, keys[0])) {
-					fprintf(stderr, "Command subscribe failed\n");
+				if (num == 1) {
+					if (kvs_unsubscribe(fdRequestPipe, fdResponsePipe, batchKeys[0])) {
+						fprintf(stderr, "Command subscribe failed\n");
+					}
+					break;
+				}
+				if (kvs_unsubscribe_batch(fdRequestPipe, fdResponsePipe, num, batchKeys,
+										  batchResults)) {
+					fprintf(stderr, "Command unsubscribe failed\n");
+					break;
+				}
+				print_missing(num, batchKeys, batchResults);
+				break;
+
+			case CMD_GET:
+				num = parse_list(STDIN_FILENO, batchKeys, MAX_BATCH_KEYS, MAX_STRING_SIZE - 1);
+				if (num == 0) {
+					fprintf(stderr, "Invalid command. See HELP for usage\n");
+					continue;
 				}
 
+				if (kvs_get(fdRequestPipe, fdResponsePipe, num, batchKeys, batchValues,
+							batchResults)) {
+					fprintf(stderr, "Command get failed\n");
+					break;
+				}
+				read_whole_values(fdRequestPipe, fdResponsePipe, num, batchKeys, batchResults,
+								  wholeValues, wholeLengths);
+				printf("[");
+				for (size_t i = 0; i < num; i++) {
+					if (wholeValues[i] != NULL) {
+						printf("(%s,%.*s)", batchKeys[i], (int) wholeLengths[i], wholeValues[i]);
+						free(wholeValues[i]);
+						continue;
+					}
+					printf("(%s,%s)", batchKeys[i], batchResults[i] ? batchValues[i] : "KVSERROR");
+				}
+				printf("]\n");
+				break;
+
+			case CMD_PUT:
+				num = parse_pairs(STDIN_FILENO, batchKeys, batchValues, MAX_BATCH_KEYS,
+								  MAX_STRING_SIZE, &ttl_ms);
+				if (num == 0) {
+					fprintf(stderr, "Invalid command. See HELP for usage\n");
+					continue;
+				}
+
+				// Without a TTL older servers are still served
+				if (ttl_ms == 0) {
+					if (kvs_put(fdRequestPipe, fdResponsePipe, num, batchKeys, batchValues)) {
+						fprintf(stderr, "Command put failed\n");
+					}
+				} else if (kvs_put_ttl(fdRequestPipe, fdResponsePipe, num, batchKeys, batchValues,
+									   ttl_ms)) {
+					fprintf(stderr, "Command put failed\n");
+				}
+				break;
+
+			case CMD_DEL:
+				num = parse_list(STDIN_FILENO, batchKeys, MAX_BATCH_KEYS, MAX_STRING_SIZE - 1);
+				if (num == 0) {
+					fprintf(stderr, "Invalid command. See HELP for usage\n");
+					continue;
+				}
+
+				if (kvs_delete(fdRequestPipe, fdResponsePipe, num, batchKeys, batchResults)) {
+					fprintf(stderr, "Command delete failed\n");
+					break;
+				}
+				print_missing(num, batchKeys, batchResults);
+				break;
+
+			case CMD_EXPIRE:
+				num = parse_expire(STDIN_FILENO, batchKeys, MAX_BATCH_KEYS, MAX_STRING_SIZE - 1,
+								   &ttl_ms);
+				if (num == 0) {
+					fprintf(stderr, "Invalid command. See HELP for usage\n");
+					continue;
+				}
+
+				if (kvs_expire(fdRequestPipe, fdResponsePipe, num, batchKeys, ttl_ms, batchResults)) {
+					fprintf(stderr, "Command expire failed\n");
+					break;
+				}
+				print_missing(num, batchKeys, batchResults);
 				break;
 
 			case CMD_DELAY:
@@ -163,6 +365,19 @@ int main(int argc, char *argv[]) {
 				}
 				break;
 
+			case CMD_RESUME: {
+				uint64_t after;
+				if (parse_resume(STDIN_FILENO, &after) == -1) {
+					fprintf(stderr, "Invalid command. See HELP for usage\n");
+					continue;
+				}
+
+				if (resume(fdRequestPipe, fdResponsePipe, after)) {
+					fprintf(stderr, "Command resume failed\n");
+				}
+				break;
+			}
+
 			case CMD_INVALID:
 				fprintf(stderr, "Invalid command. See HELP for usage\n");
 				break;
@@ -171,13 +386,18 @@ int main(int argc, char *argv[]) {
 				break;
 
 			case EOC:
+				disconnectRequested = 1;
 				if(kvs_disconnect(fdRequestPipe, fdResponsePipe, notificationsThread)) {
 					fprintf(stderr, "Failed to disconnect from server.\n");
+					return 1;
 				}
-				break;
+				terminate_pipes(fdRequestPipe, req_pipe_path, fdResponsePipe, resp_pipe_path,
+								fdNotificationPipe, notif_pipe_path);
+				return 0;
 		}
 	}
 	fprintf(stdout, "Client was disconnected by the server. \n");
+	fprintf(stdout, "Last change seen: %" PRIu64 "\n", (uint64_t) atomic_load(&lastSeq));
 	if(pthread_join(notificationsThread, NULL)){
 		fprintf(stderr, "Failed to join notification thread\n");
 	}
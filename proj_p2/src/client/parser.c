@@ -1,5 +1,6 @@
 #include "parser.h"
 
+#include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
@@ -116,19 +117,64 @@ enum Command get_next(int fd) {
 			return CMD_UNSUBSCRIBE;
 
 		case 'D':
-			if (read(fd, buf + 1, 5) != 5 || strncmp(buf, "DELAY ", 6) != 0) {
-				if (read(fd, buf + 6, 4) != 4 || strncmp(buf, "DISCONNECT", 10) != 0) {
-					cleanup(fd);
-					return CMD_INVALID;
-				}
-				if (read(fd, buf + 10, 1) != 0 && buf[10] != '\n') {
+			if (read(fd, buf + 1, 3) != 3) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			if (strncmp(buf, "DEL ", 4) == 0) {
+				return CMD_DEL;
+			}
+
+			if (strncmp(buf, "DELA", 4) == 0) {
+				if (read(fd, buf + 4, 2) != 2 || strncmp(buf, "DELAY ", 6) != 0) {
 					cleanup(fd);
 					return CMD_INVALID;
 				}
-				return CMD_DISCONNECT;
+				return CMD_DELAY;
 			}
 
-			return CMD_DELAY;
+			if (read(fd, buf + 4, 6) != 6 || strncmp(buf, "DISCONNECT", 10) != 0) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+			if (read(fd, buf + 10, 1) != 0 && buf[10] != '\n') {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+			return CMD_DISCONNECT;
+
+		case 'G':
+			if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "GET ", 4) != 0) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			return CMD_GET;
+
+		case 'E':
+			if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "EXPIRE ", 7) != 0) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			return CMD_EXPIRE;
+
+		case 'P':
+			if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "PUT ", 4) != 0) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			return CMD_PUT;
+
+		case 'R':
+			if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "RESUME ", 7) != 0) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			return CMD_RESUME;
 
 		case '#':
 			cleanup(fd);
@@ -143,7 +189,15 @@ enum Command get_next(int fd) {
 	}
 }
 
-size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size) {
+/// Parses a list of keys, up to the ']' that ends it.
+/// @param fd File descriptor to read from.
+/// @param keys Array to store the keys
+/// @param max_keys Maximum number of keys it will read.
+/// @param max_string_size Maximum string size allowed.
+/// @return 0 if the list was not parsed successfully, otherwise the number
+///          of keys parsed
+static size_t parse_keys(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
+						 size_t max_string_size) {
 	char ch;
 
 	if (read(fd, &ch, 1) != 1 || ch != '[') {
@@ -173,6 +227,17 @@ size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t
 		return 0;
 	}
 
+	return num_keys;
+}
+
+size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size) {
+	char ch;
+
+	size_t num_keys = parse_keys(fd, keys, max_keys, max_string_size);
+	if (num_keys == 0) {
+		return 0;
+	}
+
 	if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
 		cleanup(fd);
 		return 0;
@@ -181,6 +246,90 @@ size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t
 	return num_keys;
 }
 
+size_t parse_expire(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size,
+					unsigned int *ttl_ms) {
+	char ch;
+
+	size_t num_keys = parse_keys(fd, keys, max_keys, max_string_size);
+	if (num_keys == 0) {
+		return 0;
+	}
+
+	if (read(fd, &ch, 1) != 1 || ch != ' ') {
+		cleanup(fd);
+		return 0;
+	}
+
+	if (read_uint(fd, ttl_ms, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+		cleanup(fd);
+		return 0;
+	}
+
+	return num_keys;
+}
+
+size_t parse_pairs(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+				   size_t max_pairs, size_t max_string_size, unsigned int *ttl_ms) {
+	char ch;
+	*ttl_ms = 0;
+
+	if (read(fd, &ch, 1) != 1 || ch != '[') {
+		cleanup(fd);
+		return 0;
+	}
+
+	if (read(fd, &ch, 1) != 1 || ch != '(') {
+		cleanup(fd);
+		return 0;
+	}
+
+	size_t num_pairs = 0;
+	char key[max_string_size];
+	char value[max_string_size];
+	while (num_pairs < max_pairs) {
+		if (read_string(fd, key, max_string_size - 1) != 0 ||
+			read_string(fd, value, max_string_size - 1) != 1) {
+			cleanup(fd);
+			return 0;
+		}
+
+		strcpy(keys[num_pairs], key);
+		strcpy(values[num_pairs++], value);
+
+		if (read(fd, &ch, 1) != 1 || (ch != '(' && ch != ']')) {
+			cleanup(fd);
+			return 0;
+		}
+
+		if (ch == ']') {
+			break;
+		}
+	}
+
+	if (num_pairs == max_pairs && ch != ']') {
+		cleanup(fd);
+		return 0;
+	}
+
+	if (read(fd, &ch, 1) != 1) {
+		cleanup(fd);
+		return 0;
+	}
+
+	// The pairs may be given a TTL
+	if (ch == ' ' && read_uint(fd, ttl_ms, &ch) != 0) {
+		cleanup(fd);
+		return 0;
+	}
+
+	if (ch != '\n' && ch != '\0') {
+		cleanup(fd);
+		return 0;
+	}
+
+	return num_pairs;
+}
+
 int parse_delay(int fd, unsigned int *delay) {
 	char ch;
 
@@ -192,6 +341,27 @@ int parse_delay(int fd, unsigned int *delay) {
 	return 0;
 }
 
+int parse_resume(int fd, uint64_t *seq) {
+	char buf[24];
+	size_t i = 0;
+	char ch = '\0';
+	while (read(fd, &ch, 1) == 1 && ch >= '0' && ch <= '9' && i < sizeof(buf) - 1) {
+		buf[i++] = ch;
+	}
+	buf[i] = '\0';
+
+	// The number ends the line
+	if (ch != '\n') {
+		cleanup(fd);
+		return -1;
+	}
+	if (i == 0) return -1;
+
+	errno = 0;
+	*seq = strtoull(buf, NULL, 10);
+	return errno ? -1 : 0;
+}
+
 /// @brief fills a buffer with the contents of a string,
 /// and fills the rest with nulls
 /// @param dest destination buffer
@@ -2,6 +2,7 @@
 #define KVS_PARSER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "src/common/constants.h"
 
@@ -9,7 +10,12 @@ enum Command {
 	CMD_DISCONNECT,
 	CMD_SUBSCRIBE,
 	CMD_UNSUBSCRIBE,
+	CMD_GET,
+	CMD_PUT,
+	CMD_DEL,
 	CMD_DELAY,
+	CMD_RESUME,
+	CMD_EXPIRE,
 	CMD_EMPTY,
 	CMD_INVALID,
 	EOC  // End of commands
@@ -30,6 +36,30 @@ enum Command get_next(int fd);
 ///          of keys parsed
 size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size);
 
+/// Parses a list of key value pairs, as in PUT [(key,value)(key2,value2)],
+/// optionally followed by a TTL in milliseconds, as in PUT [(key,value)] 500
+/// @param fd File descriptor to read from.
+/// @param keys Array to store the keys
+/// @param values Array to store the values
+/// @param max_pairs Maximum number of pairs it will parse.
+/// @param max_string_size Maximum string size allowed.
+/// @param ttl_ms Pointer to the variable to store the TTL in, 0 if none was given.
+/// @return 0 if the command was not parsed successfully, otherwise return the
+///          number of pairs parsed
+size_t parse_pairs(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+				   size_t max_pairs, size_t max_string_size, unsigned int *ttl_ms);
+
+/// Parses an EXPIRE command, as in EXPIRE [key,key2] 500
+/// @param fd File descriptor to read from.
+/// @param keys Array to store the keys
+/// @param max_keys Maximum number of keys it will parse.
+/// @param max_string_size Maximum string size allowed.
+/// @param ttl_ms Pointer to the variable to store the TTL in.
+/// @return 0 if the command was not parsed successfully, otherwise return the
+///          number of keys parsed
+size_t parse_expire(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size,
+					unsigned int *ttl_ms);
+
 /// Parses a DELAY command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
@@ -37,6 +67,12 @@ size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t
 /// @return 0 if no thread was specified, 1 if a thread was specified, -1 on error.
 int parse_delay(int fd, unsigned int *delay);
 
+/// Parses a RESUME command.
+/// @param fd File descriptor to read from.
+/// @param seq Pointer to the variable to store the sequence number in.
+/// @return 0 if successful, -1 on error.
+int parse_resume(int fd, uint64_t *seq);
+
 void fill_with_nulls(char *dest, const char *src, size_t size);
 
 void build_connect_message(char *connectMessage, const char *req_pipe_path,
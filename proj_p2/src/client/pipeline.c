@@ -0,0 +1,472 @@
+#include "pipeline.h"
+#include "api.h"
+#include "src/common/io.h"
+#include "src/common/constants.h"
+#include "src/common/protocol.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Bytes of a GET response entry, and of GET and DEL response headers
+#define GET_ENTRY_MAX_SIZE (2 + BATCH_MAX_STRING_LENGTH)
+#define RESPONSE_HEADER_SIZE (TAG_HEADER_SIZE + 2 + sizeof(uint32_t))
+
+void kvs_pipeline_init(struct KvsPipeline *pipeline, int fdRequestPipe, int fdResponsePipe) {
+	pipeline->fdRequestPipe = fdRequestPipe;
+	pipeline->fdResponsePipe = fdResponsePipe;
+	pipeline->nextId = 0;
+	pipeline->inFlight = 0;
+	pipeline->requestBytes = 0;
+	pipeline->responseBytes = 0;
+	for (size_t i = 0; i < PIPELINE_MAX_DEPTH; i++) {
+		pipeline->pending[i].inUse = 0;
+	}
+	pipeline->outLength = 0;
+	pipeline->inStart = 0;
+	pipeline->inLength = 0;
+	pipeline->rings = NULL;
+	pipeline->fdRingWakeup = -1;
+}
+
+/// @brief Creates the shared memory of the rings. Its name is unlinked
+/// right away, so only the fd passed to the server can reach it.
+/// @return fd of the shared memory, -1 on error
+static int create_ring_memory(void) {
+	static unsigned int created = 0;
+	char name[64];
+	snprintf(name, sizeof(name), "/istkvs-%d-%u", (int) getpid(),
+			 __atomic_fetch_add(&created, 1, __ATOMIC_RELAXED));
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) return -1;
+	shm_unlink(name);
+	if (ftruncate(fd, sizeof(struct RingRegion))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int kvs_pipeline_attach_rings(struct KvsPipeline *pipeline) {
+	if (pipeline->rings != NULL || pipeline->inFlight > 0) {
+		fprintf(stderr, "Rings can only be attached to an idle pipeline.\n");
+		return 1;
+	}
+
+	int fds[2] = {create_ring_memory(), eventfd(0, 0)};
+	void *rings = fds[0] < 0 ? MAP_FAILED
+							 : mmap(NULL, sizeof(struct RingRegion), PROT_READ | PROT_WRITE,
+									MAP_SHARED, fds[0], 0);
+	if (fds[1] < 0 || rings == MAP_FAILED) {
+		perror("Failed to create rings");
+		if (rings != MAP_FAILED) munmap(rings, sizeof(struct RingRegion));
+		if (fds[0] >= 0) close(fds[0]);
+		if (fds[1] >= 0) close(fds[1]);
+		return 1;
+	}
+	struct RingRegion *region = rings;
+	ring_init(&region->requests, 1);
+	ring_init(&region->responses, 0);
+
+	// The fds can only be passed on a session socket
+	char opcode = OP_CODE_ATTACH;
+	struct iovec iov = {&opcode, 1};
+	char control[CMSG_SPACE(sizeof(fds))] = {0};
+	struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1,
+							 .msg_control = control, .msg_controllen = sizeof(control)};
+	struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+	char result = '1';
+	if (sendmsg(pipeline->fdRequestPipe, &message, MSG_NOSIGNAL) != 1) {
+		perror("Failed to send rings to the server");
+	} else if (read_server_response(pipeline->fdResponsePipe, OP_CODE_ATTACH, &result)) {
+		result = '1';
+	}
+	close(fds[0]);
+	if (result != '0') {
+		munmap(rings, sizeof(struct RingRegion));
+		close(fds[1]);
+		return 1;
+	}
+
+	pipeline->rings = region;
+	pipeline->fdRingWakeup = fds[1];
+	return 0;
+}
+
+void kvs_pipeline_destroy(struct KvsPipeline *pipeline) {
+	if (pipeline->rings == NULL) return;
+	munmap(pipeline->rings, sizeof(struct RingRegion));
+	close(pipeline->fdRingWakeup);
+	pipeline->rings = NULL;
+	pipeline->fdRingWakeup = -1;
+}
+
+/// @brief Gets the exact size of a tagged batch request.
+/// @param num_keys Number of keys.
+/// @param keys Keys of the request.
+/// @param values Values of a PUT request, NULL otherwise.
+/// @return size of the request
+static size_t tagged_request_size(size_t num_keys, char keys[][MAX_STRING_SIZE],
+								  char values[][MAX_STRING_SIZE]) {
+	size_t size = TAG_HEADER_SIZE + BATCH_HEADER_SIZE;
+	for (size_t i = 0; i < num_keys; i++) {
+		size += 1 + strnlen(keys[i], BATCH_MAX_STRING_LENGTH);
+		if (values != NULL) {
+			size += 1 + strnlen(values[i], BATCH_MAX_STRING_LENGTH);
+		}
+	}
+	return size;
+}
+
+/// @brief Queues a tagged request in the output buffer.
+/// @return 0 if the request was submitted, 1 if the pipeline is full, -1
+/// if the request is invalid
+static int submit(struct KvsPipeline *pipeline, char opcode, size_t num_keys,
+				  char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+				  int results[], kvs_completion_callback callback, void *arg, uint32_t *id) {
+	if (num_keys == 0 || num_keys > MAX_BATCH_KEYS) return -1;
+
+	size_t requestSize = tagged_request_size(num_keys, keys, opcode == OP_CODE_PUT ? values : NULL);
+	size_t responseBound = TAG_HEADER_SIZE + 2;
+	if (opcode == OP_CODE_GET) {
+		responseBound = RESPONSE_HEADER_SIZE + num_keys * GET_ENTRY_MAX_SIZE;
+	} else if (opcode == OP_CODE_DEL) {
+		responseBound = RESPONSE_HEADER_SIZE + num_keys;
+	} else if (opcode != OP_CODE_PUT) {
+		responseBound = RESPONSE_HEADER_SIZE + BATCH_BITMAP_SIZE(num_keys);
+	}
+
+	if (pipeline->inFlight == PIPELINE_MAX_DEPTH ||
+		pipeline->requestBytes + requestSize > PIPELINE_MAX_BYTES ||
+		pipeline->responseBytes + responseBound > PIPELINE_MAX_BYTES) {
+		return 1;
+	}
+
+	// Ids grow, skipping those whose slot is still taken by a slow request
+	while (pipeline->pending[pipeline->nextId % PIPELINE_MAX_DEPTH].inUse) {
+		pipeline->nextId++;
+	}
+	uint32_t requestId = pipeline->nextId++;
+
+	struct PendingRequest *request = &pipeline->pending[requestId % PIPELINE_MAX_DEPTH];
+	request->inUse = 1;
+	request->id = requestId;
+	request->opcode = opcode;
+	request->numKeys = num_keys;
+	request->values = opcode == OP_CODE_GET ? values : NULL;
+	request->results = results;
+	request->requestSize = requestSize;
+	request->responseBound = responseBound;
+	request->callback = callback;
+	request->arg = arg;
+
+	char *frame = pipeline->out + pipeline->outLength;
+	frame[0] = OP_CODE_TAGGED;
+	memcpy(frame + 1, &requestId, sizeof(requestId));
+	encode_batch_request(frame + TAG_HEADER_SIZE, opcode, num_keys, keys,
+						 opcode == OP_CODE_PUT ? values : NULL);
+	pipeline->outLength += requestSize;
+
+	pipeline->inFlight++;
+	pipeline->requestBytes += requestSize;
+	pipeline->responseBytes += responseBound;
+	if (id != NULL) *id = requestId;
+	return 0;
+}
+
+int kvs_pipeline_get(struct KvsPipeline *pipeline, size_t num_keys, char keys[][MAX_STRING_SIZE],
+					 char values[][MAX_STRING_SIZE], int found[],
+					 kvs_completion_callback callback, void *arg, uint32_t *id) {
+	return submit(pipeline, OP_CODE_GET, num_keys, keys, values, found, callback, arg, id);
+}
+
+int kvs_pipeline_put(struct KvsPipeline *pipeline, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+					 char values[][MAX_STRING_SIZE],
+					 kvs_completion_callback callback, void *arg, uint32_t *id) {
+	return submit(pipeline, OP_CODE_PUT, num_pairs, keys, values, NULL, callback, arg, id);
+}
+
+int kvs_pipeline_delete(struct KvsPipeline *pipeline, size_t num_keys, char keys[][MAX_STRING_SIZE],
+						int deleted[], kvs_completion_callback callback, void *arg, uint32_t *id) {
+	return submit(pipeline, OP_CODE_DEL, num_keys, keys, NULL, deleted, callback, arg, id);
+}
+
+int kvs_pipeline_subscribe(struct KvsPipeline *pipeline, size_t num_keys,
+						   char keys[][MAX_STRING_SIZE], int subscribed[],
+						   kvs_completion_callback callback, void *arg, uint32_t *id) {
+	return submit(pipeline, OP_CODE_SUBSCRIBE_BATCH, num_keys, keys, NULL, subscribed, callback,
+				  arg, id);
+}
+
+int kvs_pipeline_unsubscribe(struct KvsPipeline *pipeline, size_t num_keys,
+							 char keys[][MAX_STRING_SIZE], int removed[],
+							 kvs_completion_callback callback, void *arg, uint32_t *id) {
+	return submit(pipeline, OP_CODE_UNSUBSCRIBE_BATCH, num_keys, keys, NULL, removed, callback,
+				  arg, id);
+}
+
+/// @brief Writes the submitted requests to the requests ring, waking the
+/// server up if it sleeps.
+/// @param pipeline
+/// @return 0 on success, 1 on error
+static int flush_to_ring(struct KvsPipeline *pipeline) {
+	// Requests in flight never exceed the ring, so they always fit
+	ring_write(&pipeline->rings->requests, pipeline->out, pipeline->outLength);
+	pipeline->outLength = 0;
+
+	char wakeup = OP_CODE_WAKEUP;
+	if (ring_wake_consumer(&pipeline->rings->requests) &&
+		write_all(pipeline->fdRequestPipe, &wakeup, 1) == -1) {
+		fprintf(stderr, "Error waking the server up\n");
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_pipeline_flush(struct KvsPipeline *pipeline) {
+	if (pipeline->outLength == 0) return 0;
+	if (pipeline->rings != NULL) return flush_to_ring(pipeline);
+	if (write_all(pipeline->fdRequestPipe, pipeline->out, pipeline->outLength) == -1) {
+		fprintf(stderr, "Error writing requests on requests pipe\n");
+		return 1;
+	}
+	pipeline->outLength = 0;
+	return 0;
+}
+
+/// @brief Gets the size of the tagged response at the start of a buffer.
+/// @param buffer Buffered response bytes.
+/// @param length Number of buffered bytes.
+/// @return size of the response, or a lower bound larger than length if it
+/// is incomplete, 0 if it is malformed
+static size_t response_size(const char *buffer, size_t length) {
+	if (length < TAG_HEADER_SIZE + 2) return TAG_HEADER_SIZE + 2;
+	if (buffer[0] != OP_CODE_TAGGED) return 0;
+
+	char opcode = buffer[TAG_HEADER_SIZE];
+	if (opcode == OP_CODE_PUT) return TAG_HEADER_SIZE + 2;
+	if (opcode != OP_CODE_GET && opcode != OP_CODE_DEL && opcode != OP_CODE_SUBSCRIBE_BATCH &&
+		opcode != OP_CODE_UNSUBSCRIBE_BATCH) {
+		return 0;
+	}
+
+	if (length < RESPONSE_HEADER_SIZE) return RESPONSE_HEADER_SIZE;
+	uint32_t count;
+	memcpy(&count, buffer + TAG_HEADER_SIZE + 2, sizeof(count));
+	if (count > MAX_BATCH_KEYS) return 0;
+	if (opcode == OP_CODE_DEL) return RESPONSE_HEADER_SIZE + count;
+	if (opcode != OP_CODE_GET) return RESPONSE_HEADER_SIZE + BATCH_BITMAP_SIZE(count);
+
+	size_t offset = RESPONSE_HEADER_SIZE;
+	for (size_t i = 0; i < count; i++) {
+		if (offset + 2 > length) return offset + 2;
+		unsigned char valueLength = (unsigned char) buffer[offset + 1];
+		if (valueLength > BATCH_MAX_STRING_LENGTH) return 0;
+		offset += 2 + valueLength;
+	}
+	return offset;
+}
+
+/// @brief Stores the results of a complete response in its request.
+/// @param pipeline
+/// @param response The response, starting with the tag.
+/// @param completion Where to store the completion.
+/// @return 0 on success, 1 if the response matches no request
+static int complete_request(struct KvsPipeline *pipeline, const char *response,
+							struct KvsCompletion *completion) {
+	uint32_t id;
+	memcpy(&id, response + 1, sizeof(id));
+	struct PendingRequest *request = &pipeline->pending[id % PIPELINE_MAX_DEPTH];
+	const char *body = response + TAG_HEADER_SIZE;
+	if (!request->inUse || request->id != id || request->opcode != body[0]) {
+		fprintf(stderr, "Response does not match a request in flight.\n");
+		return 1;
+	}
+
+	completion->id = id;
+	completion->opcode = request->opcode;
+	completion->error = body[1] != '0';
+	completion->arg = request->arg;
+
+	if (!completion->error && request->opcode != OP_CODE_PUT) {
+		uint32_t count;
+		memcpy(&count, body + 2, sizeof(count));
+		if (count != request->numKeys) {
+			completion->error = 1;
+		} else if (request->opcode == OP_CODE_DEL) {
+			for (size_t i = 0; i < count; i++) {
+				request->results[i] = body[6 + i];
+			}
+		} else if (request->opcode != OP_CODE_GET) {
+			for (size_t i = 0; i < count; i++) {
+				request->results[i] = (body[6 + i / 8] >> (i % 8)) & 1;
+			}
+		} else {
+			size_t offset = 6;
+			for (size_t i = 0; i < count; i++) {
+				size_t valueLength = (unsigned char) body[offset + 1];
+				request->results[i] = body[offset];
+				memcpy(request->values[i], body + offset + 2, valueLength);
+				request->values[i][valueLength] = '\0';
+				offset += 2 + valueLength;
+			}
+		}
+	}
+
+	request->inUse = 0;
+	pipeline->inFlight--;
+	pipeline->requestBytes -= request->requestSize;
+	pipeline->responseBytes -= request->responseBound;
+	if (request->callback != NULL) request->callback(completion);
+	return 0;
+}
+
+/// @brief Reads the responses available on the responses ring.
+/// @param pipeline
+/// @param wait Whether to block until some bytes arrive.
+/// @return 1 if bytes were read, 0 if none were available, -1 on error
+static int read_ring_responses(struct KvsPipeline *pipeline, int wait) {
+	struct Ring *ring = &pipeline->rings->responses;
+	memmove(pipeline->in, pipeline->in + pipeline->inStart, pipeline->inLength);
+	pipeline->inStart = 0;
+
+	unsigned int spins = 0;
+	while (1) {
+		size_t bytesRead = ring_read(ring, pipeline->in + pipeline->inLength,
+									 PIPELINE_MAX_BYTES - pipeline->inLength);
+		if (bytesRead > 0) {
+			pipeline->inLength += bytesRead;
+			char wakeup = OP_CODE_WAKEUP;
+			if (ring_wake_producer(ring) && write_all(pipeline->fdRequestPipe, &wakeup, 1) == -1) {
+				fprintf(stderr, "Error waking the server up\n");
+				return -1;
+			}
+			return 1;
+		}
+		if (!wait) return 0;
+		if (++spins < PIPELINE_RING_SPINS) {
+			// Lets the server run when it shares the core
+			sched_yield();
+			continue;
+		}
+		if (!ring_sleep(ring)) continue;
+
+		// The responses pipe only ends if the server closed the session
+		struct pollfd pollFds[2] = {{.fd = pipeline->fdRingWakeup, .events = POLLIN},
+									{.fd = pipeline->fdResponsePipe, .events = POLLIN}};
+		if (poll(pollFds, 2, -1) < 0 && errno != EINTR) {
+			perror("Failed to wait for responses");
+			return -1;
+		}
+		if (pollFds[0].revents & POLLIN) {
+			uint64_t wakeups;
+			if (read(pipeline->fdRingWakeup, &wakeups, sizeof(wakeups)) < 0 && errno != EINTR) {
+				perror("Failed to read ring wakeup");
+				return -1;
+			}
+		} else if (pollFds[1].revents) {
+			fprintf(stderr, "Server closed the session.\n");
+			return -1;
+		}
+		spins = 0;
+	}
+}
+
+int kvs_pipeline_deliver(struct KvsPipeline *pipeline, const char *bytes, size_t length) {
+	memmove(pipeline->in, pipeline->in + pipeline->inStart, pipeline->inLength);
+	pipeline->inStart = 0;
+	if (length > PIPELINE_MAX_BYTES - pipeline->inLength) {
+		fprintf(stderr, "Responses overflow the requests in flight.\n");
+		return 1;
+	}
+	memcpy(pipeline->in + pipeline->inLength, bytes, length);
+	pipeline->inLength += length;
+	return 0;
+}
+
+/// @brief Reads the responses available on the responses pipe.
+/// @param pipeline
+/// @param wait Whether to block until some bytes arrive.
+/// @return 1 if bytes were read, 0 if none were available, -1 on error
+static int read_responses(struct KvsPipeline *pipeline, int wait) {
+	if (pipeline->rings != NULL) return read_ring_responses(pipeline, wait);
+	if (pipeline->fdResponsePipe == -1) {
+		// The caller delivers the responses
+		if (!wait) return 0;
+		fprintf(stderr, "Cannot wait for responses the caller delivers.\n");
+		return -1;
+	}
+	if (!wait) {
+		struct pollfd pollFd = {.fd = pipeline->fdResponsePipe, .events = POLLIN};
+		int ready = poll(&pollFd, 1, 0);
+		if (ready < 0 && errno != EINTR) {
+			perror("Failed to poll responses pipe");
+			return -1;
+		}
+		if (ready <= 0) return 0;
+	}
+
+	// Keep the incomplete response at the start of the buffer
+	memmove(pipeline->in, pipeline->in + pipeline->inStart, pipeline->inLength);
+	pipeline->inStart = 0;
+
+	ssize_t bytesRead;
+	do {
+		bytesRead = read(pipeline->fdResponsePipe, pipeline->in + pipeline->inLength,
+						 PIPELINE_MAX_BYTES - pipeline->inLength);
+	} while (bytesRead < 0 && errno == EINTR);
+
+	if (bytesRead <= 0) {
+		fprintf(stderr, "Failed to read responses from responses pipe.\n");
+		return -1;
+	}
+	pipeline->inLength += (size_t) bytesRead;
+	return 1;
+}
+
+int kvs_pipeline_complete(struct KvsPipeline *pipeline, struct KvsCompletion completions[],
+						  size_t max_completions, size_t min_completions) {
+	if (kvs_pipeline_flush(pipeline)) return -1;
+
+	if (min_completions > pipeline->inFlight) min_completions = pipeline->inFlight;
+	if (min_completions > max_completions) min_completions = max_completions;
+
+	size_t completed = 0;
+	while (completed < max_completions && pipeline->inFlight > 0) {
+		size_t size = response_size(pipeline->in + pipeline->inStart, pipeline->inLength);
+		if (size == 0) {
+			fprintf(stderr, "Malformed response from server.\n");
+			return -1;
+		}
+
+		if (size > pipeline->inLength) {
+			int status = read_responses(pipeline, completed < min_completions);
+			if (status < 0) return -1;
+			if (status == 0) break;
+			continue;
+		}
+
+		struct KvsCompletion completion;
+		if (complete_request(pipeline, pipeline->in + pipeline->inStart, &completion)) {
+			return -1;
+		}
+		if (completions != NULL) completions[completed] = completion;
+		completed++;
+		pipeline->inStart += size;
+		pipeline->inLength -= size;
+	}
+	return (int) completed;
+}
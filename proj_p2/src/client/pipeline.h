@@ -0,0 +1,182 @@
+#ifndef CLIENT_PIPELINE_H
+#define CLIENT_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/common/constants.h"
+#include "src/common/ring.h"
+
+#define PIPELINE_MAX_DEPTH 128 // max requests in flight on a session
+// Max bytes of requests, and of their responses, in flight. Half the
+// default pipe capacity, so neither side ever blocks on a full pipe while
+// the other one is blocked writing too, and a flush fits in one packet on
+// a session socket.
+#define PIPELINE_MAX_BYTES MAX_MESSAGE_SIZE
+// Yields on an empty responses ring before sleeping on the wakeup eventfd
+#define PIPELINE_RING_SPINS 8
+
+struct KvsCompletion {
+	uint32_t id;  // id returned when the request was submitted
+	char opcode;  // OP_CODE_GET, OP_CODE_PUT, OP_CODE_DEL or a subscriptions opcode
+	int error;    // 0 if the server served the request, 1 otherwise
+	void *arg;    // argument given when the request was submitted
+};
+
+/// Called for every request that completes, before it is returned by
+/// kvs_pipeline_complete.
+typedef void (*kvs_completion_callback)(const struct KvsCompletion *completion);
+
+struct PendingRequest {
+	int inUse;
+	uint32_t id;
+	char opcode;
+	size_t numKeys;
+	char (*values)[MAX_STRING_SIZE]; // GET values, NULL otherwise
+	int *results;                    // found, deleted or subscribed flags, NULL for PUT
+	size_t requestSize;
+	size_t responseBound;            // max size of the response
+	kvs_completion_callback callback;
+	void *arg;
+};
+
+/// Keeps several GET, PUT and DEL requests in flight on one session. The
+/// results arrays given on submission must stay valid until the request
+/// completes. Do not use the blocking kvs_get, kvs_put and kvs_delete
+/// while requests are in flight.
+struct KvsPipeline {
+	int fdRequestPipe, fdResponsePipe;
+	uint32_t nextId;
+	size_t inFlight;
+	size_t requestBytes;  // bytes of the requests in flight
+	size_t responseBytes; // upper bound on the bytes of their responses
+	struct PendingRequest pending[PIPELINE_MAX_DEPTH];
+	size_t outLength;     // submitted requests not yet written
+	char out[PIPELINE_MAX_BYTES];
+	size_t inStart, inLength; // responses read but not yet completed
+	char in[PIPELINE_MAX_BYTES];
+	struct RingRegion *rings; // shared with the server once attached, NULL otherwise
+	int fdRingWakeup;         // eventfd the server signals when the client sleeps
+};
+
+/// Prepares a pipeline on a connected session.
+/// @param pipeline Pipeline to initialize.
+/// @param fdRequestPipe File descriptor of the requests pipe.
+/// @param fdResponsePipe File descriptor of the responses pipe.
+void kvs_pipeline_init(struct KvsPipeline *pipeline, int fdRequestPipe, int fdResponsePipe);
+
+/// Moves the requests and responses of a pipeline on a socket session to
+/// rings in memory shared with the server. Requests and responses are then
+/// copied without system calls while both sides are busy; notifications
+/// and the blocking requests stay on the socket.
+/// @param pipeline Pipeline with no requests in flight.
+/// @return 0 on success, 1 otherwise
+int kvs_pipeline_attach_rings(struct KvsPipeline *pipeline);
+
+/// Releases the rings of a pipeline, after the session is disconnected.
+/// @param pipeline
+void kvs_pipeline_destroy(struct KvsPipeline *pipeline);
+
+/// Submits a GET request. It is sent on the next flush or completion.
+/// @param pipeline
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys to read.
+/// @param values Where to store the value of each key.
+/// @param found Set to 1 for each key that exists, 0 otherwise, or as in
+/// kvs_get to BATCH_VALUE_TRUNCATED for a longer value.
+/// @param callback Called when the request completes, may be NULL.
+/// @param arg Passed back in the completion.
+/// @param id Set to the id of the request.
+/// @return 0 if the request was submitted, 1 if the pipeline is full and
+/// requests must be completed first, -1 if the request is invalid
+int kvs_pipeline_get(struct KvsPipeline *pipeline, size_t num_keys, char keys[][MAX_STRING_SIZE],
+					 char values[][MAX_STRING_SIZE], int found[],
+					 kvs_completion_callback callback, void *arg, uint32_t *id);
+
+/// Submits a PUT request. It is sent on the next flush or completion.
+/// @param pipeline
+/// @param num_pairs Number of pairs, at most MAX_BATCH_KEYS.
+/// @param keys Keys to write.
+/// @param values Values to write.
+/// @param callback Called when the request completes, may be NULL.
+/// @param arg Passed back in the completion.
+/// @param id Set to the id of the request.
+/// @return 0 if the request was submitted, 1 if the pipeline is full and
+/// requests must be completed first, -1 if the request is invalid
+int kvs_pipeline_put(struct KvsPipeline *pipeline, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+					 char values[][MAX_STRING_SIZE],
+					 kvs_completion_callback callback, void *arg, uint32_t *id);
+
+/// Submits a DEL request. It is sent on the next flush or completion.
+/// @param pipeline
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys to delete.
+/// @param deleted Set to 1 for each key that was deleted, 0 if it was missing.
+/// @param callback Called when the request completes, may be NULL.
+/// @param arg Passed back in the completion.
+/// @param id Set to the id of the request.
+/// @return 0 if the request was submitted, 1 if the pipeline is full and
+/// requests must be completed first, -1 if the request is invalid
+int kvs_pipeline_delete(struct KvsPipeline *pipeline, size_t num_keys, char keys[][MAX_STRING_SIZE],
+						int deleted[], kvs_completion_callback callback, void *arg, uint32_t *id);
+
+/// Submits a SUBSCRIBE_BATCH request. It is sent on the next flush or
+/// completion.
+/// @param pipeline
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys or patterns to subscribe.
+/// @param subscribed Set to 1 for each key or pattern subscribed, including
+/// keys that wait to be written, 0 if the subscription failed.
+/// @param callback Called when the request completes, may be NULL.
+/// @param arg Passed back in the completion.
+/// @param id Set to the id of the request.
+/// @return 0 if the request was submitted, 1 if the pipeline is full and
+/// requests must be completed first, -1 if the request is invalid
+int kvs_pipeline_subscribe(struct KvsPipeline *pipeline, size_t num_keys,
+						   char keys[][MAX_STRING_SIZE], int subscribed[],
+						   kvs_completion_callback callback, void *arg, uint32_t *id);
+
+/// Submits an UNSUBSCRIBE_BATCH request. It is sent on the next flush or
+/// completion.
+/// @param pipeline
+/// @param num_keys Number of keys, at most MAX_BATCH_KEYS.
+/// @param keys Keys or patterns to unsubscribe.
+/// @param removed Set to 1 for each subscription removed, 0 if it did not exist.
+/// @param callback Called when the request completes, may be NULL.
+/// @param arg Passed back in the completion.
+/// @param id Set to the id of the request.
+/// @return 0 if the request was submitted, 1 if the pipeline is full and
+/// requests must be completed first, -1 if the request is invalid
+int kvs_pipeline_unsubscribe(struct KvsPipeline *pipeline, size_t num_keys,
+							 char keys[][MAX_STRING_SIZE], int removed[],
+							 kvs_completion_callback callback, void *arg, uint32_t *id);
+
+/// Writes the submitted requests to the server.
+/// @param pipeline
+/// @return 0 on success, 1 on error
+int kvs_pipeline_flush(struct KvsPipeline *pipeline);
+
+/// Hands the pipeline response bytes read by the caller, for sessions whose
+/// event loop reads the responses itself. Such a pipeline is initialized
+/// with fdResponsePipe -1, and kvs_pipeline_complete then only completes
+/// the requests whose responses were delivered, with min_completions 0.
+/// @param pipeline
+/// @param bytes Response bytes, in the order they were read.
+/// @param length Number of bytes.
+/// @return 0 on success, 1 if more bytes arrived than the requests in flight
+/// can be answered with
+int kvs_pipeline_deliver(struct KvsPipeline *pipeline, const char *bytes, size_t length);
+
+/// Sends the submitted requests and collects the responses that arrived,
+/// waiting until at least min_completions requests completed.
+/// @param pipeline
+/// @param completions Where to store the completions, may be NULL when
+/// only callbacks are used.
+/// @param max_completions Max number of requests to complete.
+/// @param min_completions Number of requests to wait for, capped at the
+/// number of requests in flight.
+/// @return number of completed requests, -1 on error
+int kvs_pipeline_complete(struct KvsPipeline *pipeline, struct KvsCompletion completions[],
+						  size_t max_completions, size_t min_completions);
+
+#endif  // CLIENT_PIPELINE_H
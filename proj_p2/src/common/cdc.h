@@ -0,0 +1,33 @@
+#ifndef COMMON_CDC_H
+#define COMMON_CDC_H
+
+#include <stdint.h>
+
+#include "src/common/constants.h"
+#include "src/common/protocol.h"
+#include "src/common/varint.h"
+
+// Change data capture stream, written by the server to a log file or a FIFO
+// and read by cdc_tail. Each file, or each time the FIFO is opened, starts
+// with CDC_MAGIC, followed by one record per committed change in sequence
+// order. Integers are in native byte order, strings are not null terminated.
+//   record: seq | timestamp | type | keyLength | key | valueLength | value
+// seq is the sequence number of the change and timestamp the time it was
+// committed, in nanoseconds since the epoch. keyLength is one byte and
+// valueLength a varint, see src/common/varint.h. Deletes have no value.
+// Streams of CDC_MAGIC_V1 held one byte value lengths, which are also the
+// varints of values below 128 bytes.
+#define CDC_MAGIC "KVSCDC02"
+#define CDC_MAGIC_V1 "KVSCDC01"
+#define CDC_MAGIC_SIZE 8
+
+enum {
+  CDC_WRITE = 'W',
+  CDC_DELETE = 'D',
+};
+
+#define CDC_RECORD_HEADER_SIZE (2 * sizeof(uint64_t) + 2) // up to the key
+#define CDC_RECORD_MAX_SIZE \
+  (CDC_RECORD_HEADER_SIZE + BATCH_MAX_STRING_LENGTH + VARINT_MAX_SIZE + MAX_VALUE_SIZE)
+
+#endif  // COMMON_CDC_H
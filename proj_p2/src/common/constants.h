@@ -3,9 +3,13 @@
 #define STATE_ACCESS_DELAY_US  // delay to apply on the server
 #define MAX_PIPE_PATH_LENGTH 40
 #define MAX_STRING_SIZE 40
+#define MAX_VALUE_SIZE (16 << 20) // max bytes in a value, see PROTOCOL_LARGE_VALUES
 #define MAX_NUMBER_SUB 10 
+#define MAX_BATCH_KEYS 256 // max keys in a batch request (GET, PUT, DEL, ...)
+#define MAX_MESSAGE_SIZE 32768 // max bytes in one packet on a session socket
 
 #define KEY_MESSAGE_SIZE 41
 #define RESULT_KEY_EXISTS '1'
 #define RESULT_KEY_DOESNT_EXIST '0'
+#define RESULT_KEY_PARKED '2' // subscribed, the key waits to be written
 #define PIPES_CLOSED  0
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef COMMON_PROTOCOL_H
 #define COMMON_PROTOCOL_H
 
+#include <stdint.h>
+
+#include "src/common/constants.h"
+
 // Opcodes for client-server communication
 // estes opcodes sao usados num switch case para determinar o que fazer com a mensagem recebida no server
 // usam estes opcodes tambem nos clientes quando enviam mensagens para o server
@@ -9,7 +13,159 @@ enum {
   OP_CODE_DISCONNECT = '2',
   OP_CODE_SUBSCRIBE = '3',
   OP_CODE_UNSUBSCRIBE = '4',
+  OP_CODE_GET = '5',
+  OP_CODE_PUT = '6',
+  OP_CODE_DEL = '7',
+  OP_CODE_TAGGED = '8',
+  OP_CODE_ATTACH = '9',
+  OP_CODE_WAKEUP = 'W',
+  OP_CODE_SUBSCRIBE_BATCH = 'S',
+  OP_CODE_UNSUBSCRIBE_BATCH = 'U',
+  OP_CODE_RESUME = 'R',
+  OP_CODE_CONNECT_COMPACT = 'C',
+  OP_CODE_PUT_VALUE = 'P',
+  OP_CODE_GET_VALUE = 'G',
+  OP_CODE_PUT_TTL = 'X',
+  OP_CODE_EXPIRE = 'E',
+};
+
+// Protocol versions. PROTOCOL_FIXED pads every key and value to
+// KEY_MESSAGE_SIZE bytes; PROTOCOL_COMPACT prefixes them with their length
+// as a varint (src/common/varint.h). Sessions use PROTOCOL_FIXED unless the
+// client asks for another version at connect:
+//   pipes:    CONNECT_COMPACT | version | 3 * (pathLength | path)
+//             sent on the server pipe instead of the CONNECT message
+//   socket:   CONNECT_COMPACT | version
+//             sent as the first request, after the CONNECT response
+//   response: CONNECT_COMPACT | result | version
+// The server answers with the version the session uses from then on, which
+// is the highest it knows up to the one asked. On a compact session
+//   SUBSCRIBE/UNSUBSCRIBE request: opcode | keyLength | key
+//   notification:     keyLength | key | valueLength | value | seq
+// and RESUME records are laid out as compact notifications. Batch frames
+// are the same in all versions: a one byte length is also the varint of a
+// length below 128. Keys stay below MAX_STRING_SIZE bytes in all.
+// A SUBSCRIBE result is RESULT_KEY_EXISTS, RESULT_KEY_PARKED for a key
+// subscribed before it is written, or RESULT_KEY_DOESNT_EXIST if the key
+// was not subscribed.
+//
+// Values may take up to MAX_VALUE_SIZE bytes. Batch frames, and the
+// notifications and RESUME records of the first two versions, carry the
+// first BATCH_MAX_STRING_LENGTH bytes of a longer value. PROTOCOL_LARGE_VALUES
+// is PROTOCOL_COMPACT with whole values in notifications and RESUME
+// records, and two requests that move one value of any size:
+//   PUT_VALUE request:  opcode | keyLength | key | valueLength | value
+//   PUT_VALUE response: opcode | result
+//   GET_VALUE request:  opcode | keyLength | key
+//   GET_VALUE response: opcode | result | found | valueLength | value
+// Values are not null terminated and may hold any byte. Sockets carry a
+// large frame in several packets of at most MAX_MESSAGE_SIZE bytes.
+//
+// PROTOCOL_EXPIRY is PROTOCOL_LARGE_VALUES with two batch requests that give
+// keys a TTL, the milliseconds until they expire as a uint32_t in native
+// byte order, placed before the count:
+//   PUT_TTL request:  opcode | ttl | count | count * (keyLength | key | valueLength | value)
+//   PUT_TTL response: opcode | result
+//   EXPIRE request:   opcode | ttl | count | count * (keyLength | key)
+//   EXPIRE response:  opcode | result | count | count * found
+// A ttl of 0 makes the keys persistent, as does a write without one. A key
+// expires as if it was deleted, with the usual DELETE notification.
+//
+// PROTOCOL_GAP_MARKERS is PROTOCOL_EXPIRY with a marker where the server
+// dropped notifications the session did not take in time: a notification
+// with an empty key and value and seq 0. No key is empty, so the marker
+// cannot be mistaken for a change.
+//
+// PROTOCOL_TRUNCATION_FLAGS is PROTOCOL_GAP_MARKERS with GET answers that
+// tell a cut value apart: found is BATCH_VALUE_TRUNCATED when the value is
+// longer than the BATCH_MAX_STRING_LENGTH bytes sent, to be read whole with
+// GET_VALUE.
+enum {
+  PROTOCOL_FIXED = 1,
+  PROTOCOL_COMPACT = 2,
+  PROTOCOL_LARGE_VALUES = 3,
+  PROTOCOL_EXPIRY = 4,
+  PROTOCOL_GAP_MARKERS = 5,
+  PROTOCOL_TRUNCATION_FLAGS = 6,
 };
+#define CONNECT_COMPACT_RESPONSE_SIZE 3
+#define TTL_SIZE sizeof(uint32_t)
+
+// Batch frames (GET, PUT, DEL). Counts are uint32_t in native byte order,
+// lengths are one byte and strings are not null terminated.
+//   GET/DEL request:  opcode | count | count * (keyLength | key)
+//   PUT request:      opcode | count | count * (keyLength | key | valueLength | value)
+//   GET response:     opcode | result | count | count * (found | valueLength | value)
+//   PUT response:     opcode | result
+//   DEL response:     opcode | result | count | count * deleted
+// found and deleted are 1 or 0, valueLength is 0 if the key was not found.
+// Subscriptions of several keys (or patterns) share the GET/DEL request
+// layout, and are answered with a bitmap: bit i % 8 of byte i / 8 is set if
+// key i is subscribed, or for an unsubscribe if its subscription was removed.
+// A subscription to a missing key waits for the key to be written, and is
+// set too.
+//   SUBSCRIBE_BATCH/UNSUBSCRIBE_BATCH response:
+//                     opcode | result | count | (count + 7) / 8 bytes
+#define BATCH_HEADER_SIZE (1 + sizeof(uint32_t))
+#define BATCH_BITMAP_SIZE(count) (((count) + 7) / 8)
+#define BATCH_MAX_STRING_LENGTH (MAX_STRING_SIZE - 1)
+#define BATCH_VALUE_TRUNCATED 2 // found, see PROTOCOL_TRUNCATION_FLAGS
+
+// Notifications carry the key and the value, each padded with '\0' to
+// KEY_MESSAGE_SIZE bytes. Every write or delete gets the next sequence
+// number, over all keys, but only the notifications of the newer versions
+// carry it, so this layout stays the one older clients read.
+//   notification:     key | value
+#define NOTIFICATION_SIZE (2 * KEY_MESSAGE_SIZE)
+// Both lengths take one byte while strings are below 128 bytes
+#define COMPACT_NOTIFICATION_MAX_SIZE (2 * MAX_STRING_SIZE + sizeof(uint64_t))
+
+// A session that lost notifications, e.g. after being disconnected,
+// subscribes again and asks for the changes after the last sequence number
+// it saw. It gets those of its keys and patterns, oldest first, in pages of
+// at most RESUME_MAX_RECORDS, each laid out as a notification of the
+// session's protocol. seq is the last change the page covers, which the
+// next RESUME starts after, and the only one a PROTOCOL_FIXED session gets.
+//   RESUME request:   opcode | seq
+//   RESUME response:  opcode | result | seq | count | count * notification
+// Changes older than the server keeps are answered with RESUME_EVICTED and
+// no records: the session must read its keys again, then resume after seq.
+enum {
+  RESUME_COMPLETE = '0', // up to the last change
+  RESUME_PARTIAL = 'P',  // more changes follow, resume again after seq
+  RESUME_EVICTED = 'E',
+};
+#define RESUME_HEADER_SIZE (2 + sizeof(uint64_t) + sizeof(uint32_t))
+#define RESUME_MAX_RECORDS MAX_BATCH_KEYS
+
+// Tagged frames wrap a GET, PUT, DEL, SUBSCRIBE_BATCH, UNSUBSCRIBE_BATCH,
+// PUT_TTL or EXPIRE request with an id chosen by the client, so several
+// requests can be in flight on one session. The response carries the same
+// id and tagged responses may arrive in any order.
+//   request:   OP_CODE_TAGGED | id | batch request
+//   response:  OP_CODE_TAGGED | id | batch response
+#define TAG_HEADER_SIZE (1 + sizeof(uint32_t))
+
+// Sessions over a unix socket carry requests, responses and notifications
+// on one SOCK_SEQPACKET socket. Clients send request bytes as they would
+// on the requests pipe. Every packet from the server starts with the type
+// below, followed by the bytes that would have gone to that pipe. No
+// packet is larger than MAX_MESSAGE_SIZE.
+enum {
+  MESSAGE_RESPONSE = 'R',
+  MESSAGE_NOTIFICATION = 'N',
+};
+
+// Clients on the same host can attach shared rings to a socket session
+// (src/common/ring.h). OP_CODE_ATTACH is sent in a packet that carries the
+// shared memory fd and an eventfd, and is answered on the socket. From then
+// on the client writes tagged requests to the requests ring and the server
+// writes every tagged response to the responses ring; all other traffic
+// stays on the socket. Whoever writes to a ring wakes the other side only if
+// it is sleeping: the client sends OP_CODE_WAKEUP on the socket, the server
+// writes to the eventfd. A server that finds the responses ring full keeps
+// the rest of its responses and marks the ring; the client that reads from
+// a marked ring sends OP_CODE_WAKEUP too.
 
 #endif  // COMMON_PROTOCOL_H
   
\ No newline at end of file
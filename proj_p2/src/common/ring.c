@@ -0,0 +1,75 @@
+#include "ring.h"
+
+#include <string.h>
+
+void ring_init(struct Ring *ring, int sleeping) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->sleeping, sleeping ? 1 : 0);
+  atomic_init(&ring->full, 0);
+}
+
+size_t ring_write(struct Ring *ring, const void *buffer, size_t size) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  size_t space = RING_SIZE - (uint32_t)(tail - head);
+  if (size > space) size = space;
+
+  size_t offset = tail & (RING_SIZE - 1);
+  size_t first = RING_SIZE - offset < size ? RING_SIZE - offset : size;
+  memcpy(ring->data + offset, buffer, first);
+  memcpy(ring->data, (const char *)buffer + first, size - first);
+
+  atomic_store_explicit(&ring->tail, tail + (uint32_t)size, memory_order_release);
+  return size;
+}
+
+size_t ring_read(struct Ring *ring, void *buffer, size_t size) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  size_t available = (uint32_t)(tail - head);
+  if (size > available) size = available;
+
+  size_t offset = head & (RING_SIZE - 1);
+  size_t first = RING_SIZE - offset < size ? RING_SIZE - offset : size;
+  memcpy(buffer, ring->data + offset, first);
+  memcpy((char *)buffer + first, ring->data, size - first);
+
+  atomic_store_explicit(&ring->head, head + (uint32_t)size, memory_order_release);
+  return size;
+}
+
+int ring_wake_consumer(struct Ring *ring) {
+  // Pairs with the fence in ring_sleep: either the consumer sees the new
+  // tail, or the producer sees the consumer asleep
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) return 0;
+  return atomic_exchange_explicit(&ring->sleeping, 0, memory_order_acq_rel) != 0;
+}
+
+int ring_sleep(struct Ring *ring) {
+  atomic_store_explicit(&ring->sleeping, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) return 1;
+
+  atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+  return 0;
+}
+
+int ring_wait_room(struct Ring *ring) {
+  atomic_store_explicit(&ring->full, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == RING_SIZE) return 1;
+
+  atomic_store_explicit(&ring->full, 0, memory_order_relaxed);
+  return 0;
+}
+
+int ring_wake_producer(struct Ring *ring) {
+  // Pairs with the fence in ring_wait_room, as in ring_wake_consumer
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&ring->full, memory_order_relaxed)) return 0;
+  return atomic_exchange_explicit(&ring->full, 0, memory_order_acq_rel) != 0;
+}
@@ -0,0 +1,74 @@
+#ifndef COMMON_RING_H
+#define COMMON_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_SIZE 65536 // bytes in each ring, a power of two
+#define CACHE_LINE_SIZE 64
+
+/// Single producer, single consumer byte ring in memory shared by a client
+/// and the server. Positions only grow and wrap around at UINT32_MAX.
+struct Ring {
+  _Atomic uint32_t head; // next byte to consume, written by the consumer
+  char headPadding[CACHE_LINE_SIZE - sizeof(uint32_t)];
+  _Atomic uint32_t tail; // next byte to produce, written by the producer
+  char tailPadding[CACHE_LINE_SIZE - sizeof(uint32_t)];
+  _Atomic uint32_t sleeping; // set by the consumer before it waits for a wakeup
+  char sleepingPadding[CACHE_LINE_SIZE - sizeof(uint32_t)];
+  _Atomic uint32_t full; // set by the producer before it waits for room
+  char fullPadding[CACHE_LINE_SIZE - sizeof(uint32_t)];
+  char data[RING_SIZE];
+};
+
+/// Shared memory of a session. The client creates it, with the server
+/// marked as sleeping on the requests ring.
+struct RingRegion {
+  struct Ring requests;  // tagged requests, client to server
+  struct Ring responses; // tagged responses, server to client
+};
+
+/// Initializes an empty ring.
+/// @param ring Ring to initialize.
+/// @param sleeping Whether the consumer starts out waiting for a wakeup.
+void ring_init(struct Ring *ring, int sleeping);
+
+/// Copies as many bytes as fit into the ring.
+/// @param ring Ring to write to.
+/// @param buffer Bytes to write.
+/// @param size Number of bytes to write.
+/// @return Number of bytes written.
+size_t ring_write(struct Ring *ring, const void *buffer, size_t size);
+
+/// Copies up to size bytes out of the ring.
+/// @param ring Ring to read from.
+/// @param buffer Where to copy the bytes.
+/// @param size Max number of bytes to read.
+/// @return Number of bytes read.
+size_t ring_read(struct Ring *ring, void *buffer, size_t size);
+
+/// Tells the producer whether the consumer must be woken up after new bytes
+/// were written, and if so clears the consumer's sleeping flag.
+/// @param ring Ring that was written to.
+/// @return 1 if the consumer is waiting for a wakeup, 0 otherwise.
+int ring_wake_consumer(struct Ring *ring);
+
+/// Marks the consumer as sleeping, unless bytes arrived in the meantime.
+/// @param ring Ring being consumed.
+/// @return 1 if the consumer may wait for a wakeup, 0 if there are bytes to read.
+int ring_sleep(struct Ring *ring);
+
+/// Marks the producer as waiting for room, unless the consumer made some in
+/// the meantime.
+/// @param ring Ring being produced to.
+/// @return 1 if the producer may wait for a wakeup, 0 if there is room.
+int ring_wait_room(struct Ring *ring);
+
+/// Tells the consumer whether the producer must be woken up after bytes
+/// were read, and if so clears the producer's waiting flag.
+/// @param ring Ring that was read from.
+/// @return 1 if the producer is waiting for room, 0 otherwise.
+int ring_wake_producer(struct Ring *ring);
+
+#endif  // COMMON_RING_H
@@ -0,0 +1,48 @@
+#include "varint.h"
+
+#include <stdio.h>
+
+#include "src/common/io.h"
+
+size_t varint_encode(uint64_t value, char *buffer) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    buffer[size++] = (char)((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  buffer[size++] = (char)value;
+  return size;
+}
+
+int varint_decode(const char *buffer, size_t length, uint64_t *value, size_t *size) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < VARINT_MAX_SIZE; i++) {
+    if (i == length) {
+      return 1;
+    }
+    unsigned char byte = (unsigned char)buffer[i];
+    result |= (uint64_t)(byte & 0x7F) << (7 * i);
+    if (!(byte & 0x80)) {
+      *value = result;
+      *size = i + 1;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int varint_read(int fd, uint64_t *value, int *intr) {
+  char buffer[VARINT_MAX_SIZE];
+  for (size_t i = 0; i < VARINT_MAX_SIZE; i++) {
+    int status = read_all(fd, buffer + i, 1, intr);
+    if (status != 1) {
+      return status;
+    }
+    if (!((unsigned char)buffer[i] & 0x80)) {
+      size_t size;
+      return varint_decode(buffer, i + 1, value, &size) == 0 ? 1 : -1;
+    }
+  }
+  fprintf(stderr, "Malformed length\n");
+  return -1;
+}
@@ -0,0 +1,34 @@
+#ifndef COMMON_VARINT_H
+#define COMMON_VARINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Varints hold 7 bits per byte, least significant first, with the high bit
+// set on every byte but the last. Values below 128 take one byte.
+#define VARINT_MAX_SIZE 10
+
+/// Encodes a value as a varint.
+/// @param value
+/// @param buffer Buffer of at least VARINT_MAX_SIZE bytes.
+/// @return number of bytes written
+size_t varint_encode(uint64_t value, char *buffer);
+
+/// Decodes a varint at the start of a buffer.
+/// @param buffer
+/// @param length Number of bytes available.
+/// @param value Where to store the value.
+/// @param size Where to store the number of bytes the varint takes.
+/// @return 0 on success, 1 if the buffer ends before the varint does, -1 if
+/// the varint is longer than VARINT_MAX_SIZE
+int varint_decode(const char *buffer, size_t length, uint64_t *value, size_t *size);
+
+/// Reads a varint from a file descriptor, one byte at a time.
+/// @param fd File descriptor to read from.
+/// @param value Where to store the value.
+/// @param intr As in read_all.
+/// @return On success, returns 1, on end of file, returns 0, on error or if
+/// the varint is malformed, returns -1
+int varint_read(int fd, uint64_t *value, int *intr);
+
+#endif  // COMMON_VARINT_H
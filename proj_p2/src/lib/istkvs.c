@@ -0,0 +1,178 @@
+#include "istkvs.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/common/constants.h"
+#include "src/server/cdc.h"
+#include "src/server/client.h"
+#include "src/server/expiry.h"
+#include "src/server/kvs.h"
+#include "src/server/notifier.h"
+#include "src/server/operations.h"
+
+_Static_assert(ISTKVS_MAX_STRING_SIZE == MAX_STRING_SIZE, "istkvs.h is out of date");
+_Static_assert(ISTKVS_MAX_VALUE_SIZE == MAX_VALUE_SIZE, "istkvs.h is out of date");
+
+struct IstKvs {
+	int open;
+};
+
+struct IstKvsSubscriber {
+	// The server serves each session from one thread at a time, so calls on
+	// the same subscriber are serialized here
+	pthread_mutex_t lock;
+	struct Client *session; // in-process session, not in the connected clients list
+};
+
+static IstKvs store = {0};
+static atomic_flag opened = ATOMIC_FLAG_INIT;
+
+/// Copies a key into the layout the core takes, checking that it fits.
+/// @param key
+/// @param keys Where to copy the key.
+/// @return 0 if the key is valid, 1 otherwise
+static int copy_key(const char *key, char keys[1][MAX_STRING_SIZE]) {
+	size_t length = strlen(key);
+	if (length == 0 || length >= MAX_STRING_SIZE) return 1;
+	memcpy(keys[0], key, length + 1);
+	return 0;
+}
+
+IstKvs *istkvs_open(const char *cdc_path) {
+	// The notifier threads and the CDC stream live as long as the process,
+	// the expiry thread as long as the store
+	if (atomic_flag_test_and_set(&opened)) {
+		fprintf(stderr, "The KVS is already open\n");
+		return NULL;
+	}
+	if (kvs_init() || notifier_init(NOTIFY_COALESCE) ||
+		(cdc_path != NULL && cdc_init(cdc_path)) || expiry_init(NULL)) {
+		fprintf(stderr, "Failed to initialize KVS\n");
+		return NULL;
+	}
+	store.open = 1;
+	return &store;
+}
+
+int istkvs_close(IstKvs *kvs) {
+	if (kvs == NULL || !kvs->open) return 1;
+	kvs->open = 0;
+	expiry_stop();
+	return kvs_terminate();
+}
+
+int istkvs_put(IstKvs *kvs, const char *key, const char *value) {
+	return istkvs_put_value(kvs, key, value, strnlen(value, MAX_VALUE_SIZE + 1));
+}
+
+int istkvs_put_value(IstKvs *kvs, const char *key, const void *value, size_t length) {
+	return istkvs_put_ttl(kvs, key, value, length, 0);
+}
+
+int istkvs_put_ttl(IstKvs *kvs, const char *key, const void *value, size_t length,
+				   unsigned int ttl_ms) {
+	char keys[1][MAX_STRING_SIZE];
+	const char *values[1] = {value};
+	if (kvs == NULL || copy_key(key, keys) || hash(key) < 0 || length > MAX_VALUE_SIZE) {
+		return 1;
+	}
+	return kvs_write(1, keys, values, &length, ttl_ms);
+}
+
+int istkvs_expire(IstKvs *kvs, const char *key, unsigned int ttl_ms) {
+	char keys[1][MAX_STRING_SIZE];
+	if (kvs == NULL || copy_key(key, keys)) return -1;
+
+	int found[1];
+	if (kvs_expire_batch(1, keys, ttl_ms, found)) return -1;
+	return found[0];
+}
+
+int istkvs_get(IstKvs *kvs, const char *key, char value[ISTKVS_MAX_STRING_SIZE]) {
+	char *whole;
+	size_t length;
+	int found = istkvs_get_value(kvs, key, &whole, &length);
+	if (found != 1) return found;
+	snprintf(value, MAX_STRING_SIZE, "%s", whole);
+	free(whole);
+	return 1;
+}
+
+int istkvs_get_value(IstKvs *kvs, const char *key, char **value, size_t *length) {
+	char keys[1][MAX_STRING_SIZE];
+	if (kvs == NULL || copy_key(key, keys)) return -1;
+
+	if (kvs_get(1, keys, value, length)) return -1;
+	return *value != NULL;
+}
+
+int istkvs_delete(IstKvs *kvs, const char *key) {
+	char keys[1][MAX_STRING_SIZE];
+	if (kvs == NULL || copy_key(key, keys)) return -1;
+
+	int deleted[1];
+	if (kvs_del(1, keys, deleted)) return -1;
+	return deleted[0];
+}
+
+int istkvs_scan(IstKvs *kvs, const char *prefix, IstKvsVisit visit, void *context) {
+	if (kvs == NULL) return 1;
+	return kvs_scan(prefix, visit, context);
+}
+
+int istkvs_snapshot(IstKvs *kvs, int fd) {
+	if (kvs == NULL) return 1;
+	return kvs_snapshot(fd);
+}
+
+IstKvsSubscriber *istkvs_subscriber_create(IstKvs *kvs, IstKvsNotify notify, void *context) {
+	if (kvs == NULL) return NULL;
+	IstKvsSubscriber *subscriber = malloc(sizeof(IstKvsSubscriber));
+	if (subscriber == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+	if (pthread_mutex_init(&subscriber->lock, NULL)) {
+		free(subscriber);
+		return NULL;
+	}
+	if (kvs_open_local(notify, context, &subscriber->session)) {
+		pthread_mutex_destroy(&subscriber->lock);
+		free(subscriber);
+		return NULL;
+	}
+	return subscriber;
+}
+
+int istkvs_subscribe(IstKvsSubscriber *subscriber, const char *key) {
+	char keys[1][MAX_STRING_SIZE];
+	if (copy_key(key, keys)) return -1;
+
+	int subscribed[1];
+	pthread_mutex_lock(&subscriber->lock);
+	int error = kvs_subscribe_batch(1, keys, subscriber->session, subscribed);
+	pthread_mutex_unlock(&subscriber->lock);
+	return error ? -1 : subscribed[0];
+}
+
+int istkvs_unsubscribe(IstKvsSubscriber *subscriber, const char *key) {
+	char keys[1][MAX_STRING_SIZE];
+	if (copy_key(key, keys)) return -1;
+
+	int removed[1];
+	pthread_mutex_lock(&subscriber->lock);
+	int error = kvs_unsubscribe_batch(1, keys, subscriber->session, removed);
+	pthread_mutex_unlock(&subscriber->lock);
+	return error ? -1 : removed[0];
+}
+
+void istkvs_subscriber_destroy(IstKvsSubscriber *subscriber) {
+	if (subscriber == NULL) return;
+	kvs_close_local(subscriber->session);
+	pthread_mutex_destroy(&subscriber->lock);
+	free(subscriber);
+}
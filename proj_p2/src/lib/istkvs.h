@@ -0,0 +1,148 @@
+#ifndef ISTKVS_H
+#define ISTKVS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// In-process IST-KVS, linked from libistkvs.a or libistkvs.so. It is the
+// store the kvs server serves, with the same semantics: writes are logged
+// with a sequence number and notify the subscribers of the key and of the
+// patterns matching it, and keys given a TTL are deleted once it runs out.
+// Every function may be called from any thread.
+//
+// The store is process wide, so istkvs_open succeeds once per process.
+
+#define ISTKVS_MAX_STRING_SIZE 40         // keys are shorter than this
+#define ISTKVS_MAX_VALUE_SIZE (16 << 20) // values take at most this many bytes
+
+typedef struct IstKvs IstKvs;
+typedef struct IstKvsSubscriber IstKvsSubscriber;
+
+/// Receives the changes to the keys a subscriber watches, on a notifier
+/// thread, one at a time per subscriber. A subscriber that falls behind
+/// only gets the latest value of each key.
+/// @param key
+/// @param value New value, "DELETE" for a delete. Whole and null
+/// terminated, but it may hold '\0' bytes.
+/// @param length Bytes in the value.
+/// @param seq Sequence number of the change.
+/// @param context As given to istkvs_subscriber_create.
+typedef void (*IstKvsNotify)(const char *key, const char *value, size_t length, uint64_t seq,
+							 void *context);
+
+/// Receives a pair found by istkvs_scan.
+/// @param key
+/// @param value Whole and null terminated, but it may hold '\0' bytes.
+/// @param length Bytes in the value.
+/// @param context As given to istkvs_scan.
+typedef void (*IstKvsVisit)(const char *key, const char *value, size_t length, void *context);
+
+/// Opens the store.
+/// @param cdc_path Log file or FIFO to stream the changes to, as the server
+/// does, NULL for none.
+/// @return the store, NULL on error or if it is already open
+IstKvs *istkvs_open(const char *cdc_path);
+
+/// Closes the store and frees its pairs. Subscribers must be destroyed first.
+/// @param kvs
+/// @return 0 if successful, 1 otherwise
+int istkvs_close(IstKvs *kvs);
+
+/// Writes a pair, replacing the value of an existing key and making it
+/// persistent.
+/// @param kvs
+/// @param key Alphanumeric key, shorter than ISTKVS_MAX_STRING_SIZE.
+/// @param value Null terminated, at most ISTKVS_MAX_VALUE_SIZE bytes.
+/// @return 0 if successful, 1 otherwise
+int istkvs_put(IstKvs *kvs, const char *key, const char *value);
+
+/// Writes a pair whose value may hold any byte.
+/// @param kvs
+/// @param key Alphanumeric key, shorter than ISTKVS_MAX_STRING_SIZE.
+/// @param value
+/// @param length Bytes in the value, at most ISTKVS_MAX_VALUE_SIZE.
+/// @return 0 if successful, 1 otherwise
+int istkvs_put_value(IstKvs *kvs, const char *key, const void *value, size_t length);
+
+/// Writes a pair that expires, as istkvs_put_value.
+/// @param kvs
+/// @param key Alphanumeric key, shorter than ISTKVS_MAX_STRING_SIZE.
+/// @param value
+/// @param length Bytes in the value, at most ISTKVS_MAX_VALUE_SIZE.
+/// @param ttl_ms Milliseconds until the key is deleted, 0 for never.
+/// @return 0 if successful, 1 otherwise
+int istkvs_put_ttl(IstKvs *kvs, const char *key, const void *value, size_t length,
+				   unsigned int ttl_ms);
+
+/// Sets when an existing key expires. Subscribers see it deleted then.
+/// @param kvs
+/// @param key
+/// @param ttl_ms Milliseconds until the key is deleted, 0 for never.
+/// @return 1 if the key exists, 0 if it does not, -1 on error
+int istkvs_expire(IstKvs *kvs, const char *key, unsigned int ttl_ms);
+
+/// Reads the value of a key, cut to ISTKVS_MAX_STRING_SIZE - 1 bytes.
+/// @param kvs
+/// @param key
+/// @param value Where to store the value.
+/// @return 1 if the key exists, 0 if it does not, -1 on error
+int istkvs_get(IstKvs *kvs, const char *key, char value[ISTKVS_MAX_STRING_SIZE]);
+
+/// Reads the whole value of a key.
+/// @param kvs
+/// @param key
+/// @param value Set to a null terminated copy of the value, which the
+/// caller must free.
+/// @param length Set to the bytes in the value.
+/// @return 1 if the key exists, 0 if it does not, -1 on error
+int istkvs_get_value(IstKvs *kvs, const char *key, char **value, size_t *length);
+
+/// Deletes a key.
+/// @param kvs
+/// @param key
+/// @return 1 if the key was deleted, 0 if it did not exist, -1 on error
+int istkvs_delete(IstKvs *kvs, const char *key);
+
+/// Visits the pairs whose keys start with a prefix. Keys are grouped by
+/// first character, and each group is read atomically; a pair written
+/// during the scan may or may not be seen. The visitor may use the store.
+/// @param kvs
+/// @param prefix "" for every pair.
+/// @param visit
+/// @param context Passed to visit.
+/// @return 0 if successful, 1 otherwise
+int istkvs_scan(IstKvs *kvs, const char *prefix, IstKvsVisit visit, void *context);
+
+/// Writes every pair, as the server's backup files do, while writes wait.
+/// @param kvs
+/// @param fd File descriptor to write to, left open.
+/// @return 0 if successful, 1 otherwise
+int istkvs_snapshot(IstKvs *kvs, int fd);
+
+/// Creates a subscriber, which watches keys and patterns for a callback.
+/// @param kvs
+/// @param notify Called with each change.
+/// @param context Passed to notify.
+/// @return the subscriber, NULL on error
+IstKvsSubscriber *istkvs_subscriber_create(IstKvs *kvs, IstKvsNotify notify, void *context);
+
+/// Watches a key, or every key with a prefix when the key ends with '*'.
+/// A key that does not exist yet is watched until it is written.
+/// @param subscriber
+/// @param key
+/// @return 1 if the key exists or is a pattern, 0 if it is watched until it
+/// is written, -1 if it cannot be watched or on error
+int istkvs_subscribe(IstKvsSubscriber *subscriber, const char *key);
+
+/// Stops watching a key or pattern.
+/// @param subscriber
+/// @param key
+/// @return 1 if it was watched, 0 if not, -1 on error
+int istkvs_unsubscribe(IstKvsSubscriber *subscriber, const char *key);
+
+/// Destroys a subscriber. Waits for its callback to return if it is running,
+/// so it must not be called from the callback.
+/// @param subscriber
+void istkvs_subscriber_destroy(IstKvsSubscriber *subscriber);
+
+#endif  // ISTKVS_H
@@ -0,0 +1,322 @@
+#include "cdc.h"
+#include "changelog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+// What the CDC thread waits for, which tells writers whether to wake it
+enum {
+	WAIT_NONE,  // not waiting, or waiting for a timeout only
+	WAIT_IDLE,  // caught up, waiting for the next change
+	WAIT_BATCH, // letting a batch grow, woken early if it grows large
+};
+
+static int enabled = 0;
+static int isFifo = 0;
+static int rotates = 0; // only a regular file is rotated
+static int fdSink = -1;
+static off_t sinkSize = 0; // bytes in the log file
+static char sinkPath[PATH_MAX];
+static char rotatedPath[PATH_MAX];
+
+// The CDC thread reads the changes back from the change log, in sequence
+// order, so writers never wait for the sink. A change evicted from the log
+// before it is streamed is dropped. The buffer grows past CDC_BUFFER_SIZE
+// to hold a record of a large value whole.
+static char *buffer;
+static size_t capacity;
+static uint64_t nextSeq = 1;                 // next change to stream, CDC thread only
+static atomic_uint_fast64_t streamedSeq = 0; // last change streamed or dropped
+static int fdWork = -1; // eventfd, signaled by writers when the CDC thread waits
+static atomic_int waiting = WAIT_NONE;
+static atomic_ulong recordsWritten = 0;
+static atomic_ulong recordsDropped = 0;
+
+/// Writes to the sink without reporting a FIFO reader that left.
+/// @return 0 if successful, otherwise the errno of the failed write
+static int write_sink(const char *bytes, size_t size) {
+	size_t written = 0;
+	while (written < size) {
+		ssize_t result = write(fdSink, bytes + written, size - written);
+		if (result == -1) {
+			if (errno == EINTR) continue;
+			return errno;
+		}
+		written += (size_t) result;
+	}
+	return 0;
+}
+
+/// Opens the sink and writes the magic. A FIFO is only opened if a reader
+/// has it open, so the CDC thread never waits in open for one.
+/// @return 0 if successful, 1 otherwise
+static int open_sink(void) {
+	int flags = isFifo ? O_WRONLY | O_NONBLOCK : O_WRONLY | O_CREAT | O_APPEND;
+	fdSink = open(sinkPath, flags, 0644);
+	if (fdSink == -1) {
+		if (!isFifo || errno != ENXIO) perror("Failed to open CDC stream");
+		return 1;
+	}
+	// Only the CDC thread waits for a slow reader
+	if ((isFifo && fcntl(fdSink, F_SETFL, 0) == -1) || write_sink(CDC_MAGIC, CDC_MAGIC_SIZE)) {
+		close(fdSink);
+		fdSink = -1;
+		return 1;
+	}
+	sinkSize = CDC_MAGIC_SIZE;
+	return 0;
+}
+
+/// Moves the log file to rotatedPath, replacing the previous one.
+/// @return 0 if successful, 1 otherwise
+static int rotate_sink(void) {
+	if (rename(sinkPath, rotatedPath)) {
+		perror("Failed to rotate CDC log");
+		return 1;
+	}
+	return 0;
+}
+
+/// Writes a batch of changes, rotating the log file when it is full.
+/// @return 0 if the batch was written, 1 if the sink is closed
+static int write_batch(const char *batch, size_t size) {
+	if (rotates && sinkSize + (off_t) size > CDC_ROTATE_SIZE && sinkSize > CDC_MAGIC_SIZE) {
+		close(fdSink);
+		fdSink = -1;
+		if (rotate_sink() == 0) open_sink();
+	}
+	if (fdSink == -1) return 1;
+
+	int error = write_sink(batch, size);
+	if (error == 0) {
+		sinkSize += (off_t) size;
+		return 0;
+	}
+	close(fdSink);
+	fdSink = -1;
+	// A FIFO reader that left is not an error, the next one gets the batch
+	if (!isFifo || error != EPIPE) {
+		fprintf(stderr, "Failed to write CDC stream: %s\n", strerror(error));
+	}
+	return 1;
+}
+
+/// Waits for a writer to signal the eventfd, for the FIFO reader to leave,
+/// in which case the FIFO is closed so the next reader starts at the magic,
+/// or for a timeout. Waiting in poll instead of on a condition sees the
+/// reader leave at once, before a new one could open the FIFO and read the
+/// rest of the old stream.
+/// @param state What the thread waits for, see the WAIT_ values.
+/// @param timeout_ms Longest wait, -1 for no limit.
+static void wait_work(int state, int timeout_ms) {
+	atomic_store(&waiting, state);
+	// Pairs with the fence of cdc_wake, so a change logged before waiting
+	// was set is seen here
+	atomic_thread_fence(memory_order_seq_cst);
+	if (state == WAIT_IDLE && changelog_last_seq() >= nextSeq) {
+		atomic_store(&waiting, WAIT_NONE);
+		return;
+	}
+
+	struct pollfd pfds[2] = {
+		{.fd = fdWork, .events = POLLIN},
+		{.fd = isFifo ? fdSink : -1, .events = 0},
+	};
+	int ready = poll(pfds, 2, timeout_ms);
+	atomic_store(&waiting, WAIT_NONE);
+	if (ready <= 0) return;
+	if (pfds[0].revents & POLLIN) {
+		uint64_t count;
+		if (read(fdWork, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+			perror("Failed to read eventfd");
+		}
+	}
+	if (pfds[1].revents & POLLERR) {
+		close(fdSink);
+		fdSink = -1;
+	}
+}
+
+/// Skips changes that will not be streamed.
+/// @param seq First change to stream afterwards.
+static void drop_changes(uint64_t seq) {
+	atomic_fetch_add_explicit(&recordsDropped, seq - nextSeq, memory_order_relaxed);
+	nextSeq = seq;
+	atomic_store_explicit(&streamedSeq, seq - 1, memory_order_relaxed);
+}
+
+/// Adds the record of a change to the buffer.
+/// @param record
+/// @param size Bytes in the buffer, updated.
+/// @return 0 if it was added, 1 if the buffer could not grow to hold it
+static int encode_record(const ChangeRecord *record, size_t *size) {
+	size_t valueLength = record->deleted ? 0 : record->valueLength;
+	const char *value = record->largeValue != NULL ? record->largeValue : record->value;
+	size_t keyLength = strnlen(record->key, BATCH_MAX_STRING_LENGTH);
+	char lengthVarint[VARINT_MAX_SIZE];
+	size_t lengthSize = varint_encode(valueLength, lengthVarint);
+	size_t recordSize = CDC_RECORD_HEADER_SIZE + keyLength + lengthSize + valueLength;
+	if (*size + recordSize > capacity) {
+		char *grown = realloc(buffer, *size + recordSize);
+		if (grown == NULL) return 1;
+		buffer = grown;
+		capacity = *size + recordSize;
+	}
+
+	char *bytes = buffer + *size;
+	memcpy(bytes, &record->seq, sizeof(record->seq));
+	memcpy(bytes + sizeof(record->seq), &record->timestamp, sizeof(record->timestamp));
+	bytes[2 * sizeof(uint64_t)] = record->deleted ? CDC_DELETE : CDC_WRITE;
+	bytes[CDC_RECORD_HEADER_SIZE - 1] = (char) keyLength;
+	memcpy(bytes + CDC_RECORD_HEADER_SIZE, record->key, keyLength);
+	memcpy(bytes + CDC_RECORD_HEADER_SIZE + keyLength, lengthVarint, lengthSize);
+	memcpy(bytes + CDC_RECORD_HEADER_SIZE + keyLength + lengthSize, value, valueLength);
+	*size += recordSize;
+	return 0;
+}
+
+/// Streams the next changes of the change log, oldest first.
+/// @return 1 if changes were streamed or dropped and more may follow, 0 if
+/// there were none or the FIFO reader left
+static int stream_changes(void) {
+	ChangeRecord records[CDC_BATCH_RECORDS];
+	size_t count;
+	if (changelog_read(nextSeq - 1, records, CDC_BATCH_RECORDS, CDC_BUFFER_SIZE, &count)) {
+		// Evicted before the sink took them
+		uint64_t first = changelog_first_seq();
+		if (first <= nextSeq) return 0;
+		drop_changes(first);
+		return 1;
+	}
+	if (count == 0) return 0;
+
+	size_t size = 0;
+	unsigned long encoded = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (encode_record(&records[i], &size)) {
+			fprintf(stderr, "Failed to grow CDC buffer, change %lu not streamed\n",
+					(unsigned long) records[i].seq);
+			atomic_fetch_add_explicit(&recordsDropped, 1, memory_order_relaxed);
+			continue;
+		}
+		encoded++;
+	}
+	uint64_t last = records[count - 1].seq;
+	changelog_release(records, count);
+
+	if (size > 0 && write_batch(buffer, size)) {
+		// Read again from the change log for the next reader
+		if (isFifo) return 0;
+		atomic_fetch_add_explicit(&recordsDropped, encoded, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&recordsWritten, encoded, memory_order_relaxed);
+	}
+	nextSeq = last + 1;
+	atomic_store_explicit(&streamedSeq, last, memory_order_relaxed);
+	return 1;
+}
+
+static void *cdc_thread(void *arg) {
+	(void) arg;
+	for (;;) {
+		if (fdSink == -1 && isFifo && open_sink()) {
+			// No reader yet, the changes wait in the change log meanwhile
+			wait_work(WAIT_NONE, CDC_REOPEN_INTERVAL_MS);
+			continue;
+		}
+		if (stream_changes()) continue;
+		if (fdSink == -1 && isFifo) continue;
+
+		// Caught up: sleep until the next change, then let a small batch
+		// grow for up to CDC_FLUSH_INTERVAL_MS
+		wait_work(WAIT_IDLE, -1);
+		wait_work(WAIT_BATCH, CDC_FLUSH_INTERVAL_MS);
+	}
+	return NULL;
+}
+
+int cdc_init(const char *path) {
+	if (snprintf(sinkPath, sizeof(sinkPath), "%s", path) >= (int) sizeof(sinkPath) ||
+		snprintf(rotatedPath, sizeof(rotatedPath), "%s.1", path) >= (int) sizeof(rotatedPath)) {
+		fprintf(stderr, "CDC stream path too long\n");
+		return 1;
+	}
+
+	struct stat st;
+	if (stat(path, &st) == 0) {
+		isFifo = S_ISFIFO(st.st_mode);
+		rotates = S_ISREG(st.st_mode);
+		// Start a new log instead of appending to the one of an earlier run
+		if (rotates && st.st_size > 0 && rotate_sink()) return 1;
+	} else if (errno == ENOENT) {
+		rotates = 1;
+	} else {
+		perror("Failed to open CDC stream");
+		return 1;
+	}
+	if (!isFifo && open_sink()) return 1;
+
+	fdWork = eventfd(0, EFD_NONBLOCK);
+	if (fdWork == -1) {
+		perror("Failed to create eventfd");
+		return 1;
+	}
+	buffer = malloc(CDC_BUFFER_SIZE);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	capacity = CDC_BUFFER_SIZE;
+	nextSeq = changelog_last_seq() + 1;
+	atomic_store(&streamedSeq, nextSeq - 1);
+
+	enabled = 1;
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, cdc_thread, NULL)) {
+		enabled = 0;
+		fprintf(stderr, "Failed to create thread\n");
+		return 1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
+void cdc_wake(uint64_t seq) {
+	if (!enabled) return;
+
+	// Pairs with the fence of wait_work
+	atomic_thread_fence(memory_order_seq_cst);
+	int state = atomic_load_explicit(&waiting, memory_order_relaxed);
+	uint64_t lag = seq - atomic_load_explicit(&streamedSeq, memory_order_relaxed);
+	if (state != WAIT_IDLE && (state != WAIT_BATCH || lag < CDC_WAKE_CHANGES)) return;
+	// Only the writer that takes the state signals
+	if (!atomic_compare_exchange_strong(&waiting, &state, WAIT_NONE)) return;
+	uint64_t one = 1;
+	if (write(fdWork, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+		perror("Failed to signal eventfd");
+	}
+}
+
+unsigned long cdc_records_written(void) {
+	return atomic_load_explicit(&recordsWritten, memory_order_relaxed);
+}
+
+unsigned long cdc_lag(void) {
+	if (!enabled) return 0;
+	return (unsigned long) (changelog_last_seq() -
+							atomic_load_explicit(&streamedSeq, memory_order_relaxed));
+}
+
+unsigned long cdc_records_dropped(void) {
+	return atomic_load_explicit(&recordsDropped, memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+#ifndef KVS_CDC_H
+#define KVS_CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "src/common/cdc.h"
+
+/// Starts streaming the committed changes to a log file or a FIFO, in the
+/// format of src/common/cdc.h. A thread reads them back from the change log,
+/// so a sink that falls behind never slows writers down: the changes it
+/// misses are dropped. A log file is rotated to "<path>.1" when it reaches
+/// CDC_ROTATE_SIZE, and so is a log left by an earlier run. A FIFO is opened
+/// once a reader opens it, and again each time the reader leaves.
+/// @param path Path of the log file or FIFO.
+/// @return 0 on success, 1 otherwise
+int cdc_init(const char *path);
+
+/// Tells the CDC thread a change was logged, waking it if it waits for
+/// one. Never blocks.
+/// @param seq Sequence number of the change.
+void cdc_wake(uint64_t seq);
+
+/// Gets how many changes were written to the sink.
+/// @return the number of changes, 0 if the stream is off
+unsigned long cdc_records_written(void);
+
+/// Gets how many changes were logged but neither streamed nor dropped yet.
+/// @return the number of changes, 0 if the stream is off
+unsigned long cdc_lag(void);
+
+/// Gets how many changes were evicted from the change log before the sink
+/// took them, or failed to be written to a log file.
+/// @return the number of changes, 0 if the stream is off
+unsigned long cdc_records_dropped(void);
+
+#endif  // KVS_CDC_H
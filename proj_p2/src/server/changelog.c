@@ -0,0 +1,203 @@
+#include "changelog.h"
+#include "cdc.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/common/protocol.h"
+
+// A slot of the ring. Its lock is held only to copy a record in or out,
+// so writers of different changes never wait for each other.
+typedef struct LogSlot {
+	atomic_int busy;
+	ChangeRecord record;
+} LogSlot;
+
+// Change seq lives in slot seq % CHANGE_LOG_CAPACITY until it is evicted
+static LogSlot ring[CHANGE_LOG_CAPACITY];
+// Last sequence number handed out. Its change may still be being copied
+// into its slot, readers stop there.
+static atomic_uint_fast64_t lastSeq = 0;
+// Oldest change not evicted to keep the large values within budget, and
+// the bytes of large values held by the ring
+static atomic_uint_fast64_t firstKept = 1;
+static atomic_size_t largeBytes = 0;
+
+/// @brief Takes the lock of a slot.
+/// @param slot
+static void lock_slot(LogSlot *slot) {
+	while (atomic_exchange_explicit(&slot->busy, 1, memory_order_acquire)) {
+		while (atomic_load_explicit(&slot->busy, memory_order_relaxed)) sched_yield();
+	}
+}
+
+/// @brief Releases the lock of a slot, publishing its record.
+/// @param slot
+static void unlock_slot(LogSlot *slot) {
+	atomic_store_explicit(&slot->busy, 0, memory_order_release);
+}
+
+/// @brief Evicts the changes before a sequence number, unless they already are.
+/// @param seq
+static void keep_from(uint64_t seq) {
+	uint64_t first = atomic_load_explicit(&firstKept, memory_order_relaxed);
+	while (first < seq && !atomic_compare_exchange_weak_explicit(&firstKept, &first, seq,
+																 memory_order_relaxed,
+																 memory_order_relaxed));
+}
+
+/// @brief Tells whether a record lost the large value it needs.
+/// @param record
+static int value_dropped(const ChangeRecord *record) {
+	return !record->deleted && record->valueLength > BATCH_MAX_STRING_LENGTH &&
+		   record->largeValue == NULL;
+}
+
+/// @brief Drops the large value of a change, if its slot still holds it.
+/// @param seq
+static void drop_large_value(uint64_t seq) {
+	LogSlot *slot = &ring[seq % CHANGE_LOG_CAPACITY];
+	lock_slot(slot);
+	char *largeValue = NULL;
+	size_t length = slot->record.valueLength;
+	if (slot->record.seq == seq) {
+		largeValue = slot->record.largeValue;
+		slot->record.largeValue = NULL;
+	}
+	unlock_slot(slot);
+	if (largeValue == NULL) return;
+	atomic_fetch_sub_explicit(&largeBytes, length, memory_order_relaxed);
+	free(largeValue);
+}
+
+uint64_t changelog_append(const char *key, const char *value, size_t valueLength) {
+	// Copied before the change is numbered, with no lock but the bucket's
+	char *largeValue = NULL;
+	int lost = 0;
+	if (value != NULL && valueLength > BATCH_MAX_STRING_LENGTH) {
+		largeValue = malloc(valueLength + 1);
+		if (largeValue == NULL) {
+			lost = 1;
+		} else {
+			memcpy(largeValue, value, valueLength);
+			largeValue[valueLength] = '\0';
+		}
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	uint64_t seq = atomic_fetch_add_explicit(&lastSeq, 1, memory_order_relaxed) + 1;
+	LogSlot *slot = &ring[seq % CHANGE_LOG_CAPACITY];
+	lock_slot(slot);
+	ChangeRecord *record = &slot->record;
+	// A writer a whole ring ahead may have taken the slot first
+	if (record->seq > seq) {
+		unlock_slot(slot);
+		free(largeValue);
+		cdc_wake(seq);
+		return seq;
+	}
+	char *evicted = record->largeValue;
+	size_t evictedLength = record->valueLength;
+
+	record->seq = seq;
+	record->timestamp = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+	record->deleted = value == NULL;
+	strncpy(record->key, key, MAX_STRING_SIZE - 1);
+	record->key[MAX_STRING_SIZE - 1] = '\0';
+	if (value == NULL) {
+		strcpy(record->value, "DELETE");
+		record->valueLength = strlen(record->value);
+	} else {
+		size_t inlined = valueLength < BATCH_MAX_STRING_LENGTH ? valueLength : BATCH_MAX_STRING_LENGTH;
+		memcpy(record->value, value, inlined);
+		record->value[inlined] = '\0';
+		record->valueLength = valueLength;
+	}
+	record->largeValue = largeValue;
+	// Resuming past this change would miss its value
+	if (lost) keep_from(seq + 1);
+	unlock_slot(slot);
+
+	if (evicted != NULL) {
+		atomic_fetch_sub_explicit(&largeBytes, evictedLength, memory_order_relaxed);
+		free(evicted);
+	}
+	if (largeValue != NULL &&
+		atomic_fetch_add_explicit(&largeBytes, valueLength, memory_order_relaxed) + valueLength >
+				CHANGE_LOG_VALUE_BYTES) {
+		// Over budget, the oldest changes go first, as they would on a full ring
+		if (seq > CHANGE_LOG_CAPACITY) keep_from(seq - CHANGE_LOG_CAPACITY + 1);
+		uint64_t first = atomic_load_explicit(&firstKept, memory_order_relaxed);
+		while (atomic_load_explicit(&largeBytes, memory_order_relaxed) > CHANGE_LOG_VALUE_BYTES &&
+			   first < seq) {
+			if (atomic_compare_exchange_weak_explicit(&firstKept, &first, first + 1,
+													  memory_order_relaxed, memory_order_relaxed)) {
+				drop_large_value(first++);
+			}
+		}
+	}
+	cdc_wake(seq);
+	return seq;
+}
+
+int changelog_read(uint64_t after, ChangeRecord records[], size_t max, size_t maxBytes,
+				   size_t *count) {
+	*count = 0;
+	uint64_t last = atomic_load_explicit(&lastSeq, memory_order_relaxed);
+	// Numbers past the last change were handed out by an earlier run of the server
+	if (after > last || after + 1 < changelog_first_seq()) return 1;
+
+	size_t bytes = 0;
+	for (uint64_t seq = after + 1; seq <= last && *count < max; seq++) {
+		LogSlot *slot = &ring[seq % CHANGE_LOG_CAPACITY];
+		lock_slot(slot);
+		const ChangeRecord *record = &slot->record;
+		// Still being logged, or evicted since the read started
+		int evicted = record->seq > seq || (record->seq == seq && value_dropped(record));
+		if (record->seq != seq || evicted) {
+			unlock_slot(slot);
+			if (evicted && *count == 0) return 1;
+			break;
+		}
+		ChangeRecord *copy = &records[*count];
+		*copy = *record;
+		if (record->largeValue != NULL) {
+			if (*count > 0 && bytes + record->valueLength > maxBytes) {
+				unlock_slot(slot);
+				break;
+			}
+			copy->largeValue = malloc(record->valueLength + 1);
+			if (copy->largeValue == NULL) {
+				unlock_slot(slot);
+				break;
+			}
+			memcpy(copy->largeValue, record->largeValue, record->valueLength + 1);
+			bytes += record->valueLength;
+		}
+		unlock_slot(slot);
+		(*count)++;
+	}
+	return 0;
+}
+
+void changelog_release(ChangeRecord records[], size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(records[i].largeValue);
+		records[i].largeValue = NULL;
+	}
+}
+
+uint64_t changelog_last_seq(void) {
+	return atomic_load_explicit(&lastSeq, memory_order_relaxed);
+}
+
+uint64_t changelog_first_seq(void) {
+	uint64_t last = atomic_load_explicit(&lastSeq, memory_order_relaxed);
+	uint64_t oldest = last > CHANGE_LOG_CAPACITY ? last - CHANGE_LOG_CAPACITY + 1 : 1;
+	uint64_t first = atomic_load_explicit(&firstKept, memory_order_relaxed);
+	return oldest > first ? oldest : first;
+}
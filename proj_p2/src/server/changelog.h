@@ -0,0 +1,62 @@
+#ifndef KVS_CHANGELOG_H
+#define KVS_CHANGELOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "src/common/constants.h"
+
+/// A committed change to a key. Changes are numbered from 1 in the order
+/// they are committed, over all keys.
+typedef struct ChangeRecord {
+	uint64_t seq;
+	uint64_t timestamp; // commit time, in nanoseconds since the epoch
+	int deleted;
+	char key[MAX_STRING_SIZE];
+	char value[MAX_STRING_SIZE]; // "DELETE" for a delete, as in notifications
+	size_t valueLength;          // of the whole value, or of "DELETE"
+	// The whole value if it does not fit in value, which holds its first
+	// BATCH_MAX_STRING_LENGTH bytes. Null terminated.
+	char *largeValue;
+} ChangeRecord;
+
+/// Numbers a change and keeps it in the change log, a ring of the last
+/// CHANGE_LOG_CAPACITY changes holding at most CHANGE_LOG_VALUE_BYTES of
+/// large values, which the CDC stream reads. Called with the bucket of the
+/// key write locked, so the changes of a key are numbered in the order they
+/// apply. Writers of other keys are not waited for.
+/// @param key
+/// @param value New value, NULL for a delete.
+/// @param valueLength Number of bytes in the value.
+/// @return the sequence number of the change
+uint64_t changelog_append(const char *key, const char *value, size_t valueLength);
+
+/// Copies the changes that follow a sequence number, oldest first, up to the
+/// first one still being logged. The large values of the copies must be
+/// freed with changelog_release.
+/// @param after Sequence number of the last change the caller has seen.
+/// @param records Where to store the changes.
+/// @param max Max number of changes to copy.
+/// @param maxBytes Max bytes of large values to copy, the first change is
+/// copied anyway.
+/// @param count Set to the number of changes copied.
+/// @return 0 if successful, 1 if changes after `after` were evicted or
+/// `after` was never handed out, in which case nothing is copied
+int changelog_read(uint64_t after, ChangeRecord records[], size_t max, size_t maxBytes,
+				   size_t *count);
+
+/// Frees the large values of changes copied by changelog_read.
+/// @param records
+/// @param count
+void changelog_release(ChangeRecord records[], size_t count);
+
+/// Gets the sequence number of the last change.
+/// @return the sequence number, 0 before the first change
+uint64_t changelog_last_seq(void);
+
+/// Gets the sequence number of the oldest change the log still holds.
+/// @return the sequence number, changelog_last_seq() + 1 if it holds none
+uint64_t changelog_first_seq(void);
+
+#endif  // KVS_CHANGELOG_H
@@ -1,14 +1,45 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <stddef.h>
+
+#include <stdatomic.h>
+
+#include "constants.h"
+#include "io.h"
+#include "kvs.h"
+#include "notifier.h"
+
 typedef struct SubscriptionsKeyNode {
     char *key;
     struct SubscriptionsKeyNode *next;
 } SubscriptionsKeyNode;
 
 struct Client {
-    int fdReq, fdResp, fdNotif;
-    SubscriptionsKeyNode *subscriptions;
+    int fdReq, fdResp, fdNotif; // the same socket on socket sessions
+    int isSocket;
+    int protocol;                   // version the session negotiated, see PROTOCOL_FIXED
+    // Key subscriptions by bucket, each list guarded by its bucket lock
+    Subscription *subscriptions[TABLE_SIZE];
+    atomic_uint subscribedBuckets;  // bit i is set once subscriptions[i] was used
+    SubscriptionsKeyNode *patterns; // pattern subscriptions
+    NotifyQueue *notifications; // notifications waiting to be sent
+    unsigned int slot;       // position in the connected clients list
+    unsigned int generation; // tells apart sessions that reused a slot
+    size_t requestLength;    // bytes buffered in requestBuffer
+    size_t requestCapacity;  // grows to fit the largest request frame
+    char *requestBuffer;
+    size_t responseLength;   // tagged responses not yet written
+    size_t responseCapacity;
+    char *responseBuffer;
+    OutputBuffer unsent;      // responses the client did not take yet
+    int outputWatched;        // whether the responses pipe was added to epoll
+    int closing;              // disconnected, only its last responses are left
+    int passedFds[2];         // fds received on the socket, -1 if none
+    struct RingRegion *rings; // shared rings, NULL until attached
+    int fdRingWakeup;         // eventfd that wakes the client
+    size_t ringLength;        // bytes buffered in ringBuffer
+    char *ringBuffer;         // requests read from the requests ring
 };
 
 #endif
\ No newline at end of file
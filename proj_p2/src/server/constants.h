@@ -2,4 +2,28 @@
 #define MAX_STRING_SIZE 40
 #define MAX_JOB_FILE_NAME_SIZE 256
 
-#define CLIENT_TERMINATED 1
\ No newline at end of file
+#define CLIENT_TERMINATED 1
+
+#define REACTOR_THREAD_COUNT 4    // threads serving the client sessions
+#define NOTIFIER_THREAD_COUNT 2   // threads sending notifications
+#define NOTIFY_QUEUE_CAPACITY 256 // notifications queued per session
+#define NOTIFY_DISCONNECT_THRESHOLD 1024 // drops before a session is disconnected
+#define COMBINING_SPIN_ROUNDS 16 // yields before a flat combining writer waits for a lock
+#define NOTIFY_TEE_MIN_SUBSCRIBERS 4 // pipe subscribers for a notification to be staged
+#define NOTIFY_TEE_MAX_PIPES 256 // staging pipes open at once, each holds an fd
+#define REQUEST_BUFFER_SIZE 4096  // initial request buffer of each session
+#define REQUEST_BUFFER_SHRINK_SIZE (1 << 20) // request buffers larger than this shrink when idle
+#define RESPONSE_BUFFER_SIZE 4096 // initial buffer of the responses a session did not take yet
+#define CONNECT_TIMEOUT_MS 1000 // how long a client has to open its pipes
+#define SOCKET_PATH_SUFFIX ".sock" // appended to the registry FIFO path
+#define CHANGE_LOG_CAPACITY 16384 // changes kept for sessions resuming their notifications
+#define CHANGE_LOG_VALUE_BYTES (64 << 20) // bytes of large values kept in the change log
+#define RESUME_MAX_VALUE_BYTES (4 << 20)  // bytes of large values in one RESUME page
+#define CDC_BUFFER_SIZE (1 << 20) // bytes of changes batched for the CDC stream
+#define CDC_FLUSH_INTERVAL_MS 10  // longest a change waits to be written to the CDC stream
+#define CDC_BATCH_RECORDS 1024    // changes read from the change log per CDC batch
+#define CDC_WAKE_CHANGES (CHANGE_LOG_CAPACITY / 4) // changes behind that end the CDC flush wait
+#define CDC_REOPEN_INTERVAL_MS 100 // how often a CDC FIFO without a reader is opened again
+#define CDC_ROTATE_SIZE (64L << 20) // size at which the CDC log file is rotated
+#define EXPIRY_INTERVAL_MS 5 // how often the keys due are expired
+#define EXPIRY_BATCH_SIZE 64 // keys expired per hold of a bucket lock
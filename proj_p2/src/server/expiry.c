@@ -0,0 +1,60 @@
+#include "expiry.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "kvs.h"
+#include "operations.h"
+#include "timers.h"
+#include "src/common/io.h"
+
+static pthread_t thread;
+static pthread_rwlock_t *outerLock = NULL;
+static atomic_int running = 0;
+
+static void *expiry_thread(void *arg) {
+	(void) arg;
+	while (atomic_load_explicit(&running, memory_order_relaxed)) {
+		uint64_t now = timers_now();
+		int due[TABLE_SIZE];
+		for (int i = 0; i < TABLE_SIZE; i++) due[i] = 1;
+
+		// One batch from each bucket with keys due, until none has
+		int pending = TABLE_SIZE;
+		while (pending > 0) {
+			for (int i = 0; i < TABLE_SIZE; i++) {
+				if (!due[i]) continue;
+				if (outerLock != NULL && pthread_rwlock_rdlock(outerLock)) {
+					fprintf(stderr, "Failed to lock global hash lock\n");
+					return NULL;
+				}
+				size_t expired = kvs_expire_due(i, now, EXPIRY_BATCH_SIZE);
+				if (outerLock != NULL) pthread_rwlock_unlock(outerLock);
+				if (expired < EXPIRY_BATCH_SIZE) {
+					due[i] = 0;
+					pending--;
+				}
+			}
+		}
+		delay(EXPIRY_INTERVAL_MS);
+	}
+	return NULL;
+}
+
+int expiry_init(pthread_rwlock_t *tableLock) {
+	outerLock = tableLock;
+	atomic_store(&running, 1);
+	if (pthread_create(&thread, NULL, expiry_thread, NULL)) {
+		fprintf(stderr, "Failed to create expiry thread\n");
+		atomic_store(&running, 0);
+		return 1;
+	}
+	return 0;
+}
+
+void expiry_stop(void) {
+	if (!atomic_exchange(&running, 0)) return;
+	if (pthread_join(thread, NULL)) {
+		fprintf(stderr, "Failed to join expiry thread\n");
+	}
+}
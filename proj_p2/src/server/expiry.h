@@ -0,0 +1,20 @@
+#ifndef KVS_EXPIRY_H
+#define KVS_EXPIRY_H
+
+#include <pthread.h>
+
+#include "constants.h"
+
+/// Starts the thread that deletes the keys whose TTL ran out. Every
+/// EXPIRY_INTERVAL_MS it advances the timing wheel of each bucket, deleting
+/// at most EXPIRY_BATCH_SIZE keys per hold of a bucket lock and taking the
+/// due buckets in turns, so requests waiting on a lock get it in between.
+/// @param tableLock Read locked around each batch, so a writer of it, such
+/// as a backup, sees no bucket changing. NULL if there is none.
+/// @return 0 if successful, 1 otherwise
+int expiry_init(pthread_rwlock_t *tableLock);
+
+/// Stops the expiry thread, waiting for its batch to end.
+void expiry_stop(void);
+
+#endif  // KVS_EXPIRY_H
@@ -4,9 +4,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "constants.h"
+#include "io.h"
 #include "src/common/io.h"
 #include "src/common/constants.h"
 #include "src/common/protocol.h"
+#include "src/common/varint.h"
 
 void write_str(int fd, const char *str) {
 	size_t len = strlen(str);
@@ -49,14 +54,345 @@ size_t strn_memcpy(char *dest, const char *src, size_t n) {
 	return bytes_to_copy;
 }
 
-int write_to_resp_pipe (int fdRespPipe, const char opcode, const char result) {
-	if (write_all(fdRespPipe, &opcode, 1) == -1) {
-		fprintf(stderr, "Failed to write OP Code %c to the responses pipe.\n", opcode);
-		return 1;
+int send_message(int fd, int isSocket, char type, const void *message, size_t size) {
+	if (!isSocket) {
+		return write_all(fd, message, size) == -1;
+	}
+
+	const char *bytes = message;
+	do {
+		size_t chunk = size < MAX_MESSAGE_SIZE - 1 ? size : MAX_MESSAGE_SIZE - 1;
+		struct iovec iov[2] = {{&type, 1}, {(void *) bytes, chunk}};
+		struct msghdr packet = {.msg_iov = iov, .msg_iovlen = 2};
+		ssize_t sent;
+		do {
+			sent = sendmsg(fd, &packet, MSG_NOSIGNAL);
+		} while (sent < 0 && errno == EINTR);
+		if (sent < 0) {
+			perror("Failed to send message");
+			return 1;
+		}
+		bytes += chunk;
+		size -= chunk;
+	} while (size > 0);
+	return 0;
+}
+
+/// @brief Appends bytes to an output buffer, reclaiming the bytes already
+/// sent before it grows.
+/// @param output
+/// @param bytes
+/// @param size
+/// @return 0 on success, 1 if it could not grow
+static int buffer_output(OutputBuffer *output, const void *bytes, size_t size) {
+	if (output->length + size > output->capacity && output->sent > 0) {
+		output->length -= output->sent;
+		memmove(output->bytes, output->bytes + output->sent, output->length);
+		output->sent = 0;
+	}
+	size_t needed = output->length + size;
+	if (needed > output->capacity) {
+		size_t capacity = output->capacity ? output->capacity * 2 : RESPONSE_BUFFER_SIZE;
+		while (capacity < needed) capacity *= 2;
+		char *grown = realloc(output->bytes, capacity);
+		if (grown == NULL) {
+			fprintf(stderr, "Failed to grow output buffer\n");
+			return 1;
+		}
+		output->bytes = grown;
+		output->capacity = capacity;
 	}
-	if (write_all(fdRespPipe, &result, 1) == -1) {
+	memcpy(output->bytes + output->length, bytes, size);
+	output->length = needed;
+	return 0;
+}
+
+/// @brief Empties an output buffer, giving back the memory a large message
+/// made it take.
+/// @param output
+static void reset_output(OutputBuffer *output) {
+	output->length = output->sent = 0;
+	if (output->capacity > REQUEST_BUFFER_SHRINK_SIZE) {
+		free(output->bytes);
+		output->bytes = NULL;
+		output->capacity = 0;
+	}
+}
+
+/// @brief Sends a packet to a session socket without waiting.
+/// @param fd
+/// @param type
+/// @param bytes
+/// @param size
+/// @return 0 if it was sent, 1 if the socket is full, -1 on error
+static int send_packet(int fd, char type, const char *bytes, size_t size) {
+	struct iovec iov[2] = {{&type, 1}, {(void *) bytes, size}};
+	struct msghdr packet = {.msg_iov = iov, .msg_iovlen = 2};
+	ssize_t sent;
+	do {
+		sent = sendmsg(fd, &packet, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+	if (sent >= 0) return 0;
+	if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+	perror("Failed to send message");
+	return -1;
+}
+
+int send_buffered(OutputBuffer *output, int fd, int isSocket, char type, const void *message,
+				  size_t size) {
+	// Nothing may overtake the bytes already waiting
+	if (output_pending(output) && flush_buffered(output, fd, isSocket) < 0) return 1;
+
+	const char *bytes = message;
+	if (!isSocket) {
+		while (size > 0 && !output_pending(output)) {
+			ssize_t written = write(fd, bytes, size);
+			if (written < 0 && errno == EINTR) continue;
+			if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			if (written < 0) {
+				perror("Failed to write message");
+				reset_output(output);
+				return 1;
+			}
+			bytes += written;
+			size -= (size_t) written;
+		}
+		if (size > 0 && buffer_output(output, bytes, size)) {
+			reset_output(output);
+			return 1;
+		}
+		return 0;
+	}
+
+	do {
+		size_t chunk = size < MAX_MESSAGE_SIZE - 1 ? size : MAX_MESSAGE_SIZE - 1;
+		int status = output_pending(output) ? 1 : send_packet(fd, type, bytes, chunk);
+		size_t packetSize = chunk + 1;
+		if (status < 0 ||
+			(status == 1 && (buffer_output(output, &packetSize, sizeof(packetSize)) ||
+							 buffer_output(output, &type, 1) ||
+							 buffer_output(output, bytes, chunk)))) {
+			reset_output(output);
+			return 1;
+		}
+		bytes += chunk;
+		size -= chunk;
+	} while (size > 0);
+	return 0;
+}
+
+int flush_buffered(OutputBuffer *output, int fd, int isSocket) {
+	while (output_pending(output)) {
+		const char *start = output->bytes + output->sent;
+		if (!isSocket) {
+			ssize_t written = write(fd, start, output->length - output->sent);
+			if (written < 0 && errno == EINTR) continue;
+			if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+			if (written < 0) {
+				perror("Failed to write message");
+				reset_output(output);
+				return -1;
+			}
+			output->sent += (size_t) written;
+			continue;
+		}
+
+		size_t packetSize;
+		memcpy(&packetSize, start, sizeof(packetSize));
+		const char *packet = start + sizeof(packetSize);
+		int status = send_packet(fd, packet[0], packet + 1, packetSize - 1);
+		if (status == 1) return 1;
+		if (status < 0) {
+			reset_output(output);
+			return -1;
+		}
+		output->sent += sizeof(packetSize) + packetSize;
+	}
+	reset_output(output);
+	return 0;
+}
+
+int output_pending(const OutputBuffer *output) {
+	return output->sent < output->length;
+}
+
+int write_to_resp_pipe (int fdRespPipe, int isSocket, const char opcode, const char result) {
+	const char response[2] = {opcode, result};
+	if (send_message(fdRespPipe, isSocket, MESSAGE_RESPONSE, response, sizeof(response))) {
 		fprintf(stderr, "Failed to write result %c to the responses pipe.\n", result);
 		return 1;
 	}
 	return 0;
+}
+
+/// @brief Gets the size of a batch frame, as request_frame_size does.
+/// @param buffer Buffered request bytes, starting with the opcode.
+/// @param length Number of buffered bytes.
+/// @param pairs Whether each entry holds a key and a value.
+/// @return as request_frame_size
+static size_t batch_frame_size(const char *buffer, size_t length, int pairs) {
+	if (length < BATCH_HEADER_SIZE) return BATCH_HEADER_SIZE;
+	uint32_t count;
+	memcpy(&count, buffer + 1, sizeof(count));
+	if (count == 0 || count > MAX_BATCH_KEYS) return INVALID_FRAME;
+
+	// Each PUT entry holds a key and a value
+	size_t strings = pairs ? 2 * (size_t) count : count;
+	size_t offset = BATCH_HEADER_SIZE;
+	for (size_t i = 0; i < strings; i++) {
+		if (offset >= length) return offset + 1;
+		unsigned char stringLength = (unsigned char) buffer[offset];
+		if (stringLength > BATCH_MAX_STRING_LENGTH) return INVALID_FRAME;
+		offset += 1 + stringLength;
+	}
+	return offset;
+}
+
+size_t request_frame_size(const char *buffer, size_t length, int protocol) {
+	if (length == 0) return 0;
+
+	switch (buffer[0]) {
+		case OP_CODE_SUBSCRIBE:
+		case OP_CODE_UNSUBSCRIBE: {
+			if (protocol < PROTOCOL_COMPACT) return 1 + KEY_MESSAGE_SIZE;
+			uint64_t keyLength;
+			size_t size;
+			int status = varint_decode(buffer + 1, length - 1, &keyLength, &size);
+			if (status > 0) return length + 1;
+			if (status < 0 || keyLength > BATCH_MAX_STRING_LENGTH) return INVALID_FRAME;
+			return 1 + size + keyLength;
+		}
+
+		case OP_CODE_CONNECT_COMPACT:
+			return 2;
+
+		case OP_CODE_GET:
+		case OP_CODE_PUT:
+		case OP_CODE_DEL:
+		case OP_CODE_SUBSCRIBE_BATCH:
+		case OP_CODE_UNSUBSCRIBE_BATCH:
+			return batch_frame_size(buffer, length, buffer[0] == OP_CODE_PUT);
+
+		case OP_CODE_PUT_TTL:
+		case OP_CODE_EXPIRE: {
+			if (protocol < PROTOCOL_EXPIRY) return INVALID_FRAME;
+			// A batch frame with the ttl between its opcode and its count
+			if (length < TTL_SIZE + BATCH_HEADER_SIZE) return TTL_SIZE + BATCH_HEADER_SIZE;
+			size_t size = batch_frame_size(buffer + TTL_SIZE, length - TTL_SIZE,
+										   buffer[0] == OP_CODE_PUT_TTL);
+			return size == INVALID_FRAME ? INVALID_FRAME : TTL_SIZE + size;
+		}
+
+		case OP_CODE_RESUME:
+			return 1 + sizeof(uint64_t);
+
+		case OP_CODE_PUT_VALUE:
+		case OP_CODE_GET_VALUE: {
+			// Unknown opcodes to older versions
+			if (protocol < PROTOCOL_LARGE_VALUES) return 1;
+			uint64_t keyLength;
+			size_t size;
+			int status = varint_decode(buffer + 1, length - 1, &keyLength, &size);
+			if (status > 0) return length + 1;
+			if (status < 0 || keyLength == 0 || keyLength > BATCH_MAX_STRING_LENGTH) {
+				return INVALID_FRAME;
+			}
+			size_t offset = 1 + size + keyLength;
+			if (buffer[0] == OP_CODE_GET_VALUE) return offset;
+
+			// The size of a value is known before the value arrives, so the
+			// buffer grows once to fit the whole frame
+			if (length <= offset) return offset + 1;
+			uint64_t valueLength;
+			status = varint_decode(buffer + offset, length - offset, &valueLength, &size);
+			if (status > 0) return length + 1;
+			if (status < 0 || valueLength > MAX_VALUE_SIZE) return INVALID_FRAME;
+			return offset + size + valueLength;
+		}
+
+		case OP_CODE_TAGGED: {
+			if (length <= TAG_HEADER_SIZE) return TAG_HEADER_SIZE + 1;
+			char opcode = buffer[TAG_HEADER_SIZE];
+			if (opcode != OP_CODE_GET && opcode != OP_CODE_PUT && opcode != OP_CODE_DEL &&
+				opcode != OP_CODE_SUBSCRIBE_BATCH && opcode != OP_CODE_UNSUBSCRIBE_BATCH &&
+				opcode != OP_CODE_PUT_TTL && opcode != OP_CODE_EXPIRE) {
+				return INVALID_FRAME;
+			}
+			size_t requestSize = request_frame_size(buffer + TAG_HEADER_SIZE,
+													length - TAG_HEADER_SIZE, protocol);
+			if (requestSize == INVALID_FRAME) return INVALID_FRAME;
+			return TAG_HEADER_SIZE + requestSize;
+		}
+
+		default:
+			// Other opcodes carry no arguments, unknown ones are rejected
+			return 1;
+	}
+}
+
+void parse_key_request(const char *request, int compact, char key[KEY_MESSAGE_SIZE]) {
+	if (!compact) {
+		memcpy(key, request + 1, KEY_MESSAGE_SIZE);
+		key[KEY_MESSAGE_SIZE - 1] = '\0';
+		return;
+	}
+	// request_frame_size checked the length
+	uint64_t keyLength;
+	size_t size;
+	varint_decode(request + 1, VARINT_MAX_SIZE, &keyLength, &size);
+	memcpy(key, request + 1 + size, keyLength);
+	key[keyLength] = '\0';
+}
+
+/// @brief Copies a length-prefixed string into a null terminated one.
+/// @param src Start of the length byte.
+/// @param dest Where to store the string.
+/// @return number of bytes read from src
+static size_t read_batch_string(const char *src, char *dest) {
+	size_t stringLength = (unsigned char) src[0];
+	memcpy(dest, src + 1, stringLength);
+	dest[stringLength] = '\0';
+	return 1 + stringLength;
+}
+
+size_t parse_batch_request(const char *request, char keys[][MAX_STRING_SIZE],
+						   const char *values[], size_t valueLengths[]) {
+	uint32_t count;
+	memcpy(&count, request + 1, sizeof(count));
+
+	size_t offset = BATCH_HEADER_SIZE;
+	for (size_t i = 0; i < count; i++) {
+		offset += read_batch_string(request + offset, keys[i]);
+		if (values != NULL) {
+			// Left in the frame, kvs_write copies them into the table
+			valueLengths[i] = (unsigned char) request[offset];
+			values[i] = request + offset + 1;
+			offset += 1 + valueLengths[i];
+		}
+	}
+	return count;
+}
+
+size_t parse_ttl_request(const char *request, uint32_t *ttl, char keys[][MAX_STRING_SIZE],
+						 const char *values[], size_t valueLengths[]) {
+	memcpy(ttl, request + 1, sizeof(*ttl));
+	// What follows the ttl is laid out as the batch after an opcode
+	return parse_batch_request(request + TTL_SIZE, keys, values, valueLengths);
+}
+
+void parse_value_request(const char *request, char key[MAX_STRING_SIZE], const char **value,
+						 size_t *valueLength) {
+	// request_frame_size checked the lengths
+	uint64_t length;
+	size_t size;
+	varint_decode(request + 1, VARINT_MAX_SIZE, &length, &size);
+	size_t offset = 1 + size;
+	memcpy(key, request + offset, length);
+	key[length] = '\0';
+	offset += length;
+	if (value == NULL) return;
+
+	varint_decode(request + offset, VARINT_MAX_SIZE, &length, &size);
+	*value = request + offset + size;
+	*valueLength = length;
 }
\ No newline at end of file
@@ -1,8 +1,14 @@
 #ifndef KVS_IO_H
 #define KVS_IO_H
 
+#include <stdint.h>
 #include <unistd.h>
 
+#include "src/common/constants.h"
+
+// Returned by request_frame_size for malformed requests
+#define INVALID_FRAME SIZE_MAX
+
 /// Writes a string to the given file descriptor.
 /// @param fd The file descriptor to write to.
 /// @param str The string to write.
@@ -26,14 +32,112 @@ size_t strn_memcpy(char *dest, const char *src, size_t n);
 /// @param req_pipe The request pipe path
 /// @param resp_pipe The response pipe path
 /// @param notif_pipe The notification pipe path
+/// @param version Set to the protocol version a CONNECT_COMPACT message asks
+/// for, 0 for a CONNECT message
 /// @return 0 on success, 1 on error
-int read_connect_message(int fdServerPipe, char *opcode, char *req_pipe, char *resp_pipe, char *notif_pipe);
+int read_connect_message(int fdServerPipe, char *opcode, char *req_pipe, char *resp_pipe,
+						 char *notif_pipe, int *version);
+
+/// @brief Sends a message to a client. Pipes get the bytes as they are,
+/// sockets get them in packets of at most MAX_MESSAGE_SIZE bytes, each
+/// starting with the type of the message.
+/// @param fd fd of the pipe or socket.
+/// @param isSocket Whether fd is a session socket.
+/// @param type MESSAGE_RESPONSE or MESSAGE_NOTIFICATION.
+/// @param message
+/// @param size Size of the message.
+/// @return 0 if the message was sent, 1 otherwise.
+int send_message(int fd, int isSocket, char type, const void *message, size_t size);
+
+/// Bytes a non-blocking pipe or socket did not take yet, sent once it is
+/// writable again. A socket takes a packet whole or not at all, so each
+/// packet is kept whole, after its size as a size_t.
+typedef struct OutputBuffer {
+	char *bytes;
+	size_t length;   // bytes buffered
+	size_t sent;     // of them already sent
+	size_t capacity;
+} OutputBuffer;
+
+/// @brief Sends a message as send_message does, without waiting for fd.
+/// What fd does not take is buffered, after what was buffered before.
+/// @param output
+/// @param fd fd of the pipe, non-blocking, or socket.
+/// @param isSocket Whether fd is a session socket.
+/// @param type MESSAGE_RESPONSE or MESSAGE_NOTIFICATION.
+/// @param message
+/// @param size Size of the message.
+/// @return 0 if the message was sent or buffered, 1 otherwise, in which
+/// case the buffer is emptied.
+int send_buffered(OutputBuffer *output, int fd, int isSocket, char type, const void *message,
+				  size_t size);
+
+/// @brief Sends the buffered bytes until fd is full.
+/// @param output
+/// @param fd
+/// @param isSocket
+/// @return 0 if every byte was sent, 1 if some are left, -1 on error, in
+/// which case the buffer is emptied.
+int flush_buffered(OutputBuffer *output, int fd, int isSocket);
+
+/// @brief Tells whether bytes wait in an output buffer.
+/// @param output
+/// @return 1 if they do, 0 otherwise
+int output_pending(const OutputBuffer *output);
 
 /// @brief Writes the opcode and the result to the response pipe.
 /// @param fdRespPipe fd of the response pipe.
+/// @param isSocket Whether fdRespPipe is a session socket.
 /// @param opcode 
 /// @param result 
 /// @return 0 if the operation was successful, 1 otherwise.
-int write_to_resp_pipe (int fdRespPipe, const char opcode, const char result);
+int write_to_resp_pipe (int fdRespPipe, int isSocket, const char opcode, const char result);
+
+/// @brief Gets the size of the request frame at the start of a buffer.
+/// @param buffer Buffered request bytes.
+/// @param length Number of buffered bytes.
+/// @param protocol Version the session negotiated.
+/// @return size of the frame, or if the frame is incomplete a lower bound
+/// larger than length, 0 if the buffer is empty and INVALID_FRAME if the
+/// frame is malformed
+size_t request_frame_size(const char *buffer, size_t length, int protocol);
+
+/// @brief Parses the key of a complete SUBSCRIBE or UNSUBSCRIBE request frame.
+/// @param request The request frame, starting with the opcode.
+/// @param compact Whether the session uses PROTOCOL_COMPACT.
+/// @param key Where to store the null terminated key.
+void parse_key_request(const char *request, int compact, char key[KEY_MESSAGE_SIZE]);
+
+/// @brief Parses the keys, and values for PUT, of a complete GET, PUT or
+/// DEL request frame.
+/// @param request The request frame, starting with the opcode.
+/// @param keys Array to store the keys.
+/// @param values Array to store where each value is in the frame, NULL for
+/// GET and DEL. Values are not null terminated.
+/// @param valueLengths Array to store the length of each value, NULL for
+/// GET and DEL.
+/// @return number of keys parsed
+size_t parse_batch_request(const char *request, char keys[][MAX_STRING_SIZE],
+						   const char *values[], size_t valueLengths[]);
+
+/// @brief Parses a complete PUT_TTL or EXPIRE request frame, as
+/// parse_batch_request does.
+/// @param request The request frame, starting with the opcode.
+/// @param ttl Set to the milliseconds until the keys expire.
+/// @param keys Array to store the keys.
+/// @param values As in parse_batch_request, NULL for EXPIRE.
+/// @param valueLengths As in parse_batch_request, NULL for EXPIRE.
+/// @return number of keys parsed
+size_t parse_ttl_request(const char *request, uint32_t *ttl, char keys[][MAX_STRING_SIZE],
+						 const char *values[], size_t valueLengths[]);
+
+/// @brief Parses a complete PUT_VALUE or GET_VALUE request frame.
+/// @param request The request frame, starting with the opcode.
+/// @param key Where to store the null terminated key.
+/// @param value Set to where the value is in the frame, not null
+/// terminated. NULL for GET_VALUE.
+/// @param valueLength Set to the length of the value. NULL for GET_VALUE.
+void parse_value_request(const char *request, char key[MAX_STRING_SIZE], const char **value,
+						 size_t *valueLength);
 
 #endif  // KVS_IO_H
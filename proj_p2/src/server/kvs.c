@@ -2,13 +2,19 @@
 #include "string.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "changelog.h"
 #include "src/common/io.h"
 #include "src/common/constants.h"
 
+// Number of keys whose chains read_pairs walks interleaved
+#define LOOKUP_GROUP_SIZE 16
+
 // Hash function based on key initial.
 // @param key Lowercase alphabetical string.
 // @return hash.
@@ -24,6 +30,86 @@ int hash(const char *key) {
 	return -1; // Invalid index for non-alphabetic or number strings
 }
 
+uint64_t hash_key(const char *key) {
+	uint64_t h = 14695981039346656037ULL;
+	for (const unsigned char *c = (const unsigned char *) key; *c != '\0'; c++) {
+		h ^= *c;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/// Gets the position of the i-th counter of a key in a bucket filter.
+/// @param keyHash Hash of the key.
+/// @param i Which of the BLOOM_HASHES counters.
+/// @return position in the counters array.
+static size_t filter_position(uint64_t keyHash, unsigned int i) {
+	uint64_t h1 = keyHash & 0xffffffff;
+	uint64_t h2 = (keyHash >> 32) | 1;
+	return (size_t) ((h1 + i * h2) % BLOOM_COUNTERS);
+}
+
+static void filter_add(BucketFilter *filter, uint64_t keyHash) {
+	for (unsigned int i = 0; i < BLOOM_HASHES; i++) {
+		unsigned char *counter = &filter->counters[filter_position(keyHash, i)];
+		if (*counter < UCHAR_MAX) (*counter)++;
+	}
+}
+
+static void filter_remove(BucketFilter *filter, uint64_t keyHash) {
+	for (unsigned int i = 0; i < BLOOM_HASHES; i++) {
+		unsigned char *counter = &filter->counters[filter_position(keyHash, i)];
+		// A saturated counter no longer knows how many keys it counts
+		if (*counter > 0 && *counter < UCHAR_MAX) (*counter)--;
+	}
+}
+
+/// Checks the filter of a bucket for a key and accounts the lookup.
+/// @param ht The hash table.
+/// @param index Bucket of the key.
+/// @param keyHash Hash of the key.
+/// @return 1 if the key may be in the bucket, 0 if it certainly is not.
+static int filter_may_contain(HashTable *ht, int index, uint64_t keyHash) {
+	atomic_fetch_add_explicit(&ht->filterLookups, 1, memory_order_relaxed);
+	for (unsigned int i = 0; i < BLOOM_HASHES; i++) {
+		if (ht->filters[index].counters[filter_position(keyHash, i)] == 0) {
+			atomic_fetch_add_explicit(&ht->filterNegatives, 1, memory_order_relaxed);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/// Accounts a lookup that passed the filter but missed on the chain.
+static void filter_false_positive(HashTable *ht) {
+	atomic_fetch_add_explicit(&ht->filterFalsePositives, 1, memory_order_relaxed);
+}
+
+/// Checks if a node holds a key. The hash and length stored in the node are
+/// compared first, so the key bytes are only read on a likely match.
+/// @param keyNode The node.
+/// @param key The key.
+/// @param keyHash hash_key of the key.
+/// @param keyLen Length of the key.
+/// @return 1 if the node holds the key, 0 otherwise.
+static inline int key_matches(const KeyNode *keyNode, const char *key,
+							  uint64_t keyHash, size_t keyLen) {
+	return keyNode->keyHash == keyHash && keyNode->keyLen == keyLen &&
+		   memcmp(keyNode->key, key, keyLen) == 0;
+}
+
+/// Copies a value, which may hold '\0' bytes, and null terminates the copy.
+/// @param value
+/// @param valueLen Number of bytes in the value.
+/// @return the copy, NULL on error
+static char *copy_value(const char *value, size_t valueLen) {
+	char *copy = malloc(valueLen + 1);
+	if (copy == NULL) return NULL;
+	memcpy(copy, value, valueLen);
+	copy[valueLen] = '\0';
+	return copy;
+}
+
 struct HashTable *create_hash_table() {
 	HashTable *ht = malloc(sizeof(HashTable));
 	if (!ht) return NULL;
@@ -33,8 +119,16 @@ struct HashTable *create_hash_table() {
 		free(ht);
 		return NULL;
 	}
+	atomic_init(&ht->filterLookups, 0);
+	atomic_init(&ht->filterNegatives, 0);
+	atomic_init(&ht->filterFalsePositives, 0);
+	atomic_init(&ht->keysExpired, 0);
+	uint64_t now = timers_now();
 	for (int i = 0; i < TABLE_SIZE; i++) {
 		ht->table[i] = NULL;
+		ht->pending[i] = NULL;
+		memset(ht->filters[i].counters, 0, BLOOM_COUNTERS);
+		wheel_init(&ht->wheels[i], now);
 		if (pthread_rwlock_init(&ht->bucketLocks[i], NULL)) {
 			fprintf(stderr, "Error: Initializing bucket lock.\n");
 			return NULL;
@@ -43,166 +137,436 @@ struct HashTable *create_hash_table() {
 	return ht;
 }
 
-int write_pair(HashTable *ht, const char *key, const char *value) {
+/// Finds where a key is linked in the pending list of its bucket.
+/// @param ht The hash table.
+/// @param index Bucket of the key.
+/// @param key The key.
+/// @param keyHash hash_key of the key.
+/// @param keyLen Length of the key.
+/// @return the link to the parked node, or to NULL at the end of the list.
+static KeyNode **find_pending_link(HashTable *ht, int index, const char *key,
+								   uint64_t keyHash, size_t keyLen) {
+	KeyNode **link = &ht->pending[index];
+	while (*link != NULL && !key_matches(*link, key, keyHash, keyLen)) {
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+int key_expired(const KeyNode *keyNode) {
+	return keyNode->expiry.expiresAt != 0 && keyNode->expiry.expiresAt <= timers_now();
+}
+
+/// Sets or clears the expiry of a key in the wheel of its bucket.
+/// @param wheel
+/// @param keyNode
+/// @param expiresAt When the key expires, 0 for never.
+static void schedule_expiry(TimerWheel *wheel, KeyNode *keyNode, uint64_t expiresAt) {
+	if (expiresAt == 0) {
+		wheel_cancel(wheel, &keyNode->expiry);
+	} else {
+		wheel_schedule(wheel, &keyNode->expiry, expiresAt);
+	}
+}
+
+/// Deletes a node of the table, logging the change and notifying its
+/// subscribers.
+/// @param ht The hash table.
+/// @param index Bucket of the node.
+/// @param keyNode
+/// @param expired Whether its TTL ran out.
+static void remove_node(HashTable *ht, int index, KeyNode *keyNode, int expired) {
+	notify_subscribers(keyNode, keyNode->key, "DELETE", strlen("DELETE"),
+					   changelog_append(keyNode->key, NULL, 0));
+	if (keyNode->prev == NULL) {
+		ht->table[index] = keyNode->next;
+	} else {
+		keyNode->prev->next = keyNode->next;
+	}
+	if (keyNode->next != NULL) keyNode->next->prev = keyNode->prev;
+	wheel_cancel(&ht->wheels[index], &keyNode->expiry);
+	if (expired) atomic_fetch_add_explicit(&ht->keysExpired, 1, memory_order_relaxed);
+
+	filter_remove(&ht->filters[index], keyNode->keyHash);
+	free(keyNode->key);
+	free(keyNode->value);
+	free_subscribers(keyNode);
+	free(keyNode);
+}
+
+int write_pair(HashTable *ht, const char *key, const char *value, size_t valueLen,
+			   uint64_t expiresAt) {
 	int index = hash(key);
-	KeyNode *keyNode = ht->table[index];
+	if (index < 0) return 1; // no bucket can hold the key
+	uint64_t keyHash = hash_key(key);
+	size_t keyLen = strlen(key);
+	// A key the filter has never seen can be inserted right away
+	int mayContain = filter_may_contain(ht, index, keyHash);
+	KeyNode *keyNode = mayContain ? ht->table[index] : NULL;
+	int expired = 0;
 
 	// Search for the key node
 	while (keyNode != NULL) {
 		// Key node found; update the value
-		if (strcmp(keyNode->key, key) == 0) {
+		if (key_matches(keyNode, key, keyHash, keyLen)) {
+			// Its subscribers learn it expired before it is created again
+			if (key_expired(keyNode)) {
+				remove_node(ht, index, keyNode, 1);
+				expired = 1;
+				break;
+			}
+			char *copy = copy_value(value, valueLen);
+			if (!copy) {
+				fprintf(stderr, "Error: Allocating value.\n");
+				return 1;
+			}
 			free(keyNode->value);
-			keyNode->value = strdup(value);
-			notify_subscribers(keyNode, key, value);
+			keyNode->value = copy;
+			keyNode->valueLen = valueLen;
+			schedule_expiry(&ht->wheels[index], keyNode, expiresAt);
+			notify_subscribers(keyNode, key, value, valueLen,
+							   changelog_append(key, value, valueLen));
 			return 0;
 		}
 		keyNode = keyNode->next; // Move to the next node
 	}
 
-	// Key not found, create a new key node
+	if (mayContain && !expired) filter_false_positive(ht);
+
+	// A key watched before it existed takes over the node its watchers are
+	// parked on, so they are attached and notified under this bucket lock
+	KeyNode **pendingLink = find_pending_link(ht, index, key, keyHash, keyLen);
+	if (*pendingLink != NULL) {
+		keyNode = *pendingLink;
+		keyNode->value = copy_value(value, valueLen);
+		if (!keyNode->value) {
+			fprintf(stderr, "Error: Allocating value.\n");
+			return 1;
+		}
+		*pendingLink = keyNode->next;
+	} else {
+		// Key not found, create a new key node
+		keyNode = malloc(sizeof(KeyNode));
+		if (!keyNode) {
+			fprintf(stderr, "Error: Allocating key node.\n");
+			return 1;
+		}
+
+		keyNode->subscribers = (SubscriberSet){0};
+		keyNode->expiry = (Timer){0};
+		keyNode->keyHash = keyHash;
+		keyNode->keyLen = keyLen;
+		keyNode->key = strdup(key);     // Allocate memory for the key
+		keyNode->value = copy_value(value, valueLen); // Allocate memory for the value
+		if (!keyNode->key || !keyNode->value) {
+			fprintf(stderr, "Error: Allocating key or value.\n");
+			free(keyNode->key);
+			free(keyNode->value);
+			free(keyNode);
+			return 1;
+		}
+	}
+	keyNode->next = ht->table[index]; // Link to existing nodes
+	keyNode->prev = NULL;
+	if (keyNode->next != NULL) keyNode->next->prev = keyNode;
+	ht->table[index] = keyNode; // Place new key node at the start of the list
+	keyNode->valueLen = valueLen;
+	filter_add(&ht->filters[index], keyHash);
+	schedule_expiry(&ht->wheels[index], keyNode, expiresAt);
+	// Only parked watchers and patterns can be subscribed to a new key
+	notify_subscribers(keyNode, key, value, valueLen, changelog_append(key, value, valueLen));
+	return 0;
+}
+
+KeyNode *find_pending_node(HashTable *ht, const char *key) {
+	int index = hash(key);
+	if (index < 0) return NULL;
+	return *find_pending_link(ht, index, key, hash_key(key), strlen(key));
+}
+
+KeyNode *park_key(HashTable *ht, const char *key) {
+	int index = hash(key);
+	if (index < 0) return NULL;
+	uint64_t keyHash = hash_key(key);
+	size_t keyLen = strlen(key);
+	KeyNode *keyNode = *find_pending_link(ht, index, key, keyHash, keyLen);
+	if (keyNode != NULL) return keyNode;
+
 	keyNode = malloc(sizeof(KeyNode));
 	if (!keyNode) {
 		fprintf(stderr, "Error: Allocating key node.\n");
-		return 1;
+		return NULL;
 	}
-
-	keyNode->subscriber = NULL;
-	keyNode->key = strdup(key);     // Allocate memory for the key
-	keyNode->value = strdup(value); // Allocate memory for the value
-	if (!keyNode->key || !keyNode->value) {
-		fprintf(stderr, "Error: Allocating key or value.\n");
-		free(keyNode->key);
-		free(keyNode->value);
+	keyNode->subscribers = (SubscriberSet){0};
+	keyNode->expiry = (Timer){0};
+	keyNode->keyHash = keyHash;
+	keyNode->keyLen = keyLen;
+	keyNode->value = NULL;
+	keyNode->key = strdup(key);
+	if (!keyNode->key) {
+		fprintf(stderr, "Error: Allocating key.\n");
 		free(keyNode);
-		return 1;
+		return NULL;
 	}
-	keyNode->next = ht->table[index]; // Link to existing nodes
-	ht->table[index] = keyNode; // Place new key node at the start of the list
-	return 0;
+	keyNode->next = ht->pending[index];
+	ht->pending[index] = keyNode;
+	return keyNode;
 }
 
-char *read_pair(HashTable *ht, const char *key) {
+KeyNode *find_key_node(HashTable *ht, const char *key) {
 	int index = hash(key);
+	uint64_t keyHash = hash_key(key);
+	if (index < 0 || !filter_may_contain(ht, index, keyHash)) return NULL;
 
+	size_t keyLen = strlen(key);
 	KeyNode *keyNode = ht->table[index];
-	char *value;
 
 	while (keyNode != NULL) {
-		if (strcmp(keyNode->key, key) == 0) {
-			value = strdup(keyNode->value);
-			return value; // Return copy of the value if found
+		if (key_matches(keyNode, key, keyHash, keyLen)) {
+			return keyNode;
 		}
 		keyNode = keyNode->next; // Move to the next node
 	}
+	filter_false_positive(ht);
 	return NULL; // Key not found
 }
 
+char *read_pair(HashTable *ht, const char *key, size_t *valueLen) {
+	KeyNode *keyNode = find_key_node(ht, key);
+	if (keyNode == NULL || key_expired(keyNode)) return NULL; // Key not found
+
+	*valueLen = keyNode->valueLen;
+	return copy_value(keyNode->value, keyNode->valueLen); // Return copy of the value if found
+}
+
+void read_pairs(HashTable *ht, size_t num_keys, const char *keys[], char *values[],
+				size_t valueLens[]) {
+	KeyNode *cursor[LOOKUP_GROUP_SIZE];
+	uint64_t keyHashes[LOOKUP_GROUP_SIZE];
+	size_t keyLens[LOOKUP_GROUP_SIZE];
+
+	for (size_t start = 0; start < num_keys; start += LOOKUP_GROUP_SIZE) {
+		size_t groupSize = num_keys - start;
+		if (groupSize > LOOKUP_GROUP_SIZE) groupSize = LOOKUP_GROUP_SIZE;
+		size_t pending = 0;
+
+		// Hash every key of the group and prefetch the head of its chain
+		for (size_t i = 0; i < groupSize; i++) {
+			values[start + i] = NULL;
+			valueLens[start + i] = 0;
+			int index = hash(keys[start + i]);
+			keyHashes[i] = hash_key(keys[start + i]);
+			keyLens[i] = strlen(keys[start + i]);
+			if (index < 0 || !filter_may_contain(ht, index, keyHashes[i])) {
+				cursor[i] = NULL;
+			} else {
+				cursor[i] = ht->table[index];
+				if (cursor[i] == NULL) filter_false_positive(ht);
+			}
+			if (cursor[i] != NULL) {
+				__builtin_prefetch(cursor[i]);
+				pending++;
+			}
+		}
+
+		// Walk all chains one node at a time
+		while (pending > 0) {
+			// The nodes were prefetched last round; the key bytes of those
+			// whose hash matches are fetched before any of them is compared
+			for (size_t i = 0; i < groupSize; i++) {
+				if (cursor[i] != NULL && cursor[i]->keyHash == keyHashes[i]) {
+					__builtin_prefetch(cursor[i]->key);
+				}
+			}
+
+			for (size_t i = 0; i < groupSize; i++) {
+				KeyNode *keyNode = cursor[i];
+				if (keyNode == NULL) continue;
+
+				if (key_matches(keyNode, keys[start + i], keyHashes[i], keyLens[i])) {
+					// Readers cannot delete an expired key, they only skip it
+					if (!key_expired(keyNode)) {
+						values[start + i] = copy_value(keyNode->value, keyNode->valueLen);
+						valueLens[start + i] = keyNode->valueLen;
+					}
+					cursor[i] = NULL;
+				} else {
+					cursor[i] = keyNode->next;
+					if (cursor[i] == NULL) filter_false_positive(ht);
+				}
+
+				if (cursor[i] == NULL) {
+					pending--;
+				} else {
+					__builtin_prefetch(cursor[i]);
+				}
+			}
+		}
+	}
+}
+
 int delete_pair(HashTable *ht, const char *key) {
 	int index = hash(key);
+	if (index < 0) return 1;
+	uint64_t keyHash = hash_key(key);
+	if (!filter_may_contain(ht, index, keyHash)) return 1;
 
+	size_t keyLen = strlen(key);
 	KeyNode *keyNode = ht->table[index];
-	KeyNode *prevNode = NULL;
 
 	// Search for the key node
 	while (keyNode != NULL) {
-		if (strcmp(keyNode->key, key) == 0) {
-			// Key found
-			// Notify clients that the key is being deleted
-			notify_subscribers(keyNode, key, "DELETE");
-			// Delete this node
-			if (prevNode == NULL) {
-				ht->table[index] = keyNode->next; 
-			} else {
-				prevNode->next = keyNode->next; 
-			}
-			free(keyNode->key);
-			free(keyNode->value);
-			free_subscribers(keyNode->subscriber);
-			free(keyNode); 
-			return 0; 
+		if (key_matches(keyNode, key, keyHash, keyLen)) {
+			// Key found, an expired one was already gone for the clients
+			int expired = key_expired(keyNode);
+			remove_node(ht, index, keyNode, expired);
+			return expired;
 		}
-		prevNode = keyNode; 
 		keyNode = keyNode->next; 
 	}
+	filter_false_positive(ht);
 	return 1;
 }
 
-int add_subscriber(KeyNode *keyNode, int fdNotifPipe) {
-    if (keyNode == NULL) {
-        fprintf(stderr, "Error: KeyNode is NULL.\n");
-        return -1;
-    }
-
-    Subscriber *current = keyNode->subscriber;
-    Subscriber *prev = NULL;
-
-    // Check if the subscriber is already on the list
-    while (current != NULL) {
-        if (current->fdNotifPipe == fdNotifPipe) {
-            return 1; // Subscriber already exists
-        }
-        prev = current;
-        current = current->next;
-    }
-
-    // Allocate a new subscriber
-    Subscriber *newSubscriber = malloc(sizeof(Subscriber));
-    if (newSubscriber == NULL) {
-        fprintf(stderr, "Error: Allocating subscriber.\n");
-        return -1;
-    }
-    newSubscriber->fdNotifPipe = fdNotifPipe;
-    newSubscriber->next = NULL;
-
-    // Add the new subscriber to the end of the list
-    if (prev == NULL) {
-        keyNode->subscriber = newSubscriber;
-    } else {
-        prev->next = newSubscriber;
-    }
-    return 0;
-}
-
-int remove_subscriber(KeyNode *keyNode, int fdNotifPipe) {
-    Subscriber *subscriber = keyNode->subscriber;
-    Subscriber *prev = NULL;
-
-    while (subscriber != NULL) {
-        if (subscriber->fdNotifPipe == fdNotifPipe) {
-            if (prev == NULL) {
-                keyNode->subscriber = subscriber->next;
-            } else {
-                prev->next = subscriber->next;
-            }
-            free(subscriber);
-            return 0; // Subscriber existed and was removed
-        }
-        prev = subscriber;
-        subscriber = subscriber->next;
-    }
-    return 1; // Subscription not found
-}
-
-void notify_subscribers(KeyNode *keyNode, const char *key, const char *value) {
-	Subscriber *subscriber = keyNode->subscriber;
-	while (subscriber != NULL) {
-		if (write_all(subscriber->fdNotifPipe, key, KEY_MESSAGE_SIZE) == -1) {
-			fprintf(stderr, "Failed to write key to notification pipe.\n");
+int set_expiry(HashTable *ht, const char *key, uint64_t expiresAt) {
+	KeyNode *keyNode = find_key_node(ht, key);
+	if (keyNode == NULL) return 1;
+
+	int index = hash(key);
+	if (key_expired(keyNode)) {
+		remove_node(ht, index, keyNode, 1);
+		return 1;
+	}
+	schedule_expiry(&ht->wheels[index], keyNode, expiresAt);
+	return 0;
+}
+
+size_t expire_pairs(HashTable *ht, int index, uint64_t now, size_t max) {
+	size_t expired = 0;
+	Timer *timer;
+	while (expired < max && (timer = wheel_expire(&ht->wheels[index], now)) != NULL) {
+		KeyNode *keyNode = (KeyNode *) ((char *) timer - offsetof(KeyNode, expiry));
+		remove_node(ht, index, keyNode, 1);
+		expired++;
+	}
+	return expired;
+}
+
+int add_subscriber(KeyNode *keyNode, NotifyQueue *queue, Subscription **sessionList) {
+	if (keyNode == NULL) {
+		fprintf(stderr, "Error: KeyNode is NULL.\n");
+		return -1;
+	}
+
+	if (subscriber_set_find(&keyNode->subscribers, queue) != NULL) {
+		return 1; // Subscriber already exists
+	}
+
+	Subscription *subscription = malloc(sizeof(Subscription));
+	if (subscription == NULL) {
+		fprintf(stderr, "Error: Allocating subscriber.\n");
+		return -1;
+	}
+	subscription->queue = queue;
+	subscription->keyNode = keyNode;
+	if (subscriber_set_add(&keyNode->subscribers, subscription)) {
+		fprintf(stderr, "Error: Allocating subscriber set.\n");
+		free(subscription);
+		return -1;
+	}
+	subscription_link(sessionList, subscription);
+	return 0;
+}
+
+int remove_subscriber(HashTable *ht, KeyNode *keyNode, NotifyQueue *queue) {
+	Subscription *subscription = subscriber_set_find(&keyNode->subscribers, queue);
+	if (subscription == NULL) return 1; // Subscription not found
+
+	cancel_subscription(ht, subscription);
+	return 0;
+}
+
+void cancel_subscription(HashTable *ht, Subscription *subscription) {
+	KeyNode *keyNode = subscription->keyNode;
+	subscriber_set_remove(&keyNode->subscribers, subscription);
+	subscription_unlink(subscription);
+	free(subscription);
+	release_parked_key(ht, keyNode);
+}
+
+void release_parked_key(HashTable *ht, KeyNode *keyNode) {
+	// A parked node only lives while someone waits for its key
+	if (keyNode->value != NULL || keyNode->subscribers.count != 0) return;
+
+	KeyNode **link = find_pending_link(ht, hash(keyNode->key), keyNode->key,
+									   keyNode->keyHash, keyNode->keyLen);
+	*link = keyNode->next;
+	free(keyNode->key);
+	free(keyNode);
+}
+
+void notify_subscribers(KeyNode *keyNode, const char *key, const char *value, size_t valueLen,
+						uint64_t seq) {
+	PatternMatches matches;
+	pattern_matches_begin(key, &matches);
+	const SubscriberSet *subscribers = &keyNode->subscribers;
+	if (subscribers->count == 0 && matches.subscribers == 0) {
+		pattern_matches_end(&matches);
+		return;
+	}
+
+	// Built once, every subscriber queues a reference to it
+	Notification *notification = notification_create(key, keyNode->keyHash, value, valueLen, seq);
+	if (notification == NULL) {
+		fprintf(stderr, "Failed to allocate notification.\n");
+		pattern_matches_end(&matches);
+		return;
+	}
+
+	// Staging costs a pipe, worth it once enough pipes get the notification
+	// in the same layout
+	size_t pipeSubscribers = matches.pipeSubscribers;
+	size_t compactPipeSubscribers = matches.compactPipeSubscribers;
+	for (size_t i = 0; i < subscribers->capacity; i++) {
+		const NotifyQueue *queue = subscribers->slots[i] != NULL ? subscribers->slots[i]->queue : NULL;
+		if (queue != NULL && !queue->isSocket) {
+			pipeSubscribers++;
+			if (queue->compact) compactPipeSubscribers++;
 		}
-		if (write_all(subscriber->fdNotifPipe, value, KEY_MESSAGE_SIZE) == -1) {
-			fprintf(stderr, "Failed to write value to notification pipe.\n");
+	}
+	notification_stage(notification,
+					   pipeSubscribers - compactPipeSubscribers >= NOTIFY_TEE_MIN_SUBSCRIBERS,
+					   compactPipeSubscribers >= NOTIFY_TEE_MIN_SUBSCRIBERS);
+
+	for (size_t i = 0; i < subscribers->capacity; i++) {
+		if (subscribers->slots[i] != NULL) {
+			notify_queue_push(subscribers->slots[i]->queue, notification);
 		}
-		subscriber = subscriber->next;
 	}
+	pattern_matches_push(&matches, notification);
+	pattern_matches_end(&matches);
+	notification_release(notification);
+}
+
+void get_filter_stats(HashTable *ht, FilterStats *stats) {
+	stats->lookups = atomic_load_explicit(&ht->filterLookups, memory_order_relaxed);
+	stats->negatives = atomic_load_explicit(&ht->filterNegatives, memory_order_relaxed);
+	stats->falsePositives =
+			atomic_load_explicit(&ht->filterFalsePositives, memory_order_relaxed);
 }
 
-void free_subscribers(Subscriber *sub) {
-	Subscriber *temp;
-	while (sub != NULL) {
-		temp = sub;
-		sub = sub->next;
-		free(temp);
+unsigned long get_expired_count(HashTable *ht) {
+	return atomic_load_explicit(&ht->keysExpired, memory_order_relaxed);
+}
+
+void free_subscribers(KeyNode *keyNode) {
+	SubscriberSet *subscribers = &keyNode->subscribers;
+	for (size_t i = 0; i < subscribers->capacity; i++) {
+		if (subscribers->slots[i] == NULL) continue;
+		subscription_unlink(subscribers->slots[i]);
+		free(subscribers->slots[i]);
 	}
+	subscriber_set_free(subscribers);
 }
 
 void free_table(HashTable *ht) {
@@ -213,7 +577,15 @@ void free_table(HashTable *ht) {
 			keyNode = keyNode->next;
 			free(temp->key);
 			free(temp->value);
-			free_subscribers(temp->subscriber);
+			free_subscribers(temp);
+			free(temp);
+		}
+		keyNode = ht->pending[i];
+		while (keyNode != NULL) {
+			KeyNode *temp = keyNode;
+			keyNode = keyNode->next;
+			free(temp->key);
+			free_subscribers(temp);
 			free(temp);
 		}
 		if (pthread_rwlock_destroy(&ht->bucketLocks[i])) {
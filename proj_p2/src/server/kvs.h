@@ -1,25 +1,58 @@
 #ifndef KEY_VALUE_STORE_H
 #define KEY_VALUE_STORE_H
 #define TABLE_SIZE 26
+#define BLOOM_COUNTERS 4096 // counters in the filter of each bucket
+#define BLOOM_HASHES 3      // counters set per key
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
-typedef struct Subscriber {
-	int fdNotifPipe;
-	struct Subscriber *next;
-} Subscriber;
+#include "notifier.h"
+#include "patterns.h"
+#include "subscriptions.h"
+#include "timers.h"
 
 typedef struct KeyNode {
+	uint64_t keyHash; // hash_key of the key, compared before the key bytes
+	size_t keyLen;
 	char *key;
-	char *value;
+	char *value;     // null terminated, but may also hold '\0' bytes
+	size_t valueLen; // bytes in value, before the terminator
 	struct KeyNode *next;
-	Subscriber *subscriber;
+	struct KeyNode *prev; // previous in the chain of the table, NULL at its head
+	SubscriberSet subscribers;
+	Timer expiry;         // in the wheel of the bucket while the key has a TTL
 } KeyNode;
 
+/// Counting bloom filter over the keys of a bucket. Counters saturate at
+/// UCHAR_MAX and are never decremented afterwards, so deletes are supported
+/// without ever producing false negatives.
+typedef struct BucketFilter {
+	unsigned char counters[BLOOM_COUNTERS];
+} BucketFilter;
+
+/// Counters of how the bucket filters answered lookups.
+typedef struct FilterStats {
+	unsigned long lookups;        // lookups that consulted a filter
+	unsigned long negatives;      // misses answered by the filter alone
+	unsigned long falsePositives; // filter hits that missed on the chain
+} FilterStats;
+
 typedef struct HashTable {
 	KeyNode *table[TABLE_SIZE];
+	// Keys subscribed before they exist, with no value. Each list is guarded
+	// by the lock of its bucket and its nodes move to the table on creation.
+	KeyNode *pending[TABLE_SIZE];
+	BucketFilter filters[TABLE_SIZE];
+	// Expiries of the keys with a TTL, guarded by the lock of their bucket
+	TimerWheel wheels[TABLE_SIZE];
 	pthread_rwlock_t *bucketLocks;
+	atomic_ulong filterLookups;
+	atomic_ulong filterNegatives;
+	atomic_ulong filterFalsePositives;
+	atomic_ulong keysExpired;
 } HashTable;
 
 /// Creates a new KVS hash table.
@@ -28,46 +61,142 @@ struct HashTable *create_hash_table();
 
 int hash(const char *key);
 
-// Writes a key value pair in the hash table.
+/// Full 64-bit hash of a key (FNV-1a), used by the bucket filters.
+/// @param key The key.
+/// @return hash.
+uint64_t hash_key(const char *key);
+
+// Writes a key value pair in the hash table, logging the change. A key
+// that expired is deleted first, as if its expiry had fired.
 // @param ht The hash table.
 // @param key The key.
-// @param value The value.
-// @return 0 if successful.
-int write_pair(HashTable *ht, const char *key, const char *value);
+// @param value The value, copied.
+// @param valueLen Number of bytes in the value.
+// @param expiresAt When the key expires, from timers_now, 0 for never.
+// @return 0 if successful, 1 on error or if no bucket can hold the key.
+int write_pair(HashTable *ht, const char *key, const char *value, size_t valueLen,
+			   uint64_t expiresAt);
+
+/// Checks whether a key expired. Expired keys read as missing until their
+/// expiry fires or a write to their bucket finds them.
+/// @param keyNode
+/// @return 1 if the key has a TTL that ran out, 0 otherwise.
+int key_expired(const KeyNode *keyNode);
+
+/// Changes when a key expires.
+/// @param ht The hash table.
+/// @param key The key.
+/// @param expiresAt When the key expires, from timers_now, 0 for never.
+/// @return 0 if successful, 1 if the key does not exist.
+int set_expiry(HashTable *ht, const char *key, uint64_t expiresAt);
+
+/// Deletes the keys of a bucket whose TTL ran out, as delete_pair does.
+/// Must be called with the bucket write lock held.
+/// @param ht The hash table.
+/// @param index Bucket to expire.
+/// @param now Current time, from timers_now.
+/// @param max Most keys to delete.
+/// @return number of keys deleted, max if more may be due
+size_t expire_pairs(HashTable *ht, int index, uint64_t now, size_t max);
 
 // Reads the value of a given key.
 // @param ht The hash table.
 // @param key The key.
-// return the value if found, NULL otherwise.
-char *read_pair(HashTable *ht, const char *key);
+// @param valueLen Set to the number of bytes in the value.
+// return a null terminated copy of the value if found, NULL otherwise.
+char *read_pair(HashTable *ht, const char *key, size_t *valueLen);
 
-/// Deletes a pair from the table.
+/// Reads the values of several keys in one pass. All keys are hashed first
+/// and their chains are walked interleaved, prefetching the next node of each
+/// chain, so the cache misses of different keys overlap.
+/// @param ht Hash table to read from.
+/// @param num_keys Number of keys to read.
+/// @param keys Array of keys.
+/// @param values Output array; values[i] is set to a null terminated copy
+/// of the value of keys[i], or NULL if the key does not exist.
+/// @param valueLens Output array; valueLens[i] is set to the number of bytes
+/// in values[i].
+void read_pairs(HashTable *ht, size_t num_keys, const char *keys[], char *values[],
+				size_t valueLens[]);
+
+/// Finds the node of a key, even if it expired.
+/// @param ht The hash table.
+/// @param key The key.
+/// @return the key node if found, NULL otherwise.
+KeyNode *find_key_node(HashTable *ht, const char *key);
+
+/// Finds the parked node of a key that does not exist yet.
+/// @param ht The hash table.
+/// @param key The key.
+/// @return the parked node if the key is watched, NULL otherwise.
+KeyNode *find_pending_node(HashTable *ht, const char *key);
+
+/// Parks a key that does not exist yet, so subscribers can wait on it. The
+/// write that creates the key attaches and notifies them.
+/// @param ht The hash table.
+/// @param key The key, not in the table.
+/// @return the parked node, NULL if the key has no bucket or on error.
+KeyNode *park_key(HashTable *ht, const char *key);
+
+/// Drops a parked key once no subscriber waits on it. Keys in the table
+/// are left alone.
+/// @param ht The hash table.
+/// @param keyNode
+void release_parked_key(HashTable *ht, KeyNode *keyNode);
+
+/// Deletes a pair from the table, logging the change.
 /// @param ht Hash table to read from.
 /// @param key Key of the pair to be deleted.
-/// @return 0 if the node was deleted successfully, 1 otherwise.
+/// @return 0 if the node was deleted successfully, 1 otherwise. An expired
+/// key is deleted but counts as missing.
 int delete_pair(HashTable *ht, const char *key);
 
 /// @brief Adds a subscriber to a key.
 /// @param keyNode To be subscribed.
-/// @param fdNotifPipe fdNotifPipe of the client subscribing.
+/// @param queue Notifications queue of the client subscribing.
+/// @param sessionList The client's list of subscriptions in the bucket of
+/// the key, where the new subscription is linked.
 /// @return 0 if successful, 1 if subscriber already exists, -1 if error
-int add_subscriber(KeyNode *keyNode, int fdNotifPipe);
+int add_subscriber(KeyNode *keyNode, NotifyQueue *queue, Subscription **sessionList);
 
 /// @brief Removes a subscriber from a key.
+/// @param ht The hash table.
 /// @param keyNode 
-/// @param fdNotifPipe 
+/// @param queue Notifications queue of the client unsubscribing.
 /// @return 0 deleted successfully, 1 subscriber not found
-int remove_subscriber(KeyNode *keyNode, int fdNotifPipe);
-
-/// @brief Notifies all subscribers of a key.
+int remove_subscriber(HashTable *ht, KeyNode *keyNode, NotifyQueue *queue);
+
+/// @brief Removes a subscription found through the client's list, without
+/// looking up the key. The bucket of the key must be write locked. A parked
+/// key is dropped with its last subscription.
+/// @param ht The hash table.
+/// @param subscription
+void cancel_subscription(HashTable *ht, Subscription *subscription);
+
+/// @brief Queues a notification for all subscribers of a key, and of the
+/// patterns matching it. The notifier threads send it, so this never waits
+/// for a subscriber.
 /// @param keyNode 
 /// @param key 
-/// @param value 
-void notify_subscribers(KeyNode *keyNode, const char *key, const char *value);
-
-/// Frees the subscribers list.
-/// @param sub List of subscribers to be deleted.
-void free_subscribers(Subscriber *sub);
+/// @param value New value, "DELETE" for a delete.
+/// @param valueLen Number of bytes in the value.
+/// @param seq Sequence number of the change, from changelog_append.
+void notify_subscribers(KeyNode *keyNode, const char *key, const char *value, size_t valueLen,
+						uint64_t seq);
+
+/// Gets a snapshot of the bucket filters' counters.
+/// @param ht The hash table.
+/// @param stats Where to store the counters.
+void get_filter_stats(HashTable *ht, FilterStats *stats);
+
+/// Gets the number of keys deleted because their TTL ran out.
+/// @param ht The hash table.
+/// @return the count
+unsigned long get_expired_count(HashTable *ht);
+
+/// Frees the subscriptions of a key, unlinking them from their clients.
+/// @param keyNode
+void free_subscribers(KeyNode *keyNode);
 
 /// Frees the hashtable.
 /// @param ht Hash table to be deleted.
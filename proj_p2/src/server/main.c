@@ -11,22 +11,34 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <errno.h>
-#include <semaphore.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 
+#include "cdc.h"
 #include "constants.h"
+#include "expiry.h"
+#include "io.h"
+#include "notifier.h"
 #include "operations.h"
 #include "parser.h"
 #include "src/common/io.h"
 #include "src/common/constants.h"
 #include "src/common/protocol.h"
+#include "src/common/ring.h"
+#include "src/common/varint.h"
 
 #include "client.h"
 
 pthread_mutex_t backupCounterMutex;
 pthread_mutex_t dirMutex;
 pthread_rwlock_t globalHashLock;
-pthread_mutex_t clientsBufferMutex; // For reading
+pthread_rwlock_t sessionsLock; // held for writing while clients are reset
 
 
 struct ThreadArgs {
@@ -35,22 +47,11 @@ struct ThreadArgs {
 	unsigned int *backupCounter;
 };
 
-struct ClientInfo {
-	char respFifo[MAX_PIPE_PATH_LENGTH];
-	char reqFifo[MAX_PIPE_PATH_LENGTH];
-	char notifFifo[MAX_PIPE_PATH_LENGTH];
-};
-
-
-struct ClientInfo *clientsBuffer[MAX_SESSION_COUNT]; //producer-consumer buffer
-sem_t readSem;
-sem_t writeSem;
+// epoll instance watching the requests pipes of all client sessions
+static int epollFd = -1;
 
-// reading index for the clientsBuffer
-int in, out;
-
-static int disconnectControl = 0;
-static int restartClients = 0;
+static volatile sig_atomic_t restartClients = 0;
+static NotifyPolicy notifyPolicy = NOTIFY_COALESCE;
 
 void *process_thread(void *arg) {
 	// mask SIGUSR1 signal
@@ -113,8 +114,12 @@ void *process_thread(void *arg) {
 		}
 
 		char keys[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
-		char values[MAX_WRITE_SIZE][MAX_STRING_SIZE] = {0};
+		// Values are allocated by parse_write for each WRITE, to their size
+		char *values[MAX_WRITE_SIZE];
+		const char *valueList[MAX_WRITE_SIZE];
+		size_t valueLengths[MAX_WRITE_SIZE];
 		unsigned int delay;
+		unsigned int ttl;
 		size_t num_pairs;
 
 		// count the backups already made on this file
@@ -124,17 +129,23 @@ void *process_thread(void *arg) {
 		while (!eocFlag) {
 			switch (get_next(fd)) {
 				case CMD_WRITE:
-					num_pairs =
-							parse_write(fd, keys, values, MAX_WRITE_SIZE, MAX_STRING_SIZE);
+					num_pairs = parse_write(fd, keys, values, valueLengths, MAX_WRITE_SIZE,
+											MAX_STRING_SIZE, &ttl);
 					if (num_pairs == 0) {
 						fprintf(stderr, "Invalid command. See HELP for usage\n");
 						continue;
 					}
+					for (size_t i = 0; i < num_pairs; i++) {
+						valueList[i] = values[i];
+					}
 					if (pthread_rwlock_rdlock(&globalHashLock) ||
-						kvs_write(num_pairs, keys, values) ||
+						kvs_write(num_pairs, keys, valueList, valueLengths, ttl) ||
 						pthread_rwlock_unlock(&globalHashLock)) {
 						fprintf(stderr, "Failed to write pair\n");
 					}
+					for (size_t i = 0; i < num_pairs; i++) {
+						free(values[i]);
+					}
 					break;
 
 				case CMD_READ:
@@ -168,6 +179,20 @@ void *process_thread(void *arg) {
 					}
 					break;
 
+				case CMD_EXPIRE:
+					num_pairs = parse_expire(fd, keys, MAX_WRITE_SIZE, MAX_STRING_SIZE, &ttl);
+
+					if (num_pairs == 0) {
+						fprintf(stderr, "Invalid command. See HELP for usage\n");
+						continue;
+					}
+					if (pthread_rwlock_rdlock(&globalHashLock) ||
+						kvs_expire(num_pairs, keys, ttl, fdOut) ||
+						pthread_rwlock_unlock(&globalHashLock)) {
+						fprintf(stderr, "Failed to expire pair\n");
+					}
+					break;
+
 				case CMD_SHOW:
 					if (pthread_rwlock_rdlock(&globalHashLock) ||
 						kvs_show(fdOut) ||
@@ -176,6 +201,12 @@ void *process_thread(void *arg) {
 					}
 					break;
 
+				case CMD_STATS:
+					if (kvs_stats(fdOut)) {
+						fprintf(stderr, "Failed to show statistics\n");
+					}
+					break;
+
 				case CMD_WAIT:
 					if (parse_wait(fd, &delay, NULL) == -1) {
 						fprintf(stderr, "Invalid command. See HELP for usage\n");
@@ -266,10 +297,12 @@ void *process_thread(void *arg) {
 
 				case CMD_HELP:
 					printf("Available commands:\n"
-						   "  WRITE [(key,value)(key2,value2),...]\n"
+						   "  WRITE [(key,value)(key2,value2),...] [ttl_ms]\n"
 						   "  READ [key,key2,...]\n"
 						   "  DELETE [key,key2,...]\n"
+						   "  EXPIRE [key,key2,...] <ttl_ms>\n"
 						   "  SHOW\n"
+						   "  STATS\n"
 						   "  WAIT <delay_ms>\n"
 						   "  BACKUP\n"
 						   "  HELP\n");
@@ -296,27 +329,64 @@ void *process_thread(void *arg) {
 	return NULL;
 }
 
+/// @brief Reads the paths of a CONNECT_COMPACT message, each prefixed with
+/// its length.
+/// @param fdServerPipe
+/// @param paths Where to store the null terminated paths.
+/// @return 0 on success, 1 on error
+static int read_compact_paths(int fdServerPipe, char *paths[3]) {
+	int reading_error = 0;
+	for (int i = 0; i < 3; i++) {
+		uint64_t length;
+		if (varint_read(fdServerPipe, &length, &reading_error) <= 0 ||
+			length > MAX_PIPE_PATH_LENGTH ||
+			(length > 0 && read_all(fdServerPipe, paths[i], length, &reading_error) <= 0)) {
+			return 1;
+		}
+		paths[i][length] = '\0';
+	}
+	return 0;
+}
+
 /// @brief Reads the connect message from the server pipe
 /// @param fdServerPipe 
 /// @param opcode 
 /// @param req_pipe 
 /// @param resp_pipe 
 /// @param notif_pipe 
+/// @param version Set to the version a CONNECT_COMPACT message asks for, 0
+/// for a CONNECT message
 /// @return 0 on success, 1 on error
-int read_connect_message(int fdServerPipe, char *opcode, char *req_pipe, char *resp_pipe, char *notif_pipe) {
+int read_connect_message(int fdServerPipe, char *opcode, char *req_pipe, char *resp_pipe,
+						 char *notif_pipe, int *version) {
 	int reading_error = 0;
 	char buffer[MAX_PIPE_PATH_LENGTH*3 + 1];
 
-	if(read_all(fdServerPipe, buffer, MAX_PIPE_PATH_LENGTH*3 + 1, &reading_error) <= 0
-	   || reading_error == 1) {
+	if (read_all(fdServerPipe, buffer, 1, &reading_error) <= 0 || reading_error == 1) {
 		return 1;
 	}
-	
+
 	*opcode = buffer[0];
-    opcode[1] = '\0';
-	
+	*version = 0;
+
+	if (*opcode == OP_CODE_CONNECT_COMPACT) {
+		char *paths[3] = {req_pipe, resp_pipe, notif_pipe};
+		if (read_all(fdServerPipe, buffer, 1, &reading_error) <= 0 ||
+			read_compact_paths(fdServerPipe, paths)) {
+			fprintf(stderr, "Malformed connect message\n");
+			return 1;
+		}
+		*version = buffer[0];
+		return 0;
+	}
+
     if (*opcode != OP_CODE_CONNECT) return 1;
 
+	if (read_all(fdServerPipe, buffer + 1, MAX_PIPE_PATH_LENGTH * 3, &reading_error) <= 0 ||
+		reading_error == 1) {
+		return 1;
+	}
+
 	strncpy(req_pipe, &buffer[1], MAX_PIPE_PATH_LENGTH);
     req_pipe[MAX_PIPE_PATH_LENGTH] = '\0';
 
@@ -329,11 +399,521 @@ int read_connect_message(int fdServerPipe, char *opcode, char *req_pipe, char *r
 	return 0;
 }
 
-/// @brief Given an opcode, executes the request from the client
+/// @brief Writes the tagged responses buffered for a client to its
+/// responses ring, waking the client up if it sleeps. What does not fit
+/// stays buffered; the client sends OP_CODE_WAKEUP once it makes room.
 /// @param client
-/// @param opcode 
-/// @return 1 if CONNECT, SUBSCRIBE, UNSUBSCRIBE, 0 if DISCONNECT, -1 unknown opcode
-int manage_request(struct Client *client, const char opcode) {
+/// @return 0 on success, 1 if the client stopped reading its ring
+static int write_to_ring(struct Client *client) {
+	struct Ring *ring = &client->rings->responses;
+	const uint64_t wakeup = 1;
+	size_t written = 0;
+	do {
+		written += ring_write(ring, client->responseBuffer + written,
+							  client->responseLength - written);
+	} while (written < client->responseLength && !ring_wait_room(ring));
+
+	if (written > 0 && ring_wake_consumer(ring) &&
+		write(client->fdRingWakeup, &wakeup, sizeof(wakeup)) < 0) {
+		perror("Failed to wake client");
+		return 1;
+	}
+	client->responseLength -= written;
+	memmove(client->responseBuffer, client->responseBuffer + written, client->responseLength);
+
+	// Pipelined clients never have more responses in flight than fit, so
+	// another ring's worth unread means the client is gone
+	if (client->responseLength > RING_SIZE) {
+		fprintf(stderr, "Client stopped reading its responses ring.\n");
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Maps the rings a client passed with OP_CODE_ATTACH.
+/// @param client
+/// @return 0 on success, 1 otherwise
+static int attach_rings(struct Client *client) {
+	struct stat region;
+	if (!client->isSocket || client->rings != NULL || client->passedFds[1] < 0 ||
+		fstat(client->passedFds[0], &region) ||
+		(size_t) region.st_size < sizeof(struct RingRegion)) {
+		fprintf(stderr, "Client sent no valid rings to attach.\n");
+		return 1;
+	}
+
+	char *ringBuffer = malloc(RING_SIZE);
+	void *rings = mmap(NULL, sizeof(struct RingRegion), PROT_READ | PROT_WRITE, MAP_SHARED,
+					   client->passedFds[0], 0);
+	if (ringBuffer == NULL || rings == MAP_FAILED) {
+		perror("Failed to map client rings");
+		free(ringBuffer);
+		if (rings != MAP_FAILED) munmap(rings, sizeof(struct RingRegion));
+		return 1;
+	}
+
+	// The mapping stays valid after its fd is closed
+	close(client->passedFds[0]);
+	client->fdRingWakeup = client->passedFds[1];
+	client->passedFds[0] = client->passedFds[1] = -1;
+	client->rings = rings;
+	client->ringBuffer = ringBuffer;
+	client->ringLength = 0;
+	return 0;
+}
+
+/// @brief Watches the responses pipe of a client until it takes the
+/// responses it left unread. Its requests are not read meanwhile.
+/// @param client
+/// @return 0 on success, 1 on error
+static int watch_output(struct Client *client) {
+	struct epoll_event event;
+	event.events = EPOLLOUT | EPOLLONESHOT;
+	event.data.u64 = ((uint64_t) client->generation << 32) | client->slot;
+	// The responses pipe of a pipe session is only added the first time
+	int op = client->isSocket || client->outputWatched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(epollFd, op, client->fdResp, &event)) {
+		perror("Failed to watch responses pipe");
+		return 1;
+	}
+	client->outputWatched = 1;
+	return 0;
+}
+
+/// @brief Disconnects a client. One that has not taken its last responses
+/// is left to the reactors until it does.
+/// @param client
+static void disconnect_client(struct Client *client) {
+	kvs_disconnect(&client);
+	if (client != NULL && watch_output(client)) kvs_finish_disconnect(client);
+}
+
+/// @brief Writes the tagged responses buffered for a client.
+/// @param client
+/// @return 0 on success, 1 on error
+static int flush_responses(struct Client *client) {
+	if (client->responseLength == 0) return 0;
+	if (client->rings != NULL) return write_to_ring(client);
+
+	int error = send_to_client(client, client->responseBuffer, client->responseLength);
+	client->responseLength = 0;
+	if (error) fprintf(stderr, "Failed to write responses to the responses pipe.\n");
+	return error;
+}
+
+/// @brief Sends the response to a request. Untagged responses are written
+/// right away, tagged ones are buffered so that all the requests read in
+/// one go are answered with a single write. Neither waits for the client.
+/// @param client
+/// @param tag Id of a tagged request, NULL if the request was not tagged.
+/// @param response The response, starting with the opcode.
+/// @param length Size of the response.
+/// @return 0 on success, 1 on error
+static int send_response(struct Client *client, const uint32_t *tag,
+						 const char *response, size_t length) {
+	if (tag == NULL) {
+		if (flush_responses(client) || send_to_client(client, response, length)) {
+			fprintf(stderr, "Failed to write response to the responses pipe.\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	size_t needed = client->responseLength + TAG_HEADER_SIZE + length;
+	if (needed > client->responseCapacity) {
+		size_t capacity = client->responseCapacity ? client->responseCapacity * 2 : REQUEST_BUFFER_SIZE;
+		while (capacity < needed) capacity *= 2;
+		char *buffer = realloc(client->responseBuffer, capacity);
+		if (buffer == NULL) {
+			fprintf(stderr, "Failed to grow response buffer\n");
+			return 1;
+		}
+		client->responseBuffer = buffer;
+		client->responseCapacity = capacity;
+	}
+
+	char *entry = client->responseBuffer + client->responseLength;
+	entry[0] = OP_CODE_TAGGED;
+	memcpy(entry + 1, tag, sizeof(*tag));
+	memcpy(entry + TAG_HEADER_SIZE, response, length);
+	client->responseLength = needed;
+	return 0;
+}
+
+/// @brief Answers a GET request with the values of its keys.
+/// @param client
+/// @param request The request frame.
+/// @param tag Id of a tagged request, NULL otherwise.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_get(struct Client *client, const char *request, const uint32_t *tag) {
+	char keys[MAX_BATCH_KEYS][MAX_STRING_SIZE];
+	char *values[MAX_BATCH_KEYS];
+	size_t valueLengths[MAX_BATCH_KEYS];
+	size_t numKeys = parse_batch_request(request, keys, NULL, NULL);
+
+	int error = 0;
+	if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+		error = 1;
+	} else {
+		error = kvs_get(numKeys, keys, values, valueLengths);
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+	}
+	if (error) numKeys = 0;
+
+	char response[BATCH_HEADER_SIZE + 1 + numKeys * (2 + BATCH_MAX_STRING_LENGTH)];
+	size_t offset = 0;
+	response[offset++] = OP_CODE_GET;
+	response[offset++] = error ? '1' : '0';
+	uint32_t count = (uint32_t) numKeys;
+	memcpy(response + offset, &count, sizeof(count));
+	offset += sizeof(count);
+
+	for (size_t i = 0; i < numKeys; i++) {
+		if (values[i] == NULL) {
+			response[offset++] = 0;
+			response[offset++] = 0;
+			continue;
+		}
+		// Batch frames carry the start of a larger value, GET_VALUE the whole
+		size_t valueLength = valueLengths[i] < BATCH_MAX_STRING_LENGTH ? valueLengths[i]
+																		: BATCH_MAX_STRING_LENGTH;
+		int truncated = valueLength < valueLengths[i] &&
+						client->protocol >= PROTOCOL_TRUNCATION_FLAGS;
+		response[offset++] = truncated ? BATCH_VALUE_TRUNCATED : 1;
+		response[offset++] = (char) valueLength;
+		memcpy(response + offset, values[i], valueLength);
+		offset += valueLength;
+		free(values[i]);
+	}
+
+	return send_response(client, tag, response, offset);
+}
+
+/// @brief Tells whether every key of a batch has a bucket that can hold it.
+/// @param keys
+/// @param numKeys
+/// @return 1 if they all do, 0 otherwise
+static int batch_keys_valid(char keys[][MAX_STRING_SIZE], size_t numKeys) {
+	for (size_t i = 0; i < numKeys; i++) {
+		if (hash(keys[i]) < 0) return 0;
+	}
+	return 1;
+}
+
+/// @brief Moves the keys of a batch that have a bucket to its front.
+/// @param keys
+/// @param numKeys
+/// @param positions Set to the position in the request of each key kept.
+/// @return number of keys kept
+static size_t keep_valid_keys(char keys[][MAX_STRING_SIZE], size_t numKeys, size_t positions[]) {
+	size_t kept = 0;
+	for (size_t i = 0; i < numKeys; i++) {
+		if (hash(keys[i]) < 0) continue;
+		if (kept != i) memcpy(keys[kept], keys[i], MAX_STRING_SIZE);
+		positions[kept++] = i;
+	}
+	return kept;
+}
+
+/// @brief Answers a PUT or PUT_TTL request after writing its pairs.
+/// @param client
+/// @param request The request frame.
+/// @param tag Id of a tagged request, NULL otherwise.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_put(struct Client *client, const char *request, const uint32_t *tag) {
+	char keys[MAX_BATCH_KEYS][MAX_STRING_SIZE];
+	const char *values[MAX_BATCH_KEYS];
+	size_t valueLengths[MAX_BATCH_KEYS];
+	uint32_t ttl = 0;
+	size_t numPairs = request[0] == OP_CODE_PUT_TTL
+							  ? parse_ttl_request(request, &ttl, keys, values, valueLengths)
+							  : parse_batch_request(request, keys, values, valueLengths);
+
+	int error = 0;
+	if (!batch_keys_valid(keys, numPairs)) {
+		// No bucket can hold one of the keys, none of the pairs is written
+		error = 1;
+	} else if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+		error = 1;
+	} else {
+		error = kvs_write(numPairs, keys, values, valueLengths, ttl);
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+	}
+
+	const char response[2] = {request[0], error ? '1' : '0'};
+	return send_response(client, tag, response, sizeof(response));
+}
+
+/// @brief Answers a DEL request with whether each key was deleted, or an
+/// EXPIRE request with whether each key exists.
+/// @param client
+/// @param request The request frame.
+/// @param tag Id of a tagged request, NULL otherwise.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_del(struct Client *client, const char *request, const uint32_t *tag) {
+	char keys[MAX_BATCH_KEYS][MAX_STRING_SIZE];
+	int deleted[MAX_BATCH_KEYS];
+	uint32_t ttl = 0;
+	size_t numKeys = request[0] == OP_CODE_EXPIRE
+							 ? parse_ttl_request(request, &ttl, keys, NULL, NULL)
+							 : parse_batch_request(request, keys, NULL, NULL);
+
+	// Keys no bucket can hold are missing, the others are looked up
+	size_t positions[MAX_BATCH_KEYS];
+	int results[MAX_BATCH_KEYS];
+	size_t numValid = keep_valid_keys(keys, numKeys, positions);
+	for (size_t i = 0; i < numKeys; i++) {
+		deleted[i] = 0;
+	}
+
+	int error = 0;
+	if (numValid == 0) {
+		// Nothing to look up
+	} else if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+		error = 1;
+	} else {
+		if (request[0] == OP_CODE_EXPIRE) {
+			error = kvs_expire_batch(numValid, keys, ttl, results);
+		} else {
+			error = kvs_del(numValid, keys, results);
+		}
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+		for (size_t i = 0; i < numValid && !error; i++) {
+			deleted[positions[i]] = results[i];
+		}
+	}
+	if (error) numKeys = 0;
+
+	char response[BATCH_HEADER_SIZE + 1 + numKeys];
+	size_t offset = 0;
+	response[offset++] = request[0];
+	response[offset++] = error ? '1' : '0';
+	uint32_t count = (uint32_t) numKeys;
+	memcpy(response + offset, &count, sizeof(count));
+	offset += sizeof(count);
+	for (size_t i = 0; i < numKeys; i++) {
+		response[offset++] = (char) deleted[i];
+	}
+
+	return send_response(client, tag, response, offset);
+}
+
+/// @brief Answers a SUBSCRIBE_BATCH or UNSUBSCRIBE_BATCH request with a
+/// bitmap of the keys it succeeded for. A subscription waiting for its key
+/// to be written succeeded too.
+/// @param client
+/// @param request The request frame.
+/// @param tag Id of a tagged request, NULL otherwise.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_subscriptions(struct Client *client, const char *request, const uint32_t *tag) {
+	char keys[MAX_BATCH_KEYS][MAX_STRING_SIZE];
+	int succeeded[MAX_BATCH_KEYS];
+	size_t numKeys = parse_batch_request(request, keys, NULL, NULL);
+
+	int error = 0;
+	if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+		error = 1;
+	} else {
+		if (request[0] == OP_CODE_SUBSCRIBE_BATCH) {
+			error = kvs_subscribe_batch(numKeys, keys, client, succeeded);
+		} else {
+			error = kvs_unsubscribe_batch(numKeys, keys, client, succeeded);
+		}
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+	}
+	if (error) numKeys = 0;
+
+	char response[BATCH_HEADER_SIZE + 1 + BATCH_BITMAP_SIZE(MAX_BATCH_KEYS)];
+	size_t offset = 0;
+	response[offset++] = request[0];
+	response[offset++] = error ? '1' : '0';
+	uint32_t count = (uint32_t) numKeys;
+	memcpy(response + offset, &count, sizeof(count));
+	offset += sizeof(count);
+	memset(response + offset, 0, BATCH_BITMAP_SIZE(numKeys));
+	for (size_t i = 0; i < numKeys; i++) {
+		// Subscriptions report -1 only for the keys they failed for
+		int bit = request[0] == OP_CODE_SUBSCRIBE_BATCH ? succeeded[i] >= 0 : succeeded[i];
+		if (bit) response[offset + i / 8] |= (char) (1 << (i % 8));
+	}
+	offset += BATCH_BITMAP_SIZE(numKeys);
+
+	return send_response(client, tag, response, offset);
+}
+
+/// @brief Writes the value of a PUT_VALUE request, which is read from the
+/// request buffer without being copied.
+/// @param client
+/// @param request The request frame.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_put_value(struct Client *client, const char *request) {
+	char keys[1][MAX_STRING_SIZE];
+	const char *values[1];
+	size_t valueLengths[1];
+	parse_value_request(request, keys[0], &values[0], &valueLengths[0]);
+
+	int error = 0;
+	if (hash(keys[0]) < 0) {
+		// No bucket can hold the key
+		error = 1;
+	} else if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+		error = 1;
+	} else {
+		error = kvs_write(1, keys, values, valueLengths, 0);
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+	}
+
+	const char response[2] = {OP_CODE_PUT_VALUE, error ? '1' : '0'};
+	return send_response(client, NULL, response, sizeof(response));
+}
+
+/// @brief Answers a GET_VALUE request with the whole value of its key. The
+/// value is sent from the copy kvs_get makes, after the header.
+/// @param client
+/// @param request The request frame.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_get_value(struct Client *client, const char *request) {
+	char keys[1][MAX_STRING_SIZE];
+	char *values[1] = {NULL};
+	size_t valueLengths[1] = {0};
+	parse_value_request(request, keys[0], NULL, NULL);
+
+	int error = 0;
+	if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+		error = 1;
+	} else {
+		error = kvs_get(1, keys, values, valueLengths);
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+	}
+
+	char response[3 + VARINT_MAX_SIZE];
+	size_t offset = 0;
+	response[offset++] = OP_CODE_GET_VALUE;
+	response[offset++] = error ? '1' : '0';
+	response[offset++] = !error && values[0] != NULL;
+	offset += varint_encode(error ? 0 : valueLengths[0], response + offset);
+	int sendError = send_response(client, NULL, response, offset);
+	if (!sendError && !error && valueLengths[0] > 0) {
+		sendError = send_to_client(client, values[0], valueLengths[0]);
+	}
+	if (!error) free(values[0]);
+	return sendError;
+}
+
+/// @brief Answers a RESUME request with a page of the changes the client
+/// missed.
+/// @param client
+/// @param request The request frame.
+/// @return 0 on success, 1 if the response could not be sent
+static int manage_resume(struct Client *client, const char *request) {
+	uint64_t after;
+	memcpy(&after, request + 1, sizeof(after));
+	ChangeRecord records[RESUME_MAX_RECORDS];
+	size_t numRecords = 0;
+	uint64_t last = after;
+
+	int status = -1;
+	if (pthread_rwlock_rdlock(&globalHashLock)) {
+		fprintf(stderr, "Failed to lock global hash lock\n");
+	} else {
+		status = kvs_resume(after, client, records, &numRecords, &last);
+		if (pthread_rwlock_unlock(&globalHashLock)) {
+			fprintf(stderr, "Failed to unlock global hash lock\n");
+		}
+	}
+
+	char response[RESUME_HEADER_SIZE + RESUME_MAX_RECORDS * NOTIFICATION_SIZE];
+	size_t offset = 0;
+	response[offset++] = OP_CODE_RESUME;
+	switch (status) {
+		case 0:
+			response[offset++] = RESUME_COMPLETE;
+			break;
+		case 1:
+			response[offset++] = RESUME_PARTIAL;
+			break;
+		case 2:
+			response[offset++] = RESUME_EVICTED;
+			break;
+		default:
+			// kvs_resume kept no changes
+			response[offset++] = '1';
+			break;
+	}
+	memcpy(response + offset, &last, sizeof(last));
+	offset += sizeof(last);
+	uint32_t count = (uint32_t) numRecords;
+	memcpy(response + offset, &count, sizeof(count));
+	offset += sizeof(count);
+
+	// Records are laid out as notifications: compact ones prefix the strings
+	// with their length, fixed ones pad them with '\0'
+	int error = 0;
+	for (size_t i = 0; i < numRecords && !error; i++) {
+		size_t keyLength = strnlen(records[i].key, BATCH_MAX_STRING_LENGTH);
+		size_t valueLength = records[i].valueLength < BATCH_MAX_STRING_LENGTH
+									 ? records[i].valueLength
+									 : BATCH_MAX_STRING_LENGTH;
+		if (client->protocol < PROTOCOL_COMPACT) {
+			memset(response + offset, 0, 2 * KEY_MESSAGE_SIZE);
+			memcpy(response + offset, records[i].key, keyLength);
+			memcpy(response + offset + KEY_MESSAGE_SIZE, records[i].value, valueLength);
+			offset += NOTIFICATION_SIZE;
+			continue;
+		}
+
+		offset += varint_encode(keyLength, response + offset);
+		memcpy(response + offset, records[i].key, keyLength);
+		offset += keyLength;
+		if (client->protocol >= PROTOCOL_LARGE_VALUES && records[i].largeValue != NULL) {
+			// Sent from the record instead of copied into the page
+			offset += varint_encode(records[i].valueLength, response + offset);
+			error = send_response(client, NULL, response, offset) ||
+					send_to_client(client, records[i].largeValue, records[i].valueLength);
+			offset = 0;
+		} else {
+			offset += varint_encode(valueLength, response + offset);
+			memcpy(response + offset, records[i].value, valueLength);
+			offset += valueLength;
+		}
+		memcpy(response + offset, &records[i].seq, sizeof(records[i].seq));
+		offset += sizeof(records[i].seq);
+	}
+	changelog_release(records, numRecords);
+
+	return error || send_response(client, NULL, response, offset);
+}
+
+/// @brief Executes a request from the client
+/// @param client
+/// @param request The request frame, starting with the opcode.
+/// @return CLIENT_TERMINATED if the client was disconnected, 0 otherwise
+int manage_request(struct Client *client, const char *request) {
+	const char opcode = request[0];
+
+	// Answers must not overtake the tagged ones already buffered
+	if (opcode != OP_CODE_TAGGED && flush_responses(client)) {
+		disconnect_client(client);
+		return CLIENT_TERMINATED;
+	}
 
 	switch (opcode) {
 		case OP_CODE_CONNECT: {
@@ -342,126 +922,509 @@ int manage_request(struct Client *client, const char opcode) {
 		}
 
 		case OP_CODE_DISCONNECT: {
-			kvs_disconnect(&client);
-			return 1;
+			disconnect_client(client);
+			return CLIENT_TERMINATED;
+		}
+
+		case OP_CODE_CONNECT_COMPACT: {
+			// Socket sessions negotiate after connecting, pipe sessions
+			// already did and get the version they use
+			const char response[CONNECT_COMPACT_RESPONSE_SIZE] = {
+				OP_CODE_CONNECT_COMPACT, '0', (char) kvs_set_protocol(client, request[1])};
+			if (send_to_client(client, response, sizeof(response))) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
 		}
 
 		case OP_CODE_SUBSCRIBE: {
 			char key[KEY_MESSAGE_SIZE];
-			int readingError = 0;
-			if(read_all(client->fdReq, key, KEY_MESSAGE_SIZE, &readingError) <= 0){
-				fprintf(stderr, "Failed to read key from requests pipe.\n");
-				if (disconnectControl) return 1; // if SIGUSR1 was sent
-				kvs_disconnect(&client);
-				return 1;
-			}
+			parse_key_request(request, client->protocol >= PROTOCOL_COMPACT, key);
 			if (kvs_subscribe(key, &client)) {
 				fprintf(stderr, "Failed to subscribe client\n");
-				if (disconnectControl) return 1; // if SIGUSR1 was sent
-				kvs_disconnect(&client);
-				return 1;
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
 			}
 			return 0;
 		}
 
 		case OP_CODE_UNSUBSCRIBE: {
 			char key[KEY_MESSAGE_SIZE];
-			int readingError = 0;
-			if (read_all(client->fdReq, key, KEY_MESSAGE_SIZE, &readingError) <= 0) {
-				fprintf(stderr, "Failed to read key from requests pipe. Client was disconnected.\n");
-				if (disconnectControl) return 1; // if SIGUSR1 was sent
-				kvs_disconnect(&client);
-				return 1;
-			}
+			parse_key_request(request, client->protocol >= PROTOCOL_COMPACT, key);
 			kvs_unsubscribe(key, &client);
 			return 0;
 		}
+
+		case OP_CODE_GET: {
+			if (manage_get(client, request, NULL)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_PUT:
+		case OP_CODE_PUT_TTL: {
+			if (manage_put(client, request, NULL)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_DEL:
+		case OP_CODE_EXPIRE: {
+			if (manage_del(client, request, NULL)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_SUBSCRIBE_BATCH:
+		case OP_CODE_UNSUBSCRIBE_BATCH: {
+			if (manage_subscriptions(client, request, NULL)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_PUT_VALUE: {
+			if (manage_put_value(client, request)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_GET_VALUE: {
+			if (manage_get_value(client, request)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_RESUME: {
+			if (manage_resume(client, request)) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_ATTACH: {
+			const char response[2] = {OP_CODE_ATTACH, attach_rings(client) ? '1' : '0'};
+			if (send_to_client(client, response, sizeof(response))) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
+		case OP_CODE_WAKEUP:
+			// Only there to wake the reactor up for the requests ring
+			return 0;
+
+		case OP_CODE_TAGGED: {
+			uint32_t tag;
+			memcpy(&tag, request + 1, sizeof(tag));
+			const char *taggedRequest = request + TAG_HEADER_SIZE;
+			int error;
+			switch (taggedRequest[0]) {
+				case OP_CODE_GET:
+					error = manage_get(client, taggedRequest, &tag);
+					break;
+				case OP_CODE_PUT:
+				case OP_CODE_PUT_TTL:
+					error = manage_put(client, taggedRequest, &tag);
+					break;
+				case OP_CODE_SUBSCRIBE_BATCH:
+				case OP_CODE_UNSUBSCRIBE_BATCH:
+					error = manage_subscriptions(client, taggedRequest, &tag);
+					break;
+				default:
+					// request_frame_size only lets batch requests through
+					error = manage_del(client, taggedRequest, &tag);
+					break;
+			}
+			if (error) {
+				disconnect_client(client);
+				return CLIENT_TERMINATED;
+			}
+			return 0;
+		}
+
 		default: {
 			fprintf(stderr, "Unrecognized OP Code: %c. Client was disconnected.\n", opcode);
-			if (disconnectControl) return 1; // if SIGUSR1 was sent
-			kvs_disconnect(&client);
-			return 1;
+			disconnect_client(client);
+			return CLIENT_TERMINATED;
 		}
 	}
 }
 
+/// @brief Executes every complete request in a buffer of a client.
+/// @param client
+/// @param buffer The request buffer or the ring buffer of the client.
+/// @param length Bytes in the buffer, updated to those of the incomplete
+/// frame left at its start.
+/// @return CLIENT_TERMINATED if the client was disconnected, 0 otherwise
+static int process_requests(struct Client *client, char *buffer, size_t *length) {
+	size_t offset = 0;
+	// The rest waits in the buffer while the client does not read
+	while (!output_pending(&client->unsent)) {
+		size_t frameSize = request_frame_size(buffer + offset, *length - offset, client->protocol);
+		if (frameSize == INVALID_FRAME) {
+			fprintf(stderr, "Malformed request. Client was disconnected.\n");
+			disconnect_client(client);
+			return CLIENT_TERMINATED;
+		}
+		if (frameSize == 0 || frameSize > *length - offset) break;
 
-void *process_client_thread() {
-	// mask SIGUSR1 signal
-	sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGUSR1);
-    pthread_sigmask(SIG_BLOCK, &set, NULL);
+		if (manage_request(client, buffer + offset) == CLIENT_TERMINATED) {
+			return CLIENT_TERMINATED;
+		}
+		offset += frameSize;
+	}
 
-	while (1) {
-		// Read from producer consumer buffer
-		// CRITICAL SECTION FOR READING CLIENTS BUFFER
-		sem_wait(&readSem);
-		pthread_mutex_lock(&clientsBufferMutex);
+	if (flush_responses(client)) {
+		disconnect_client(client);
+		return CLIENT_TERMINATED;
+	}
 
-		struct ClientInfo *newClient = clientsBuffer[out];
+	// Keep the incomplete frame at the start of the buffer
+	*length -= offset;
+	memmove(buffer, buffer + offset, *length);
+	return 0;
+}
 
-		char reqPath[MAX_PIPE_PATH_LENGTH];
-		char respPath[MAX_PIPE_PATH_LENGTH];
-		char notifPath[MAX_PIPE_PATH_LENGTH];
+/// @brief Serves the requests a client wrote to its requests ring, then
+/// marks the server as sleeping on the ring.
+/// @param client
+/// @param pending Set to 1 if the ring still has requests, because the
+/// client kept writing.
+/// @return CLIENT_TERMINATED if the client was disconnected, 0 otherwise
+static int serve_rings(struct Client *client, int *pending) {
+	*pending = 0;
+	// Bounded, like reads from the socket
+	for (int reads = 0; reads < 64; reads++) {
+		size_t bytesRead = ring_read(&client->rings->requests, client->ringBuffer + client->ringLength,
+									 RING_SIZE - client->ringLength);
+		client->ringLength += bytesRead;
+		// Requests left while the client did not read come first
+		if (client->ringLength > 0 &&
+			process_requests(client, client->ringBuffer, &client->ringLength) == CLIENT_TERMINATED) {
+			return CLIENT_TERMINATED;
+		}
+		if (output_pending(&client->unsent)) return 0;
+		if (bytesRead == 0 && ring_sleep(&client->rings->requests)) return 0;
+	}
+	*pending = 1;
+	return 0;
+}
 
-		strcpy(reqPath, newClient->reqFifo);
-		strcpy(respPath, newClient->respFifo);
-		strcpy(notifPath, newClient->notifFifo);
+/// @brief Watches the requests pipe of a client for the next request.
+/// @param client
+/// @param op EPOLL_CTL_ADD for a new client, EPOLL_CTL_MOD to rearm it.
+/// @param ringPending Whether the requests ring still has requests. The
+/// client is then served again as soon as a reactor is free.
+/// @return 0 on success, 1 on error
+static int watch_client(struct Client *client, int op, int ringPending) {
+	struct epoll_event event;
+	// A session socket is always writable, so EPOLLOUT fires right away
+	event.events = EPOLLIN | EPOLLONESHOT | (ringPending ? EPOLLOUT : 0);
+	event.data.u64 = ((uint64_t) client->generation << 32) | client->slot;
+	if (epoll_ctl(epollFd, op, client->fdReq, &event)) {
+		perror("Failed to watch requests pipe");
+		return 1;
+	}
+	return 0;
+}
 
-		free(newClient);
+/// @brief Grows the request buffer of a client to fit its incomplete frame,
+/// or on sockets, to fit a whole packet after the buffered bytes.
+/// @param client
+/// @return 0 on success, 1 on error
+static int grow_request_buffer(struct Client *client) {
+	size_t needed;
+	if (client->isSocket) {
+		// Packets larger than the free space would be truncated
+		needed = client->requestLength + MAX_MESSAGE_SIZE;
+	} else {
+		needed = request_frame_size(client->requestBuffer, client->requestLength,
+									 client->protocol);
+		if (needed == INVALID_FRAME || needed <= client->requestCapacity) return 1;
+	}
 
-		out++;
-		if (out == MAX_SESSION_COUNT) out = 0;
+	size_t capacity = client->requestCapacity * 2;
+	if (capacity < needed) capacity = needed;
+	char *buffer = realloc(client->requestBuffer, capacity);
+	if (buffer == NULL) {
+		fprintf(stderr, "Failed to grow request buffer\n");
+		return 1;
+	}
+	client->requestBuffer = buffer;
+	client->requestCapacity = capacity;
+	return 0;
+}
 
-		pthread_mutex_unlock(&clientsBufferMutex);
-		sem_post(&writeSem);
-		// END OF CRITICAL SECTION FOR READING CLIENTS BUFFER
+/// @brief Receives a packet from a session socket into the request buffer,
+/// keeping the fds passed along with it.
+/// @param client
+/// @return bytes received, 0 on end of file, -1 on error
+static ssize_t receive_packet(struct Client *client) {
+	struct iovec iov = {client->requestBuffer + client->requestLength,
+						client->requestCapacity - client->requestLength};
+	char control[CMSG_SPACE(sizeof(client->passedFds))];
+	struct msghdr packet = {.msg_iov = &iov, .msg_iovlen = 1,
+							.msg_control = control, .msg_controllen = sizeof(control)};
+
+	// Sockets stay blocking for the notifiers, responses and this read do
+	// not wait
+	ssize_t bytesRead = recvmsg(client->fdReq, &packet, MSG_DONTWAIT);
+	for (struct cmsghdr *header = CMSG_FIRSTHDR(&packet); bytesRead >= 0 && header != NULL;
+		 header = CMSG_NXTHDR(&packet, header)) {
+		if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+
+		int fds[2] = {-1, -1};
+		size_t numFds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(header), (numFds < 2 ? numFds : 2) * sizeof(int));
+		for (size_t i = 2; i < numFds; i++) {
+			int extra;
+			memcpy(&extra, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+			close(extra);
+		}
+		for (int i = 0; i < 2; i++) {
+			if (client->passedFds[i] >= 0) close(client->passedFds[i]);
+			client->passedFds[i] = fds[i];
+		}
+	}
+	return bytesRead;
+}
 
-		struct Client *client = NULL;
-		int status = kvs_connect(reqPath, respPath, notifPath, &client);
-		if(status){ 
-			fprintf(stderr, "Failed to connect to the server\n");
-			if(status == -1) continue; // could not allocate client
-			kvs_disconnect(&client);
-			continue;
+/// @brief Sends a client the responses it left unread.
+/// @param client
+/// @return 0 if they were all sent, 1 if the client still has to take
+/// some, CLIENT_TERMINATED if it was disconnected
+static int serve_output(struct Client *client) {
+	int status = flush_buffered(&client->unsent, client->fdResp, client->isSocket);
+	if (client->closing) {
+		if (status == 1 && !watch_output(client)) return 1;
+		kvs_finish_disconnect(client);
+		return CLIENT_TERMINATED;
+	}
+	if (status < 0) {
+		disconnect_client(client);
+		return CLIENT_TERMINATED;
+	}
+	if (status == 1 && watch_output(client)) {
+		disconnect_client(client);
+		return CLIENT_TERMINATED;
+	}
+	return status;
+}
+
+/// @brief Reads what a client sent and serves its requests.
+/// @param client
+static void serve_client(struct Client *client) {
+	if (output_pending(&client->unsent) && serve_output(client)) return;
+	// Requests left while the client did not read come first
+	if (client->requestLength > 0 &&
+		process_requests(client, client->requestBuffer, &client->requestLength) ==
+				CLIENT_TERMINATED) {
+		return;
+	}
+
+	// Bounded, so a busy client does not hold the reactor forever
+	for (int reads = 0; reads < 64 && !output_pending(&client->unsent); reads++) {
+		size_t space = client->requestCapacity - client->requestLength;
+		if ((space == 0 || (client->isSocket && space < MAX_MESSAGE_SIZE)) &&
+			grow_request_buffer(client)) {
+			disconnect_client(client);
+			return;
 		}
 
-		int clientStatus = 0;
-		int readingError = 0;
-		char opcode = OP_CODE_CONNECT;
-		status = 0;
-
-		while (clientStatus != CLIENT_TERMINATED) {
-			status = read_all(client->fdReq, &opcode, 1, &readingError);
-			if (disconnectControl) break; // if SIGUSR1 was sent
-			if (status != 1) {
-				if(status == -1 || readingError){
-					fprintf(stderr, "Failed to read OP Code from requests pipe.\n");
-				}
-				kvs_disconnect(&client);
-				break;
+		ssize_t bytesRead;
+		if (client->isSocket) {
+			bytesRead = receive_packet(client);
+		} else {
+			bytesRead = read(client->fdReq, client->requestBuffer + client->requestLength,
+							 client->requestCapacity - client->requestLength);
+		}
+		if (bytesRead > 0) {
+			client->requestLength += (size_t) bytesRead;
+			if (process_requests(client, client->requestBuffer, &client->requestLength) ==
+				CLIENT_TERMINATED) {
+				return;
 			}
-			clientStatus = manage_request(client, opcode);
+			continue;
+		}
+		if (bytesRead < 0 && errno == EINTR) continue;
+		if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+		if (bytesRead < 0) perror("Failed to read from requests pipe");
+		disconnect_client(client);
+		return;
+	}
+
+	// A large value grew the buffer, which goes back to its size once served
+	if (client->requestCapacity > REQUEST_BUFFER_SHRINK_SIZE &&
+		client->requestLength <= REQUEST_BUFFER_SIZE) {
+		char *buffer = realloc(client->requestBuffer, REQUEST_BUFFER_SIZE);
+		if (buffer != NULL) {
+			client->requestBuffer = buffer;
+			client->requestCapacity = REQUEST_BUFFER_SIZE;
 		}
 	}
+
+	int ringPending = 0;
+	if (client->rings != NULL && !output_pending(&client->unsent) &&
+		serve_rings(client, &ringPending) == CLIENT_TERMINATED) {
+		return;
+	}
+
+	if (output_pending(&client->unsent)) {
+		if (watch_output(client)) disconnect_client(client);
+		return;
+	}
+	if (watch_client(client, EPOLL_CTL_MOD, ringPending)) {
+		disconnect_client(client);
+	}
+}
+
+void *process_reactor_thread() {
+	// mask SIGUSR1 signal
+	sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (1) {
+		struct epoll_event event;
+		int ready = epoll_wait(epollFd, &event, 1, -1);
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			perror("Failed to wait for client requests");
+			return NULL;
+		}
+		if (ready == 0) continue;
+
+		// CRITICAL SECTION SESSIONS
+		if (pthread_rwlock_rdlock(&sessionsLock)) {
+			fprintf(stderr, "Failed to lock sessions\n");
+			continue;
+		}
+
+		// The session may have ended since the event was queued
+		struct Client *client = get_client((unsigned int) (event.data.u64 & UINT32_MAX),
+										   (unsigned int) (event.data.u64 >> 32));
+		if (client != NULL) {
+			serve_client(client);
+		}
+
+		if (pthread_rwlock_unlock(&sessionsLock)) {
+			fprintf(stderr, "Failed to unlock sessions\n");
+		}
+		// END OF CRITICAL SECTION SESSIONS
+	}
 	return NULL;
 }
 
 /// @brief async signal safe function to handle SIGUSR1
 void handle_SIGUSR1(){
-	disconnectControl = 1;
 	restartClients = 1;
-	sem_post(&writeSem);
 }
 
 /// @brief restarts all clients and reets the restartClients flag
 int restart_clients(){
-	clean_all_clients();
 	restartClients = 0;
+	// Wait for the reactors to leave the sessions they are serving
+	if (pthread_rwlock_wrlock(&sessionsLock)) {
+		fprintf(stderr, "Failed to lock sessions\n");
+		return 1;
+	}
+	clean_all_clients();
+	if (pthread_rwlock_unlock(&sessionsLock)) {
+		fprintf(stderr, "Failed to unlock sessions\n");
+	}
 	return 0;
 }
 
+/// @brief Disconnects the clients whose notifications queue overflowed.
+/// @param fdOverflow eventfd the notifiers signal overflows on.
+/// @return 0 on success, 1 on error
+static int disconnect_slow_clients(int fdOverflow) {
+	uint64_t overflows;
+	if (read(fdOverflow, &overflows, sizeof(overflows)) < 0) return 0;
+
+	// Like a restart, the reactors must leave the sessions first
+	if (pthread_rwlock_wrlock(&sessionsLock)) {
+		fprintf(stderr, "Failed to lock sessions\n");
+		return 1;
+	}
+	disconnect_overflowed_clients();
+	if (pthread_rwlock_unlock(&sessionsLock)) {
+		fprintf(stderr, "Failed to unlock sessions\n");
+	}
+	return 0;
+}
+
+/// @brief Hands a new client over to the reactors.
+/// @param client
+static void register_client(struct Client *client) {
+	// Socket sessions are read and answered with MSG_DONTWAIT instead, so
+	// that the notifiers still block on them
+	if (!client->isSocket) {
+		int flags = fcntl(client->fdReq, F_GETFL);
+		int respFlags = fcntl(client->fdResp, F_GETFL);
+		if (flags < 0 || fcntl(client->fdReq, F_SETFL, flags | O_NONBLOCK) ||
+			respFlags < 0 || fcntl(client->fdResp, F_SETFL, respFlags | O_NONBLOCK)) {
+			fprintf(stderr, "Failed to register client\n");
+			disconnect_client(client);
+			return;
+		}
+	}
+
+	// From here on the client belongs to the reactors
+	if (watch_client(client, EPOLL_CTL_ADD, 0)) {
+		fprintf(stderr, "Failed to register client\n");
+		disconnect_client(client);
+	}
+}
+
+/// @brief Creates the socket clients connect to, named after the server pipe.
+/// @param fifo_path Path of the server pipe.
+/// @return fd of the listening socket, -1 on error
+static int open_server_socket(const char *fifo_path) {
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	int length = snprintf(address.sun_path, sizeof(address.sun_path), "%s%s",
+						  fifo_path, SOCKET_PATH_SUFFIX);
+	if (length < 0 || (size_t) length >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Server socket path is too long\n");
+		return -1;
+	}
+
+	if (unlink(address.sun_path) && errno != ENOENT) {
+		fprintf(stderr, "Failed to unlink server socket\n");
+		return -1;
+	}
+
+	int fdSocket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fdSocket < 0) {
+		perror("Failed to create server socket");
+		return -1;
+	}
+	if (bind(fdSocket, (struct sockaddr *) &address, sizeof(address)) ||
+		listen(fdSocket, SOMAXCONN)) {
+		perror("Failed to listen on server socket");
+		close(fdSocket);
+		return -1;
+	}
+	return fdSocket;
+}
+
 void *process_host_thread(void *arg){
 	// set handel for SIGUSR1 signal
 	sigset_t set;
@@ -482,70 +1445,100 @@ void *process_host_thread(void *arg){
 		return NULL;
 	}
 
-	in  = 0;
-	out = 0;
-	
-	sem_init(&readSem, 0, 0);
-	sem_init(&writeSem, 0, MAX_SESSION_COUNT);
-	pthread_mutex_init(&clientsBufferMutex, NULL);
+	epollFd = epoll_create1(0);
+	if (epollFd < 0) {
+		perror("Failed to create epoll instance");
+		return NULL;
+	}
 
-	int fdServerPipe = open(fifo_path, O_RDONLY);
+	// Opened without blocking, so socket clients are served before the
+	// first client writes to the pipe
+	int fdServerPipe = open(fifo_path, O_RDONLY | O_NONBLOCK);
 	if (fdServerPipe < 0) {
 		fprintf(stderr, "Failed to open server pipe\n");
+		close(epollFd);
+		return NULL;
+	}
 
-		if (pthread_mutex_destroy(&clientsBufferMutex)) 
-			fprintf(stderr, "Failed to destroy clientsBufferMutex\n");
+	// Keep a writer open so reads block between clients instead of
+	// returning end of file
+	int fdServerPipeWriter = open(fifo_path, O_WRONLY);
+	if (fdServerPipeWriter < 0) {
+		fprintf(stderr, "Failed to open server pipe for writing\n");
+	}
 
-		if (sem_destroy(&readSem) == -1 || sem_destroy(&writeSem)) 
-			fprintf(stderr, "Failed to destroy semaphores\n");
+	int flags = fcntl(fdServerPipe, F_GETFL);
+	if (flags < 0 || fcntl(fdServerPipe, F_SETFL, flags & ~O_NONBLOCK)) {
+		fprintf(stderr, "Failed to set server pipe to blocking\n");
+	}
 
-		return NULL;
+	// Clients may also connect through the socket next to the server pipe
+	int fdServerSocket = open_server_socket(fifo_path);
+
+	// Notifications are sent by their own threads, so writers never wait
+	// for a subscriber
+	if (notifier_init(notifyPolicy)) {
+		fprintf(stderr, "Failed to start notifier threads\n");
 	}
 
 	// Create threads to deal with clients
-	pthread_t thread[MAX_SESSION_COUNT];
-	for(int i = 0; i < MAX_SESSION_COUNT; i++){
-		if(pthread_create(&thread[i], NULL, process_client_thread, NULL)){
+	pthread_t thread[REACTOR_THREAD_COUNT];
+	for(int i = 0; i < REACTOR_THREAD_COUNT; i++){
+		if(pthread_create(&thread[i], NULL, process_reactor_thread, NULL)){
 			fprintf(stderr, "Failed to create thread\n");
 		}
 	}
 
 	char opCode;
-	char req_pipe[MAX_PIPE_PATH_LENGTH];
-	char resp_pipe[MAX_PIPE_PATH_LENGTH];
-	char notif_pipe[MAX_PIPE_PATH_LENGTH];
+	int version;
+	char req_pipe[MAX_PIPE_PATH_LENGTH + 1];
+	char resp_pipe[MAX_PIPE_PATH_LENGTH + 1];
+	char notif_pipe[MAX_PIPE_PATH_LENGTH + 1];
+
+	struct pollfd listeners[3] = {{.fd = fdServerPipe, .events = POLLIN},
+								  {.fd = notifier_overflow_fd(), .events = POLLIN},
+								  {.fd = fdServerSocket, .events = POLLIN}};
+	nfds_t numListeners = fdServerSocket < 0 ? 2 : 3;
 
 	while (1) {
-		// read from producer-consumer clients buffer
-		sem_wait(&writeSem);
-		
 		// check if SIGUSR1 was sent
 		if(restartClients){
 			restart_clients();
 			continue;
 		} 
-		if (read_connect_message(fdServerPipe, &opCode, req_pipe, resp_pipe, notif_pipe) == 1) {
-			sem_post(&writeSem);
+		if (poll(listeners, numListeners, -1) < 0) {
+			if (errno != EINTR) perror("Failed to wait for clients");
 			continue;
 		}
-		disconnectControl = 0; // reset disconnect control flag
 
-		struct ClientInfo *newClient = malloc(sizeof(struct ClientInfo));
-		if(newClient == NULL){
-			fprintf(stderr, "Failed to allocate memory for new client\n");
-			sem_post(&writeSem);
-			continue;
+		if (listeners[1].revents & POLLIN) {
+			disconnect_slow_clients(listeners[1].fd);
 		}
 
-		strcpy(newClient->respFifo, resp_pipe);
-		strcpy(newClient->reqFifo, req_pipe);
-		strcpy(newClient->notifFifo, notif_pipe);
+		if (numListeners == 3 && (listeners[2].revents & POLLIN)) {
+			int fdSocket = accept(fdServerSocket, NULL, NULL);
+			struct Client *client = NULL;
+			if (fdSocket < 0) {
+				if (errno != EINTR) perror("Failed to accept client");
+			} else if (kvs_connect_socket(fdSocket, &client)) {
+				fprintf(stderr, "Failed to connect to the server\n");
+			} else {
+				register_client(client);
+			}
+		}
 
-		// add the new client to producer-consumer buffer
-		clientsBuffer[in] = newClient;
-		in++;
-		if (in == MAX_SESSION_COUNT) in = 0;
-		sem_post(&readSem);
+		if (!(listeners[0].revents & POLLIN) ||
+			read_connect_message(fdServerPipe, &opCode, req_pipe, resp_pipe, notif_pipe,
+								 &version) == 1) {
+			continue;
+		}
+
+		struct Client *client = NULL;
+		if (kvs_connect(req_pipe, resp_pipe, notif_pipe, version, &client)) {
+			fprintf(stderr, "Failed to connect to the server\n");
+			continue;
+		}
+		register_client(client);
 	}
 	return NULL;
 }
@@ -561,8 +1554,8 @@ int main(int argc, char *argv[]) {
     sigemptyset(&sa.sa_mask);
     sigaction(SIGUSR1, &sa, NULL);
 
-	if (argc != 5) {
-		fprintf(stderr, "Usage: %s <dir_jobs> <max_threads> <backups_max> [name_registry_FIFO]\n", argv[0]);
+	if (argc < 5 || argc > 8) {
+		fprintf(stderr, "Usage: %s <dir_jobs> <max_threads> <backups_max> [name_registry_FIFO] [max_sessions] [coalesce|drop-oldest|disconnect] [cdc_path]\n", argv[0]);
 		return 1;
 	}
 
@@ -570,6 +1563,26 @@ int main(int argc, char *argv[]) {
 	unsigned int backupCounter = (unsigned int) strtoul(argv[2], NULL, 10);
 	unsigned int MAX_THREADS = (unsigned int) strtoul(argv[3], NULL, 10);
 	const char *fifo_path = argv[4];
+	unsigned int maxSessions = MAX_SESSION_COUNT;
+	if (argc >= 6) {
+		maxSessions = (unsigned int) strtoul(argv[5], NULL, 10);
+		if (maxSessions == 0) {
+			fprintf(stderr, "Invalid maximum number of sessions\n");
+			return 1;
+		}
+	}
+	if (argc >= 7) {
+		if (!strcmp(argv[6], "coalesce")) {
+			notifyPolicy = NOTIFY_COALESCE;
+		} else if (!strcmp(argv[6], "drop-oldest")) {
+			notifyPolicy = NOTIFY_DROP_OLDEST;
+		} else if (!strcmp(argv[6], "disconnect")) {
+			notifyPolicy = NOTIFY_DISCONNECT;
+		} else {
+			fprintf(stderr, "Invalid notifications overflow policy\n");
+			return 1;
+		}
+	}
 
 	DIR *dir = opendir(directory_path);
 
@@ -578,7 +1591,7 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-	if (kvs_init()) {
+	if (kvs_init() || kvs_init_sessions(maxSessions)) {
 		if (closedir(dir)) {
 			fprintf(stderr, "Failed to close directory\n");
 		}
@@ -588,10 +1601,29 @@ int main(int argc, char *argv[]) {
 
 	if (pthread_mutex_init(&backupCounterMutex, NULL) ||
 		pthread_mutex_init(&dirMutex, NULL) ||
-		pthread_rwlock_init(&globalHashLock, NULL)) {
+		pthread_rwlock_init(&globalHashLock, NULL) ||
+		pthread_rwlock_init(&sessionsLock, NULL)) {
 		fprintf(stderr, "Failed to initialize lock\n");
 	}
 
+	// Only the host thread handles SIGUSR1, the threads created from here
+	// inherit the mask
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	if (argc == 8 && cdc_init(argv[7])) {
+		fprintf(stderr, "Failed to start the CDC stream\n");
+		return 1;
+	}
+
+	// Keys expire under the global hash lock, like every other change
+	if (expiry_init(&globalHashLock)) {
+		fprintf(stderr, "Failed to start expiring keys\n");
+		return 1;
+	}
+
 	// create jobs threads
 	pthread_t thread[MAX_THREADS];
 	struct ThreadArgs args = {dir, directory_path, &backupCounter};
@@ -623,11 +1655,13 @@ int main(int argc, char *argv[]) {
 	}
 
 	while (wait(NULL) > 0);
+	expiry_stop();
 
 	if (pthread_mutex_unlock(&backupCounterMutex) || closedir(dir) ||
 		pthread_mutex_destroy(&backupCounterMutex) ||
 		pthread_mutex_destroy(&dirMutex) ||
-		pthread_rwlock_destroy(&globalHashLock) || kvs_terminate()) {
+		pthread_rwlock_destroy(&globalHashLock) ||
+		pthread_rwlock_destroy(&sessionsLock) || kvs_terminate()) {
 		fprintf(stderr, "Failed to close resources\n");
 	}
 	return 0;
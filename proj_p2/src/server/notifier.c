@@ -0,0 +1,711 @@
+#ifdef NOTIFY_TEE
+#define _GNU_SOURCE // tee
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "notifier.h"
+#include "src/common/protocol.h"
+#include "src/common/varint.h"
+
+#define NOTIFIER_EVENTS 16 // queues taken from each epoll_wait
+
+#ifdef NOTIFY_TEE
+#define NOT_STAGED -1   // staging of a notification that is written instead
+#define STAGE_WANTED -2 // staging of a notification its first sender stages
+
+// Staging pipes open, at most NOTIFY_TEE_MAX_PIPES
+static atomic_int stagingPipes = 0;
+#endif
+
+static int notifierEpoll = -1;
+static int fdOverflow = -1;
+static NotifyPolicy overflowPolicy = NOTIFY_COALESCE;
+
+// Queues by slot. Events carry the slot and generation of their queue
+// instead of a pointer, so an event queued before a session ended finds
+// nothing instead of a freed queue.
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static NotifyQueue **registry = NULL;
+static uint32_t registrySize = 0;
+static uint32_t registryGeneration = 0;
+
+Notification *notification_create(const char *key, uint64_t keyHash, const char *value,
+								  size_t valueLength, uint64_t seq) {
+	Notification *notification = malloc(sizeof(Notification));
+	if (notification == NULL) return NULL;
+
+	notification->value = NULL;
+	notification->valueLength = valueLength;
+	if (valueLength > BATCH_MAX_STRING_LENGTH) {
+		notification->value = malloc(valueLength + 1);
+		if (notification->value == NULL) {
+			free(notification);
+			return NULL;
+		}
+		memcpy(notification->value, value, valueLength);
+		notification->value[valueLength] = '\0';
+	}
+
+	atomic_init(&notification->refs, 1);
+	notification->id = seq; // from 1, queues start with lastPushed at 0
+	notification->keyHash = keyHash;
+	size_t lengths[2] = {strnlen(key, BATCH_MAX_STRING_LENGTH),
+						 valueLength < BATCH_MAX_STRING_LENGTH ? valueLength : BATCH_MAX_STRING_LENGTH};
+	memset(notification->message, 0, sizeof(notification->message));
+	memcpy(notification->message, key, lengths[0]);
+	memcpy(notification->message + KEY_MESSAGE_SIZE, value, lengths[1]);
+
+	size_t size = 0;
+	for (int i = 0; i < 2; i++) {
+		const char *string = notification->message + i * KEY_MESSAGE_SIZE;
+		size += varint_encode(lengths[i], notification->compact + size);
+		memcpy(notification->compact + size, string, lengths[i]);
+		size += lengths[i];
+	}
+	memcpy(notification->compact + size, &seq, sizeof(seq));
+	notification->compactSize = size + sizeof(seq);
+#ifdef NOTIFY_TEE
+	atomic_init(&notification->staging, NOT_STAGED);
+	atomic_init(&notification->compactStaging, NOT_STAGED);
+#endif
+	return notification;
+}
+
+#ifdef NOTIFY_TEE
+/// @brief Copies bytes into a new staging pipe, unless NOTIFY_TEE_MAX_PIPES
+/// are open.
+/// @param bytes
+/// @param size
+/// @return the read end of the pipe, -1 if it was not made
+static int stage_bytes(const char *bytes, size_t size) {
+	if (atomic_fetch_add_explicit(&stagingPipes, 1, memory_order_relaxed) >= NOTIFY_TEE_MAX_PIPES) {
+		atomic_fetch_sub_explicit(&stagingPipes, 1, memory_order_relaxed);
+		return -1;
+	}
+
+	// The one copy from user space. tee never consumes the staged bytes, so
+	// the write end is not needed afterwards.
+	int staging[2];
+	if (pipe2(staging, O_NONBLOCK | O_CLOEXEC)) {
+		atomic_fetch_sub_explicit(&stagingPipes, 1, memory_order_relaxed);
+		return -1;
+	}
+	if (write(staging[1], bytes, size) != (ssize_t) size) {
+		close(staging[0]);
+		atomic_fetch_sub_explicit(&stagingPipes, 1, memory_order_relaxed);
+		staging[0] = -1;
+	}
+	close(staging[1]);
+	return staging[0];
+}
+
+/// @brief Closes a staging pipe.
+/// @param staging
+static void unstage(int staging) {
+	close(staging);
+	atomic_fetch_sub_explicit(&stagingPipes, 1, memory_order_relaxed);
+}
+
+/// @brief Gives the staging pipe of a layout, staging it on its first send.
+/// Senders racing to stage it agree on the pipe of the first one.
+/// @param staging Staging of the layout in the notification.
+/// @param bytes
+/// @param size
+/// @return the read end of the pipe, -1 if the layout is written instead
+static int staged_fd(atomic_int *staging, const char *bytes, size_t size) {
+	int fd = atomic_load_explicit(staging, memory_order_acquire);
+	if (fd != STAGE_WANTED) return fd;
+
+	int staged = stage_bytes(bytes, size);
+	if (!atomic_compare_exchange_strong_explicit(staging, &fd, staged, memory_order_acq_rel,
+												 memory_order_acquire)) {
+		if (staged >= 0) unstage(staged);
+		return fd;
+	}
+	return staged;
+}
+#endif
+
+void notification_stage(Notification *notification, int fixed, int compact) {
+#ifdef NOTIFY_TEE
+	// Staged by the first send, after the key is unlocked
+	if (fixed) atomic_store_explicit(&notification->staging, STAGE_WANTED, memory_order_relaxed);
+	if (compact) {
+		atomic_store_explicit(&notification->compactStaging, STAGE_WANTED, memory_order_relaxed);
+	}
+#else
+	(void) notification;
+	(void) fixed;
+	(void) compact;
+#endif
+}
+
+void notification_release(Notification *notification) {
+	if (atomic_fetch_sub_explicit(&notification->refs, 1, memory_order_acq_rel) == 1) {
+#ifdef NOTIFY_TEE
+		int staging = atomic_load_explicit(&notification->staging, memory_order_relaxed);
+		int compactStaging = atomic_load_explicit(&notification->compactStaging,
+												  memory_order_relaxed);
+		if (staging >= 0) unstage(staging);
+		if (compactStaging >= 0) unstage(compactStaging);
+#endif
+		free(notification->value);
+		free(notification);
+	}
+}
+
+/// @brief Gives a queue a slot in the registry.
+/// @param queue
+/// @return 0 on success, 1 otherwise
+static int register_queue(NotifyQueue *queue) {
+	pthread_mutex_lock(&registryLock);
+	uint32_t slot = 0;
+	while (slot < registrySize && registry[slot] != NULL) slot++;
+
+	if (slot == registrySize) {
+		uint32_t newSize = registrySize ? 2 * registrySize : 16;
+		NotifyQueue **grown = realloc(registry, newSize * sizeof(NotifyQueue *));
+		if (grown == NULL) {
+			pthread_mutex_unlock(&registryLock);
+			return 1;
+		}
+		memset(grown + registrySize, 0, (newSize - registrySize) * sizeof(NotifyQueue *));
+		registry = grown;
+		registrySize = newSize;
+	}
+
+	queue->slot = slot;
+	queue->generation = ++registryGeneration;
+	registry[slot] = queue;
+	pthread_mutex_unlock(&registryLock);
+	return 0;
+}
+
+/// @brief Finds the queue of an event and takes a reference to it.
+/// @param id Slot and generation of the queue.
+/// @return the queue, NULL if it was closed
+static NotifyQueue *acquire_queue(uint64_t id) {
+	uint32_t slot = (uint32_t) (id & UINT32_MAX);
+	NotifyQueue *queue = NULL;
+	pthread_mutex_lock(&registryLock);
+	if (slot < registrySize && registry[slot] != NULL &&
+		registry[slot]->generation == (uint32_t) (id >> 32)) {
+		queue = registry[slot];
+		pthread_mutex_lock(&queue->lock);
+		queue->refs++;
+		pthread_mutex_unlock(&queue->lock);
+	}
+	pthread_mutex_unlock(&registryLock);
+	return queue;
+}
+
+/// @brief Sets up a queue whose fd is open and registers it.
+/// @param queue
+/// @return 0 on success, 1 otherwise, in which case the queue is freed
+static int init_queue(NotifyQueue *queue) {
+	if (pthread_mutex_init(&queue->lock, NULL)) {
+		fprintf(stderr, "Failed to create notifications queue\n");
+		close(queue->fd);
+		free(queue);
+		return 1;
+	}
+
+	queue->refs = 1;
+	queue->compact = 0;
+	queue->largeValues = 0;
+	queue->gapMarkers = 0;
+	queue->sentBytes = 0;
+	queue->closed = 0;
+	queue->armed = 0;
+	queue->registered = 0;
+	queue->overflowed = 0;
+	queue->gap = 0;
+	queue->head = 0;
+	queue->count = 0;
+	queue->lastPushed = 0;
+	queue->dropped = 0;
+	queue->coalesced = 0;
+
+	if (register_queue(queue)) {
+		fprintf(stderr, "Failed to register notifications queue\n");
+		close(queue->fd);
+		pthread_mutex_destroy(&queue->lock);
+		free(queue);
+		return 1;
+	}
+	return 0;
+}
+
+NotifyQueue *notify_queue_create(int fdNotif, int isSocket) {
+	NotifyQueue *queue = malloc(sizeof(NotifyQueue));
+	if (queue == NULL) return NULL;
+
+	// The queue keeps its own fd, so a notifier never writes to an fd the
+	// session closed and the kernel handed out again
+	queue->fd = dup(fdNotif);
+	if (queue->fd < 0) {
+		fprintf(stderr, "Failed to create notifications queue\n");
+		free(queue);
+		return NULL;
+	}
+
+	// Only notifications go through a notifications pipe. Sockets are also
+	// used for responses and stay blocking, they are sent to with MSG_DONTWAIT
+	if (!isSocket) {
+		int flags = fcntl(queue->fd, F_GETFL);
+		if (flags < 0 || fcntl(queue->fd, F_SETFL, flags | O_NONBLOCK)) {
+			fprintf(stderr, "Failed to make notifications pipe non-blocking\n");
+		}
+	}
+
+	queue->isSocket = isSocket;
+	queue->callback = NULL;
+	queue->context = NULL;
+	return init_queue(queue) ? NULL : queue;
+}
+
+NotifyQueue *notify_queue_create_local(NotifyCallback callback, void *context) {
+	NotifyQueue *queue = malloc(sizeof(NotifyQueue));
+	if (queue == NULL) return NULL;
+
+	// Never written to, it only lets the queue be armed like the others
+	queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (queue->fd < 0) {
+		fprintf(stderr, "Failed to create notifications queue\n");
+		free(queue);
+		return NULL;
+	}
+
+	queue->isSocket = 0;
+	queue->callback = callback;
+	queue->context = context;
+	return init_queue(queue) ? NULL : queue;
+}
+
+void notify_queue_set_protocol(NotifyQueue *queue, int version) {
+	pthread_mutex_lock(&queue->lock);
+	queue->compact = version >= PROTOCOL_COMPACT;
+	queue->largeValues = version >= PROTOCOL_LARGE_VALUES;
+	queue->gapMarkers = version >= PROTOCOL_GAP_MARKERS;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/// @brief Drops every queued notification. Called with the lock held.
+/// @param queue
+static void drop_notifications(NotifyQueue *queue) {
+	queue->sentBytes = 0;
+	while (queue->count > 0) {
+		notification_release(queue->items[queue->head]);
+		queue->head = (queue->head + 1) % NOTIFY_QUEUE_CAPACITY;
+		queue->count--;
+	}
+}
+
+/// @brief Drops a reference to a queue and unlocks it, freeing it with the
+/// last reference.
+/// @param queue Queue whose lock is held.
+static void release_queue(NotifyQueue *queue) {
+	int last = --queue->refs == 0;
+	pthread_mutex_unlock(&queue->lock);
+	if (!last) return;
+
+	close(queue->fd);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue);
+}
+
+void notify_queue_close(NotifyQueue *queue) {
+	pthread_mutex_lock(&registryLock);
+	registry[queue->slot] = NULL;
+	pthread_mutex_unlock(&registryLock);
+
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	drop_notifications(queue);
+
+	// Closing a duplicate leaves the fd registered while the session still
+	// has its own
+	if (queue->registered && epoll_ctl(notifierEpoll, EPOLL_CTL_DEL, queue->fd, NULL)) {
+		perror("Failed to stop watching notifications fd");
+	}
+	queue->registered = 0;
+
+	// A notifier holds a reference while it runs the callback, whose
+	// context the caller may free next
+	while (queue->callback != NULL && queue->refs > 1) {
+		pthread_mutex_unlock(&queue->lock);
+		sched_yield();
+		pthread_mutex_lock(&queue->lock);
+	}
+	release_queue(queue);
+}
+
+/// @brief Asks a notifier to drain a queue once its fd is writable. Called
+/// with the lock held.
+/// @param queue
+/// @return 0 on success, 1 on error
+static int arm_queue(NotifyQueue *queue) {
+	struct epoll_event event;
+	event.events = EPOLLOUT | EPOLLONESHOT;
+	event.data.u64 = (uint64_t) queue->generation << 32 | queue->slot;
+	if (epoll_ctl(notifierEpoll, queue->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, queue->fd,
+				  &event)) {
+		perror("Failed to watch notifications fd");
+		return 1;
+	}
+	queue->registered = 1;
+	return 0;
+}
+
+/// @brief Makes room in a full queue by dropping its oldest notification.
+/// Called with the lock held.
+/// @param queue
+static void drop_oldest(NotifyQueue *queue) {
+	if (queue->sentBytes > 0) {
+		// The head was sent in part, the one after it goes instead
+		size_t next = (queue->head + 1) % NOTIFY_QUEUE_CAPACITY;
+		Notification *partial = queue->items[queue->head];
+		queue->items[queue->head] = queue->items[next];
+		queue->items[next] = partial;
+	}
+	notification_release(queue->items[queue->head]);
+	queue->head = (queue->head + 1) % NOTIFY_QUEUE_CAPACITY;
+	queue->count--;
+	queue->dropped++;
+	queue->gap = queue->gapMarkers;
+
+	if (overflowPolicy == NOTIFY_DISCONNECT && !queue->overflowed &&
+		queue->dropped >= NOTIFY_DISCONNECT_THRESHOLD) {
+		// The host thread disconnects the session, writers cannot
+		const uint64_t overflow = 1;
+		queue->overflowed = 1;
+		queue->closed = 1;
+		drop_notifications(queue);
+		if (write(fdOverflow, &overflow, sizeof(overflow)) < 0) {
+			perror("Failed to report overflowed session");
+		}
+	}
+}
+
+/// @brief Replaces the queued notification of the same key, if there is
+/// one. Called with the lock held.
+/// @param queue
+/// @param notification
+/// @return 1 if a notification was replaced, 0 otherwise
+static int coalesce(NotifyQueue *queue, Notification *notification) {
+	// A healthy subscriber keeps its queue nearly empty, so this only
+	// scans long queues of subscribers that fell behind
+	for (size_t i = queue->sentBytes > 0 ? 1 : 0; i < queue->count; i++) {
+		size_t position = (queue->head + i) % NOTIFY_QUEUE_CAPACITY;
+		Notification *queued = queue->items[position];
+		if (queued->keyHash == notification->keyHash &&
+			!strcmp(queued->message, notification->message)) {
+			atomic_fetch_add_explicit(&notification->refs, 1, memory_order_relaxed);
+			queue->items[position] = notification;
+			notification_release(queued);
+			queue->coalesced++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void notify_queue_push(NotifyQueue *queue, Notification *notification) {
+	pthread_mutex_lock(&queue->lock);
+	if (queue->closed || queue->lastPushed == notification->id) {
+		pthread_mutex_unlock(&queue->lock);
+		return;
+	}
+	queue->lastPushed = notification->id;
+	if (overflowPolicy == NOTIFY_COALESCE && coalesce(queue, notification)) {
+		pthread_mutex_unlock(&queue->lock);
+		return;
+	}
+
+	// The writer never waits for the subscriber
+	if (queue->count == NOTIFY_QUEUE_CAPACITY) {
+		drop_oldest(queue);
+		if (queue->closed) {
+			pthread_mutex_unlock(&queue->lock);
+			return;
+		}
+	}
+	atomic_fetch_add_explicit(&notification->refs, 1, memory_order_relaxed);
+	queue->items[(queue->head + queue->count) % NOTIFY_QUEUE_CAPACITY] = notification;
+	queue->count++;
+
+	if (!queue->armed && !arm_queue(queue)) queue->armed = 1;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+int notify_queue_stats(NotifyQueue *queue, NotifyQueueStats *stats) {
+	pthread_mutex_lock(&queue->lock);
+	stats->depth = queue->count;
+	stats->dropped = queue->dropped;
+	stats->coalesced = queue->coalesced;
+	int overflowed = queue->overflowed;
+	pthread_mutex_unlock(&queue->lock);
+	return overflowed;
+}
+
+/// @brief Sends a notification with a large value to a PROTOCOL_LARGE_VALUES
+/// session without blocking. It takes more than a pipe holds or a packet
+/// carries, so it goes out in pieces, each resuming where the last stopped.
+/// @param queue
+/// @param notification
+/// @param sentBytes Bytes of the notification already sent, updated.
+/// @return 0 if the rest was sent, 1 if the fd is full, -1 on error
+static int send_large_notification(NotifyQueue *queue, const Notification *notification,
+								   size_t *sentBytes) {
+	char header[2 * VARINT_MAX_SIZE + BATCH_MAX_STRING_LENGTH];
+	size_t keyLength = strlen(notification->message);
+	size_t headerSize = varint_encode(keyLength, header);
+	memcpy(header + headerSize, notification->message, keyLength);
+	headerSize += keyLength;
+	headerSize += varint_encode(notification->valueLength, header + headerSize);
+	const struct iovec parts[3] = {
+		{header, headerSize},
+		{notification->value, notification->valueLength},
+		{(void *) &notification->id, sizeof(notification->id)},
+	};
+	size_t size = headerSize + notification->valueLength + sizeof(uint64_t);
+
+	char type = MESSAGE_NOTIFICATION;
+	while (*sentBytes < size) {
+		// A packet is a whole message, so it must fit with its type byte
+		struct iovec iov[4];
+		int count = 0;
+		size_t limit = queue->isSocket ? MAX_MESSAGE_SIZE - 1 : size;
+		if (queue->isSocket) iov[count++] = (struct iovec){&type, 1};
+		size_t skip = *sentBytes;
+		size_t chunk = 0;
+		for (int i = 0; i < 3 && chunk < limit; i++) {
+			if (skip >= parts[i].iov_len) {
+				skip -= parts[i].iov_len;
+				continue;
+			}
+			size_t length = parts[i].iov_len - skip;
+			if (length > limit - chunk) length = limit - chunk;
+			iov[count++] = (struct iovec){(char *) parts[i].iov_base + skip, length};
+			chunk += length;
+			skip = 0;
+		}
+
+		ssize_t sent;
+		do {
+			if (queue->isSocket) {
+				struct msghdr packet = {.msg_iov = iov, .msg_iovlen = (size_t) count};
+				sent = sendmsg(queue->fd, &packet, MSG_DONTWAIT | MSG_NOSIGNAL);
+			} else {
+				sent = writev(queue->fd, iov, count);
+			}
+		} while (sent < 0 && errno == EINTR);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+			perror("Failed to send notification");
+			return -1;
+		}
+		*sentBytes += queue->isSocket ? chunk : (size_t) sent;
+	}
+	return 0;
+}
+
+/// @brief Sends a notification without blocking.
+/// @param queue
+/// @param notification
+/// @param sentBytes Bytes of the notification already sent, updated when
+/// it is sent in pieces.
+/// @return 0 if it was sent, 1 if the fd is full, -1 on error
+static int send_notification(NotifyQueue *queue, Notification *notification,
+							 size_t *sentBytes) {
+	if (queue->callback != NULL) {
+		queue->callback(notification->message,
+						notification->value != NULL ? notification->value
+													: notification->message + KEY_MESSAGE_SIZE,
+						notification->valueLength, notification->id, queue->context);
+		return 0;
+	}
+	if (queue->largeValues && notification->value != NULL) {
+		return send_large_notification(queue, notification, sentBytes);
+	}
+
+	const char *message = notification->message;
+	size_t size = sizeof(notification->message);
+#ifdef NOTIFY_TEE
+	atomic_int *stagingOf = &notification->staging;
+#endif
+	if (queue->compact) {
+		message = notification->compact;
+		size = notification->compactSize;
+#ifdef NOTIFY_TEE
+		stagingOf = &notification->compactStaging;
+#endif
+	}
+#ifdef NOTIFY_TEE
+	int staging = queue->isSocket ? NOT_STAGED : staged_fd(stagingOf, message, size);
+#endif
+
+	ssize_t sent;
+	do {
+		if (queue->isSocket) {
+			char type = MESSAGE_NOTIFICATION;
+			struct iovec iov[2] = {{&type, 1}, {(void *) message, size}};
+			struct msghdr packet = {.msg_iov = iov, .msg_iovlen = 2};
+			sent = sendmsg(queue->fd, &packet, MSG_DONTWAIT | MSG_NOSIGNAL);
+#ifdef NOTIFY_TEE
+		} else if (staging >= 0) {
+			// Duplicates the staged page reference, without copying the bytes
+			sent = tee(staging, queue->fd, size, SPLICE_F_NONBLOCK);
+#endif
+		} else {
+			// Below PIPE_BUF, so the write is all or nothing
+			sent = write(queue->fd, message, size);
+		}
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent >= 0) return 0;
+	if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+	perror("Failed to send notification");
+	return -1;
+}
+
+/// @brief Sends the marker of dropped notifications, an empty key and value
+/// with seq 0, without blocking.
+/// @param queue
+/// @return 0 if it was sent, 1 if the fd is full, -1 on error
+static int send_gap_marker(NotifyQueue *queue) {
+	const char marker[2 + sizeof(uint64_t)] = {0};
+	ssize_t sent;
+	do {
+		if (queue->isSocket) {
+			char type = MESSAGE_NOTIFICATION;
+			struct iovec iov[2] = {{&type, 1}, {(void *) marker, sizeof(marker)}};
+			struct msghdr packet = {.msg_iov = iov, .msg_iovlen = 2};
+			sent = sendmsg(queue->fd, &packet, MSG_DONTWAIT | MSG_NOSIGNAL);
+		} else {
+			sent = write(queue->fd, marker, sizeof(marker));
+		}
+	} while (sent < 0 && errno == EINTR);
+
+	if (sent >= 0) return 0;
+	if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+	perror("Failed to send notification");
+	return -1;
+}
+
+/// @brief Sends the notifications of a queue until it is empty or its fd
+/// is full, in which case the queue is armed again.
+/// @param queue Queue armed on this thread, with a reference held.
+static void drain_queue(NotifyQueue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	int rearmed = 0;
+	while (!queue->closed && queue->count > 0) {
+		// The marker takes the place of the dropped notifications, once the
+		// one sent in part is whole
+		if (queue->gap && queue->sentBytes == 0) {
+			int status = send_gap_marker(queue);
+			if (status == 1) {
+				rearmed = !arm_queue(queue);
+				break;
+			}
+			queue->gap = 0;
+			if (status < 0) {
+				queue->closed = 1;
+				drop_notifications(queue);
+				break;
+			}
+		}
+
+		Notification *notification = queue->items[queue->head];
+		queue->head = (queue->head + 1) % NOTIFY_QUEUE_CAPACITY;
+		queue->count--;
+		size_t sentBytes = queue->sentBytes;
+		queue->sentBytes = 0;
+		pthread_mutex_unlock(&queue->lock);
+
+		int status = send_notification(queue, notification, &sentBytes);
+
+		pthread_mutex_lock(&queue->lock);
+		if (status == 1 && !queue->closed && queue->count == NOTIFY_QUEUE_CAPACITY &&
+			sentBytes > 0) {
+			// The rest of it must follow, so a queued one makes room instead
+			drop_oldest(queue);
+		}
+		if (status == 1 && !queue->closed && queue->count < NOTIFY_QUEUE_CAPACITY) {
+			// Back to the front, to be sent once the subscriber catches up
+			queue->head = (queue->head + NOTIFY_QUEUE_CAPACITY - 1) % NOTIFY_QUEUE_CAPACITY;
+			queue->items[queue->head] = notification;
+			queue->count++;
+			queue->sentBytes = sentBytes;
+			rearmed = !arm_queue(queue);
+			break;
+		}
+		notification_release(notification);
+		if (status < 0) {
+			// The session is gone, it is cleaned up by its reactor
+			queue->closed = 1;
+			drop_notifications(queue);
+		}
+	}
+	if (!rearmed) queue->armed = 0;
+	release_queue(queue);
+}
+
+/// @brief Sends the notifications of the queues whose fds became writable.
+static void *process_notifier_thread() {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (1) {
+		struct epoll_event events[NOTIFIER_EVENTS];
+		int ready = epoll_wait(notifierEpoll, events, NOTIFIER_EVENTS, -1);
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			perror("Failed to wait for notifications fds");
+			return NULL;
+		}
+		for (int i = 0; i < ready; i++) {
+			// The session may have ended since the event was queued
+			NotifyQueue *queue = acquire_queue(events[i].data.u64);
+			if (queue != NULL) drain_queue(queue);
+		}
+	}
+	return NULL;
+}
+
+int notifier_init(NotifyPolicy policy) {
+	overflowPolicy = policy;
+	notifierEpoll = epoll_create1(0);
+	fdOverflow = eventfd(0, EFD_NONBLOCK);
+	if (notifierEpoll < 0 || fdOverflow < 0) {
+		perror("Failed to create notifier fds");
+		return 1;
+	}
+
+	pthread_t thread[NOTIFIER_THREAD_COUNT];
+	for (int i = 0; i < NOTIFIER_THREAD_COUNT; i++) {
+		if (pthread_create(&thread[i], NULL, process_notifier_thread, NULL)) {
+			fprintf(stderr, "Failed to create notifier thread\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int notifier_overflow_fd(void) {
+	return fdOverflow;
+}
@@ -0,0 +1,167 @@
+#ifndef KVS_NOTIFIER_H
+#define KVS_NOTIFIER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "src/common/constants.h"
+#include "src/common/protocol.h"
+
+/// What a session's queue does with notifications the session cannot take.
+typedef enum NotifyPolicy {
+	// A notification replaces the queued one of the same key, so a slow
+	// subscriber only gets the latest value. The oldest is dropped when the
+	// queue is full of other keys.
+	NOTIFY_COALESCE,
+	NOTIFY_DROP_OLDEST, // the oldest notification is dropped on a full queue
+	// As NOTIFY_DROP_OLDEST, until NOTIFY_DISCONNECT_THRESHOLD notifications
+	// were dropped, then the session is disconnected
+	NOTIFY_DISCONNECT,
+} NotifyPolicy;
+
+/// Change to a key, shared by the queues of every subscriber of the key.
+typedef struct Notification {
+	atomic_uint refs;
+	uint64_t id;                     // sequence number of the change
+	uint64_t keyHash;                // hash_key of the key
+	char message[NOTIFICATION_SIZE]; // as sent, see NOTIFICATION_SIZE
+	size_t compactSize;
+	char compact[COMPACT_NOTIFICATION_MAX_SIZE]; // as sent to compact sessions
+	// Both layouts cut a value to BATCH_MAX_STRING_LENGTH bytes. A longer
+	// one is kept whole, null terminated, for PROTOCOL_LARGE_VALUES sessions.
+	char *value;
+	size_t valueLength;
+#ifdef NOTIFY_TEE
+	atomic_int staging;        // read end of a pipe holding the message, see NOT_STAGED
+	atomic_int compactStaging; // the same for the compact layout
+#endif
+} Notification;
+
+/// Receives the notifications of an in-process session, on a notifier thread.
+/// @param key
+/// @param value New value, "DELETE" for a delete. Null terminated, but it
+/// may hold '\0' bytes.
+/// @param valueLength Bytes in the value.
+/// @param seq Sequence number of the change.
+/// @param context As given to notify_queue_create_local.
+typedef void (*NotifyCallback)(const char *key, const char *value, size_t valueLength,
+							   uint64_t seq, void *context);
+
+/// Bounded queue of the notifications waiting to be sent to a session.
+/// Notifier threads drain it without blocking, so a slow subscriber only
+/// delays its own notifications.
+typedef struct NotifyQueue {
+	pthread_mutex_t lock;
+	int fd;            // duplicate of the notifications fd of the session
+	int isSocket;
+	int compact;     // sends the PROTOCOL_COMPACT layout
+	int largeValues; // sends whole values, see PROTOCOL_LARGE_VALUES
+	int gapMarkers;  // marks dropped notifications, see PROTOCOL_GAP_MARKERS
+	// Bytes of the notification at the head already sent. A large value is
+	// sent in pieces, and the rest must follow before anything else.
+	size_t sentBytes;
+	// Called instead of writing to fd, which is then an eventfd that is
+	// always writable
+	NotifyCallback callback;
+	void *context;
+	uint32_t slot;       // position in the notifier registry
+	uint32_t generation; // tells apart queues that reused a slot
+	unsigned int refs;   // held by the session and by the notifiers draining it
+	int closed;          // the session ended or its fd failed
+	int armed;           // waiting for the fd to be writable, or being drained
+	int registered;      // fd added to the notifier epoll instance
+	int overflowed;      // must be disconnected under NOTIFY_DISCONNECT
+	int gap;             // notifications were dropped since the last marker
+	size_t head, count;
+	uint64_t lastPushed; // id of the last notification queued
+	unsigned long dropped;   // notifications dropped on a full queue
+	unsigned long coalesced; // notifications replaced by a newer value
+	Notification *items[NOTIFY_QUEUE_CAPACITY];
+} NotifyQueue;
+
+/// Counters of a session's queue, as shown by STATS.
+typedef struct NotifyQueueStats {
+	size_t depth;
+	unsigned long dropped;
+	unsigned long coalesced;
+} NotifyQueueStats;
+
+/// Starts the notifier threads.
+/// @param policy What full queues do.
+/// @return 0 on success, 1 otherwise
+int notifier_init(NotifyPolicy policy);
+
+/// Gets the eventfd that becomes readable when a session must be
+/// disconnected because its queue overflowed.
+/// @return the eventfd, -1 if the notifier is not running
+int notifier_overflow_fd(void);
+
+/// Creates the queue of a session.
+/// @param fdNotif fd the notifications of the session are sent on.
+/// @param isSocket Whether fdNotif is a session socket.
+/// @return the queue, NULL on error
+NotifyQueue *notify_queue_create(int fdNotif, int isSocket);
+
+/// Switches the notifications of a session to the layout of a protocol
+/// version. Called when the session negotiates it, before it subscribes to
+/// anything.
+/// @param queue
+/// @param version PROTOCOL_COMPACT or a later version.
+void notify_queue_set_protocol(NotifyQueue *queue, int version);
+
+/// Creates the queue of an in-process session, whose notifications are
+/// passed to a callback instead of sent on an fd.
+/// @param callback Called on a notifier thread, one notification at a time.
+/// @param context Passed to the callback.
+/// @return the queue, NULL on error
+NotifyQueue *notify_queue_create_local(NotifyCallback callback, void *context);
+
+/// Drops the notifications left in the queue of a session that ended. The
+/// queue is freed once no notifier holds it. For an in-process session,
+/// waits for a callback that is running to return, so it must not be
+/// called from the callback.
+/// @param queue
+void notify_queue_close(NotifyQueue *queue);
+
+/// Creates a notification, with a reference held by the caller.
+/// @param key
+/// @param keyHash hash_key of the key.
+/// @param value
+/// @param valueLength Number of bytes in the value.
+/// @param seq Sequence number of the change.
+/// @return the notification, NULL on error
+Notification *notification_create(const char *key, uint64_t keyHash, const char *value,
+								  size_t valueLength, uint64_t seq);
+
+/// Marks a notification to be copied into a staging pipe, from which it is
+/// duplicated into the notifications pipe of each subscriber with tee(2).
+/// The first notifier thread to send it stages it, so no pipe is made under
+/// the lock of the key. Only built with NOTIFY_TEE; a notification that is
+/// not staged, or finds NOTIFY_TEE_MAX_PIPES staged already, is written
+/// instead.
+/// @param notification
+/// @param fixed Whether to stage the PROTOCOL_FIXED layout.
+/// @param compact Whether to stage the PROTOCOL_COMPACT layout.
+void notification_stage(Notification *notification, int fixed, int compact);
+
+/// Drops a reference to a notification, freeing it with the last one.
+/// @param notification
+void notification_release(Notification *notification);
+
+/// Queues a notification for a session without waiting for it, applying
+/// the overflow policy. A session whose key and pattern subscriptions match
+/// the same change gets it once.
+/// @param queue
+/// @param notification
+void notify_queue_push(NotifyQueue *queue, Notification *notification);
+
+/// Gets the counters of a queue.
+/// @param queue
+/// @param stats Where to store the counters.
+/// @return whether the session must be disconnected because its queue overflowed
+int notify_queue_stats(NotifyQueue *queue, NotifyQueueStats *stats);
+
+#endif  // KVS_NOTIFIER_H
@@ -1,3 +1,7 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,23 +10,35 @@
 
 #include "io.h"
 #include "constants.h"
+#include "cdc.h"
+#include "changelog.h"
 #include "kvs.h"
+#include "operations.h"
+#include "patterns.h"
+#include "sort.h"
+#include "timers.h"
 #include "src/common/constants.h"
 #include "src/common/io.h"
 #include "src/common/protocol.h"
 #include <fcntl.h>
+#include <sys/mman.h>
+#include "src/common/ring.h"
 
 #include "client.h"
 
 static struct HashTable *kvs_table = NULL;
 
+// Pair of a kvs_write call, sorted by its key, which must come first
 typedef struct {
 	char key[MAX_STRING_SIZE];
-	char value[MAX_STRING_SIZE];
+	const char *value;
+	size_t valueLength;
 } KeyValuePair;
 
 
-struct Client *connectedClients[MAX_SESSION_COUNT] = {NULL};
+struct Client **connectedClients = NULL;
+unsigned int maxSessions = 0;
+unsigned int sessionGeneration = 0;
 pthread_mutex_t connectedClientsMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
@@ -49,27 +65,25 @@ int kvs_terminate() {
 		return 1;
 	}
 	free_table(kvs_table);
+	free(connectedClients);
 	return 0;
 }
 
-// Alphabetical comparison of pairs
-int compare_pairs(const void *a, const void *b) {
-	const KeyValuePair *pair1 = (const KeyValuePair *) a;
-	const KeyValuePair *pair2 = (const KeyValuePair *) b;
-	return strcmp(pair1->key, pair2->key);
-}
-
-// Alphabetical comparison of keys
-int compare_keys(const void *a, const void *b) {
-	const char *key1 = (const char *) a;
-	const char *key2 = (const char *) b;
-	return strcmp(key1, key2);
+int kvs_init_sessions(unsigned int max_sessions) {
+	connectedClients = calloc(max_sessions, sizeof(struct Client *));
+	if (connectedClients == NULL) {
+		fprintf(stderr, "Failed to allocate the client list\n");
+		return 1;
+	}
+	maxSessions = max_sessions;
+	return 0;
 }
 
 int lock_write_list(size_t num_pairs, char keys[][MAX_STRING_SIZE],
 					int indexList[]) {
 	for (size_t i = 0; i < num_pairs; i++) {
 		int index = hash(keys[i]);
+		if (index < 0) continue; // the key has no bucket, like the pattern "*"
 
 		// If that index still hasn't been locked
 		if (indexList[index] == 0) {
@@ -87,6 +101,7 @@ int lock_read_list(size_t num_pairs, char keys[][MAX_STRING_SIZE],
 				   int indexList[]) {
 	for (size_t i = 0; i < num_pairs; i++) {
 		int index = hash(keys[i]);
+		if (index < 0) continue;
 
 		// If that index still hasn't been locked
 		if (indexList[index] == 0) {
@@ -113,23 +128,155 @@ int unlock_list(int indexList[]) {
 	return 0;
 }
 
-int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
-			  char values[][MAX_STRING_SIZE]) {
+#ifdef FLAT_COMBINING
+
+/// Pending writes of one kvs_write call to one bucket, published for
+/// whichever thread holds the bucket lock to apply.
+typedef struct WriteRequest {
+	const KeyValuePair *pairs;
+	const size_t *order; // positions in pairs of this bucket's pairs
+	size_t numPairs;
+	uint64_t expiresAt;
+	struct WriteRequest *next;
+	atomic_int done;
+} WriteRequest;
+
+// Publication list of each bucket
+static _Atomic(WriteRequest *) publicationLists[TABLE_SIZE];
+
+/// Publishes a write request on the publication list of a bucket.
+/// @param index Bucket of the request.
+/// @param request Request to publish.
+static void publish_write(int index, WriteRequest *request) {
+	WriteRequest *head = atomic_load_explicit(&publicationLists[index], memory_order_relaxed);
+	do {
+		request->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&publicationLists[index], &head, request,
+													memory_order_release,
+													memory_order_relaxed));
+}
+
+/// Applies every write request published on a bucket. Must be called with
+/// the bucket write lock held.
+/// @param index Bucket to combine.
+static void combine_writes(int index) {
+	WriteRequest *request =
+			atomic_exchange_explicit(&publicationLists[index], NULL, memory_order_acquire);
+	while (request != NULL) {
+		// The owner may return as soon as done is set
+		WriteRequest *next = request->next;
+		for (size_t i = 0; i < request->numPairs; i++) {
+			const KeyValuePair *pair = &request->pairs[request->order[i]];
+			if (write_pair(kvs_table, pair->key, pair->value, pair->valueLength,
+						   request->expiresAt)) {
+				fprintf(stderr, "Failed to write the value of key %s\n", pair->key);
+			}
+		}
+		atomic_store_explicit(&request->done, 1, memory_order_release);
+		request = next;
+	}
+}
+
+/// Writes sorted pairs through the publication lists. Each bucket's share of
+/// the pairs is published, and the thread that gets a bucket lock applies
+/// every request pending on it, so contended buckets change hands once per
+/// group of writers instead of once per writer.
+/// @param num_pairs Number of pairs.
+/// @param pairs Pairs sorted by key.
+/// @param expiresAt When the pairs expire, 0 for never.
+/// @return 0 if successful, 1 otherwise.
+static int flat_combining_write(size_t num_pairs, const KeyValuePair pairs[],
+								uint64_t expiresAt) {
+	// Group the pairs by bucket, keeping them sorted inside each bucket
+	size_t count[TABLE_SIZE] = {0};
+	int indexes[num_pairs];
+	for (size_t i = 0; i < num_pairs; i++) {
+		indexes[i] = hash(pairs[i].key);
+		if (indexes[i] < 0) {
+			fprintf(stderr, "Failed to write the value of key %s\n", pairs[i].key);
+			continue;
+		}
+		count[indexes[i]]++;
+	}
+
+	size_t order[num_pairs];
+	size_t start[TABLE_SIZE];
+	size_t total = 0;
+	for (int b = 0; b < TABLE_SIZE; b++) {
+		start[b] = total;
+		total += count[b];
+	}
+	size_t next[TABLE_SIZE];
+	memcpy(next, start, sizeof(next));
+	for (size_t i = 0; i < num_pairs; i++) {
+		if (indexes[i] >= 0) order[next[indexes[i]]++] = i;
+	}
+
+	WriteRequest requests[TABLE_SIZE];
+	for (int b = 0; b < TABLE_SIZE; b++) {
+		if (count[b] == 0) continue;
+		requests[b].pairs = pairs;
+		requests[b].order = order + start[b];
+		requests[b].numPairs = count[b];
+		requests[b].expiresAt = expiresAt;
+		atomic_init(&requests[b].done, 0);
+		publish_write(b, &requests[b]);
+	}
+
+	// Combine until every request of this call has been applied. A few
+	// rounds let the current holders apply it; after them this thread
+	// waits for each lock, one at a time, so it never spins for long.
+	int pending = 1;
+	for (unsigned int round = 0; pending; round++) {
+		int block = round >= COMBINING_SPIN_ROUNDS;
+		pending = 0;
+		for (int b = 0; b < TABLE_SIZE; b++) {
+			if (count[b] == 0 || atomic_load_explicit(&requests[b].done, memory_order_acquire)) {
+				continue;
+			}
+			int locked = block ? pthread_rwlock_wrlock(&kvs_table->bucketLocks[b])
+							   : pthread_rwlock_trywrlock(&kvs_table->bucketLocks[b]);
+			if (locked == 0) {
+				combine_writes(b);
+				if (pthread_rwlock_unlock(&kvs_table->bucketLocks[b])) {
+					fprintf(stderr, "Failed to unlock bucket %d\n", b);
+					return 1;
+				}
+			}
+			if (!atomic_load_explicit(&requests[b].done, memory_order_acquire)) {
+				pending = 1;
+			}
+		}
+		if (pending && !block) sched_yield();
+	}
+	return 0;
+}
+
+#endif  // FLAT_COMBINING
+
+int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], const char *values[],
+			  const size_t valueLengths[], unsigned int ttl_ms) {
 	if (kvs_table == NULL) {
 		fprintf(stderr, "KVS state must be initialized\n");
 		return 1;
 	}
+	uint64_t expiresAt = ttl_ms ? timers_now() + ttl_ms : 0;
 
-	// Sort the pairs alphabetically
-	char pairs[num_pairs][2][MAX_STRING_SIZE];
+	// Sort the pairs alphabetically. Values are not moved, write_pair copies
+	// each one once into its node.
+	KeyValuePair pairs[num_pairs];
 	for (size_t i = 0; i < num_pairs; i++) {
-		strcpy(pairs[i][0], keys[i]);
-		strcpy(pairs[i][1], values[i]);
+		strcpy(pairs[i].key, keys[i]);
+		pairs[i].value = values[i];
+		pairs[i].valueLength = valueLengths[i];
 	}
-	qsort(pairs, num_pairs, sizeof(pairs[0]), compare_pairs);
+	sort_keys(pairs, num_pairs, sizeof(pairs[0]));
+#ifdef FLAT_COMBINING
+	return flat_combining_write(num_pairs, pairs, expiresAt);
+#else
 	char sortedKeys[num_pairs][MAX_STRING_SIZE];
 	for (size_t i = 0; i < num_pairs; i++) {
-		strcpy(sortedKeys[i], pairs[i][0]);
+		strcpy(sortedKeys[i], pairs[i].key);
 	}
 
 	// Lock all meaningful keys
@@ -139,9 +286,9 @@ int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
 	}
 
 	for (size_t i = 0; i < num_pairs; i++) {
-		if (write_pair(kvs_table, pairs[i][0], pairs[i][1])) {
-			fprintf(stderr, "Failed to write keypair (%s,%s)\n", pairs[i][0],
-					pairs[i][1]);
+		if (write_pair(kvs_table, pairs[i].key, pairs[i].value, pairs[i].valueLength,
+					   expiresAt)) {
+			fprintf(stderr, "Failed to write the value of key %s\n", pairs[i].key);
 		}
 	}
 
@@ -149,6 +296,7 @@ int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE],
 		return 1;
 	}
 	return 0;
+#endif  // FLAT_COMBINING
 }
 
 int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut) {
@@ -156,7 +304,7 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut) {
 		fprintf(stderr, "KVS state must be initialized\n");
 		return 1;
 	}
-	qsort(keys, num_pairs, MAX_STRING_SIZE, compare_keys);
+	sort_keys(keys, num_pairs, MAX_STRING_SIZE);
 
 	// Lock all meaningful keys
 	int indexList[TABLE_SIZE] = {0};
@@ -166,17 +314,28 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut) {
 	if (write(fdOut, "[", 1) < 0) {
 		fprintf(stderr, "Failed to write to output file\n");
 	}
+	const char *keyList[num_pairs];
+	char *results[num_pairs];
+	size_t resultLengths[num_pairs];
+	for (size_t i = 0; i < num_pairs; i++) {
+		keyList[i] = keys[i];
+	}
+	read_pairs(kvs_table, num_pairs, keyList, results, resultLengths);
+
 	for (size_t i = 0; i < num_pairs; i++) {
 		char buffer[MAX_WRITE_SIZE];
-		char *result = read_pair(kvs_table, keys[i]);
+		char *result = results[i];
 
 		if (result == NULL) {
 			snprintf(buffer, sizeof(buffer), "(%s,KVSERROR)", keys[i]);
 		} else {
-			snprintf(buffer, sizeof(buffer), "(%s,%s)", keys[i], result);
+			snprintf(buffer, sizeof(buffer), "(%s,", keys[i]);
 		}
 
-		if (write(fdOut, buffer, strlen(buffer)) < 0) {
+		// A value is written as it is, it may not fit in the buffer
+		if (write_all(fdOut, buffer, strlen(buffer)) < 0 ||
+			(result != NULL && (write_all(fdOut, result, resultLengths[i]) < 0 ||
+								write_all(fdOut, ")", 1) < 0))) {
 			fprintf(stderr, "Failed to write to output file\n");
 		}
 		free(result);
@@ -196,7 +355,7 @@ int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut) {
 		fprintf(stderr, "KVS state must be initialized\n");
 		return 1;
 	}
-	qsort(keys, num_pairs, MAX_STRING_SIZE, compare_keys);
+	sort_keys(keys, num_pairs, MAX_STRING_SIZE);
 
 	// Lock all meaningful keys
 	int indexList[TABLE_SIZE] = {0};
@@ -232,6 +391,160 @@ int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut) {
 	return 0;
 }
 
+// Key of a batch together with its position in the caller's arrays
+typedef struct {
+	char key[MAX_STRING_SIZE];
+	size_t position;
+} BatchKey;
+
+/// Sorts the keys of a batch, remembering where each one came from.
+/// @param num_keys Number of keys.
+/// @param keys Keys in the caller's order.
+/// @param batch Where to store the sorted keys.
+/// @param sortedKeys Where to store a copy of the sorted keys.
+static void sort_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], BatchKey batch[],
+					   char sortedKeys[][MAX_STRING_SIZE]) {
+	for (size_t i = 0; i < num_keys; i++) {
+		strcpy(batch[i].key, keys[i]);
+		batch[i].position = i;
+	}
+	sort_keys(batch, num_keys, sizeof(batch[0]));
+	for (size_t i = 0; i < num_keys; i++) {
+		strcpy(sortedKeys[i], batch[i].key);
+	}
+}
+
+int kvs_get(size_t num_keys, char keys[][MAX_STRING_SIZE], char *values[],
+			size_t valueLengths[]) {
+	if (kvs_table == NULL) {
+		fprintf(stderr, "KVS state must be initialized\n");
+		return 1;
+	}
+
+	BatchKey batch[num_keys];
+	char sortedKeys[num_keys][MAX_STRING_SIZE];
+	sort_batch(num_keys, keys, batch, sortedKeys);
+
+	// Lock all meaningful keys
+	int indexList[TABLE_SIZE] = {0};
+	if (lock_read_list(num_keys, sortedKeys, indexList)) {
+		return 1;
+	}
+
+	const char *keyList[num_keys];
+	char *results[num_keys];
+	size_t resultLengths[num_keys];
+	for (size_t i = 0; i < num_keys; i++) {
+		keyList[i] = sortedKeys[i];
+	}
+	read_pairs(kvs_table, num_keys, keyList, results, resultLengths);
+
+	if (unlock_list(indexList)) {
+		for (size_t i = 0; i < num_keys; i++) free(results[i]);
+		return 1;
+	}
+
+	for (size_t i = 0; i < num_keys; i++) {
+		values[batch[i].position] = results[i];
+		valueLengths[batch[i].position] = resultLengths[i];
+	}
+	return 0;
+}
+
+int kvs_del(size_t num_keys, char keys[][MAX_STRING_SIZE], int deleted[]) {
+	if (kvs_table == NULL) {
+		fprintf(stderr, "KVS state must be initialized\n");
+		return 1;
+	}
+
+	BatchKey batch[num_keys];
+	char sortedKeys[num_keys][MAX_STRING_SIZE];
+	sort_batch(num_keys, keys, batch, sortedKeys);
+
+	// Lock all meaningful keys
+	int indexList[TABLE_SIZE] = {0};
+	if (lock_write_list(num_keys, sortedKeys, indexList)) {
+		return 1;
+	}
+
+	for (size_t i = 0; i < num_keys; i++) {
+		deleted[batch[i].position] = delete_pair(kvs_table, sortedKeys[i]) == 0;
+	}
+
+	if (unlock_list(indexList)) {
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_expire_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], unsigned int ttl_ms,
+					 int found[]) {
+	if (kvs_table == NULL) {
+		fprintf(stderr, "KVS state must be initialized\n");
+		return 1;
+	}
+	uint64_t expiresAt = ttl_ms ? timers_now() + ttl_ms : 0;
+
+	BatchKey batch[num_keys];
+	char sortedKeys[num_keys][MAX_STRING_SIZE];
+	sort_batch(num_keys, keys, batch, sortedKeys);
+
+	// Lock all meaningful keys
+	int indexList[TABLE_SIZE] = {0};
+	if (lock_write_list(num_keys, sortedKeys, indexList)) {
+		return 1;
+	}
+
+	for (size_t i = 0; i < num_keys; i++) {
+		found[batch[i].position] = set_expiry(kvs_table, sortedKeys[i], expiresAt) == 0;
+	}
+
+	if (unlock_list(indexList)) {
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_expire(size_t num_keys, char keys[][MAX_STRING_SIZE], unsigned int ttl_ms, int fdOut) {
+	int found[num_keys];
+	if (kvs_expire_batch(num_keys, keys, ttl_ms, found)) return 1;
+
+	// Missing keys are reported as DELETE reports them
+	int aux = 0;
+	for (size_t i = 0; i < num_keys; i++) {
+		if (found[i]) continue;
+		if (!aux) {
+			if (write(fdOut, "[", 1) < 0) {
+				fprintf(stderr, "Failed to write to output file\n");
+			}
+			aux = 1;
+		}
+		char buffer[MAX_WRITE_SIZE];
+		snprintf(buffer, sizeof(buffer), "(%s,KVSMISSING)", keys[i]);
+		if (write(fdOut, buffer, strlen(buffer)) < 0) {
+			fprintf(stderr, "Failed to write to output file\n");
+		}
+	}
+	if (aux) {
+		if (write(fdOut, "]\n", 2) < 0) {
+			fprintf(stderr, "Failed to write to output file\n");
+		}
+	}
+	return 0;
+}
+
+size_t kvs_expire_due(int index, uint64_t now, size_t max) {
+	if (pthread_rwlock_wrlock(&kvs_table->bucketLocks[index])) {
+		fprintf(stderr, "Failed to lock bucket %d\n", index);
+		return 0;
+	}
+	size_t expired = expire_pairs(kvs_table, index, now, max);
+	if (pthread_rwlock_unlock(&kvs_table->bucketLocks[index])) {
+		fprintf(stderr, "Failed to unlock bucket %d\n", index);
+	}
+	return expired;
+}
+
 int kvs_show(int fdOut) {
 	// Lock all keys
 	for (int i = 0; i < TABLE_SIZE; i++) {
@@ -244,13 +557,14 @@ int kvs_show(int fdOut) {
 	char buffer[MAX_WRITE_SIZE];
 	for (int i = 0; i < TABLE_SIZE; i++) {
 		KeyNode *keyNode = kvs_table->table[i];
-		while (keyNode != NULL) {
-			snprintf(buffer, sizeof(buffer), "(%s, %s)\n", keyNode->key,
-					 keyNode->value);
-			if (write(fdOut, buffer, strlen(buffer)) < 0) {
+		for (; keyNode != NULL; keyNode = keyNode->next) {
+			if (key_expired(keyNode)) continue;
+			snprintf(buffer, sizeof(buffer), "(%s, ", keyNode->key);
+			if (write_all(fdOut, buffer, strlen(buffer)) < 0 ||
+				write_all(fdOut, keyNode->value, keyNode->valueLen) < 0 ||
+				write_all(fdOut, ")\n", 2) < 0) {
 				fprintf(stderr, "Failed to write to output file.\n");
 			}
-			keyNode = keyNode->next;
 		}
 	}
 
@@ -263,129 +577,368 @@ int kvs_show(int fdOut) {
 	return 0;
 }
 
-int kvs_backup(int fdBck) {
+int kvs_stats(int fdOut) {
+	if (kvs_table == NULL) {
+		fprintf(stderr, "KVS state must be initialized\n");
+		return 1;
+	}
+
+	FilterStats stats;
+	get_filter_stats(kvs_table, &stats);
+
+	// Fraction of lookups for absent keys that the filters let through
+	unsigned long misses = stats.negatives + stats.falsePositives;
+	double fpRate = misses ? (double) stats.falsePositives / (double) misses : 0.0;
+
+	char buffer[2 * MAX_WRITE_SIZE];
+	snprintf(buffer, sizeof(buffer),
+			 "(filter_lookups, %lu)\n(filter_negatives, %lu)\n"
+			 "(filter_false_positives, %lu)\n(filter_false_positive_rate, %.4f)\n"
+			 "(pattern_subscriptions, %zu)\n(change_log_seq, %" PRIu64 ")\n"
+			 "(cdc_records_written, %lu)\n(cdc_records_dropped, %lu)\n(cdc_lag, %lu)\n"
+			 "(keys_expired, %lu)\n",
+			 stats.lookups, stats.negatives, stats.falsePositives, fpRate,
+			 pattern_subscription_count(), changelog_last_seq(), cdc_records_written(),
+			 cdc_records_dropped(), cdc_lag(), get_expired_count(kvs_table));
+	if (write(fdOut, buffer, strlen(buffer)) < 0) {
+		fprintf(stderr, "Failed to write to output file.\n");
+		return 1;
+	}
+
+	int error = 0;
+	pthread_mutex_lock(&connectedClientsMutex);
+	for (unsigned int i = 0; i < maxSessions && !error; i++) {
+		if (connectedClients[i] == NULL) continue;
+
+		NotifyQueueStats queueStats;
+		notify_queue_stats(connectedClients[i]->notifications, &queueStats);
+		snprintf(buffer, sizeof(buffer),
+				 "(session_%u_queue_depth, %zu)\n(session_%u_dropped, %lu)\n"
+				 "(session_%u_coalesced, %lu)\n",
+				 i, queueStats.depth, i, queueStats.dropped, i, queueStats.coalesced);
+		if (write(fdOut, buffer, strlen(buffer)) < 0) {
+			fprintf(stderr, "Failed to write to output file.\n");
+			error = 1;
+		}
+	}
+	pthread_mutex_unlock(&connectedClientsMutex);
+	return error;
+}
+
+/// Writes every pair in the format of the backup files. The caller keeps
+/// the table from changing.
+/// @param fdOut File descriptor to write the pairs to.
+static void write_pairs(int fdOut) {
 	for (int i = 0; i < TABLE_SIZE; i++) {
 		KeyNode *keyNode = kvs_table->table[i];
-		while (keyNode != NULL) {
-			char aux[MAX_STRING_SIZE];
+		for (; keyNode != NULL; keyNode = keyNode->next) {
+			if (key_expired(keyNode)) continue;
+			// The key and its framing go in one write, the value is written
+			// from the node as it is, however large
+			char aux[MAX_STRING_SIZE + 3];
 			aux[0] = '(';
 			size_t num_bytes_copied = 1; // the "("
-			// the - 1 are all to leave space for the '/0'
-			num_bytes_copied += strn_memcpy(aux + num_bytes_copied,
-											keyNode->key, MAX_STRING_SIZE - num_bytes_copied - 1);
-			num_bytes_copied += strn_memcpy(aux + num_bytes_copied,
-											", ", MAX_STRING_SIZE - num_bytes_copied - 1);
-			num_bytes_copied += strn_memcpy(aux + num_bytes_copied,
-											keyNode->value, MAX_STRING_SIZE - num_bytes_copied - 1);
-			num_bytes_copied += strn_memcpy(aux + num_bytes_copied,
-											")\n", MAX_STRING_SIZE - num_bytes_copied - 1);
-			aux[num_bytes_copied] = '\0';
-			write_str(fdBck, aux);
-			keyNode = keyNode->next;
+			num_bytes_copied += strn_memcpy(aux + num_bytes_copied, keyNode->key,
+											MAX_STRING_SIZE - 1);
+			num_bytes_copied += strn_memcpy(aux + num_bytes_copied, ", ", 2);
+			if (write_all(fdOut, aux, num_bytes_copied) < 0 ||
+				write_all(fdOut, keyNode->value, keyNode->valueLen) < 0 ||
+				write_all(fdOut, ")\n", 2) < 0) {
+				write_str(STDERR_FILENO, "Failed to write pair\n");
+			}
 		}
 	}
+}
+
+int kvs_backup(int fdBck) {
+	write_pairs(fdBck);
 	close(fdBck);
 
 	return 0;
 }
 
-void kvs_wait(unsigned int delay_ms) {
-	struct timespec delay = delay_to_timespec(delay_ms);
-	nanosleep(&delay, NULL);
+int kvs_snapshot(int fdOut) {
+	if (kvs_table == NULL) {
+		fprintf(stderr, "KVS state must be initialized\n");
+		return 1;
+	}
+
+	// Lock all keys, writers wait until the pairs are written
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		if (pthread_rwlock_rdlock(&kvs_table->bucketLocks[i])) {
+			fprintf(stderr, "Failed to lock bucket %d\n", i);
+			for (int j = 0; j < i; j++) pthread_rwlock_unlock(&kvs_table->bucketLocks[j]);
+			return 1;
+		}
+	}
+	write_pairs(fdOut);
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		if (pthread_rwlock_unlock(&kvs_table->bucketLocks[i])) {
+			fprintf(stderr, "Failed to unlock bucket %d\n", i);
+			return 1;
+		}
+	}
+	return 0;
 }
 
-int kvs_subscribe(const char *key, struct Client **client) {
-	if(strlen(key) == 0 || strlen(key) > MAX_STRING_SIZE){
-		write_to_resp_pipe((*client)->fdResp, OP_CODE_SUBSCRIBE, RESULT_KEY_DOESNT_EXIST);
-		fprintf(stderr, "Client tried to subscribe an invalid key\n");
-		return 0;
+int kvs_scan(const char *prefix, KvsVisitor visit, void *context) {
+	if (kvs_table == NULL) {
+		fprintf(stderr, "KVS state must be initialized\n");
+		return 1;
 	}
-	int index = hash(key);
-	if (pthread_rwlock_wrlock(&kvs_table->bucketLocks[index])) {
-		fprintf(stderr, "Failed to lock key %d\n", index);
-		return -1;
+
+	// Keys are bucketed by their first character, so a prefix is in one bucket
+	size_t prefixLen = strlen(prefix);
+	int first = 0, last = TABLE_SIZE - 1;
+	if (prefixLen > 0) {
+		first = last = hash(prefix);
+		if (first < 0) return 0;
 	}
 
-	int subscriptionStatus = 0;
-	char result = RESULT_KEY_DOESNT_EXIST;
-	KeyNode *keyNode = kvs_table->table[index];
-	while (keyNode != NULL) {
-		if (strcmp(keyNode->key, key) == 0) {
-			subscriptionStatus = add_subscriber(keyNode, (*client)->fdNotif);
-			if (subscriptionStatus == -1) {
-				fprintf(stderr, "Failed to add subscriber\n");
+	for (int i = first; i <= last; i++) {
+		// Copied under the lock and visited without it, so the visitor may
+		// write to the KVS
+		if (pthread_rwlock_rdlock(&kvs_table->bucketLocks[i])) {
+			fprintf(stderr, "Failed to lock bucket %d\n", i);
+			return 1;
+		}
+		size_t count = 0;
+		for (KeyNode *keyNode = kvs_table->table[i]; keyNode != NULL; keyNode = keyNode->next) {
+			count += strncmp(keyNode->key, prefix, prefixLen) == 0 && !key_expired(keyNode);
+		}
+		KeyValuePair *pairs = count ? malloc(count * sizeof(*pairs)) : NULL;
+		if (count && pairs == NULL) {
+			pthread_rwlock_unlock(&kvs_table->bucketLocks[i]);
+			fprintf(stderr, "Failed to allocate memory\n");
+			return 1;
+		}
+		size_t copied = 0;
+		int error = 0;
+		for (KeyNode *keyNode = kvs_table->table[i]; keyNode != NULL; keyNode = keyNode->next) {
+			if (strncmp(keyNode->key, prefix, prefixLen) || key_expired(keyNode)) continue;
+			snprintf(pairs[copied].key, MAX_STRING_SIZE, "%s", keyNode->key);
+			char *value = malloc(keyNode->valueLen + 1);
+			if (value == NULL) {
+				error = 1;
+				break;
 			}
-			result = RESULT_KEY_EXISTS;
-			break;
+			memcpy(value, keyNode->value, keyNode->valueLen + 1);
+			pairs[copied].value = value;
+			pairs[copied].valueLength = keyNode->valueLen;
+			copied++;
+		}
+		if (pthread_rwlock_unlock(&kvs_table->bucketLocks[i])) {
+			fprintf(stderr, "Failed to unlock bucket %d\n", i);
+			error = 1;
 		}
-		keyNode = keyNode->next;
-	}
 
-	if (pthread_rwlock_unlock(&kvs_table->bucketLocks[index])) {
-		fprintf(stderr, "Failed to unlock key %d\n", index);
+		for (size_t j = 0; j < copied; j++) {
+			if (!error) visit(pairs[j].key, pairs[j].value, pairs[j].valueLength, context);
+			free((char *) pairs[j].value);
+		}
+		free(pairs);
+		if (error) {
+			fprintf(stderr, "Failed to copy the pairs of bucket %d\n", i);
+			return 1;
+		}
 	}
+	return 0;
+}
 
-	if (subscriptionStatus == 0) { // if client wasnt subscribed already
-		SubscriptionsKeyNode *newSub = malloc(sizeof(SubscriptionsKeyNode));
-		if (newSub == NULL) {
-			fprintf(stderr, "Failed to allocate memory for new subscription\n");
-			return -1;
+void kvs_wait(unsigned int delay_ms) {
+	struct timespec delay = delay_to_timespec(delay_ms);
+	nanosleep(&delay, NULL);
+}
+
+/// @brief Subscribes a client to a key or pattern and records it in the
+/// client's subscriptions. The bucket of the key must be write locked.
+/// @param key
+/// @param client
+/// @return 0 if the client is subscribed, 1 if the key does not exist (the
+/// subscription then waits for it to be written), 2 if no write can ever
+/// create the key, so it is not subscribed, -1 if an error occurred
+static int add_subscription(const char *key, struct Client *client) {
+	if (!is_pattern(key)) {
+		int index = hash(key);
+		if (index < 0) return 2;
+
+		// A missing key is parked until the write that creates it
+		int exists = 1;
+		KeyNode *keyNode = find_key_node(kvs_table, key);
+		// An expired key goes first, the subscription then waits for its next write
+		if (keyNode != NULL && key_expired(keyNode)) {
+			delete_pair(kvs_table, key);
+			keyNode = NULL;
+		}
+		if (keyNode == NULL) {
+			exists = 0;
+			keyNode = park_key(kvs_table, key);
+			if (keyNode == NULL) return -1;
 		}
 
-		newSub->key = strdup(key);
-		if (newSub->key == NULL) {
-			fprintf(stderr, "Failed to allocate memory for new subscription key\n");
-			free(newSub);
+		// Linked in the client's list for the bucket, whose lock is held
+		int subscriptionStatus =
+				add_subscriber(keyNode, client->notifications, &client->subscriptions[index]);
+		if (subscriptionStatus == -1) {
+			fprintf(stderr, "Failed to add subscriber\n");
+			release_parked_key(kvs_table, keyNode);
 			return -1;
 		}
+		atomic_fetch_or_explicit(&client->subscribedBuckets, 1u << index, memory_order_relaxed);
+		return exists ? 0 : 1;
+	}
+
+	// Covers the keys with the prefix, whether they exist yet or not
+	int subscriptionStatus = pattern_subscribe(key, client->notifications);
+	if (subscriptionStatus == -1) {
+		fprintf(stderr, "Failed to add subscriber\n");
+		return -1;
+	}
+	if (subscriptionStatus == 1) return 0; // client was subscribed already
+
+	SubscriptionsKeyNode *newSub = malloc(sizeof(SubscriptionsKeyNode));
+	if (newSub == NULL) {
+		fprintf(stderr, "Failed to allocate memory for new subscription\n");
+		return -1;
+	}
+
+	newSub->key = strdup(key);
+	if (newSub->key == NULL) {
+		fprintf(stderr, "Failed to allocate memory for new subscription key\n");
+		free(newSub);
+		return -1;
+	}
+
+	newSub->next = client->patterns;
+	client->patterns = newSub;
+	return 0;
+}
+
+/// @brief Removes a client from the subscribers of a key or pattern. The
+/// bucket of the key must be write locked.
+/// @param key
+/// @param queue Notifications queue of the client.
+/// @return 0 if deleted successfully, 1 subscription not found
+static int remove_subscription(const char *key, NotifyQueue *queue) {
+	if (is_pattern(key)) return pattern_unsubscribe(key, queue);
+
+	KeyNode *keyNode = find_key_node(kvs_table, key);
+	if (keyNode == NULL) keyNode = find_pending_node(kvs_table, key);
+	if (keyNode == NULL) return 1;
+	return remove_subscriber(kvs_table, keyNode, queue);
+}
+
+int send_to_client(struct Client *client, const void *message, size_t size) {
+	return send_buffered(&client->unsent, client->fdResp, client->isSocket, MESSAGE_RESPONSE,
+						 message, size);
+}
+
+/// @brief Sends a client the result of a request.
+/// @param client
+/// @param opcode Opcode of the request.
+/// @param result
+/// @return 0 on success, 1 on error
+static int send_result(struct Client *client, char opcode, char result) {
+	const char response[2] = {opcode, result};
+	if (send_to_client(client, response, sizeof(response))) {
+		fprintf(stderr, "Failed to write result %c to the responses pipe.\n", result);
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_subscribe(const char *key, struct Client **client) {
+	if(strlen(key) == 0 || strlen(key) > MAX_STRING_SIZE){
+		send_result(*client, OP_CODE_SUBSCRIBE, RESULT_KEY_DOESNT_EXIST);
+		fprintf(stderr, "Client tried to subscribe an invalid key\n");
+		return 0;
+	}
 
-		newSub->next = (*client)->subscriptions;
-		(*client)->subscriptions = newSub;
+	// Only the bucket of the key is locked, its first character is enough
+	int indexList[TABLE_SIZE] = {0};
+	char keys[1][MAX_STRING_SIZE];
+	strncpy(keys[0], key, MAX_STRING_SIZE - 1);
+	keys[0][MAX_STRING_SIZE - 1] = '\0';
+	if (lock_write_list(1, keys, indexList)) {
+		return -1;
+	}
+	int subscriptionStatus = add_subscription(key, *client);
+	unlock_list(indexList);
+	if (subscriptionStatus == -1) {
+		return -1;
 	}
 
+	// Parked keys are subscribed, as in kvs_subscribe_batch
 	const char opcode = OP_CODE_SUBSCRIBE;
-	if(write_to_resp_pipe((*client)->fdResp, opcode, result) == 1){
+	char result = RESULT_KEY_DOESNT_EXIST;
+	if (subscriptionStatus == 0) {
+		result = RESULT_KEY_EXISTS;
+	} else if (subscriptionStatus == 1) {
+		result = RESULT_KEY_PARKED;
+	}
+	if(send_result(*client, opcode, result) == 1){
 		return -1;
 	}
 	return 0;
 }
 
-int kvs_aux_unsubscribe(const char *key, struct Client **client) {
-	int index = hash(key);
-	if (pthread_rwlock_wrlock(&kvs_table->bucketLocks[index])) {
-		fprintf(stderr, "Failed to lock key %d\n", index);
+int kvs_subscribe_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], struct Client *client,
+						int subscribed[]) {
+	BatchKey batch[num_keys];
+	char sortedKeys[num_keys][MAX_STRING_SIZE];
+	sort_batch(num_keys, keys, batch, sortedKeys);
+
+	// Each bucket is locked once for the whole batch
+	int indexList[TABLE_SIZE] = {0};
+	if (lock_write_list(num_keys, sortedKeys, indexList)) {
+		unlock_list(indexList);
+		return 1;
 	}
 
-	int result = 1; // subscription not found
-	KeyNode *keyNode = kvs_table->table[index];
-	while (keyNode != NULL) {
-		if (strcmp(keyNode->key, key) == 0) {
-			if (keyNode->subscriber == NULL) {
-				if (pthread_rwlock_unlock(&kvs_table->bucketLocks[index])) {
-					fprintf(stderr, "Failed to unlock key %d\n", index);
-				}
-				return result;
-			}
-			result = remove_subscriber(keyNode, (*client)->fdNotif);
-			break;
+	// A key that fails leaves the others subscribed
+	for (size_t i = 0; i < num_keys; i++) {
+		int subscriptionStatus = add_subscription(sortedKeys[i], client);
+		int result = -1;
+		if (subscriptionStatus == 0) {
+			result = 1;
+		} else if (subscriptionStatus == 1) {
+			result = 0; // parked until the key is written
 		}
-		keyNode = keyNode->next;
+		subscribed[batch[i].position] = result;
 	}
 
-	if (pthread_rwlock_unlock(&kvs_table->bucketLocks[index])) {
-		fprintf(stderr, "Failed to unlock key %d\n", index);
+	if (unlock_list(indexList)) {
+		return 1;
+	}
+	return 0;
+}
+
+int kvs_aux_unsubscribe(const char *key, struct Client **client) {
+	int indexList[TABLE_SIZE] = {0};
+	char keys[1][MAX_STRING_SIZE];
+	strncpy(keys[0], key, MAX_STRING_SIZE - 1);
+	keys[0][MAX_STRING_SIZE - 1] = '\0';
+	if (lock_write_list(1, keys, indexList)) {
+		fprintf(stderr, "Failed to lock key %s\n", key);
 	}
+
+	int result = remove_subscription(key, (*client)->notifications);
+
+	unlock_list(indexList);
 	return result;
 }
 
 void client_remove_subscription(const char *key, struct Client **client) {
-    SubscriptionsKeyNode *current = (*client)->subscriptions;
+    // Key subscriptions leave the client's lists along with the key's set
+    if (!is_pattern(key)) return;
+
+    SubscriptionsKeyNode *current = (*client)->patterns;
     SubscriptionsKeyNode *prev = NULL;
     
     while (current != NULL) {
         if (strcmp(current->key, key) == 0) {
             if (prev == NULL) {
-                (*client)->subscriptions = current->next;
+                (*client)->patterns = current->next;
             } else {
                 prev->next = current->next;
             }
@@ -401,9 +954,32 @@ void client_remove_subscription(const char *key, struct Client **client) {
 }
 
 
+int kvs_unsubscribe_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], struct Client *client,
+						  int removed[]) {
+	BatchKey batch[num_keys];
+	char sortedKeys[num_keys][MAX_STRING_SIZE];
+	sort_batch(num_keys, keys, batch, sortedKeys);
+
+	int indexList[TABLE_SIZE] = {0};
+	if (lock_write_list(num_keys, sortedKeys, indexList)) {
+		unlock_list(indexList);
+		return 1;
+	}
+
+	for (size_t i = 0; i < num_keys; i++) {
+		client_remove_subscription(sortedKeys[i], &client);
+		removed[batch[i].position] = remove_subscription(sortedKeys[i], client->notifications) == 0;
+	}
+
+	if (unlock_list(indexList)) {
+		return 1;
+	}
+	return 0;
+}
+
 int kvs_unsubscribe(const char *key, struct Client **client) {
 	if(strlen(key) == 0 || strlen(key) > MAX_STRING_SIZE){
-		write_to_resp_pipe((*client)->fdResp, OP_CODE_UNSUBSCRIBE, 1);
+		send_result(*client, OP_CODE_UNSUBSCRIBE, 1);
 		fprintf(stderr, "Client tried to unsubscribe an invalid key\n");
 		return 0;
 	}
@@ -415,17 +991,91 @@ int kvs_unsubscribe(const char *key, struct Client **client) {
 	char result_char = (kvs_aux_unsubscribe(key, client) ? '1' : '0');
 
 	const char opcode = OP_CODE_UNSUBSCRIBE;
-	if(write_to_resp_pipe((*client)->fdResp, opcode, result_char) == 1){
+	if(send_result(*client, opcode, result_char) == 1){
 		return 1;
 	}
 	return 0;
 }
 
 
+/// @brief Tells whether a change is to a key or pattern a client is
+/// subscribed to. The bucket of the key must be locked.
+/// @param record
+/// @param client
+/// @return 1 if the client is subscribed, 0 otherwise
+static int resume_matches(const ChangeRecord *record, struct Client *client) {
+	// Matched as notifications are, under the lock pattern subscriptions take
+	PatternMatches matches;
+	pattern_matches_begin(record->key, &matches);
+	int subscribed = pattern_matches_find(&matches, client->notifications);
+	pattern_matches_end(&matches);
+	if (subscribed) return 1;
+	if (hash(record->key) < 0) return 0;
+
+	// A key deleted since the change is parked if the client subscribed again
+	KeyNode *keyNode = find_key_node(kvs_table, record->key);
+	if (keyNode == NULL) keyNode = find_pending_node(kvs_table, record->key);
+	return keyNode != NULL &&
+		   subscriber_set_find(&keyNode->subscribers, client->notifications) != NULL;
+}
+
+int kvs_resume(uint64_t after, struct Client *client, ChangeRecord records[], size_t *count,
+			   uint64_t *last) {
+	ChangeRecord changes[RESUME_MAX_RECORDS];
+	char keys[RESUME_MAX_RECORDS][MAX_STRING_SIZE];
+	size_t valueBytes = 0; // of the large values in the page
+	*count = 0;
+	*last = after;
+
+	while (*count < RESUME_MAX_RECORDS && valueBytes < RESUME_MAX_VALUE_BYTES) {
+		// No more changes than the page has room for, so the page covers
+		// every change read
+		size_t numChanges;
+		if (changelog_read(*last, changes, RESUME_MAX_RECORDS - *count,
+						   RESUME_MAX_VALUE_BYTES - valueBytes, &numChanges)) {
+			changelog_release(records, *count);
+			*count = 0;
+			*last = changelog_last_seq();
+			return 2;
+		}
+		if (numChanges == 0) return 0;
+
+		for (size_t i = 0; i < numChanges; i++) {
+			strcpy(keys[i], changes[i].key);
+		}
+		sort_keys(keys, numChanges, MAX_STRING_SIZE);
+		int indexList[TABLE_SIZE] = {0};
+		if (lock_read_list(numChanges, keys, indexList)) {
+			unlock_list(indexList);
+			changelog_release(changes, numChanges);
+			changelog_release(records, *count);
+			*count = 0;
+			return -1;
+		}
+		for (size_t i = 0; i < numChanges; i++) {
+			if (resume_matches(&changes[i], client)) {
+				if (changes[i].largeValue != NULL) valueBytes += changes[i].valueLength;
+				records[(*count)++] = changes[i];
+			} else {
+				changelog_release(&changes[i], 1);
+			}
+		}
+		if (unlock_list(indexList)) {
+			changelog_release(records, *count);
+			*count = 0;
+			return -1;
+		}
+		*last = changes[numChanges - 1].seq;
+	}
+	return *last < changelog_last_seq();
+}
+
 int add_client(struct Client *client) {
 	pthread_mutex_lock(&connectedClientsMutex);
-	for (int i = 0; i < MAX_SESSION_COUNT; i++) {
+	for (unsigned int i = 0; i < maxSessions; i++) {
 		if (connectedClients[i] == NULL) {
+			client->slot = i;
+			client->generation = ++sessionGeneration;
 			connectedClients[i] = client;
 			pthread_mutex_unlock(&connectedClientsMutex);
 			return 0;
@@ -436,140 +1086,340 @@ int add_client(struct Client *client) {
 	return 1;
 }
 
-int remove_client(int fdReqPipe, int fdRespPipe, int fdNotifPipe) {
+/// @brief Frees a client and what it holds, apart from its pipes or socket.
+/// @param client
+static void free_client(struct Client *client) {
+	if (client->rings != NULL && munmap(client->rings, sizeof(struct RingRegion))) {
+		fprintf(stderr, "Failed to unmap client rings\n");
+	}
+	if (client->fdRingWakeup >= 0) close(client->fdRingWakeup);
+	for (int i = 0; i < 2; i++) {
+		if (client->passedFds[i] >= 0) close(client->passedFds[i]);
+	}
+	notify_queue_close(client->notifications);
+	free(client->ringBuffer);
+	free(client->requestBuffer);
+	free(client->responseBuffer);
+	free(client->unsent.bytes);
+	free(client);
+}
+
+int remove_client(struct Client *client) {
 	pthread_mutex_lock(&connectedClientsMutex);
-	for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-		if (connectedClients[i] != NULL
-			&& connectedClients[i]->fdReq == fdReqPipe 
-			&& connectedClients[i]->fdResp == fdRespPipe
-			&& connectedClients[i]->fdNotif == fdNotifPipe) {
-
-			free(connectedClients[i]);
-			connectedClients[i] = NULL;
-			pthread_mutex_unlock(&connectedClientsMutex);
-			return 0;
-		}
+	if (client->slot < maxSessions && connectedClients[client->slot] == client) {
+		connectedClients[client->slot] = NULL;
+		pthread_mutex_unlock(&connectedClientsMutex);
+		free_client(client);
+		return 0;
 	}
 	pthread_mutex_unlock(&connectedClientsMutex);
 	fprintf(stderr, "Client not found in the list\n");
 	return 1;
 }
 
-int kvs_connect(char *req_pipe, char *resp_pipe, char *notif_pipe, struct Client **client) {
+struct Client *get_client(unsigned int slot, unsigned int generation) {
+	struct Client *client = NULL;
+	pthread_mutex_lock(&connectedClientsMutex);
+	if (slot < maxSessions && connectedClients[slot] != NULL &&
+		connectedClients[slot]->generation == generation) {
+		client = connectedClients[slot];
+	}
+	pthread_mutex_unlock(&connectedClientsMutex);
+	return client;
+}
 
-	int result = 0; // 0 if successful, 1 otherwise
+/// @brief Creates the session of a client whose fds are open and answers
+/// its connect request.
+/// @param fdReq fd the requests are read from.
+/// @param fdResp fd the responses are written to.
+/// @param fdNotif fd the notifications are written to.
+/// @param isSocket Whether the three fds are the same session socket.
+/// @param client Set to the new client on success, NULL otherwise.
+/// @return 0 on success, -1 if the client was not allocated, 1 for other
+/// errors, in which case the fds are closed
+static int create_client(int fdReq, int fdResp, int fdNotif, int isSocket, int version,
+						 struct Client **client) {
+	int result = 0;
+	struct Client *newClient = malloc(sizeof(struct Client));
+	if (newClient == NULL) {
+		fprintf(stderr, "Failed to allocate memory for client\n");
+		result = -1;
+	} else {
+		newClient->fdReq = fdReq;
+		newClient->fdResp = fdResp;
+		newClient->fdNotif = fdNotif;
+		newClient->isSocket = isSocket;
+		newClient->protocol = PROTOCOL_FIXED;
+		memset(newClient->subscriptions, 0, sizeof(newClient->subscriptions));
+		atomic_init(&newClient->subscribedBuckets, 0);
+		newClient->patterns = NULL;
+		newClient->requestLength = 0;
+		newClient->requestCapacity = REQUEST_BUFFER_SIZE;
+		newClient->requestBuffer = malloc(REQUEST_BUFFER_SIZE);
+		newClient->notifications = notify_queue_create(fdNotif, isSocket);
+		newClient->responseLength = 0;
+		newClient->responseCapacity = 0;
+		newClient->responseBuffer = NULL;
+		memset(&newClient->unsent, 0, sizeof(newClient->unsent));
+		newClient->outputWatched = 0;
+		newClient->closing = 0;
+		newClient->passedFds[0] = newClient->passedFds[1] = -1;
+		newClient->rings = NULL;
+		newClient->fdRingWakeup = -1;
+		newClient->ringLength = 0;
+		newClient->ringBuffer = NULL;
+
+		if (newClient->requestBuffer == NULL || newClient->notifications == NULL) {
+			fprintf(stderr, "Failed to allocate memory for client\n");
+			if (newClient->notifications != NULL) notify_queue_close(newClient->notifications);
+			free(newClient->requestBuffer);
+			free(newClient);
+			result = -1;
+		} else if (add_client(newClient)) {
+			fprintf(stderr, "Failed to add client to list\n");
+			notify_queue_close(newClient->notifications);
+			free(newClient->requestBuffer);
+			free(newClient);
+			result = 1;
+		}
+	}
 
-	int fdNotifPipe = open(notif_pipe, O_WRONLY);
+	if (version == 0) {
+		write_to_resp_pipe(fdResp, isSocket, OP_CODE_CONNECT, result ? '1' : '0');
+	} else {
+		const char response[CONNECT_COMPACT_RESPONSE_SIZE] = {
+			OP_CODE_CONNECT_COMPACT, result ? '1' : '0',
+			(char) (result ? PROTOCOL_FIXED : kvs_set_protocol(newClient, version))};
+		send_message(fdResp, isSocket, MESSAGE_RESPONSE, response, sizeof(response));
+	}
+	if (result) {
+		if (isSocket) {
+			if (close(fdReq) < 0) fprintf(stderr, "Failed to close socket\n");
+		} else if (close(fdReq) < 0 || close(fdResp) < 0 || close(fdNotif) < 0) {
+			fprintf(stderr, "Failed to close pipes\n");
+		}
+		return result;
+	}
+	*client = newClient;
+	return 0;
+}
+
+/// @brief Opens the write end of a client pipe. The client is given
+/// CONNECT_TIMEOUT_MS to open its end, so the host thread never waits for
+/// longer on a client that does not.
+/// @param path
+/// @return fd of the pipe, blocking, or -1 on error
+static int open_client_pipe(const char *path) {
+	for (unsigned int waited = 0;; waited++) {
+		int fd = open(path, O_WRONLY | O_NONBLOCK);
+		if (fd >= 0) {
+			if (fcntl(fd, F_SETFL, 0) == 0) return fd;
+			close(fd);
+			return -1;
+		}
+		if ((errno != ENXIO && errno != EINTR) || waited >= CONNECT_TIMEOUT_MS) return -1;
+		kvs_wait(1);
+	}
+}
+
+int kvs_connect(char *req_pipe, char *resp_pipe, char *notif_pipe, int version,
+				struct Client **client) {
+	*client = NULL;
+
+	// The client opens its pipes in this order, each open waiting for ours
+	int fdNotifPipe = open_client_pipe(notif_pipe);
 	if (fdNotifPipe < 0) {
 		fprintf(stderr, "Failed to open notifications pipe\n");
-		result = 1;
+		return 1;
 	}
 
-	int fdReqPipe = open(req_pipe, O_RDONLY);
+	// Does not wait for the writer. Until the client opens it, the pipe
+	// reports no event, so it is not mistaken for a closed one
+	int fdReqPipe = open(req_pipe, O_RDONLY | O_NONBLOCK);
 	if (fdReqPipe < 0) {
 		fprintf(stderr, "Failed to open requests pipe\n");
-		result = 1;
+		close(fdNotifPipe);
+		return 1;
 	}
 
-	int fdRespPipe = open(resp_pipe, O_WRONLY);
+	int fdRespPipe = open_client_pipe(resp_pipe);
 	if (fdRespPipe < 0) {
 		fprintf(stderr, "Failed to open responses pipe\n");
+		close(fdNotifPipe);
+		close(fdReqPipe);
 		return 1;
 	}
 
-	*client = malloc(sizeof(struct Client)); // if an error occurs here, no disconnect is needed
+	return create_client(fdReqPipe, fdRespPipe, fdNotifPipe, 0, version, client);
+}
+
+int kvs_connect_socket(int fdSocket, struct Client **client) {
+	*client = NULL;
+	return create_client(fdSocket, fdSocket, fdSocket, 1, 0, client);
+}
+
+int kvs_set_protocol(struct Client *client, int version) {
+	// Only before the first subscription, so the notifications of a session
+	// and the pattern trie's count of compact subscribers never mix layouts
+	if (version > client->protocol && client->patterns == NULL &&
+		atomic_load(&client->subscribedBuckets) == 0) {
+		client->protocol = version < PROTOCOL_TRUNCATION_FLAGS ? version : PROTOCOL_TRUNCATION_FLAGS;
+		notify_queue_set_protocol(client->notifications, client->protocol);
+	}
+	return client->protocol;
+}
+
+int kvs_open_local(NotifyCallback callback, void *context, struct Client **client) {
+	*client = calloc(1, sizeof(struct Client));
 	if (*client == NULL) {
-		if(close(fdReqPipe) < 0 || close(fdRespPipe) < 0 || close(fdNotifPipe) < 0){
-			fprintf(stderr, "Failed to close pipes\n");
-		}
 		fprintf(stderr, "Failed to allocate memory for client\n");
-		result = -1;
+		return 1;
+	}
+	(*client)->fdReq = (*client)->fdResp = (*client)->fdNotif = -1;
+	(*client)->passedFds[0] = (*client)->passedFds[1] = -1;
+	(*client)->fdRingWakeup = -1;
+	(*client)->protocol = PROTOCOL_FIXED;
+	(*client)->notifications = notify_queue_create_local(callback, context);
+	if ((*client)->notifications == NULL) {
+		free(*client);
+		*client = NULL;
+		return 1;
 	}
-	else {
-		(*client)->fdReq = fdReqPipe;
-		(*client)->fdResp = fdRespPipe;
-		(*client)->fdNotif = fdNotifPipe;
-		(*client)->subscriptions = NULL;
+	return 0;
+}
 
-		if (add_client(*client)) {
-			fprintf(stderr, "Failed to add client to list\n");
-			result = 1;
+/// @brief Closes the pipes, or the socket, of a client. The requests pipe
+/// of a disconnected client is already closed.
+/// @param client
+/// @return 0 on success, 1 if some fd failed to close
+static int close_client_fds(struct Client *client) {
+	if (client->isSocket) {
+		if (close(client->fdReq) < 0) {
+			fprintf(stderr, "Failed to close session socket.\n");
+			return 1;
 		}
+		return 0;
 	}
-	
-	char result_char = result ? '1' : '0';
 
-	write_to_resp_pipe((*client)->fdResp, OP_CODE_CONNECT, result_char);
-	return result;
+	int error = 0;
+	if (client->fdReq >= 0 && close(client->fdReq) < 0) {
+		fprintf(stderr, "Failed to close requests pipe.\n");
+		error = 1;
+	}
+
+	if (close(client->fdNotif) < 0) {
+		fprintf(stderr, "Failed to close notifications pipe.\n");
+		error = 1;
+	}
+
+	if (close(client->fdResp) < 0) {
+		fprintf(stderr, "Failed to close responses pipe.\n");
+		error = 1;
+	}
+	return error;
 }
 
-void kvs_disconnect(struct Client **client) {
+/// @brief Removes every subscription of a client. Key subscriptions are
+/// reached through the client's lists, locking each bucket once.
+/// @param client
+static void drop_subscriptions(struct Client *client) {
+	unsigned int buckets = atomic_exchange(&client->subscribedBuckets, 0);
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		if (!(buckets & (1u << i))) continue;
+		if (pthread_rwlock_wrlock(&kvs_table->bucketLocks[i])) {
+			fprintf(stderr, "Failed to lock bucket %d\n", i);
+			continue;
+		}
+		while (client->subscriptions[i] != NULL) {
+			cancel_subscription(kvs_table, client->subscriptions[i]);
+		}
+		if (pthread_rwlock_unlock(&kvs_table->bucketLocks[i])) {
+			fprintf(stderr, "Failed to unlock bucket %d\n", i);
+		}
+	}
 
-	// Unsubscribe all keys
-	SubscriptionsKeyNode *current = (*client)->subscriptions;
+	SubscriptionsKeyNode *current = client->patterns;
 	while (current != NULL) {
-		kvs_aux_unsubscribe(current->key, client);
+		pattern_unsubscribe(current->key, client->notifications);
 		SubscriptionsKeyNode *next = current->next;
 		free(current->key);
 		free(current);
 		current = next;
 	}
-	(*client)->subscriptions = NULL;
+	client->patterns = NULL;
+}
 
-	char result = '0';
-	if (close((*client)->fdReq) < 0) {
-		fprintf(stderr, "kvs_disconnect: Failed to close requests pipe.\n");
-		result = '1';
-	}
+void kvs_disconnect(struct Client **client) {
+	drop_subscriptions(*client);
 
-	if (close((*client)->fdNotif) < 0) {
-		fprintf(stderr, "kvs_disconnect: Failed to close from notifications pipe.\n");
-		result = '1';
+	char result = '0';
+	// The socket is also the way the answer goes out
+	if (!(*client)->isSocket && (*client)->fdReq >= 0) {
+		if (close((*client)->fdReq) < 0) {
+			fprintf(stderr, "kvs_disconnect: Failed to close requests pipe.\n");
+			result = '1';
+		}
+		(*client)->fdReq = -1;
 	}
 
-	if(write_to_resp_pipe((*client)->fdResp, OP_CODE_DISCONNECT, result) == 1) {
+	// Answer before closing the notifications pipe, whose end of file makes
+	// the client tear down its pipes
+	if (!(*client)->closing && send_result(*client, OP_CODE_DISCONNECT, result) == 1) {
 		fprintf(stderr, "kvs_disconnect: Failed to write disconnect response to responses pipe\n");
 	}
 
-	if (close((*client)->fdResp) < 0) {
-		fprintf(stderr, "kvs_disconnect: Failed to close responses pipe.\n");
+	// A client that does not read keeps its session until it took the rest
+	if (output_pending(&(*client)->unsent)) {
+		(*client)->closing = 1;
+		return;
 	}
+	kvs_finish_disconnect(*client);
+	*client = NULL;
+}
 
-	if (remove_client((*client)->fdReq, (*client)->fdResp, (*client)->fdNotif)) {
+void kvs_finish_disconnect(struct Client *client) {
+	close_client_fds(client);
+	if (remove_client(client)) {
 		fprintf(stderr, "kvs_disconnect: Failed to remove client from the list\n");
 	}
 }
 
 
-int clean_all_clients() {
-	pthread_mutex_lock(&connectedClientsMutex);
-	for (int i = 0; i < MAX_SESSION_COUNT; i++) {
+/// @brief Ends a session without answering it, so the client only sees its
+/// pipes or socket close. Called with connectedClientsMutex held.
+/// @param slot Slot of the session.
+static void drop_client(unsigned int slot) {
+	drop_subscriptions(connectedClients[slot]);
 
-		if (connectedClients[i] == NULL) continue;
-		SubscriptionsKeyNode *current = connectedClients[i]->subscriptions;
-		while (current != NULL) {
-			kvs_aux_unsubscribe(current->key, &connectedClients[i]);
-			SubscriptionsKeyNode *next = current->next;
-			free(current->key);
-			free(current);
-			current = next;
-		}
-		connectedClients[i]->subscriptions = NULL;
+	close_client_fds(connectedClients[slot]);
 
-		if (close(connectedClients[i]->fdReq) < 0) {
-			fprintf(stderr, "Failed to close requests pipe.\n");
-		}
+	free_client(connectedClients[slot]);
+	connectedClients[slot] = NULL;
+}
 
-		if (close(connectedClients[i]->fdNotif) < 0) {
-			fprintf(stderr, "Failed to close notifications pipe.\n");
-		}
+void kvs_close_local(struct Client *client) {
+	drop_subscriptions(client);
+	free_client(client);
+}
 
-		if (close(connectedClients[i]->fdResp) < 0) {
-			fprintf(stderr, "Failed to close responses pipe.\n");
-		}
+int clean_all_clients() {
+	pthread_mutex_lock(&connectedClientsMutex);
+	for (unsigned int i = 0; i < maxSessions; i++) {
+		if (connectedClients[i] != NULL) drop_client(i);
+	}
+	pthread_mutex_unlock(&connectedClientsMutex);
+	return 0;
+}
 
-		free(connectedClients[i]);
-		connectedClients[i] = NULL;
+int disconnect_overflowed_clients() {
+	pthread_mutex_lock(&connectedClientsMutex);
+	for (unsigned int i = 0; i < maxSessions; i++) {
+		NotifyQueueStats stats;
+		if (connectedClients[i] != NULL &&
+			notify_queue_stats(connectedClients[i]->notifications, &stats)) {
+			fprintf(stderr, "Client fell too far behind on notifications and was disconnected.\n");
+			drop_client(i);
+		}
 	}
 	pthread_mutex_unlock(&connectedClientsMutex);
 	return 0;
@@ -2,7 +2,9 @@
 #define KVS_OPERATIONS_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "src/common/constants.h"
+#include "changelog.h"
 #include "client.h"
 
 
@@ -16,11 +18,18 @@ int kvs_init();
 int kvs_terminate();
 
 /// Writes a key value pair to the KVS. If key already exists it is updated.
+/// When compiled with FLAT_COMBINING the pairs are applied by flat combining:
+/// the writes to each bucket are atomic, but the batch is not atomic across
+/// buckets.
 /// @param num_pairs Number of pairs being written.
 /// @param keys Array of keys' strings.
-/// @param values Array of values' strings.
+/// @param values Array of values, which may hold '\0' bytes. Copied.
+/// @param valueLengths Number of bytes in each value.
+/// @param ttl_ms Milliseconds until the pairs expire, 0 for never. A write
+/// replaces the TTL the key had.
 /// @return 0 if the pairs were written successfully, 1 otherwise.
-int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE]);
+int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], const char *values[],
+			  const size_t valueLengths[], unsigned int ttl_ms);
 
 /// Reads values from the KVS.
 /// @param num_pairs Number of pairs to read.
@@ -35,19 +44,102 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut);
 /// @return 0 if the pairs were deleted successfully, 1 otherwise.
 int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int fdOut);
 
+/// Reads values from the KVS into memory.
+/// @param num_keys Number of keys to read.
+/// @param keys Array of keys' strings.
+/// @param values Output array; values[i] is set to a null terminated copy
+/// of the value of keys[i] that the caller must free, or NULL if the key
+/// does not exist.
+/// @param valueLengths Output array; valueLengths[i] is set to the number
+/// of bytes in values[i].
+/// @return 0 if the keys were read, 1 otherwise.
+int kvs_get(size_t num_keys, char keys[][MAX_STRING_SIZE], char *values[],
+			size_t valueLengths[]);
+
+/// Deletes key value pairs from the KVS, reporting each key's outcome.
+/// @param num_keys Number of keys to delete.
+/// @param keys Array of keys' strings.
+/// @param deleted Output array; deleted[i] is set to 1 if keys[i] was
+/// deleted, 0 if it did not exist.
+/// @return 0 if the keys were processed, 1 otherwise.
+int kvs_del(size_t num_keys, char keys[][MAX_STRING_SIZE], int deleted[]);
+
+/// Sets the TTL of existing keys, writing the missing ones to the output.
+/// @param num_keys Number of keys.
+/// @param keys Array of keys' strings.
+/// @param ttl_ms Milliseconds until the keys expire, 0 for never.
+/// @param fdOut File descriptor to write the output.
+/// @return 0 if the keys were processed, 1 otherwise.
+int kvs_expire(size_t num_keys, char keys[][MAX_STRING_SIZE], unsigned int ttl_ms, int fdOut);
+
+/// Sets the TTL of existing keys, reporting each key's outcome.
+/// @param num_keys Number of keys.
+/// @param keys Array of keys' strings.
+/// @param ttl_ms Milliseconds until the keys expire, 0 for never.
+/// @param found Output array; found[i] is set to 1 if keys[i] exists, 0
+/// otherwise.
+/// @return 0 if the keys were processed, 1 otherwise.
+int kvs_expire_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], unsigned int ttl_ms,
+					 int found[]);
+
+/// Deletes keys of a bucket whose TTL ran out, holding the bucket lock for
+/// at most max of them.
+/// @param index Bucket to expire.
+/// @param now Current time, from timers_now.
+/// @param max Most keys to delete.
+/// @return number of keys deleted, max if more may be due
+size_t kvs_expire_due(int index, uint64_t now, size_t max);
+
 /// Writes the state of the KVS.
 /// @param fd File descriptor to write the output.
 int kvs_show(int fdOut);
 
+/// Writes the KVS statistics, such as the false positive rate of the
+/// bucket filters and the notifications queue of each session.
+/// @param fdOut File descriptor to write the output.
+/// @return 0 if successful, 1 otherwise.
+int kvs_stats(int fdOut);
+
 /// Creates a backup of the KVS state and stores it in the correspondent
-/// backup file
+/// backup file. Runs in the forked backup process, without locks.
 /// @return 0 if the backup was successful, 1 otherwise.
 int kvs_backup(int fdBck);
 
+/// Writes the pairs in the format of the backup files, keeping the writers
+/// out until they are all written.
+/// @param fdOut File descriptor to write the pairs to. Left open.
+/// @return 0 if the pairs were written, 1 otherwise.
+int kvs_snapshot(int fdOut);
+
+/// Visits a pair found by kvs_scan.
+/// @param key
+/// @param value Null terminated, but it may hold '\0' bytes.
+/// @param valueLength Bytes in the value.
+/// @param context As given to kvs_scan.
+typedef void (*KvsVisitor)(const char *key, const char *value, size_t valueLength,
+						   void *context);
+
+/// Visits the pairs whose keys start with a prefix, one bucket at a time.
+/// Each bucket is copied under its lock and visited without it, so a pair
+/// written during the scan may or may not be seen.
+/// @param prefix Prefix of the keys, "" for every key.
+/// @param visit Called for each pair.
+/// @param context Passed to visit.
+/// @return 0 if the pairs were visited, 1 otherwise.
+int kvs_scan(const char *prefix, KvsVisitor visit, void *context);
+
 /// Waits for a given amount of time.
 /// @param delay_us Delay in milliseconds.
 void kvs_wait(unsigned int delay_ms);
 
+/// @brief Sends a response to a client without waiting for it to read. What
+/// the client does not take yet is buffered and sent once it reads again.
+/// @param client
+/// @param message
+/// @param size Size of the message.
+/// @return 0 on success, 1 on error
+int send_to_client(struct Client *client, const void *message, size_t size);
+
 /// @brief subscribes a client to a key
 /// @param key 
 /// @param client 
@@ -55,26 +147,43 @@ void kvs_wait(unsigned int delay_ms);
 /// -1 if an error occurred
 int kvs_subscribe(const char *key, struct Client **client);
 
-/// @brief removes a client from the connectedClients list
-/// @param fdReqPipe 
-/// @param fdRespPipe 
-/// @param fdNotifPipe 
-/// @return 0 if the client was removed successfully, 1 otherwise.
-int remove_client(int fdReqPipe, int fdRespPipe, int fdNotifPipe);
-
-/// @brief subscribes a client to a key
+/// @brief subscribes a client to a key, or to every key with a prefix when
+/// the key ends with PATTERN_WILDCARD. A missing key is watched until it is
+/// written, and answered with RESULT_KEY_PARKED.
 /// @param key 
 /// @param client 
 /// @return 0 success, -1 otherwise
 int kvs_subscribe(const char *key, struct Client **client);
 
+/// Subscribes a client to several keys or patterns, locking the bucket of
+/// the keys once for the whole batch.
+/// @param num_keys Number of keys.
+/// @param keys Keys or patterns to subscribe.
+/// @param client
+/// @param subscribed Set to 1 for each key that exists or pattern, 0 if the
+/// subscription waits for the key to be written, -1 if the key could not be
+/// subscribed.
+/// @return 0 if successful, 1 otherwise.
+int kvs_subscribe_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], struct Client *client,
+						int subscribed[]);
+
+/// Unsubscribes a client from several keys or patterns, locking the bucket
+/// of the keys once for the whole batch.
+/// @param num_keys Number of keys.
+/// @param keys Keys or patterns to unsubscribe.
+/// @param client
+/// @param removed Set to 1 for each subscription removed, 0 if it did not exist.
+/// @return 0 if successful, 1 otherwise.
+int kvs_unsubscribe_batch(size_t num_keys, char keys[][MAX_STRING_SIZE], struct Client *client,
+						  int removed[]);
+
 /// @brief unsubscribes a client from a key
 /// @param key 
 /// @param client 
 /// @return 0 if deletec successfully, 1 subscription not found
 int kvs_aux_unsubscribe(const char *key, struct Client **client) ;
 
-/// @brief removes a subscription from the subscription list of a client    
+/// @brief removes a pattern from the pattern subscriptions of a client
 /// @param key 
 /// @param client 
 void client_remove_subscription(const char *key, struct Client **client);
@@ -85,40 +194,100 @@ void client_remove_subscription(const char *key, struct Client **client);
 /// @return 0 if the client was successfully unsubscribed, 1 otherwise.
 int kvs_unsubscribe(const char *key, struct Client **client);
 
-// Connects to the client.
+/// Collects the changes a client missed after a sequence number, to the
+/// keys and patterns it is subscribed to now.
+/// @param after Sequence number of the last change the client saw.
+/// @param client
+/// @param records Where to store the changes, at least RESUME_MAX_RECORDS.
+/// Their large values, at most about RESUME_MAX_VALUE_BYTES, must be freed
+/// with changelog_release.
+/// @param count Set to the number of changes stored.
+/// @param last Set to the last change looked at, which the next call starts
+/// after. When changes were evicted, set to the last change committed.
+/// @return 0 if every change was looked at, 1 if more remain, 2 if changes
+/// after `after` were evicted, -1 if an error occurred, in which case no
+/// changes are stored
+int kvs_resume(uint64_t after, struct Client *client, ChangeRecord records[], size_t *count,
+			   uint64_t *last);
+
+/// Initializes the list of connected clients.
+/// @param max_sessions Maximum number of concurrent client sessions.
+/// @return 0 if successful, 1 otherwise.
+int kvs_init_sessions(unsigned int max_sessions);
+
+/// Connects to the client, opening its pipes and answering the connect
+/// request.
 /// @param req_pipe Path to the request pipe.
 /// @param resp_pipe Path to the response pipe.
 /// @param notif_pipe Path to the notification pipe.
-/// @param client Pointer to the client struct.
+/// @param version Protocol version a CONNECT_COMPACT message asked for, 0
+/// for a CONNECT message.
+/// @param client Set to the new client on success, NULL otherwise.
 /// @return 0 if the connection was successful, -1 if the client was not allocated, 1 for other errors.
-int kvs_connect(char *req_pipe, char *resp_pipe, char *notif_pipe, struct Client **client);
+int kvs_connect(char *req_pipe, char *resp_pipe, char *notif_pipe, int version,
+				struct Client **client);
+
+/// Creates the session of a client connected to the server socket and
+/// answers it.
+/// @param fdSocket The accepted session socket.
+/// @param client Set to the new client on success, NULL otherwise.
+/// @return 0 if the connection was successful, -1 if the client was not allocated, 1 for other errors.
+int kvs_connect_socket(int fdSocket, struct Client **client);
+
+/// Switches a session to the highest protocol version the server knows up
+/// to the one asked. A session that already subscribed keeps its version.
+/// @param client
+/// @param version Version the client asked for.
+/// @return the version the session uses
+int kvs_set_protocol(struct Client *client, int version);
+
+/// Creates an in-process session, whose notifications are passed to a
+/// callback. It has no pipes and is not in the connected clients list.
+/// @param callback Called on a notifier thread for each notification.
+/// @param context Passed to the callback.
+/// @param client Set to the new session on success, NULL otherwise.
+/// @return 0 if successful, 1 otherwise.
+int kvs_open_local(NotifyCallback callback, void *context, struct Client **client);
 
-/// @brief adds a client to the connectedClients list
+/// Ends an in-process session, dropping its subscriptions. Waits for a
+/// callback that is running to return.
+/// @param client
+void kvs_close_local(struct Client *client);
+
+/// @brief adds a client to the connectedClients list, assigning its slot
+/// and generation
 /// @param client 
-/// @return 0 success, 1 otherwise
+/// @return 0 success, 1 if the list is full
 int add_client(struct Client *client);
 
-/// @brief removes a client from the connectedClients list
-/// @param fdReqPipe 
-/// @param fdRespPipe 
-/// @param fdNotifPipe 
+/// @brief removes a client from the connectedClients list and frees it
+/// @param client 
 /// @return 0 success, 1 otherwise
-int remove_client(int fdReqPipe, int fdRespPipe, int fdNotifPipe);
+int remove_client(struct Client *client);
 
-/// @brief 
-/// @param req_pipe 
-/// @param resp_pipe 
-/// @param notif_pipe 
-/// @param client 
-/// @return 0 success, -1 error happen pipes closed, 1 error happen and disconnect still needed
-int kvs_connect(char *req_pipe, char *resp_pipe, char *notif_pipe, struct Client **client);
+/// @brief gets a connected client by its slot, if it is still the same session
+/// @param slot Slot of the client in the connectedClients list.
+/// @param generation Generation of the session.
+/// @return the client, or NULL if the session is gone
+struct Client *get_client(unsigned int slot, unsigned int generation);
 
 /// @brief disconnects a client from the server
-/// @param client 
+/// @param client Set to NULL once the client is removed. It is left set if
+/// the client did not take its last responses yet, so they are sent first.
 void kvs_disconnect(struct Client **client);
 
+/// @brief Ends the session of a disconnected client that took its last
+/// responses, closing its fds.
+/// @param client
+void kvs_finish_disconnect(struct Client *client);
+
 /// @brief called after a SIGUSR1 signal is received. Disconnects all clients
 /// @return 0
 int clean_all_clients();
 
+/// @brief Disconnects the clients whose notifications queue overflowed.
+/// Must not run while the reactors serve clients.
+/// @return 0
+int disconnect_overflowed_clients();
+
 #endif  // KVS_OPERATIONS_H
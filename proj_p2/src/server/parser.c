@@ -7,6 +7,7 @@
 
 #include "constants.h"
 #include "io.h"
+#include "src/common/constants.h"
 
 /// Reads a string and indicates the position from where it was
 /// extracted, based on the KVS specification.
@@ -85,6 +86,49 @@ static int read_uint(int fd, unsigned int *value, char *next) {
 	return 0;
 }
 
+/// Reads a value up to the ')' that ends its pair, into a buffer that grows
+/// with it.
+/// @param fd File to read from.
+/// @param value Set to the null terminated value, which the caller must free.
+/// @param length Set to the length of the value.
+/// @return 1 if successful, 0 otherwise.
+static int read_value(int fd, char **value, size_t *length) {
+	size_t capacity = MAX_STRING_SIZE;
+	char *buffer = malloc(capacity);
+	if (buffer == NULL) return 0;
+
+	size_t i = 0;
+	while (1) {
+		char ch;
+		if (read(fd, &ch, 1) != 1 || ch == ' ' || ch == ',' || ch == ']') {
+			free(buffer);
+			return 0;
+		}
+		if (ch == ')') break;
+
+		if (i + 1 == capacity) {
+			if (capacity > MAX_VALUE_SIZE) {
+				free(buffer);
+				return 0;
+			}
+			size_t grown = 2 * capacity > MAX_VALUE_SIZE + 1 ? MAX_VALUE_SIZE + 1 : 2 * capacity;
+			char *bigger = realloc(buffer, grown);
+			if (bigger == NULL) {
+				free(buffer);
+				return 0;
+			}
+			buffer = bigger;
+			capacity = grown;
+		}
+		buffer[i++] = ch;
+	}
+
+	buffer[i] = '\0';
+	*value = buffer;
+	*length = i;
+	return 1;
+}
+
 // Jumps file descriptor to next line.
 // @param fd File descriptor.
 static void cleanup(int fd) {
@@ -126,8 +170,35 @@ enum Command get_next(int fd) {
 
 			return CMD_DELETE;
 
+		case 'E':
+			if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "EXPIRE ", 7) != 0) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			return CMD_EXPIRE;
+
 		case 'S':
-			if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "SHOW", 4) != 0) {
+			if (read(fd, buf + 1, 3) != 3) {
+				cleanup(fd);
+				return CMD_INVALID;
+			}
+
+			if (strncmp(buf, "STAT", 4) == 0) {
+				if (read(fd, buf + 4, 1) != 1 || buf[4] != 'S') {
+					cleanup(fd);
+					return CMD_INVALID;
+				}
+
+				if (read(fd, buf + 5, 1) != 0 && buf[5] != '\n') {
+					cleanup(fd);
+					return CMD_INVALID;
+				}
+
+				return CMD_STATS;
+			}
+
+			if (strncmp(buf, "SHOW", 4) != 0) {
 				cleanup(fd);
 				return CMD_INVALID;
 			}
@@ -181,15 +252,16 @@ enum Command get_next(int fd) {
 // Parses a key value pair.
 // @param fd File decriptor to read from.
 // @param key Pointer where the key will be stored
-// @param value Pointer where the value will be stored
+// @param value Set to the value, allocated for it
+// @param length Set to the length of the value
 // @return 1 if successful, 0 otherwise.
-int parse_pair(int fd, char *key, char *value) {
+int parse_pair(int fd, char *key, char **value, size_t *length) {
 	if (read_string(fd, key, MAX_STRING_SIZE) != 0) {
 		cleanup(fd);
 		return 0;
 	}
 
-	if (read_string(fd, value, MAX_STRING_SIZE) != 1) {
+	if (!read_value(fd, value, length)) {
 		cleanup(fd);
 		return 0;
 	}
@@ -197,9 +269,21 @@ int parse_pair(int fd, char *key, char *value) {
 	return 1;
 }
 
-size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], size_t max_pairs,
-				   size_t max_string_size) {
+/// Frees the values parse_write read before it failed.
+/// @param values
+/// @param num_values
+/// @return 0, the number of pairs of a failed parse.
+static size_t free_values(char *values[], size_t num_values) {
+	for (size_t i = 0; i < num_values; i++) {
+		free(values[i]);
+	}
+	return 0;
+}
+
+size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char *values[], size_t valueLengths[],
+				   size_t max_pairs, size_t max_string_size, unsigned int *ttl_ms) {
 	char ch;
+	*ttl_ms = 0;
 
 	if (read(fd, &ch, 1) != 1 || ch != '[') {
 		cleanup(fd);
@@ -213,19 +297,17 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRIN
 
 	size_t num_pairs = 0;
 	char key[max_string_size];
-	char value[max_string_size];
 	while (num_pairs < max_pairs) {
-		if (parse_pair(fd, key, value) == 0) {
+		if (parse_pair(fd, key, &values[num_pairs], &valueLengths[num_pairs]) == 0) {
 			cleanup(fd);
-			return 0;
+			return free_values(values, num_pairs);
 		}
 
-		strcpy(keys[num_pairs], key);
-		strcpy(values[num_pairs++], value);
+		strcpy(keys[num_pairs++], key);
 
 		if (read(fd, &ch, 1) != 1 || (ch != '(' && ch != ']')) {
 			cleanup(fd);
-			return 0;
+			return free_values(values, num_pairs);
 		}
 
 		if (ch == ']') {
@@ -235,18 +317,37 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRIN
 
 	if (num_pairs == max_pairs) {
 		cleanup(fd);
-		return 0;
+		return free_values(values, num_pairs);
 	}
 
-	if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+	if (read(fd, &ch, 1) != 1) {
 		cleanup(fd);
-		return 0;
+		return free_values(values, num_pairs);
+	}
+
+	// The pairs may be given a TTL
+	if (ch == ' ' && read_uint(fd, ttl_ms, &ch) != 0) {
+		cleanup(fd);
+		return free_values(values, num_pairs);
+	}
+
+	if (ch != '\n' && ch != '\0') {
+		cleanup(fd);
+		return free_values(values, num_pairs);
 	}
 
 	return num_pairs;
 }
 
-size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size) {
+/// Parses a list of keys, up to the ']' that ends it.
+/// @param fd File descriptor to read from.
+/// @param keys Array to store the keys
+/// @param max_keys Maximum number of keys it will read.
+/// @param max_string_size Maximum string size allowed.
+/// @return 0 if the list was not parsed successfully, otherwise the number
+/// of keys parsed
+static size_t parse_keys(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
+						 size_t max_string_size) {
 	char ch;
 
 	if (read(fd, &ch, 1) != 1 || ch != '[') {
@@ -275,6 +376,17 @@ size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
 		return 0;
 	}
 
+	return num_keys;
+}
+
+size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size) {
+	char ch;
+
+	size_t num_keys = parse_keys(fd, keys, max_keys, max_string_size);
+	if (num_keys == 0) {
+		return 0;
+	}
+
 	if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
 		cleanup(fd);
 		return 0;
@@ -283,6 +395,28 @@ size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
 	return num_keys;
 }
 
+size_t parse_expire(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size,
+					unsigned int *ttl_ms) {
+	char ch;
+
+	size_t num_keys = parse_keys(fd, keys, max_keys, max_string_size);
+	if (num_keys == 0) {
+		return 0;
+	}
+
+	if (read(fd, &ch, 1) != 1 || ch != ' ') {
+		cleanup(fd);
+		return 0;
+	}
+
+	if (read_uint(fd, ttl_ms, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+		cleanup(fd);
+		return 0;
+	}
+
+	return num_keys;
+}
+
 int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
 	char ch;
 
@@ -8,7 +8,9 @@ enum Command {
 	CMD_WRITE,
 	CMD_READ,
 	CMD_DELETE,
+	CMD_EXPIRE,
 	CMD_SHOW,
+	CMD_STATS,
 	CMD_WAIT,
 	CMD_BACKUP,
 	CMD_HELP,
@@ -23,16 +25,21 @@ enum Command {
 // @return enum Command Command code.
 enum Command get_next(int fd);
 
-/// Parses a WRITE command.
+/// Parses a WRITE command. Values may take up to MAX_VALUE_SIZE bytes, and
+/// the pairs may be followed by the milliseconds until they expire.
 /// @param fd File descriptor to read from.
 /// @param keys Array to store the keys
-/// @param values Array to store the values
+/// @param values Array to store the values, each allocated for the pair and
+/// to be freed by the caller.
+/// @param valueLengths Array to store the length of each value.
 /// @param max_pairs Maximum number of pairs it will write.
-/// @param max_string_size Maximum string size allowed.
+/// @param max_string_size Maximum key size allowed.
+/// @param ttl_ms Set to the milliseconds until the pairs expire, 0 if the
+/// command has none.
 /// @return 0 if the command was not parsed successfully, otherwise return the
 //          of pairs parsed.
-size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], size_t max_pairs,
-				   size_t max_string_size);
+size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char *values[], size_t valueLengths[],
+				   size_t max_pairs, size_t max_string_size, unsigned int *ttl_ms);
 
 // Parses a READ or a DELETE command.
 // @param fd File descriptor to read from.
@@ -43,6 +50,18 @@ size_t parse_write(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRIN
 //          of keys parsed
 size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size);
 
+/// Parses an EXPIRE command: a list of keys, as READ takes, and the
+/// milliseconds until they expire.
+/// @param fd File descriptor to read from.
+/// @param keys Array to store the keys
+/// @param max_keys Maximum number of keys it will read.
+/// @param max_string_size Maximum string size allowed.
+/// @param ttl_ms Set to the milliseconds until the keys expire, 0 for never.
+/// @return 0 if the command was not parsed successfully, otherwise the
+/// number of keys parsed
+size_t parse_expire(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size,
+					unsigned int *ttl_ms);
+
 /// Parses a WAIT command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
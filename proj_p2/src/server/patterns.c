@@ -0,0 +1,197 @@
+#include "patterns.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Node of the subscription trie, reached from the root by the characters
+/// of its prefix. Children are a list, so finding one costs at most the
+/// number of distinct characters that follow the prefix.
+typedef struct PatternNode {
+	char label; // last character of the prefix
+	struct PatternNode *children;
+	struct PatternNode *sibling;
+	SubscriberSet subscribers;
+	size_t pipeSubscribers;
+	size_t compactPipeSubscribers; // of which take the compact layout
+} PatternNode;
+
+// Writers read lock the trie while they notify, subscribing write locks it
+static pthread_rwlock_t trieLock = PTHREAD_RWLOCK_INITIALIZER;
+static PatternNode root = {0};
+// Lets writers skip the trie while no pattern is subscribed
+static atomic_size_t subscriptionCount = 0;
+
+int is_pattern(const char *key) {
+	size_t length = strlen(key);
+	return length > 0 && key[length - 1] == PATTERN_WILDCARD;
+}
+
+/// @brief Finds the child of a node that a character leads to.
+/// @param node
+/// @param label
+/// @return the child, NULL if there is none
+static PatternNode *find_child(const PatternNode *node, char label) {
+	PatternNode *child = node->children;
+	while (child != NULL && child->label != label) child = child->sibling;
+	return child;
+}
+
+int pattern_subscribe(const char *pattern, NotifyQueue *queue) {
+	size_t prefixLength = strlen(pattern) - 1;
+	int result = -1;
+	if (pthread_rwlock_wrlock(&trieLock)) {
+		fprintf(stderr, "Failed to lock the pattern trie\n");
+		return -1;
+	}
+
+	PatternNode *node = &root;
+	for (size_t i = 0; i < prefixLength; i++) {
+		PatternNode *child = find_child(node, pattern[i]);
+		if (child == NULL) {
+			child = calloc(1, sizeof(PatternNode));
+			if (child == NULL) {
+				fprintf(stderr, "Error: Allocating pattern node.\n");
+				goto unlock;
+			}
+			child->label = pattern[i];
+			child->sibling = node->children;
+			node->children = child;
+		}
+		node = child;
+	}
+
+	if (subscriber_set_find(&node->subscribers, queue) != NULL) {
+		result = 1;
+		goto unlock;
+	}
+
+	// Nodes created above without a subscriber are reused by the next
+	// subscription to the prefix
+	Subscription *subscription = malloc(sizeof(Subscription));
+	if (subscription == NULL) {
+		fprintf(stderr, "Error: Allocating pattern subscriber.\n");
+		goto unlock;
+	}
+	subscription->queue = queue;
+	subscription->keyNode = NULL;
+	subscription->next = NULL;
+	subscription->prevNext = NULL;
+	if (subscriber_set_add(&node->subscribers, subscription)) {
+		fprintf(stderr, "Error: Allocating pattern subscriber.\n");
+		free(subscription);
+		goto unlock;
+	}
+	if (!queue->isSocket) node->pipeSubscribers++;
+	if (!queue->isSocket && queue->compact) node->compactPipeSubscribers++;
+	atomic_fetch_add_explicit(&subscriptionCount, 1, memory_order_relaxed);
+	result = 0;
+
+unlock:
+	pthread_rwlock_unlock(&trieLock);
+	return result;
+}
+
+int pattern_unsubscribe(const char *pattern, NotifyQueue *queue) {
+	size_t prefixLength = strlen(pattern) - 1;
+	if (prefixLength > MAX_STRING_SIZE) return 1;
+
+	int result = 1;
+	if (pthread_rwlock_wrlock(&trieLock)) {
+		fprintf(stderr, "Failed to lock the pattern trie\n");
+		return 1;
+	}
+
+	PatternNode *path[MAX_STRING_SIZE + 1];
+	PatternNode *node = &root;
+	path[0] = node;
+	for (size_t i = 0; i < prefixLength && node != NULL; i++) {
+		node = find_child(node, pattern[i]);
+		path[i + 1] = node;
+	}
+	if (node == NULL) goto unlock;
+
+	Subscription *subscription = subscriber_set_find(&node->subscribers, queue);
+	if (subscription == NULL) goto unlock;
+
+	subscriber_set_remove(&node->subscribers, subscription);
+	if (!queue->isSocket) node->pipeSubscribers--;
+	if (!queue->isSocket && queue->compact) node->compactPipeSubscribers--;
+	free(subscription);
+	atomic_fetch_sub_explicit(&subscriptionCount, 1, memory_order_relaxed);
+	result = 0;
+
+	// Prunes the nodes left without subscribers nor children, bottom up
+	for (size_t depth = prefixLength; depth > 0; depth--) {
+		PatternNode *leaf = path[depth];
+		if (leaf->subscribers.count != 0 || leaf->children != NULL) break;
+
+		PatternNode **link = &path[depth - 1]->children;
+		while (*link != leaf) link = &(*link)->sibling;
+		*link = leaf->sibling;
+		free(leaf);
+	}
+
+unlock:
+	pthread_rwlock_unlock(&trieLock);
+	return result;
+}
+
+void pattern_matches_begin(const char *key, PatternMatches *matches) {
+	matches->locked = 0;
+	matches->count = 0;
+	matches->subscribers = 0;
+	matches->pipeSubscribers = 0;
+	matches->compactPipeSubscribers = 0;
+	if (atomic_load_explicit(&subscriptionCount, memory_order_relaxed) == 0) return;
+
+	if (pthread_rwlock_rdlock(&trieLock)) {
+		fprintf(stderr, "Failed to lock the pattern trie\n");
+		return;
+	}
+	matches->locked = 1;
+
+	// Every node on the way is a prefix of the key
+	const PatternNode *node = &root;
+	const size_t maxMatches = sizeof(matches->nodes) / sizeof(matches->nodes[0]);
+	for (size_t i = 0; node != NULL && matches->count < maxMatches; i++) {
+		if (node->subscribers.count != 0) {
+			matches->nodes[matches->count++] = (PatternNode *) node;
+			matches->subscribers += node->subscribers.count;
+			matches->pipeSubscribers += node->pipeSubscribers;
+			matches->compactPipeSubscribers += node->compactPipeSubscribers;
+		}
+		if (key[i] == '\0') break;
+		node = find_child(node, key[i]);
+	}
+}
+
+void pattern_matches_push(const PatternMatches *matches, Notification *notification) {
+	for (size_t i = 0; i < matches->count; i++) {
+		const SubscriberSet *subscribers = &matches->nodes[i]->subscribers;
+		for (size_t j = 0; j < subscribers->capacity; j++) {
+			if (subscribers->slots[j] != NULL) {
+				notify_queue_push(subscribers->slots[j]->queue, notification);
+			}
+		}
+	}
+}
+
+int pattern_matches_find(const PatternMatches *matches, const NotifyQueue *queue) {
+	for (size_t i = 0; i < matches->count; i++) {
+		if (subscriber_set_find(&matches->nodes[i]->subscribers, queue) != NULL) return 1;
+	}
+	return 0;
+}
+
+void pattern_matches_end(PatternMatches *matches) {
+	if (!matches->locked) return;
+	pthread_rwlock_unlock(&trieLock);
+	matches->locked = 0;
+}
+
+size_t pattern_subscription_count(void) {
+	return atomic_load_explicit(&subscriptionCount, memory_order_relaxed);
+}
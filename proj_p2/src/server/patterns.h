@@ -0,0 +1,71 @@
+#ifndef KVS_PATTERNS_H
+#define KVS_PATTERNS_H
+
+#include <stddef.h>
+
+#include "constants.h"
+#include "notifier.h"
+#include "subscriptions.h"
+
+/// Ends a pattern subscription: "user:42:*" covers every key starting with
+/// "user:42:", including keys written after subscribing.
+#define PATTERN_WILDCARD '*'
+
+struct PatternNode;
+
+/// Trie nodes whose prefix matched a key. While matches are held the trie
+/// is read locked, so their subscribers stay registered.
+typedef struct PatternMatches {
+	int locked;
+	size_t count;
+	size_t subscribers;     // over all the matched nodes
+	size_t pipeSubscribers; // of which get notifications on a pipe
+	size_t compactPipeSubscribers; // of those, in the compact layout
+	// One node per prefix length of the key, the empty prefix included
+	struct PatternNode *nodes[MAX_STRING_SIZE + 1];
+} PatternMatches;
+
+/// Tells whether a subscription key is a pattern.
+/// @param key
+/// @return 1 if the key ends with PATTERN_WILDCARD, 0 otherwise
+int is_pattern(const char *key);
+
+/// Subscribes a session to every key with the prefix of a pattern.
+/// @param pattern Prefix followed by PATTERN_WILDCARD.
+/// @param queue Notifications queue of the session.
+/// @return 0 if successful, 1 if already subscribed, -1 if error
+int pattern_subscribe(const char *pattern, NotifyQueue *queue);
+
+/// Removes a pattern subscription, and the trie nodes left without use.
+/// @param pattern Prefix followed by PATTERN_WILDCARD.
+/// @param queue Notifications queue of the session.
+/// @return 0 if removed, 1 if the session was not subscribed
+int pattern_unsubscribe(const char *pattern, NotifyQueue *queue);
+
+/// Finds the patterns matching a key, walking the trie along the key. The
+/// cost depends on the length of the key, not on how many patterns exist.
+/// Must be followed by pattern_matches_end.
+/// @param key
+/// @param matches Where to store the matched nodes.
+void pattern_matches_begin(const char *key, PatternMatches *matches);
+
+/// Queues a notification for the subscribers of the matched patterns.
+/// @param matches
+/// @param notification
+void pattern_matches_push(const PatternMatches *matches, Notification *notification);
+
+/// Tells whether a session is subscribed to one of the matched patterns.
+/// @param matches
+/// @param queue Notifications queue of the session.
+/// @return 1 if it is, 0 otherwise
+int pattern_matches_find(const PatternMatches *matches, const NotifyQueue *queue);
+
+/// Lets go of the matched nodes.
+/// @param matches
+void pattern_matches_end(PatternMatches *matches);
+
+/// Gets how many pattern subscriptions exist, over all sessions.
+/// @return the number of subscriptions
+size_t pattern_subscription_count(void);
+
+#endif  // KVS_PATTERNS_H
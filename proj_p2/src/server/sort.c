@@ -0,0 +1,121 @@
+#include "sort.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/common/constants.h"
+
+// Runs of at most this many rows are sorted with insertion sort
+#define INSERTION_SORT_THRESHOLD 16
+
+#ifdef USE_QSORT
+
+// Alphabetical comparison of the keys at the start of two rows
+static int compare_keys(const void *a, const void *b) {
+	const char *key1 = (const char *) a;
+	const char *key2 = (const char *) b;
+	return strcmp(key1, key2);
+}
+
+void sort_keys(void *rows, size_t num_rows, size_t row_size) {
+	qsort(rows, num_rows, row_size, compare_keys);
+}
+
+#else
+
+/// Sorts keys that share their first depth bytes by insertion.
+/// @param keys Pointers to the keys to sort.
+/// @param num_keys Number of keys.
+/// @param depth Number of leading bytes that are equal in all keys.
+static void insertion_sort(const char **keys, size_t num_keys, size_t depth) {
+	for (size_t i = 1; i < num_keys; i++) {
+		const char *key = keys[i];
+		size_t j = i;
+		while (j > 0 && strcmp(keys[j - 1] + depth, key + depth) > 0) {
+			keys[j] = keys[j - 1];
+			j--;
+		}
+		keys[j] = key;
+	}
+}
+
+/// Stable MSD radix sort on the key byte at depth, recursing into each run
+/// of keys that share that byte. Only the pointers to the keys are moved.
+/// @param keys Pointers to the keys to sort.
+/// @param aux Scratch space for num_keys pointers.
+/// @param num_keys Number of keys.
+/// @param depth Number of leading bytes that are equal in all keys.
+static void radix_sort(const char **keys, const char **aux, size_t num_keys,
+					   size_t depth) {
+	while (num_keys > INSERTION_SORT_THRESHOLD && depth < MAX_STRING_SIZE) {
+		size_t count[256] = {0};
+		for (size_t i = 0; i < num_keys; i++) {
+			count[(unsigned char) keys[i][depth]]++;
+		}
+
+		// Every key has the same byte here, move on to the next one
+		unsigned char first = (unsigned char) keys[0][depth];
+		if (count[first] == num_keys) {
+			if (first == '\0') return;
+			depth++;
+			continue;
+		}
+
+		size_t offset[256];
+		size_t total = 0;
+		for (size_t c = 0; c < 256; c++) {
+			offset[c] = total;
+			total += count[c];
+		}
+		for (size_t i = 0; i < num_keys; i++) {
+			aux[offset[(unsigned char) keys[i][depth]]++] = keys[i];
+		}
+		memcpy(keys, aux, num_keys * sizeof(*keys));
+
+		// Keys that ended at this depth are equal; sort the other runs
+		size_t start = count[0];
+		for (size_t c = 1; c < 256; c++) {
+			if (count[c] > 1) {
+				radix_sort(keys + start, aux, count[c], depth + 1);
+			}
+			start += count[c];
+		}
+		return;
+	}
+	insertion_sort(keys, num_keys, depth);
+}
+
+void sort_keys(void *rows, size_t num_rows, size_t row_size) {
+	if (num_rows < 2) return;
+
+	char *base = rows;
+	const char *keys[num_rows];
+	const char *aux[num_rows];
+	for (size_t i = 0; i < num_rows; i++) {
+		keys[i] = base + i * row_size;
+	}
+	radix_sort(keys, aux, num_rows, 0);
+
+	// Row i goes where keys says; the moves are done in place one cycle of
+	// the permutation at a time, through a single spare row
+	size_t from[num_rows];
+	for (size_t i = 0; i < num_rows; i++) {
+		from[i] = (size_t) (keys[i] - base) / row_size;
+	}
+	char tmp[row_size];
+	for (size_t i = 0; i < num_rows; i++) {
+		if (from[i] == i) continue;
+		memcpy(tmp, base + i * row_size, row_size);
+		size_t j = i;
+		while (from[j] != i) {
+			memcpy(base + j * row_size, base + from[j] * row_size, row_size);
+			size_t next = from[j];
+			from[j] = j;
+			j = next;
+		}
+		memcpy(base + j * row_size, tmp, row_size);
+		from[j] = j;
+	}
+}
+
+#endif  // USE_QSORT
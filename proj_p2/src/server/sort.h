@@ -0,0 +1,15 @@
+#ifndef KVS_SORT_H
+#define KVS_SORT_H
+
+#include <stddef.h>
+
+/// Sorts a batch of fixed-width rows alphabetically (strcmp order) by the
+/// null-terminated key stored at the start of each row. Uses an MSD radix
+/// sort that falls back to insertion sort on small runs, or qsort when
+/// compiled with USE_QSORT.
+/// @param rows Array of rows, such as char[][MAX_STRING_SIZE].
+/// @param num_rows Number of rows.
+/// @param row_size Size of each row in bytes.
+void sort_keys(void *rows, size_t num_rows, size_t row_size);
+
+#endif  // KVS_SORT_H
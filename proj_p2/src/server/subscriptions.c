@@ -0,0 +1,112 @@
+#include "subscriptions.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SET_MIN_CAPACITY 4
+
+/// @brief Gets the home slot of a session in a set.
+/// @param queue Notifications queue of the session.
+/// @param capacity Capacity of the set.
+/// @return the slot
+static size_t home_slot(const NotifyQueue *queue, size_t capacity) {
+	// Fibonacci hashing, the high bits mix every bit of the address
+	uint64_t h = (uint64_t) (uintptr_t) queue * 11400714819323198485ULL;
+	return (size_t) (h >> 32) & (capacity - 1);
+}
+
+/// @brief Moves the subscriptions of a set to a table of another capacity.
+/// @param set
+/// @param capacity New capacity, a power of two larger than the count.
+/// @return 0 if successful, -1 if error
+static int resize(SubscriberSet *set, size_t capacity) {
+	Subscription **slots = calloc(capacity, sizeof(Subscription *));
+	if (slots == NULL) return -1;
+
+	for (size_t i = 0; i < set->capacity; i++) {
+		Subscription *subscription = set->slots[i];
+		if (subscription == NULL) continue;
+		size_t slot = home_slot(subscription->queue, capacity);
+		while (slots[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+		slots[slot] = subscription;
+	}
+	free(set->slots);
+	set->slots = slots;
+	set->capacity = capacity;
+	return 0;
+}
+
+Subscription *subscriber_set_find(const SubscriberSet *set, const NotifyQueue *queue) {
+	if (set->count == 0) return NULL;
+
+	size_t slot = home_slot(queue, set->capacity);
+	while (set->slots[slot] != NULL) {
+		if (set->slots[slot]->queue == queue) return set->slots[slot];
+		slot = (slot + 1) & (set->capacity - 1);
+	}
+	return NULL;
+}
+
+int subscriber_set_add(SubscriberSet *set, Subscription *subscription) {
+	// Kept at most three quarters full, so probe sequences stay short
+	if (4 * (set->count + 1) > 3 * set->capacity) {
+		size_t capacity = set->capacity ? 2 * set->capacity : SET_MIN_CAPACITY;
+		if (resize(set, capacity)) return -1;
+	}
+
+	size_t slot = home_slot(subscription->queue, set->capacity);
+	while (set->slots[slot] != NULL) slot = (slot + 1) & (set->capacity - 1);
+	set->slots[slot] = subscription;
+	set->count++;
+	return 0;
+}
+
+void subscriber_set_remove(SubscriberSet *set, Subscription *subscription) {
+	size_t mask = set->capacity - 1;
+	size_t slot = home_slot(subscription->queue, set->capacity);
+	while (set->slots[slot] != subscription) slot = (slot + 1) & mask;
+
+	// Shifts back the entries probed past the freed slot, so that lookups
+	// never need tombstones
+	size_t hole = slot;
+	for (size_t next = (hole + 1) & mask; set->slots[next] != NULL; next = (next + 1) & mask) {
+		size_t home = home_slot(set->slots[next]->queue, set->capacity);
+		// The entry can fill the hole unless its home lies after the hole
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			set->slots[hole] = set->slots[next];
+			hole = next;
+		}
+	}
+	set->slots[hole] = NULL;
+	set->count--;
+
+	if (set->count == 0) {
+		subscriber_set_free(set);
+	} else if (set->capacity > SET_MIN_CAPACITY && 8 * set->count < set->capacity) {
+		// Iterating a set costs its capacity, so it shrinks with the count.
+		// Failing to shrink leaves a valid, larger table.
+		resize(set, set->capacity / 2);
+	}
+}
+
+void subscription_link(Subscription **head, Subscription *subscription) {
+	subscription->next = *head;
+	if (*head != NULL) (*head)->prevNext = &subscription->next;
+	subscription->prevNext = head;
+	*head = subscription;
+}
+
+void subscription_unlink(Subscription *subscription) {
+	if (subscription->prevNext == NULL) return;
+	*subscription->prevNext = subscription->next;
+	if (subscription->next != NULL) subscription->next->prevNext = subscription->prevNext;
+	subscription->next = NULL;
+	subscription->prevNext = NULL;
+}
+
+void subscriber_set_free(SubscriberSet *set) {
+	free(set->slots);
+	set->slots = NULL;
+	set->count = 0;
+	set->capacity = 0;
+}
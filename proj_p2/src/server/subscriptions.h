@@ -0,0 +1,58 @@
+#ifndef KVS_SUBSCRIPTIONS_H
+#define KVS_SUBSCRIPTIONS_H
+
+#include <stddef.h>
+
+#include "notifier.h"
+
+struct KeyNode;
+
+/// A session subscribed to a key or a pattern. Key subscriptions are also
+/// linked in the session's list for the bucket of the key, both guarded by
+/// the bucket lock, so either side reaches the other without a lookup.
+typedef struct Subscription {
+	NotifyQueue *queue;             // notifications queue of the session
+	struct KeyNode *keyNode;        // key subscribed, NULL for a pattern
+	struct Subscription *next;      // next in the session's list
+	struct Subscription **prevNext; // what points to this one in that list
+} Subscription;
+
+/// Subscriptions of a key or pattern, indexed by the queue of the session,
+/// in an open addressing table with linear probing.
+typedef struct SubscriberSet {
+	size_t count;
+	size_t capacity; // 0 or a power of two
+	Subscription **slots;
+} SubscriberSet;
+
+/// Finds the subscription of a session.
+/// @param set
+/// @param queue Notifications queue of the session.
+/// @return the subscription, NULL if the session is not subscribed
+Subscription *subscriber_set_find(const SubscriberSet *set, const NotifyQueue *queue);
+
+/// Adds a subscription, whose session must not be in the set yet.
+/// @param set
+/// @param subscription
+/// @return 0 if successful, -1 if error
+int subscriber_set_add(SubscriberSet *set, Subscription *subscription);
+
+/// Removes a subscription that is in the set.
+/// @param set
+/// @param subscription
+void subscriber_set_remove(SubscriberSet *set, Subscription *subscription);
+
+/// Links a subscription at the head of a session's list.
+/// @param head Head of the list.
+/// @param subscription
+void subscription_link(Subscription **head, Subscription *subscription);
+
+/// Takes a subscription out of the session's list it is in, if any.
+/// @param subscription
+void subscription_unlink(Subscription *subscription);
+
+/// Frees the table of a set, not the subscriptions.
+/// @param set
+void subscriber_set_free(SubscriberSet *set);
+
+#endif  // KVS_SUBSCRIPTIONS_H
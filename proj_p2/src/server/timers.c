@@ -0,0 +1,110 @@
+#include "timers.h"
+
+#include <string.h>
+#include <time.h>
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+// Ticks the wheel spans, past them a timer waits in the last level
+#define WHEEL_SPAN (UINT64_C(1) << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+uint64_t timers_now(void) {
+	// clock_gettime is async signal safe, backups check expiries too
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	// Shifted so no time is 0, which means no expiry
+	return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000 + 1;
+}
+
+void wheel_init(TimerWheel *wheel, uint64_t now) {
+	wheel->current = now;
+	wheel->count = 0;
+	memset(wheel->slots, 0, sizeof(wheel->slots));
+}
+
+/// Links a timer at the head of a slot.
+/// @param slot
+/// @param timer
+static void slot_link(Timer **slot, Timer *timer) {
+	timer->next = *slot;
+	if (timer->next != NULL) timer->next->prevNext = &timer->next;
+	timer->prevNext = slot;
+	*slot = timer;
+}
+
+/// Takes a timer out of its slot.
+/// @param timer
+static void slot_unlink(Timer *timer) {
+	*timer->prevNext = timer->next;
+	if (timer->next != NULL) timer->next->prevNext = timer->prevNext;
+	timer->next = NULL;
+	timer->prevNext = NULL;
+}
+
+/// Links a timer in the slot its expiry falls in, on the lowest level that
+/// reaches it from the current tick.
+/// @param wheel
+/// @param timer
+static void place(TimerWheel *wheel, Timer *timer) {
+	// A timer already due goes in the slot expired next
+	uint64_t expiresAt = timer->expiresAt > wheel->current ? timer->expiresAt : wheel->current;
+	uint64_t delta = expiresAt - wheel->current;
+	if (delta >= WHEEL_SPAN) expiresAt = wheel->current + WHEEL_SPAN - 1;
+
+	unsigned int level = 0;
+	while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_SLOT_BITS * (level + 1)) != 0) {
+		level++;
+	}
+	size_t index = (size_t) (expiresAt >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+	slot_link(&wheel->slots[level][index], timer);
+}
+
+/// Spreads the slot of a level that the current tick reached over the
+/// levels below, then does the same one level up if this level wrapped.
+/// @param wheel
+/// @param level Level above 0.
+static void cascade(TimerWheel *wheel, unsigned int level) {
+	size_t index = (size_t) (wheel->current >> (WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+	Timer *timer = wheel->slots[level][index];
+	wheel->slots[level][index] = NULL;
+	while (timer != NULL) {
+		Timer *next = timer->next;
+		place(wheel, timer);
+		timer = next;
+	}
+	if (index == 0 && level + 1 < WHEEL_LEVELS) cascade(wheel, level + 1);
+}
+
+void wheel_schedule(TimerWheel *wheel, Timer *timer, uint64_t expiresAt) {
+	wheel_cancel(wheel, timer);
+	timer->expiresAt = expiresAt;
+	place(wheel, timer);
+	wheel->count++;
+}
+
+void wheel_cancel(TimerWheel *wheel, Timer *timer) {
+	timer->expiresAt = 0;
+	if (timer->prevNext == NULL) return;
+	slot_unlink(timer);
+	wheel->count--;
+}
+
+Timer *wheel_expire(TimerWheel *wheel, uint64_t now) {
+	while (wheel->current <= now) {
+		// With no timers there is nothing to cascade on the way
+		if (wheel->count == 0) {
+			wheel->current = now + 1;
+			return NULL;
+		}
+
+		// Every timer in the slot of the current tick is due
+		Timer *timer = wheel->slots[0][wheel->current & SLOT_MASK];
+		if (timer != NULL) {
+			slot_unlink(timer);
+			wheel->count--;
+			return timer;
+		}
+		wheel->current++;
+		if ((wheel->current & SLOT_MASK) == 0) cascade(wheel, 1);
+	}
+	return NULL;
+}
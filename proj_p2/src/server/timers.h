@@ -0,0 +1,59 @@
+#ifndef KVS_TIMERS_H
+#define KVS_TIMERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WHEEL_LEVELS 4    // levels of the timing wheel
+#define WHEEL_SLOT_BITS 8 // each level has 2^WHEEL_SLOT_BITS slots
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+
+/// A timer embedded in the structure it expires, linked in one slot of a
+/// wheel while it is scheduled.
+typedef struct Timer {
+	uint64_t expiresAt;      // milliseconds on timers_now, 0 if not set or cancelled
+	struct Timer *next;      // next in the slot
+	struct Timer **prevNext; // what points to this one in the slot, NULL if not in one
+} Timer;
+
+/// Hierarchical timing wheel with a tick of one millisecond. Level l has a
+/// slot for every 2^(l * WHEEL_SLOT_BITS) ticks, and a timer sits on the
+/// lowest level whose span reaches its expiry. Scheduling and cancelling
+/// take constant time; when the lower level wraps, the next slot of the
+/// level above is spread over it. Timers due later than the span of the
+/// wheel, about 49 days, wait in the last level and are placed again.
+typedef struct TimerWheel {
+	uint64_t current; // next tick to expire
+	size_t count;     // timers scheduled
+	Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} TimerWheel;
+
+/// Gets the clock timers expire on, which only moves forward.
+/// @return milliseconds since an arbitrary point, never 0
+uint64_t timers_now(void);
+
+/// Initializes an empty wheel.
+/// @param wheel
+/// @param now Current time, from timers_now.
+void wheel_init(TimerWheel *wheel, uint64_t now);
+
+/// Schedules a timer, cancelling it first if it is already scheduled.
+/// @param wheel
+/// @param timer
+/// @param expiresAt When it expires, from timers_now. Times already past
+/// expire on the next advance.
+void wheel_schedule(TimerWheel *wheel, Timer *timer, uint64_t expiresAt);
+
+/// Cancels a timer if it is scheduled.
+/// @param wheel
+/// @param timer
+void wheel_cancel(TimerWheel *wheel, Timer *timer);
+
+/// Advances the wheel towards a time, stopping at the first timer due. The
+/// timer is taken out of the wheel but keeps its expiresAt.
+/// @param wheel
+/// @param now Time to advance to.
+/// @return a timer due at or before now, NULL once the wheel reached now
+Timer *wheel_expire(TimerWheel *wheel, uint64_t now);
+
+#endif  // KVS_TIMERS_H
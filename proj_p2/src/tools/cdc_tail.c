@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "src/common/cdc.h"
+#include "src/common/io.h"
+
+#define TAIL_BUFFER_SIZE (64 * 1024) // grows to hold the largest record
+#define TAIL_POLL_MS 100 // wait for a log file to grow
+#define NSEC_PER_SEC UINT64_C(1000000000)
+
+static char *buffer = NULL;
+static size_t capacity = 0;
+static size_t buffered = 0;
+static int sawMagic = 0;
+static uint64_t afterSeq = 0;
+
+/// Opens the stream, waiting for it to be created or, for a FIFO, for the
+/// server to open it.
+/// @param path
+/// @param st Set to the status of the opened stream.
+/// @return the file descriptor, -1 on error
+static int open_stream(const char *path, struct stat *st) {
+	for (;;) {
+		int fd = open(path, O_RDONLY);
+		if (fd != -1) {
+			if (fstat(fd, st)) {
+				perror("Failed to stat CDC stream");
+				close(fd);
+				return -1;
+			}
+			buffered = 0;
+			sawMagic = 0;
+			return fd;
+		}
+		if (errno != ENOENT) {
+			perror("Failed to open CDC stream");
+			return -1;
+		}
+		delay(TAIL_POLL_MS);
+	}
+}
+
+/// Prints the whole records in the buffer and keeps the partial one.
+/// @return 0 if successful, 1 if the stream is not a CDC stream
+static int print_records(void) {
+	size_t offset = 0;
+	if (!sawMagic) {
+		if (buffered < CDC_MAGIC_SIZE) return 0;
+		if (memcmp(buffer, CDC_MAGIC, CDC_MAGIC_SIZE) &&
+			memcmp(buffer, CDC_MAGIC_V1, CDC_MAGIC_SIZE)) {
+			fprintf(stderr, "Not a CDC stream\n");
+			return 1;
+		}
+		sawMagic = 1;
+		offset = CDC_MAGIC_SIZE;
+	}
+
+	for (;;) {
+		size_t left = buffered - offset;
+		if (left < CDC_RECORD_HEADER_SIZE) break;
+		const char *record = buffer + offset;
+		size_t keyLength = (unsigned char) record[CDC_RECORD_HEADER_SIZE - 1];
+		if (left < CDC_RECORD_HEADER_SIZE + keyLength) break;
+		uint64_t valueLength;
+		size_t lengthSize;
+		int status = varint_decode(record + CDC_RECORD_HEADER_SIZE + keyLength,
+								   left - CDC_RECORD_HEADER_SIZE - keyLength, &valueLength,
+								   &lengthSize);
+		if (status > 0) break;
+		if (status < 0 || valueLength > MAX_VALUE_SIZE) {
+			fprintf(stderr, "Corrupt CDC record\n");
+			return 1;
+		}
+		size_t size = CDC_RECORD_HEADER_SIZE + keyLength + lengthSize + valueLength;
+		if (left < size) break;
+
+		uint64_t seq, timestamp;
+		memcpy(&seq, record, sizeof(seq));
+		memcpy(&timestamp, record + sizeof(seq), sizeof(timestamp));
+		char type = record[2 * sizeof(uint64_t)];
+		const char *key = record + CDC_RECORD_HEADER_SIZE;
+		const char *value = key + keyLength + lengthSize;
+		if (seq > afterSeq) {
+			if (type == CDC_DELETE) {
+				printf("%" PRIu64 " %" PRIu64 ".%09" PRIu64 " (%.*s,DELETE)\n", seq,
+					   timestamp / NSEC_PER_SEC, timestamp % NSEC_PER_SEC, (int) keyLength, key);
+			} else {
+				// Values may hold '\0' bytes, and are too long for a precision
+				printf("%" PRIu64 " %" PRIu64 ".%09" PRIu64 " (%.*s,", seq,
+					   timestamp / NSEC_PER_SEC, timestamp % NSEC_PER_SEC, (int) keyLength, key);
+				fwrite(value, 1, (size_t) valueLength, stdout);
+				fputs(")\n", stdout);
+			}
+		}
+		offset += size;
+	}
+	fflush(stdout);
+
+	memmove(buffer, buffer + offset, buffered - offset);
+	buffered -= offset;
+	return 0;
+}
+
+/// Reads what the stream holds now.
+/// @return 1 if something was read, 0 at the end of the stream, -1 on error
+static int read_stream(int fd) {
+	// Full of a partial record
+	if (buffered == capacity) {
+		size_t grown = capacity ? 2 * capacity : TAIL_BUFFER_SIZE;
+		char *bigger = realloc(buffer, grown);
+		if (bigger == NULL) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			return -1;
+		}
+		buffer = bigger;
+		capacity = grown;
+	}
+	ssize_t result = read(fd, buffer + buffered, capacity - buffered);
+	if (result == -1) {
+		if (errno == EINTR) return 1;
+		perror("Failed to read CDC stream");
+		return -1;
+	}
+	if (result == 0) return 0;
+	buffered += (size_t) result;
+	return print_records() ? -1 : 1;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s <cdc_path> [after_seq]\n", argv[0]);
+		return 1;
+	}
+	if (argc == 3) {
+		char *end;
+		errno = 0;
+		afterSeq = strtoull(argv[2], &end, 10);
+		if (errno || *end != '\0') {
+			fprintf(stderr, "Invalid sequence number\n");
+			return 1;
+		}
+	}
+
+	struct stat st;
+	int fd = open_stream(argv[1], &st);
+	if (fd == -1) return 1;
+
+	for (;;) {
+		int result = read_stream(fd);
+		if (result == -1) break;
+		if (result == 1) continue;
+
+		if (S_ISFIFO(st.st_mode)) {
+			// The server closed the FIFO, wait for it to open it again
+			close(fd);
+			fd = open_stream(argv[1], &st);
+			if (fd == -1) return 1;
+			continue;
+		}
+
+		// A rotated log is finished once it was read to the end after the
+		// new log appeared
+		struct stat current;
+		if (stat(argv[1], &current) == 0 &&
+			(current.st_ino != st.st_ino || current.st_dev != st.st_dev)) {
+			while ((result = read_stream(fd)) == 1);
+			if (result == -1) break;
+			close(fd);
+			fd = open_stream(argv[1], &st);
+			if (fd == -1) return 1;
+			continue;
+		}
+		delay(TAIL_POLL_MS);
+	}
+	close(fd);
+	return 1;
+}